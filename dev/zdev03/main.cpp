@@ -11,6 +11,8 @@ Developping structures and function declarations
 #include <time.h>
 #include <memory.h>
 #include <stdlib.h>
+#include <math.h>
+#include <thread>
 
 #include "gparser/gparser.h"
 
@@ -84,14 +86,247 @@ void check_function()
     printf( "\n" );
     check_parser( parser, "function int myfunc(int a, int b)"
         "{ int c = a+b; return c}" );
+    printf( "\n" );
+    check_parser( parser, "myfunc(2, 3)" );
+    printf( "\n" );
+    check_parser( parser, "double x = 1.5; myfunc(1, 2)*x" );
+    printf( "\n" );
+    check_parser( parser, "function int g(int a){ a }" );
+    gParser_dispose( parser );
+}
+
+void check_structure()
+{
+    gParser* parser = gParser_create();
+
+    printf( "\n" );
+    check_parser( parser, "struct point{ double x; double y; int id }" );
+    printf( "\n" );
+    check_parser( parser, "point p; point ps[100]" );
+    printf( "\n" );
+    check_parser( parser, "p.x = 1.5; ps[3].y = 2" );
+    printf( "\n" );
+    check_parser( parser, "p.x*ps[3].y + ps[3].id" );
+    printf( "\n" );
+    check_parser( parser, "ps[100].x" );
     gParser_dispose( parser );
 }
+
+/* Distance in units in the last place between the result and the reference */
+double ulp_error( const double x, const double ref )
+{
+    if (x == ref || (x != x && ref != ref)){
+        return 0;
+    }
+    if (x != x || ref != ref || fabs( ref ) > 1.7e308){
+        return 1e30;
+    }
+    return fabs( x - ref ) / (nextafter( fabs( ref ), HUGE_VAL ) - fabs( ref ));
+}
+
+/* Compares the batch implementations of the built-in functions with the C
+ * library. The maximum errors are the ones documented in Function.hpp:
+ *     exp                  1 ulp
+ *     log, sin, cos        2 ulp
+ *     log10, tan           4 ulp
+ *     sqrt                 exact
+ * The arguments cover small and large magnitudes, subnormal numbers, the
+ * limits of overflow and underflow, infinities and NaN. */
+void check_builtins()
+{
+    const char* names[] = { "exp", "log", "log10", "sin", "cos", "tan", "sqrt" };
+    double( *ref[] )(double) = { exp, log, log10, sin, cos, tan, sqrt };
+    const double bound[] = { 1, 2, 4, 2, 2, 4, 0 };
+    const double special[] = { 0.0, -0.0, 1.0, -1.0, 709.78, 710.0, -745.1
+        , -746.0, 1e300, 5e-324, 2.2e-308, 1e6, 2e6, HUGE_VAL, -HUGE_VAL };
+    const int nspecial = sizeof( special ) / sizeof( double );
+    const size_t n = 100000;
+    gParser* parser = gParser_create();
+    double* x = (double*)malloc( sizeof( double )*n );
+    double* y = (double*)malloc( sizeof( double )*n );
+
+    printf( "\n" );
+    check_parser( parser, "double x = 2.0" );
+    printf( "\n" );
+    check_parser( parser, "min( max( x, 0 ), 1 ) + abs( -3 )" );
+    printf( "\n" );
+    check_parser( parser, "sqrt( x ) * sqrt( x )" );
+    printf( "\n" );
+    check_parser( parser, "sin( x )^2 + cos( x )^2" );
+    printf( "\n" );
+    check_parser( parser, "double y = max( 1, 2 ), z = exp( log( x ) )" );
+    printf( "\n" );
+    check_parser( parser, "sqrt( x, 1 )" );
+    printf( "\n" );
+
+    srand( 1 );
+    for (size_t i = 0; i < n; i++){
+        const double u = rand() / (double)RAND_MAX;
+        switch (i % 4){
+        case 0: x[i] = (u - 0.5) * 20; break;
+        case 1: x[i] = (u - 0.5) * 1500; break;
+        case 2: x[i] = ldexp( u, rand() % 2100 - 1070 ); break;
+        default: x[i] = i % 8 == 3 ? special[(i / 8) % nspecial] : (u - 0.5) * 2e6;
+        }
+    }
+
+    for (int f = 0; f < 7; f++){
+        char code[32];
+        sprintf( code, "%s( x )", names[f] );
+        gProgram* program = gParser_compile( parser, code );
+        gProgram_bindColumn( program, "x", x, 0 );
+        gProgram_evalBatch( program, n, y );
+
+        double worst = 0;
+        for (size_t i = 0; i < n; i++){
+            const double err = ulp_error( y[i], ref[f]( x[i] ) );
+            worst = err > worst ? err : worst;
+        }
+        printf( "%-6s max error %.2f ulp %s\n", names[f], worst
+            , worst <= bound[f] ? "ok" : "FAILED" );
+        gProgram_dispose( program );
+    }
+
+    free( x );
+    free( y );
+    gParser_dispose( parser );
+}
+
+/* The first calls to the built-in functions of the process are resolved by
+ * parsers in several threads at once */
+void check_builtins_threads()
+{
+    const int nthreads = 8;
+    int results[nthreads];
+    std::thread threads[nthreads];
+
+    for (int t = 0; t < nthreads; t++){
+        results[t] = 0;
+        threads[t] = std::thread( [&results, t](){
+            gParser* parser = gParser_create();
+            gParser_command( parser, "double x = 0.5" );
+            gProgram* program = gParser_compile( parser
+                , "sqrt( x ) + exp( x ) + log( x ) + sin( x ) + min( x, 1 )" );
+            results[t] = program != nullptr && gProgram_eval( program ) == GPARSE_OK;
+            gProgram_dispose( program );
+            gParser_dispose( parser );
+        } );
+    }
+    int ok = 1;
+    for (int t = 0; t < nthreads; t++){
+        threads[t].join();
+        ok = ok && results[t];
+    }
+    printf( "builtins in threads %s\n", ok ? "ok" : "FAILED" );
+}
+
+/* '&&' and '||' merge the right operand into the register of the left one,
+ * which must not be the register of an argument or a local variable */
+void check_logic_locals()
+{
+    gParser* parser = gParser_create();
+    int ok = gParser_command( parser, "function bool f(bool a, int x)"
+        "{ bool c = a && (5 % x == 1); return a }" ) != GPARSE_ERROR
+        && gParser_command( parser, "function bool g(bool a, int x)"
+        "{ bool c = a || (5 % x == 1); return a }" ) != GPARSE_ERROR
+        && gParser_command( parser, "function int h(bool a, int x)"
+        "{ int c = 0; bool d = a && (c = x) > 0; return c }" ) != GPARSE_ERROR;
+    ok = ok && gParser_command( parser, "f(true, 5)" ) == GPARSE_OK
+        && *(_bool_*)parser->ans.pvalue == true;
+    ok = ok && gParser_command( parser, "g(false, 2)" ) == GPARSE_OK
+        && *(_bool_*)parser->ans.pvalue == false;
+    /* The assignment is skipped, even for a short right operand */
+    ok = ok && gParser_command( parser, "h(false, 5)" ) == GPARSE_OK
+        && *(_int_*)parser->ans.pvalue == 0;
+    ok = ok && gParser_command( parser, "h(true, 5)" ) == GPARSE_OK
+        && *(_int_*)parser->ans.pvalue == 5;
+    printf( "logic on local variables %s\n", ok ? "ok" : "FAILED" );
+    gParser_dispose( parser );
+}
+
+/* Formulas are evaluated again when their inputs change, even if they
+ * were queued because they were just defined */
+void check_formulas()
+{
+    gParser* parser = gParser_create();
+    double x = 1;
+    double price = 10;
+    double cost = 4;
+    double twenty = 20;
+
+    gParser_addVariable( parser, "x", t_double, &x );
+    gParser_addVariable( parser, "price", t_double, &price );
+    gParser_addVariable( parser, "cost", t_double, &cost );
+    int ok = gParser_define( parser, "y", "x*2" ) == GPARSE_OK;
+    x = 7;
+    ok = ok && gParser_touch( parser, "x" ) == GPARSE_OK
+        && gParser_update( parser ) == GPARSE_OK;
+    gVariable* y = gParser_findVariable( parser, "y" );
+    ok = ok && y != nullptr && *(double*)y->pvalue == 14;
+
+    ok = ok && gParser_define( parser, "margin", "price - cost" ) == GPARSE_OK
+        && gParser_define( parser, "total", "margin * 2" ) == GPARSE_OK;
+    ok = ok && gParser_write( parser, "price", &twenty ) == GPARSE_OK
+        && gParser_update( parser ) == GPARSE_OK;
+    gVariable* margin = gParser_findVariable( parser, "margin" );
+    gVariable* total = gParser_findVariable( parser, "total" );
+    ok = ok && margin != nullptr && total != nullptr
+        && *(double*)margin->pvalue == 16 && *(double*)total->pvalue == 32;
+
+    /* Without changes, nothing is evaluated */
+    ok = ok && gParser_update( parser ) == GPARSE_OK && *(double*)total->pvalue == 32;
+    printf( "formulas %s\n", ok ? "ok" : "FAILED" );
+    gParser_dispose( parser );
+}
+
+/* Functions which are not inlined run in frames kept by the caller, for
+ * each row of the interpreter and each block of a batch, also nested */
+void check_function_frames()
+{
+    gParser* parser = gParser_create();
+    const size_t n = 10000;
+    double* x = (double*)malloc( sizeof( double )*n );
+    double* y = (double*)malloc( sizeof( double )*n );
+    int ok = gParser_command( parser, "double x = 0; double scale = 3" ) != GPARSE_ERROR
+        && gParser_command( parser, "function double f(double a)"
+        "{ double b = a*scale; return b + 1 }" ) != GPARSE_ERROR
+        && gParser_command( parser, "function double g(double a)"
+        "{ return f( a ) + f( a + 1 )*scale }" ) != GPARSE_ERROR;
+    for (int i = 0; i < 100 && ok; i++){
+        ok = gParser_command( parser, "x = x + 1; g( x )" ) == GPARSE_OK
+            && *(double*)parser->ans.pvalue == (3 * (i + 1) + 1) + (3 * (i + 2) + 1) * 3;
+    }
+    for (size_t i = 0; i < n; i++){
+        x[i] = double( i % 100 );
+    }
+    gProgram* program = gParser_compile( parser, "g( x ) - f( x )" );
+    ok = ok && program != nullptr && gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK;
+    for (int k = 0; k < 3 && ok; k++){
+        ok = gProgram_evalBatch( program, n, y ) == GPARSE_OK;
+        for (size_t i = 0; i < n && ok; i++){
+            const double v = x[i];
+            ok = y[i] == (3 * (v + 1) + 1) * 3;
+        }
+    }
+    printf( "function frames %s\n", ok ? "ok" : "FAILED" );
+    gProgram_dispose( program );
+    free( x );
+    free( y );
+    gParser_dispose( parser );
+}
+
 int main( int argc, char* argv[] )
 {
     clock_t init = clock();
 
     //check_struct();
+    check_builtins_threads();
     check_function();
+    check_logic_locals();
+    check_function_frames();
+    check_formulas();
+    check_structure();
+    check_builtins();
 
     clock_t end = clock();
     printf( "time:%i", end - init );
@@ -0,0 +1,901 @@
+/***
+Author: Mario J. Martin <dominonurbs$gmail.com>
+
+Checking the batch evaluation of compiled programs over columns
+*******************************************************************************/
+
+#define _CRTDBG_MAP_ALLOC
+#include <crtdbg.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stddef.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "gparser/gparser.h"
+
+#define NROWS 3000
+
+void report( const char* name, const int ok )
+{
+    printf( "%-28s %s\n", name, ok ? "ok" : "FAILED" );
+}
+
+/* A variable assigned by the program, and not bound to a column, has the
+ * value of each row in the next statements */
+void check_assign()
+{
+    gParser* parser = gParser_create();
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    double* y = (double*)malloc( sizeof( double )*NROWS );
+    double* z = (double*)malloc( sizeof( double )*NROWS );
+    int ok;
+
+    for (int i = 0; i < NROWS; i++){
+        x[i] = i;
+    }
+    gParser_command( parser, "double x = 0; double acc = 0; double t = -1" );
+
+    gProgram* program = gParser_compile( parser, "acc = x + 1; acc * 2" );
+    gProgram_bindColumn( program, "x", x, 0 );
+    ok = gProgram_evalBatch( program, NROWS, y ) == GPARSE_OK;
+    for (int i = 0; i < NROWS; i++){
+        ok = ok && y[i] == 2 * (i + 1);
+    }
+    report( "assign in batch", ok );
+    gProgram_dispose( program );
+
+    /* The rows that skip the assignment keep the value of the variable */
+    program = gParser_compile( parser, "(x > 10 && (t = x) > 0) || true; t" );
+    gProgram_bindColumn( program, "x", x, 0 );
+    ok = gProgram_evalBatch( program, NROWS, y ) == GPARSE_OK;
+    for (int i = 0; i < NROWS; i++){
+        ok = ok && y[i] == (i > 10 ? i : -1);
+    }
+    report( "assign in a branch", ok );
+    gProgram_dispose( program );
+
+    /* A formula sees the assignments of the previous ones */
+    const char* formulas[] = { "acc = x + 1", "acc * 2" };
+    void* outs[] = { y, z };
+    program = gParser_compileSet( parser, formulas, 2 );
+    gProgram_bindColumn( program, "x", x, 0 );
+    ok = gProgram_evalSet( program, NROWS, outs, nullptr ) == GPARSE_OK;
+    for (int i = 0; i < NROWS; i++){
+        ok = ok && y[i] == i + 1 && z[i] == 2 * (i + 1);
+    }
+    report( "assign in a set", ok );
+    gProgram_dispose( program );
+
+    program = gParser_compile( parser, "acc = 5; acc = acc + 1; acc * 2" );
+    ok = gProgram_eval( program ) == GPARSE_OK
+        && *(double*)program->ans.pvalue == 12;
+    report( "assign in scalar", ok );
+    gProgram_dispose( program );
+
+    free( x );
+    free( y );
+    free( z );
+    gParser_dispose( parser );
+}
+
+/* Filters select the same rows as the expression, whatever the order in
+ * which the terms are evaluated */
+void check_filter()
+{
+    gParser* parser = gParser_create();
+    int* k = (int*)malloc( sizeof( int )*NROWS );
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    uint64_t* bitmap = (uint64_t*)malloc( sizeof( uint64_t )*((NROWS + 63) / 64) );
+    size_t* rows = (size_t*)malloc( sizeof( size_t )*NROWS );
+    size_t count;
+    size_t nrows;
+    int ok;
+
+    for (int i = 0; i < NROWS; i++){
+        k[i] = i;
+        x[i] = (i * 37) % 101;
+    }
+    gParser_command( parser, "int k = 0; double x = 0" );
+
+    /* The last term discards more rows, so it is moved first */
+    gProgram* program = gParser_compileFilter( parser, "k % 3 == 0 && x > 50 && k > 2900" );
+    gProgram_bindColumn( program, "k", k, 0 );
+    gProgram_bindColumn( program, "x", x, 0 );
+    ok = gProgram_filter( program, NROWS, bitmap, &count ) == GPARSE_OK
+        && gProgram_filterRows( program, NROWS, rows, &nrows ) == GPARSE_OK
+        && count == nrows;
+    size_t n = 0;
+    for (int i = 0; i < NROWS && ok; i++){
+        const int selected = i % 3 == 0 && x[i] > 50 && i > 2900;
+        ok = ((bitmap[i / 64] >> (i % 64)) & 1) == (uint64_t)selected;
+        if (selected){
+            ok = ok && n < nrows && rows[n] == (size_t)i;
+            n++;
+        }
+    }
+    report( "filter", ok && n == count );
+    gProgram_dispose( program );
+
+    /* A division by zero is not evaluated for the rows discarded before */
+    program = gParser_compileFilter( parser, "k > 0 && 3000 % k == 0" );
+    gProgram_bindColumn( program, "k", k, 0 );
+    ok = gProgram_filterRows( program, NROWS, rows, &nrows ) == GPARSE_OK;
+    n = 0;
+    for (int i = 1; i < NROWS; i++){
+        if (3000 % i == 0){
+            ok = ok && n < nrows && rows[n] == (size_t)i;
+            n++;
+        }
+    }
+    report( "filter with guards", ok && n == nrows );
+    gProgram_dispose( program );
+
+    free( k );
+    free( x );
+    free( bitmap );
+    free( rows );
+    gParser_dispose( parser );
+}
+
+/* Scale of a value, as the data of the callbacks */
+struct scale_t
+{
+    double factor;
+    int scalar_calls;
+    int batch_rows;
+};
+
+void scale_scalar( void* result, const void* const* args, void* data )
+{
+    scale_t* scale = (scale_t*)data;
+    *(double*)result = *(const double*)args[0] * scale->factor;
+    scale->scalar_calls++;
+}
+
+void scale_batch( void* result, const void* const* args, size_t n, void* data )
+{
+    scale_t* scale = (scale_t*)data;
+    const double* x = (const double*)args[0];
+    for (size_t i = 0; i < n; i++){
+        ((double*)result)[i] = x[i] * scale->factor;
+    }
+    scale->batch_rows += (int)n;
+}
+
+int clamp_int( int x, int lo, int hi )
+{
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+/* Functions of the host are called by the interpreter and by programs, and
+ * programs call the batch version for the whole blocks of rows */
+void check_callbacks()
+{
+    gParser* parser = gParser_create();
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    double* y = (double*)malloc( sizeof( double )*NROWS );
+    int* k = (int*)malloc( sizeof( int )*NROWS );
+    int* c = (int*)malloc( sizeof( int )*NROWS );
+    scale_t scale = { 3, 0, 0 };
+    const int args_type[] = { t_double };
+    int ok;
+
+    for (int i = 0; i < NROWS; i++){
+        x[i] = i;
+        k[i] = i - 100;
+    }
+    ok = gParser_addFunctionBatch( parser, "scale", t_double, 1, args_type
+        , scale_scalar, scale_batch, &scale ) == GPARSE_OK
+        && gParser_addFunction( parser, "scale", t_double, 1, args_type
+        , scale_scalar, &scale ) == GPARSE_NAME_COLLISION
+        && gParser_addFunction( parser, "clamp", clamp_int ) == GPARSE_OK
+        && gParser_addFunction( parser, "lerp"
+        , []( double a, double b, double t ){ return a + t*(b - a); } ) == GPARSE_OK;
+    report( "add callbacks", ok );
+
+    gParser_command( parser, "double x = 0; int k = 0" );
+    ok = gParser_command( parser, "scale( 2 ) + lerp( 0, 10, 0.5 )" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == 11 && scale.scalar_calls == 1;
+    report( "callbacks in commands", ok );
+
+    gProgram* program = gParser_compile( parser, "scale( x ) + 1" );
+    gProgram_bindColumn( program, "x", x, 0 );
+    ok = gProgram_evalBatch( program, NROWS, y ) == GPARSE_OK
+        && scale.batch_rows == NROWS && scale.scalar_calls == 1;
+    for (int i = 0; i < NROWS; i++){
+        ok = ok && y[i] == 3 * i + 1;
+    }
+    report( "batch callbacks", ok );
+    gProgram_dispose( program );
+
+    /* The arguments are casted to the types of the function */
+    program = gParser_compile( parser, "clamp( k, 0, 1000 )" );
+    gProgram_bindColumn( program, "k", k, 0 );
+    ok = program->type == t_int && gProgram_evalBatch( program, NROWS, c ) == GPARSE_OK;
+    for (int i = 0; i < NROWS; i++){
+        ok = ok && c[i] == clamp_int( i - 100, 0, 1000 );
+    }
+    report( "native callbacks", ok );
+    gProgram_dispose( program );
+
+    free( x );
+    free( y );
+    free( k );
+    free( c );
+    gParser_dispose( parser );
+}
+
+/* Structure of the host, used in place */
+struct rec_t
+{
+    double x;
+    int id;
+    float w;
+};
+
+/* Structures of the host are read and written in place, as variables,
+ * arrays and rows of a batch */
+void check_struct()
+{
+    gParser* parser = gParser_create();
+    rec_t* recs = (rec_t*)malloc( sizeof( rec_t )*NROWS );
+    double* y = (double*)malloc( sizeof( double )*NROWS );
+    rec_t r = { 1.5, 7, 2 };
+    const gField fields[] = { { "x", t_double, offsetof( rec_t, x ) }
+        , { "id", t_int, offsetof( rec_t, id ) }
+        , { "w", t_float, offsetof( rec_t, w ) } };
+    int ok;
+
+    for (int i = 0; i < NROWS; i++){
+        recs[i].x = i;
+        recs[i].id = i % 10;
+        recs[i].w = 0;
+    }
+    const int type = gParser_addStruct( parser, "rec", sizeof( rec_t ), 3, fields );
+    ok = type != t_undefined
+        && gParser_addStruct( parser, "rec", sizeof( rec_t ), 3, fields ) == t_undefined
+        && gParser_addVariable( parser, "r", type, &r ) != nullptr
+        && gParser_addStructArray( parser, "rs", type, recs, NROWS ) != nullptr;
+    report( "add structures", ok );
+
+    ok = gParser_command( parser, "r.x * r.id + rs[12].x" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == 1.5 * 7 + 12;
+    ok = ok && gParser_command( parser, "r.id = 9; rs[5].w = 0.5" ) == GPARSE_OK
+        && r.id == 9 && recs[5].w == 0.5f;
+    report( "structures in place", ok );
+    recs[5].w = 0;
+
+    /* Each row reads and writes its own structure */
+    gProgram* program = gParser_compile( parser, "r.w = r.x * 2; r.x + r.id" );
+    ok = program != nullptr
+        && gProgram_bindStruct( program, "r", recs, 0 ) == GPARSE_OK
+        && gProgram_evalBatch( program, NROWS, y ) == GPARSE_OK;
+    for (int i = 0; i < NROWS && ok; i++){
+        ok = y[i] == i + i % 10 && recs[i].w == 2.0f * i;
+    }
+    ok = ok && r.w == 2 && r.x == 1.5;
+    report( "bind structures", ok );
+    gProgram_dispose( program );
+
+    free( recs );
+    free( y );
+    gParser_dispose( parser );
+}
+
+/* Releases nothing, the buffers belong to the check */
+void arrow_release_none( ArrowArray* array )
+{
+    array->release = nullptr;
+}
+
+/* Arrow arrays are read in place, with their offsets and nulls, and the
+ * results are exported as an Arrow array */
+void check_arrow()
+{
+    gParser* parser = gParser_create();
+    double* x = (double*)malloc( sizeof( double )*(NROWS + 1) );
+    int* k = (int*)malloc( sizeof( int )*(NROWS + 1) );
+    unsigned char* x_valid = (unsigned char*)malloc( (NROWS + 1 + 7) / 8 );
+    int ok;
+
+    /* The batch starts at the second value of the columns */
+    memset( x_valid, 0, (NROWS + 1 + 7) / 8 );
+    int64_t nulls = 0;
+    for (int i = 0; i < NROWS + 1; i++){
+        x[i] = i;
+        k[i] = 2 * i;
+        if (i % 7 != 0){
+            x_valid[i / 8] |= (unsigned char)(1 << (i % 8));
+        }
+        else{
+            nulls++;
+        }
+    }
+    const void* x_buffers[] = { x_valid, x };
+    const void* k_buffers[] = { nullptr, k };
+    const void* batch_buffers[] = { nullptr };
+    ArrowSchema x_schema = { "g", "x", nullptr, ARROW_FLAG_NULLABLE, 0, nullptr, nullptr
+        , nullptr, nullptr };
+    ArrowSchema k_schema = { "i", "k", nullptr, 0, 0, nullptr, nullptr, nullptr, nullptr };
+    ArrowSchema* children_schema[] = { &x_schema, &k_schema };
+    ArrowSchema batch_schema = { "+s", "", nullptr, 0, 2, children_schema, nullptr
+        , nullptr, nullptr };
+    ArrowArray x_array = { NROWS + 1, nulls, 0, 2, 0, x_buffers, nullptr, nullptr
+        , arrow_release_none, nullptr };
+    ArrowArray k_array = { NROWS + 1, 0, 0, 2, 0, k_buffers, nullptr, nullptr
+        , arrow_release_none, nullptr };
+    ArrowArray* children[] = { &x_array, &k_array };
+    ArrowArray batch = { NROWS, 0, 1, 1, 2, batch_buffers, children, nullptr
+        , arrow_release_none, nullptr };
+
+    gParser_command( parser, "double x = 0; int k = 0" );
+    gProgram* program = gParser_compile( parser, "x + k" );
+    ArrowArray out;
+    ArrowSchema out_schema;
+    ok = gProgram_bindArrow( program, nullptr, &batch_schema, &batch ) == GPARSE_OK
+        && gProgram_evalArrow( program, NROWS, &out, &out_schema ) == GPARSE_OK
+        && strcmp( out_schema.format, "g" ) == 0 && out.length == NROWS
+        && out.buffers[0] != nullptr;
+    int64_t out_nulls = 0;
+    for (int i = 0; i < NROWS && ok; i++){
+        const int row = i + 1;
+        const int valid = (((const uint64_t*)out.buffers[0])[i / 64] >> (i % 64)) & 1;
+        ok = valid == (row % 7 != 0)
+            && (!valid || ((const double*)out.buffers[1])[i] == 3.0 * row);
+        out_nulls += !valid;
+    }
+    ok = ok && out.null_count == out_nulls;
+    report( "arrow record batch", ok );
+    if (out.release != nullptr){
+        out.release( &out );
+        out_schema.release( &out_schema );
+    }
+    gProgram_dispose( program );
+
+    /* A type that does not match, and an assigned variable, are not bound */
+    program = gParser_compile( parser, "k * 2" );
+    ok = gProgram_bindArrow( program, "k", &x_schema, &x_array ) == GPARSE_ERROR
+        && gProgram_bindArrow( program, "k", &k_schema, &k_array ) == GPARSE_OK;
+    gProgram_dispose( program );
+    program = gParser_compile( parser, "k = k + 1" );
+    ok = ok && gProgram_bindArrow( program, "k", &k_schema, &k_array ) == GPARSE_ERROR;
+    report( "arrow types", ok );
+    gProgram_dispose( program );
+
+    free( x );
+    free( k );
+    free( x_valid );
+    gParser_dispose( parser );
+}
+
+/* Nulls propagate through the operators, with the three-valued logic of
+ * SQL for '&&' and '||', and filters skip them */
+void check_nulls()
+{
+    gParser* parser = gParser_create();
+    const int nwords = (NROWS + 63) / 64;
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    double* y = (double*)malloc( sizeof( double )*NROWS );
+    double* z = (double*)malloc( sizeof( double )*NROWS );
+    _bool_* b = (_bool_*)malloc( sizeof( _bool_ )*NROWS );
+    uint64_t* x_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    uint64_t* z_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    uint64_t* valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    size_t* rows = (size_t*)malloc( sizeof( size_t )*NROWS );
+    size_t nulls;
+    size_t nrows;
+    int ok;
+
+    memset( x_valid, 0, sizeof( uint64_t )*nwords );
+    for (int i = 0; i < NROWS; i++){
+        x[i] = i;
+        z[i] = 0;
+        if (i % 5 != 0){
+            x_valid[i / 64] |= uint64_t( 1 ) << (i % 64);
+        }
+    }
+    memset( z_valid, 0, sizeof( uint64_t )*nwords );
+    gParser_command( parser, "double x = 0; double z = 0" );
+
+    gProgram* program = gParser_compile( parser, "x * 2 + 1" );
+    ok = gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "x", x_valid ) == GPARSE_OK
+        && gProgram_evalNulls( program, NROWS, y, valid, &nulls ) == GPARSE_OK
+        && nulls == NROWS / 5;
+    for (int i = 0; i < NROWS && ok; i++){
+        const int is_valid = (valid[i / 64] >> (i % 64)) & 1;
+        ok = is_valid == (i % 5 != 0) && (!is_valid || y[i] == 2 * i + 1);
+    }
+    report( "nulls propagate", ok );
+    gProgram_dispose( program );
+
+    /* 'null && false' is false and 'null || true' is true */
+    program = gParser_compile( parser, "x > 10 && x < 2" );
+    ok = gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "x", x_valid ) == GPARSE_OK
+        && gProgram_evalNulls( program, NROWS, b, valid, &nulls ) == GPARSE_OK
+        && nulls == NROWS / 5;
+    gProgram_dispose( program );
+    program = gParser_compile( parser, "x > 10 || true" );
+    ok = ok && gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "x", x_valid ) == GPARSE_OK
+        && gProgram_evalNulls( program, NROWS, b, valid, &nulls ) == GPARSE_OK
+        && nulls == 0;
+    for (int i = 0; i < NROWS && ok; i++){
+        ok = b[i] == true;
+    }
+    report( "nulls in logic", ok );
+    gProgram_dispose( program );
+
+    /* The rows where the condition is null are not selected */
+    program = gParser_compileFilter( parser, "x > 100" );
+    ok = gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "x", x_valid ) == GPARSE_OK
+        && gProgram_filterRows( program, NROWS, rows, &nrows ) == GPARSE_OK;
+    size_t n = 0;
+    for (int i = 101; i < NROWS; i++){
+        if (i % 5 != 0){
+            ok = ok && n < nrows && rows[n] == (size_t)i;
+            n++;
+        }
+    }
+    report( "nulls in filters", ok && n == nrows );
+    gProgram_dispose( program );
+
+    /* Assignments write the validity of the column */
+    program = gParser_compile( parser, "z = x + 1" );
+    ok = gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "x", x_valid ) == GPARSE_OK
+        && gProgram_bindColumn( program, "z", z, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "z", z_valid ) == GPARSE_OK
+        && gProgram_evalNulls( program, NROWS, y, nullptr, nullptr ) == GPARSE_OK;
+    for (int i = 0; i < NROWS && ok; i++){
+        const int is_valid = (z_valid[i / 64] >> (i % 64)) & 1;
+        ok = is_valid == (i % 5 != 0) && (!is_valid || z[i] == i + 1);
+    }
+    report( "nulls assigned", ok );
+    gProgram_dispose( program );
+
+    /* Null rows hold a zero divisor, which is not evaluated */
+    int* k = (int*)malloc( sizeof( int )*NROWS );
+    int* r = (int*)malloc( sizeof( int )*NROWS );
+    for (int i = 0; i < NROWS; i++){
+        k[i] = i % 5 == 0 ? 0 : i;
+    }
+    gParser_command( parser, "int k = 1" );
+    program = gParser_compile( parser, "1000 %% k + 1000 % k" );
+    ok = gProgram_bindColumn( program, "k", k, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "k", x_valid ) == GPARSE_OK
+        && gProgram_evalNulls( program, NROWS, r, valid, &nulls ) == GPARSE_OK
+        && nulls == NROWS / 5;
+    for (int i = 0; i < NROWS && ok; i++){
+        const int is_valid = (valid[i / 64] >> (i % 64)) & 1;
+        ok = is_valid == (i % 5 != 0) && (!is_valid || r[i] == 1000 / i + 1000 % i);
+    }
+    gProgram_dispose( program );
+    program = gParser_compileFilter( parser, "1000 % k == 0" );
+    ok = ok && gProgram_bindColumn( program, "k", k, 0 ) == GPARSE_OK
+        && gProgram_bindValidity( program, "k", x_valid ) == GPARSE_OK
+        && gProgram_filterRows( program, NROWS, rows, &nrows ) == GPARSE_OK;
+    n = 0;
+    for (int i = 1; i < NROWS; i++){
+        if (i % 5 != 0 && 1000 % i == 0){
+            ok = ok && n < nrows && rows[n] == (size_t)i;
+            n++;
+        }
+    }
+    report( "nulls divided", ok && n == nrows );
+    gProgram_dispose( program );
+    free( k );
+    free( r );
+
+    free( x );
+    free( y );
+    free( z );
+    free( b );
+    free( x_valid );
+    free( z_valid );
+    free( valid );
+    free( rows );
+    gParser_dispose( parser );
+}
+
+/* The formulas of a set give the same results as compiled one by one */
+void check_set()
+{
+    gParser* parser = gParser_create();
+    const int nwords = (NROWS + 63) / 64;
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    int* k = (int*)malloc( sizeof( int )*NROWS );
+    double* y = (double*)malloc( sizeof( double )*NROWS );
+    double* z = (double*)malloc( sizeof( double )*NROWS );
+    _bool_* b = (_bool_*)malloc( sizeof( _bool_ )*NROWS );
+    uint64_t* x_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    uint64_t* y_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    int ok;
+
+    for (int i = 0; i < NROWS; i++){
+        x[i] = i * 0.5;
+        k[i] = i % 17;
+    }
+    for (int w = 0; w < nwords; w++){
+        x_valid[w] = 0x5555555555555555ULL;
+    }
+    gParser_command( parser, "double x = 0; int k = 0" );
+
+    const char* formulas[] = { "sqrt( x ) + k", "k > 8", "sqrt( x ) * 2" };
+    void* outs[] = { y, b, z };
+    gProgram* program = gParser_compileSet( parser, formulas, 3 );
+    ok = program != nullptr && gProgram_outputs( program ) == 3
+        && gProgram_outputType( program, 0 ) == t_double
+        && gProgram_outputType( program, 1 ) == t_bool
+        && gProgram_outputType( program, 3 ) == t_undefined
+        && gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_bindColumn( program, "k", k, 0 ) == GPARSE_OK
+        && gProgram_evalSet( program, NROWS, outs, nullptr ) == GPARSE_OK;
+    for (int i = 0; i < NROWS && ok; i++){
+        ok = y[i] == sqrt( i * 0.5 ) + i % 17 && b[i] == (i % 17 > 8)
+            && z[i] == sqrt( i * 0.5 ) * 2;
+    }
+    report( "set of formulas", ok );
+
+    /* Null arrays are skipped, and nulls propagate to each formula */
+    void* some[] = { y, nullptr, nullptr };
+    uint64_t* valid[] = { y_valid, nullptr, nullptr };
+    ok = gProgram_bindValidity( program, "x", x_valid ) == GPARSE_OK
+        && gProgram_evalSet( program, NROWS, some, valid ) == GPARSE_OK;
+    for (int w = 0; w < nwords && ok; w++){
+        const uint64_t mask = w == nwords - 1 && NROWS % 64 != 0
+            ? (uint64_t( 1 ) << (NROWS % 64)) - 1 : ~uint64_t( 0 );
+        ok = (y_valid[w] & mask) == (x_valid[w] & mask);
+    }
+    report( "set with nulls", ok );
+    gProgram_dispose( program );
+
+    /* The index of the wrong formula is reported */
+    const char* wrong[] = { "x + 1", "x +* 2" };
+    program = gParser_compileSet( parser, wrong, 2 );
+    report( "set with errors", program == nullptr && parser->err_line == 1 );
+
+    free( x );
+    free( k );
+    free( y );
+    free( z );
+    free( b );
+    free( x_valid );
+    free( y_valid );
+    gParser_dispose( parser );
+}
+
+/* Aggregates of the results, in one or several threads */
+void check_aggregate()
+{
+    gParser* parser = gParser_create();
+    const int nwords = (NROWS + 63) / 64;
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    uint64_t* x_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    gAggregate one;
+    gAggregate many;
+    int ok;
+
+    memset( x_valid, 0, sizeof( uint64_t )*nwords );
+    double sum = 0;
+    double min = HUGE_VAL;
+    double max = -HUGE_VAL;
+    size_t count = 0;
+    for (int i = 0; i < NROWS; i++){
+        x[i] = sin( i * 0.1 ) * 100;
+        if (i % 3 != 0){
+            x_valid[i / 64] |= uint64_t( 1 ) << (i % 64);
+            sum += x[i] * 2;
+            min = x[i] * 2 < min ? x[i] * 2 : min;
+            max = x[i] * 2 > max ? x[i] * 2 : max;
+            count++;
+        }
+    }
+    const double mean = sum / count;
+    double ss = 0;
+    for (int i = 0; i < NROWS; i++){
+        if (i % 3 != 0){
+            ss += (x[i] * 2 - mean) * (x[i] * 2 - mean);
+        }
+    }
+    const double variance = ss / (count - 1);
+
+    gParser_command( parser, "double x = 0" );
+    gProgram* program = gParser_compile( parser, "x * 2" );
+    gProgram_bindColumn( program, "x", x, 0 );
+    gProgram_bindValidity( program, "x", x_valid );
+    ok = gProgram_aggregate( program, NROWS, &one, GPARSE_PAIRWISE, 1 ) == GPARSE_OK
+        && gProgram_aggregate( program, NROWS, &many, GPARSE_PAIRWISE, 4 ) == GPARSE_OK
+        && one.count == count && one.min == min && one.max == max
+        && fabs( one.sum - sum ) < 1e-9 * fabs( sum ) + 1e-9
+        && fabs( one.mean - mean ) < 1e-9 * fabs( mean ) + 1e-9
+        && fabs( one.variance - variance ) < 1e-9 * variance;
+    report( "aggregate", ok );
+
+    /* Pairwise summation gives the same result for any number of threads */
+    ok = many.count == one.count && many.sum == one.sum && many.mean == one.mean
+        && many.variance == one.variance && many.min == one.min && many.max == one.max;
+    report( "aggregate in threads", ok );
+
+    ok = gProgram_aggregate( program, NROWS, &many, 0, 0 ) == GPARSE_OK
+        && many.count == count && fabs( many.sum - sum ) < 1e-9 * fabs( sum ) + 1e-9;
+    report( "aggregate unordered", ok );
+    gProgram_dispose( program );
+
+    /* Without values the results are NaN */
+    program = gParser_compile( parser, "x" );
+    ok = gProgram_aggregate( program, 0, &one, 0, 1 ) == GPARSE_OK
+        && one.count == 0 && one.mean != one.mean;
+    report( "aggregate empty", ok );
+    gProgram_dispose( program );
+
+    free( x );
+    free( x_valid );
+    gParser_dispose( parser );
+}
+
+/* Groups by the result of a program, in several threads */
+void check_group()
+{
+    gParser* parser = gParser_create();
+    const int nwords = (NROWS + 63) / 64;
+    int* k = (int*)malloc( sizeof( int )*NROWS );
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    uint64_t* k_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    double sums[7];
+    size_t counts[7];
+    gGroups groups;
+    int ok;
+
+    memset( k_valid, 0, sizeof( uint64_t )*nwords );
+    memset( sums, 0, sizeof( sums ) );
+    memset( counts, 0, sizeof( counts ) );
+    for (int i = 0; i < NROWS; i++){
+        k[i] = i;
+        x[i] = i % 5;
+        /* Rows with a null key are skipped */
+        if (i % 11 != 0){
+            k_valid[i / 64] |= uint64_t( 1 ) << (i % 64);
+            sums[i % 7] += x[i];
+            counts[i % 7]++;
+        }
+    }
+    gParser_command( parser, "int k = 0; double x = 0" );
+    gProgram* key = gParser_compile( parser, "k % 7" );
+    gProgram* value = gParser_compile( parser, "x" );
+    gProgram_bindColumn( key, "k", k, 0 );
+    gProgram_bindValidity( key, "k", k_valid );
+    gProgram_bindColumn( value, "x", x, 0 );
+
+    ok = gProgram_groupBy( key, value, NROWS, &groups, 0, 4 ) == GPARSE_OK
+        && groups.key_type == t_int && groups.ngroups == 7;
+    int seen = 0;
+    for (size_t g = 0; g < groups.ngroups && ok; g++){
+        const int key_value = ((const int*)groups.keys)[g];
+        ok = key_value >= 0 && key_value < 7 && ((seen >> key_value) & 1) == 0
+            && groups.aggregates[g].count == counts[key_value]
+            && groups.aggregates[g].sum == sums[key_value];
+        seen |= 1 << key_value;
+    }
+    report( "group by", ok );
+    gGroups_release( &groups );
+
+    /* Only the rows, and the groups that do not fit */
+    ok = gProgram_groupBy( key, nullptr, NROWS, &groups, 0, 1 ) == GPARSE_OK
+        && groups.ngroups == 7;
+    for (size_t g = 0; g < groups.ngroups && ok; g++){
+        ok = groups.aggregates[g].count == counts[((const int*)groups.keys)[g]];
+    }
+    gGroups_release( &groups );
+    gProgram_dispose( key );
+    key = gParser_compile( parser, "k" );
+    gProgram_bindColumn( key, "k", k, 0 );
+    ok = ok && gProgram_groupBy( key, nullptr, NROWS, &groups, 1000, 2 ) == GPARSE_ERROR;
+    report( "group by count and memory", ok );
+
+    gProgram_dispose( key );
+    gProgram_dispose( value );
+    free( k );
+    free( x );
+    free( k_valid );
+    gParser_dispose( parser );
+}
+
+/* Window functions give the values of the last rows, whether the stream
+ * is evaluated at once or in pieces */
+void check_window()
+{
+    gParser* parser = gParser_create();
+    const int n = 25;
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    double* all[5];
+    double* pieces[5];
+    int ok = 1;
+
+    for (int f = 0; f < 5; f++){
+        all[f] = (double*)malloc( sizeof( double )*NROWS );
+        pieces[f] = (double*)malloc( sizeof( double )*NROWS );
+    }
+    for (int i = 0; i < NROWS; i++){
+        x[i] = sin( i * 0.37 ) * 50 + i % 13;
+    }
+    gParser_command( parser, "double x = 0" );
+
+    const char* formulas[] = { "mavg( x, 25 )", "mstd( x, 25 )", "ema( x, 0.2 )"
+        , "rmin( x, 25 )", "rmax( x, 25 )" };
+    gProgram* program = gParser_compileSet( parser, formulas, 5 );
+    ok = program != nullptr && gProgram_bindColumn( program, "x", x, 0 ) == GPARSE_OK
+        && gProgram_evalSet( program, NROWS, (void**)all, nullptr ) == GPARSE_OK;
+
+    double ema = x[0];
+    for (int i = 0; i < NROWS && ok; i++){
+        const int first = i + 1 > n ? i + 1 - n : 0;
+        const int count = i + 1 - first;
+        double sum = 0;
+        double min = x[first];
+        double max = x[first];
+        for (int j = first; j <= i; j++){
+            sum += x[j];
+            min = x[j] < min ? x[j] : min;
+            max = x[j] > max ? x[j] : max;
+        }
+        const double mean = sum / count;
+        double ss = 0;
+        for (int j = first; j <= i; j++){
+            ss += (x[j] - mean) * (x[j] - mean);
+        }
+        ema = i == 0 ? x[0] : ema + 0.2 * (x[i] - ema);
+        ok = fabs( all[0][i] - mean ) < 1e-9
+            && (count < 2 || fabs( all[1][i] - sqrt( ss / (count - 1) ) ) < 1e-9)
+            && all[2][i] == ema && all[3][i] == min && all[4][i] == max;
+    }
+    report( "windows", ok );
+
+    /* The same stream in pieces, after clearing the state */
+    gProgram_resetWindows( program );
+    const int sizes[] = { 1, 999, 1500, 500 };
+    int row = 0;
+    for (int p = 0; p < 4 && ok; p++){
+        void* outs[5];
+        for (int f = 0; f < 5; f++){
+            outs[f] = pieces[f] + row;
+        }
+        ok = gProgram_bindColumn( program, "x", x + row, 0 ) == GPARSE_OK
+            && gProgram_evalSet( program, sizes[p], outs, nullptr ) == GPARSE_OK;
+        row += sizes[p];
+    }
+    for (int f = 0; f < 5 && ok; f++){
+        ok = memcmp( all[f], pieces[f], sizeof( double )*NROWS ) == 0;
+    }
+    report( "windows in pieces", ok && row == NROWS );
+    gProgram_dispose( program );
+
+    /* The size of the window must be a valid constant */
+    program = gParser_compile( parser, "mavg( x, 0 )" );
+    ok = program == nullptr;
+    program = gParser_compile( parser, "ema( x, x )" );
+    report( "windows arguments", ok && program == nullptr );
+    gProgram_dispose( program );
+
+    for (int f = 0; f < 5; f++){
+        free( all[f] );
+        free( pieces[f] );
+    }
+    free( x );
+    gParser_dispose( parser );
+}
+
+/* Columns written to files are mapped and bound by name */
+void check_columns()
+{
+    gParser* parser = gParser_create();
+    const int nwords = (NROWS + 63) / 64;
+    const char* dir = "zdev04_columns";
+    double* x = (double*)malloc( sizeof( double )*NROWS );
+    int* k = (int*)malloc( sizeof( int )*NROWS );
+    double* y = (double*)malloc( sizeof( double )*NROWS );
+    uint64_t* k_valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    uint64_t* valid = (uint64_t*)malloc( sizeof( uint64_t )*nwords );
+    gColumns columns;
+    int ok;
+
+#if defined(_WIN32)
+    _mkdir( dir );
+#else
+    mkdir( dir, 0755 );
+#endif
+    memset( k_valid, 0, sizeof( uint64_t )*nwords );
+    for (int i = 0; i < NROWS; i++){
+        x[i] = i * 0.25;
+        k[i] = i % 9;
+        if (i % 4 != 0){
+            k_valid[i / 64] |= uint64_t( 1 ) << (i % 64);
+        }
+    }
+    /* The shortest column gives the rows */
+    ok = gColumn_write( dir, "x", t_double, x, nullptr, NROWS ) == GPARSE_OK
+        && gColumn_write( dir, "k", t_int, k, k_valid, NROWS - 10 ) == GPARSE_OK
+        && gColumn_write( dir, "bad name", t_int, k, nullptr, NROWS ) == GPARSE_ERROR
+        && gColumns_open( dir, &columns ) == GPARSE_OK
+        && columns.ncolumns == 2 && columns.nrows == NROWS - 10
+        && strcmp( columns.columns[0].name, "k" ) == 0
+        && columns.columns[0].validity != nullptr && columns.columns[1].validity == nullptr;
+    report( "column files", ok );
+
+    gParser_command( parser, "double x = 0; int k = 0; double z = 0" );
+    gProgram* program = gParser_compile( parser, "x * k" );
+    size_t nulls;
+    ok = ok && gProgram_bindColumns( program, &columns ) == GPARSE_OK
+        && gProgram_evalNulls( program, columns.nrows, y, valid, &nulls ) == GPARSE_OK
+        && nulls == (NROWS - 10 + 3) / 4;
+    for (size_t i = 0; i < columns.nrows && ok; i++){
+        const int is_valid = (valid[i / 64] >> (i % 64)) & 1;
+        ok = is_valid == (i % 4 != 0) && (!is_valid || y[i] == i * 0.25 * (i % 9));
+    }
+    report( "bind column files", ok );
+    gProgram_dispose( program );
+
+    /* The mapped columns are read only, and their types must match */
+    program = gParser_compile( parser, "x = x + 1" );
+    ok = gProgram_bindColumns( program, &columns ) == GPARSE_ERROR;
+    gProgram_dispose( program );
+    program = gParser_compile( parser, "z * 2" );
+    ok = ok && gProgram_bindColumns( program, &columns ) == GPARSE_ERROR;
+    gProgram_dispose( program );
+    report( "column files errors", ok );
+
+    gColumns_close( &columns );
+    char path[256];
+    sprintf( path, "%s/x.gcol", dir );
+    remove( path );
+    sprintf( path, "%s/k.gcol", dir );
+    remove( path );
+#if defined(_WIN32)
+    _rmdir( dir );
+#else
+    rmdir( dir );
+#endif
+    free( x );
+    free( k );
+    free( y );
+    free( k_valid );
+    free( valid );
+    gParser_dispose( parser );
+}
+
+int main( int argc, char* argv[] )
+{
+    clock_t init = clock();
+
+    check_assign();
+    check_filter();
+    check_callbacks();
+    check_struct();
+    check_arrow();
+    check_nulls();
+    check_set();
+    check_aggregate();
+    check_group();
+    check_window();
+    check_columns();
+
+    clock_t end = clock();
+    printf( "time:%i", end - init );
+    _CrtDumpMemoryLeaks();
+    getchar();
+
+    return 0;
+}
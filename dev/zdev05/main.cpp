@@ -0,0 +1,324 @@
+/***
+Author: Mario J. Martin <dominonurbs$gmail.com>
+
+Checking the evaluation of expressions from several threads
+*******************************************************************************/
+
+#define _CRTDBG_MAP_ALLOC
+#include <crtdbg.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stddef.h>
+#include <thread>
+#include <atomic>
+
+#include "gparser/gparser.h"
+
+void report( const char* name, const int ok )
+{
+    printf( "%-28s %s\n", name, ok ? "ok" : "FAILED" );
+}
+
+/* Runs the script in two parsers, one statement after the other and in
+ * parallel, and compares the status, the answer and the variables */
+int compare_parallel( const char* script, const int nvars, const char* const* varnames )
+{
+    gParser* seq = gParser_create();
+    gParser* par = gParser_create();
+    const char* decl = "double a = 0; double b = 0; double c = 0; int k = 0";
+
+    gParser_command( seq, decl );
+    gParser_command( par, decl );
+    const int s0 = gParser_command( seq, script );
+    const int s1 = gParser_commandParallel( par, script, 4 );
+    int ok = s0 == s1;
+    if (s0 == GPARSE_ERROR){
+        ok = ok && seq->err_column == par->err_column;
+    }
+    else{
+        ok = ok && seq->ans.type == par->ans.type
+            && (seq->ans.pvalue == nullptr) == (par->ans.pvalue == nullptr)
+            && (seq->ans.pvalue == nullptr || gVariable_getasDouble( seq->ans )
+            == gVariable_getasDouble( par->ans ));
+    }
+    for (int i = 0; i < nvars && ok; i++){
+        gVariable* v0 = gParser_findVariable( seq, varnames[i] );
+        gVariable* v1 = gParser_findVariable( par, varnames[i] );
+        ok = v0 != nullptr && v1 != nullptr
+            && gVariable_getasDouble( *v0 ) == gVariable_getasDouble( *v1 );
+    }
+
+    gParser_dispose( seq );
+    gParser_dispose( par );
+    return ok;
+}
+
+/* The statements of a script give the same results, and the same status,
+ * when the independent ones run in parallel */
+void check_parallel()
+{
+    const char* vars[] = { "a", "b", "c", "k", "d" };
+
+    report( "parallel statements", compare_parallel(
+        "a = sqrt( 2 )\nb = exp( 1 )\nc = a + b\na = c*2; b = a + c\nc = a*b", 3, vars ) );
+    report( "parallel declarations", compare_parallel(
+        "a = 1\ndouble d = a + 1\nb = d*3\nk = 7; c = b + k", 5, vars ) );
+
+    /* The status is the one of the last statement, as in gParser_command */
+    report( "parallel status", compare_parallel( "a = 1\na + 1\n", 1, vars )
+        && compare_parallel( "a = 1; a + 1", 1, vars )
+        && compare_parallel( "a = 1; a + 1; ", 1, vars )
+        && compare_parallel( "int d = 2\n", 0, vars )
+        && compare_parallel( "\n", 0, vars )
+        && compare_parallel( "", 0, vars ) );
+    report( "parallel errors", compare_parallel( "a = 1\nb = e + 1\nc = 2", 1, vars )
+        && compare_parallel( "a = 1\nb = 2\nc = a +* b", 2, vars ) );
+}
+
+/* A writer publishes pairs of values which add up to zero, and the readers
+ * of the segment never see half of an update */
+void check_shared()
+{
+    const char* names[] = { "a", "b", "n" };
+    const int types[] = { t_double, t_double, t_int };
+    const int nupdates = 200000;
+    int ok;
+
+    gShared_remove( "zdev05_shared" );
+    gShared* segment = gShared_create( "zdev05_shared", 3, names, types );
+    gShared* view = gShared_open( "zdev05_shared" );
+    gParser* parser = gParser_create();
+    ok = segment != nullptr && view != nullptr && gShared_find( view, "b" ) == 1
+        && gShared_find( view, "c" ) == -1
+        && gParser_addShared( parser, view ) == GPARSE_OK;
+    report( "shared segment", ok );
+    if (!ok){
+        gParser_dispose( parser );
+        gShared_close( view );
+        gShared_close( segment );
+        gShared_remove( "zdev05_shared" );
+        return;
+    }
+
+    std::thread writer( [segment, nupdates](){
+        const int index[] = { 0, 1, 2 };
+        for (int i = 1; i <= nupdates; i++){
+            const double a = i * 0.5;
+            const double b = -a;
+            const void* values[] = { &a, &b, &i };
+            gShared_write( segment, 3, index, values );
+        }
+    } );
+    gProgram* program = gParser_compile( parser, "a + b == 0 && a == n * 0.5" );
+    int last = 0;
+    while (last < nupdates && ok){
+        gShared_read( view );
+        ok = gProgram_eval( program ) == GPARSE_OK && *(_bool_*)program->ans.pvalue;
+        gVariable* n = gParser_findVariable( parser, "n" );
+        ok = ok && *(int*)n->pvalue >= last;
+        last = *(int*)n->pvalue;
+    }
+    writer.join();
+    gShared_read( view );
+    ok = ok && gParser_command( parser, "n" ) == GPARSE_OK
+        && *(int*)parser->ans.pvalue == nupdates;
+    report( "shared updates", ok );
+
+    gProgram_dispose( program );
+    gParser_dispose( parser );
+    gShared_close( view );
+    gShared_close( segment );
+    ok = gShared_remove( "zdev05_shared" ) == GPARSE_OK
+        && gShared_open( "zdev05_shared" ) == nullptr;
+    report( "shared removed", ok );
+}
+
+/* Range of the host, updated as a whole */
+struct range_t
+{
+    double lo;
+    double hi;
+};
+
+/* Two writers update plain and structure variables of the host while the
+ * expressions are evaluated, and each evaluation sees a single update */
+void check_snapshot()
+{
+    gParser* parser = gParser_create();
+    const int nrows = 1000;
+    const int nupdates = 100000;
+    double a = 0;
+    double b = 0;
+    range_t r = { 0, 0 };
+    double* x = (double*)calloc( nrows, sizeof( double ) );
+    double* y = (double*)malloc( sizeof( double )*nrows );
+    const gField fields[] = { { "lo", t_double, offsetof( range_t, lo ) }
+        , { "hi", t_double, offsetof( range_t, hi ) } };
+    const char* names[] = { "a", "b", "r" };
+    int ok;
+
+    const int type = gParser_addStruct( parser, "range", sizeof( range_t ), 2, fields );
+    gParser_addVariable( parser, "a", t_double, &a );
+    gParser_addVariable( parser, "b", t_double, &b );
+    gParser_addVariable( parser, "r", type, &r );
+    gParser_command( parser, "double x = 0" );
+    gSnapshot* snapshot = gParser_addSnapshot( parser, 3, names );
+    ok = snapshot != nullptr && gParser_addSnapshot( parser, 1, names ) == nullptr;
+    report( "snapshot", ok );
+    if (!ok){
+        free( x );
+        free( y );
+        gParser_dispose( parser );
+        return;
+    }
+
+    std::thread writers[2];
+    for (int t = 0; t < 2; t++){
+        writers[t] = std::thread( [&, t](){
+            for (int i = 1; i <= nupdates; i++){
+                const double v = 2 * i + t;
+                gSnapshot_begin( snapshot );
+                a = v;
+                b = -v;
+                r.lo = v;
+                r.hi = v;
+                gSnapshot_end( snapshot );
+            }
+        } );
+    }
+
+    gProgram* program = gParser_compile( parser, "a + b == 0 && r.lo == a && r.hi == -b" );
+    gProgram* batch = gParser_compile( parser, "x + a + r.hi" );
+    gProgram_bindColumn( batch, "x", x, 0 );
+    for (int i = 0; i < 2000 && ok; i++){
+        ok = gParser_command( parser, "a + b + r.lo - r.hi" ) == GPARSE_OK
+            && *(double*)parser->ans.pvalue == 0
+            && gProgram_eval( program ) == GPARSE_OK && *(_bool_*)program->ans.pvalue;
+        ok = ok && gProgram_evalBatch( batch, nrows, y ) == GPARSE_OK;
+        for (int k = 1; k < nrows && ok; k++){
+            ok = y[k] == y[0];
+        }
+    }
+    for (int t = 0; t < 2; t++){
+        writers[t].join();
+    }
+    report( "snapshot updates", ok );
+
+    /* Assignments change only the copy */
+    ok = gParser_command( parser, "a = -1; a" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == -1 && a != -1;
+    report( "snapshot assignments", ok );
+
+    /* An update in progress keeps the previous copy, and it is counted */
+    const int stale = snapshot->stale;
+    gSnapshot_begin( snapshot );
+    a = 5;
+    ok = gParser_command( parser, "a" ) == GPARSE_OK && *(double*)parser->ans.pvalue == -1
+        && snapshot->stale == stale + 1;
+    gSnapshot_end( snapshot );
+    ok = ok && gParser_command( parser, "a" ) == GPARSE_OK && *(double*)parser->ans.pvalue == 5
+        && snapshot->stale == stale + 1;
+    report( "snapshot stale", ok );
+
+    gProgram_dispose( program );
+    gProgram_dispose( batch );
+    free( x );
+    free( y );
+    gParser_dispose( parser );
+}
+
+/* Readers evaluate a formula while a writer replaces it, and each result
+ * is the one of some version, not older than the previous result */
+void check_registry()
+{
+    gParser* parser = gParser_create();
+    const int nreaders = 3;
+    const int nversions = 20000;
+    std::thread readers[nreaders];
+    int results[nreaders];
+    std::atomic< int > done( 0 );
+    char formula[64];
+
+    gParser_command( parser, "double v = 2" );
+    gRegistry* registry = gRegistry_create( parser, 4 );
+    int ok = registry != nullptr
+        && gRegistry_set( registry, "f", "v * 1" ) == GPARSE_OK
+        && gRegistry_set( registry, "g", "v = 1" ) == GPARSE_ERROR
+        && gRegistry_find( registry, "f" ) == 0 && gRegistry_find( registry, "g" ) == -1;
+    report( "registry", ok );
+    if (!ok){
+        gRegistry_dispose( registry );
+        gParser_dispose( parser );
+        return;
+    }
+
+    /* Odd versions are 'v * k', doubles, and even ones are 'k', integers */
+    for (int t = 0; t < nreaders; t++){
+        results[t] = 1;
+        readers[t] = std::thread( [&, t](){
+            gReader* reader = gRegistry_reader( registry );
+            int last = 0;
+            while (done == 0 && results[t]){
+                union { double d; int i; } value;
+                int type;
+                if (gReader_eval( reader, 0, &value, &type ) != GPARSE_OK){
+                    results[t] = 0;
+                    break;
+                }
+                const int k = type == t_double ? int( value.d / 2 ) : value.i;
+                results[t] = k >= last && ((type == t_double && k % 2 == 1 && value.d == 2 * k)
+                    || (type == t_int && k % 2 == 0));
+                last = k;
+            }
+            gReader_dispose( reader );
+        } );
+    }
+    for (int k = 2; k <= nversions && ok; k++){
+        if (k % 2 == 1){
+            sprintf( formula, "v * %i", k );
+        }
+        else{
+            sprintf( formula, "%i", k );
+        }
+        ok = gRegistry_set( registry, "f", formula ) == GPARSE_OK;
+    }
+    done = 1;
+    for (int t = 0; t < nreaders; t++){
+        readers[t].join();
+        ok = ok && results[t];
+    }
+    report( "registry updates", ok );
+
+    gReader* reader = gRegistry_reader( registry );
+    double value;
+    ok = gRegistry_remove( registry, "f" ) == GPARSE_OK
+        && gReader_eval( reader, 0, &value, nullptr ) == GPARSE_ERROR
+        && gRegistry_set( registry, "f", "v + 1" ) == GPARSE_OK
+        && gReader_eval( reader, 0, &value, nullptr ) == GPARSE_OK && value == 3;
+    report( "registry remove", ok );
+    gReader_dispose( reader );
+    gRegistry_dispose( registry );
+    gParser_dispose( parser );
+}
+
+int main( int argc, char* argv[] )
+{
+    clock_t init = clock();
+
+    check_parallel();
+    check_shared();
+    check_snapshot();
+    check_registry();
+
+    clock_t end = clock();
+    printf( "time:%i", end - init );
+    _CrtDumpMemoryLeaks();
+    getchar();
+
+    return 0;
+}
@@ -0,0 +1,410 @@
+/***
+Author: Mario J. Martin <dominonurbs$gmail.com>
+
+Checking the state of the parsers: caches, files, clones, layers and pools
+*******************************************************************************/
+
+#define _CRTDBG_MAP_ALLOC
+#include <crtdbg.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <memory.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <thread>
+
+#include "gparser/gparser.h"
+
+void report( const char* name, const int ok )
+{
+    printf( "%-28s %s\n", name, ok ? "ok" : "FAILED" );
+}
+
+/* Evaluates the program and compares the result */
+int eval_equals( gProgram* program, const double expected )
+{
+    return program != nullptr && gProgram_eval( program ) == GPARSE_OK
+        && gVariable_getasDouble( program->ans ) == expected;
+}
+
+void half( void* result, const void* const* args, void* data )
+{
+    *(double*)result = *(const double*)args[0] / 2;
+}
+
+/* Programs saved in the cache are taken by the next parsers with the same
+ * variables and functions */
+void check_cache()
+{
+    const char* path = "zdev06.gcache";
+    const int args_type[] = { t_double };
+    int ok;
+
+    remove( path );
+    gParser* parser = gParser_create();
+    gParser_command( parser, "double x = 3; int k = 2" );
+    gParser_addFunction( parser, "half", t_double, 1, args_type, half, nullptr );
+    gCache* cache = gCache_open( parser, path );
+    gProgram* a = gCache_compile( cache, "x * k + half( x )" );
+    gProgram* b = gCache_compileFilter( cache, "x > k" );
+    gProgram* c = gCache_compile( cache, "x * k + half( x )" );
+    ok = cache != nullptr && cache->misses == 2 && cache->hits == 1
+        && eval_equals( a, 7.5 ) && eval_equals( c, 7.5 ) && b != nullptr
+        && gCache_save( cache ) == GPARSE_OK;
+    report( "cache", ok );
+    gProgram_dispose( a );
+    gProgram_dispose( b );
+    gProgram_dispose( c );
+    gCache_close( cache );
+    gParser_dispose( parser );
+
+    /* Other parser, with the same names and types, takes the programs */
+    parser = gParser_create();
+    gParser_command( parser, "int k = 4; double x = 1" );
+    gParser_addFunction( parser, "half", t_double, 1, args_type, half, nullptr );
+    cache = gCache_open( parser, path );
+    a = gCache_compile( cache, "x * k + half( x )" );
+    ok = cache != nullptr && cache->hits == 1 && cache->misses == 0
+        && eval_equals( a, 4.5 );
+    gProgram_dispose( a );
+    gParser_command( parser, "k = 5; x = 2" );
+    a = gCache_compile( cache, "x * k + half( x )" );
+    ok = ok && cache->hits == 2 && eval_equals( a, 11 );
+    gProgram_dispose( a );
+
+    /* Programs of window functions are always compiled */
+    a = gCache_compile( cache, "mavg( x, 3 )" );
+    ok = ok && cache->misses == 1 && gCache_save( cache ) == GPARSE_OK;
+    gProgram_dispose( a );
+    a = gCache_compile( cache, "mavg( x, 3 )" );
+    ok = ok && cache->misses == 2 && eval_equals( a, 2 );
+    report( "cache reopened", ok );
+    gProgram_dispose( a );
+    gCache_close( cache );
+    gParser_dispose( parser );
+
+    /* A variable of other type, or a missing function, compile again */
+    parser = gParser_create();
+    gParser_command( parser, "double x = 3; double k = 2" );
+    cache = gCache_open( parser, path );
+    a = gCache_compile( cache, "x * k" );
+    gProgram_dispose( a );
+    a = gCache_compile( cache, "x * k + half( x )" );
+    ok = cache != nullptr && cache->hits == 0 && a == nullptr;
+    gCache_close( cache );
+    gParser_dispose( parser );
+
+    /* A file that is not a cache is an empty cache */
+    FILE* f = fopen( path, "wb" );
+    fputs( "not a cache", f );
+    fclose( f );
+    parser = gParser_create();
+    gParser_command( parser, "double x = 3; int k = 2" );
+    cache = gCache_open( parser, path );
+    a = gCache_compile( cache, "x * k" );
+    ok = ok && cache != nullptr && cache->nentries == 1 && cache->misses == 1
+        && eval_equals( a, 6 );
+    report( "cache mismatch", ok );
+    gProgram_dispose( a );
+    gCache_close( cache );
+    gParser_dispose( parser );
+    remove( path );
+}
+
+/* The structure types and the variables of the scripts are saved with
+ * their values, and loaded in other parsers */
+void check_state()
+{
+    const char* path = "zdev06.gstate";
+    double host = 5;
+    int ok;
+
+    gParser* parser = gParser_create();
+    gParser_addVariable( parser, "host", t_double, &host );
+    ok = gParser_command( parser, "struct point{ double x; double y; int id }" ) != GPARSE_ERROR
+        && gParser_command( parser, "point p; point ps[10]; double d = 1.5; int k = 7"
+        "; bool b = true" ) != GPARSE_ERROR
+        && gParser_command( parser, "p.x = 2; ps[3].y = 4; ps[9].id = 11" ) != GPARSE_ERROR
+        && gParser_saveState( parser, path ) == GPARSE_OK;
+    gParser_dispose( parser );
+
+    parser = gParser_create();
+    ok = ok && gParser_loadState( parser, path ) == GPARSE_OK
+        && gParser_command( parser, "p.x + ps[3].y + ps[9].id + d + k" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == 2 + 4 + 11 + 1.5 + 7
+        && gParser_command( parser, "b" ) == GPARSE_OK && *(_bool_*)parser->ans.pvalue
+        && gParser_findVariable( parser, "host" ) == nullptr;
+    /* The loaded variables are used as the declared ones */
+    ok = ok && gParser_command( parser, "point q; q.id = ps[9].id + 1; d = d * 2; q.id + d" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == 12 + 3;
+    report( "state", ok );
+
+    /* Nothing is loaded if a variable is declared */
+    ok = gParser_loadState( parser, path ) == GPARSE_ERROR;
+    gParser_dispose( parser );
+    parser = gParser_create();
+    ok = ok && gParser_command( parser, "struct point{ double x; int id }" ) != GPARSE_ERROR
+        && gParser_loadState( parser, path ) == GPARSE_ERROR
+        && gParser_findVariable( parser, "d" ) == nullptr;
+    gParser_dispose( parser );
+    parser = gParser_create();
+    ok = ok && gParser_command( parser, "int d = 0" ) != GPARSE_ERROR
+        && gParser_loadState( parser, path ) == GPARSE_ERROR
+        && gParser_findVariable( parser, "k" ) == nullptr;
+    gParser_dispose( parser );
+
+    /* Nor if the file is truncated, or it is not a state */
+    FILE* f = fopen( path, "rb" );
+    fseek( f, 0, SEEK_END );
+    const long size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    char* image = (char*)malloc( size );
+    const int nread = (int)fread( image, 1, size, f );
+    fclose( f );
+    f = fopen( path, "wb" );
+    fwrite( image, 1, size - 8, f );
+    fclose( f );
+    parser = gParser_create();
+    ok = ok && nread == size && gParser_loadState( parser, path ) == GPARSE_ERROR
+        && gParser_findVariable( parser, "d" ) == nullptr;
+    gParser_dispose( parser );
+    image[0] ^= 0x55;
+    f = fopen( path, "wb" );
+    fwrite( image, 1, size, f );
+    fclose( f );
+    free( image );
+    parser = gParser_create();
+    ok = ok && gParser_loadState( parser, path ) == GPARSE_ERROR;
+    gParser_dispose( parser );
+    parser = gParser_create();
+    ok = ok && gParser_loadState( parser, "zdev06.missing" ) == GPARSE_ERROR;
+    report( "state errors", ok );
+    gParser_dispose( parser );
+    remove( path );
+}
+
+/* The clones take the values of the template, and the functions of the
+ * scripts assign the variables of the clone */
+void check_clone()
+{
+    const int args_type[] = { t_double };
+    double host = 5;
+    int ok;
+
+    gParser* parser = gParser_create();
+    gParser_addVariable( parser, "host", t_double, &host );
+    gParser_addFunction( parser, "half", t_double, 1, args_type, half, nullptr );
+    ok = gParser_command( parser, "struct point{ double x; int id }" ) != GPARSE_ERROR
+        && gParser_command( parser, "point p; point ps[4]; double d = 1.5; int counter = 0"
+        "; p.x = 2; ps[3].id = 9" ) != GPARSE_ERROR
+        && gParser_command( parser, "function int bump(int n)"
+        "{ counter = counter + n; return counter }" ) != GPARSE_ERROR
+        && gParser_command( parser, "function double twice(double v)"
+        "{ return half( v ) * 4 }" ) != GPARSE_ERROR;
+
+    gParser* clone = gParser_clone( parser );
+    ok = ok && clone != nullptr
+        && gParser_command( clone, "p.x + ps[3].id + d + counter" ) == GPARSE_OK
+        && *(double*)clone->ans.pvalue == 2 + 9 + 1.5
+        && gParser_command( clone, "bump( 3 ); bump( 4 )" ) == GPARSE_OK
+        && *(_int_*)clone->ans.pvalue == 7
+        && gParser_command( clone, "twice( d ) + half( host )" ) == GPARSE_OK
+        && *(double*)clone->ans.pvalue == 3 + 2.5;
+    report( "clone", ok );
+
+    /* The variables of the host are the same, and the template is unchanged */
+    ok = clone != nullptr && gParser_command( clone, "host = 6; d = 0; p.x = 0" ) == GPARSE_OK
+        && host == 6
+        && gParser_command( parser, "p.x + d + counter" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == 2 + 1.5
+        && gParser_command( parser, "bump( 1 )" ) == GPARSE_OK
+        && *(_int_*)parser->ans.pvalue == 1;
+    /* And it can be cloned again, as the clone */
+    gParser* other = gParser_clone( parser );
+    gParser* third = gParser_clone( clone );
+    ok = ok && other != nullptr && third != nullptr
+        && gParser_command( other, "bump( 1 )" ) == GPARSE_OK
+        && *(_int_*)other->ans.pvalue == 2
+        && gParser_command( third, "bump( 1 ) + p.x + host" ) == GPARSE_OK
+        && gVariable_getasDouble( third->ans ) == 8 + 0 + 6;
+    report( "clone template", ok );
+    gParser_dispose( third );
+    gParser_dispose( other );
+    gParser_dispose( clone );
+    gParser_dispose( parser );
+}
+
+/* The layers read the variables of the base, and write their own copies,
+ * also from the functions of the scripts of the base */
+void check_layer()
+{
+    const int args_type[] = { t_double };
+    double host = 5;
+    int ok;
+
+    gParser* base = gParser_create();
+    gParser_addVariable( base, "host", t_double, &host );
+    gParser_addFunction( base, "half", t_double, 1, args_type, half, nullptr );
+    ok = gParser_command( base, "struct point{ double x; int id }" ) != GPARSE_ERROR
+        && gParser_command( base, "point p; double d = 1.5; int counter = 0" ) != GPARSE_ERROR
+        && gParser_command( base, "function double twice(double v)"
+        "{ return half( v ) * 4 }" ) != GPARSE_ERROR
+        && gParser_command( base, "function int bump(int n)"
+        "{ counter = counter + n; return counter }" ) != GPARSE_ERROR
+        && gParser_command( base, "function int bump2(int n){ return bump( n ) * 2 }" ) != GPARSE_ERROR;
+
+    gParser* layer1 = gParser_createLayer( base );
+    gParser* layer2 = gParser_createLayer( base );
+    ok = ok && layer1 != nullptr && layer2 != nullptr
+        && gParser_command( layer1, "bump( 5 )" ) == GPARSE_OK
+        && *(_int_*)layer1->ans.pvalue == 5
+        && gParser_command( layer2, "bump( 1 )" ) == GPARSE_OK
+        && *(_int_*)layer2->ans.pvalue == 1
+        && gParser_command( layer2, "bump2( 1 )" ) == GPARSE_OK
+        && *(_int_*)layer2->ans.pvalue == 4
+        && gParser_command( layer1, "twice( d ) + half( host )" ) == GPARSE_OK
+        && *(double*)layer1->ans.pvalue == 3 + 2.5
+        && gParser_command( base, "counter" ) == GPARSE_OK
+        && *(_int_*)base->ans.pvalue == 0;
+    report( "layer functions", ok );
+
+    /* Copy on write of the variables, and of the instances of structures */
+    gProgram* program = layer1 != nullptr ? gParser_compile( layer1, "d + p.x" ) : nullptr;
+    ok = program != nullptr
+        && gParser_command( layer1, "d = 2; p.x = 3" ) == GPARSE_OK
+        && eval_equals( program, 5 )
+        && gParser_command( layer2, "d + p.x" ) == GPARSE_OK
+        && *(double*)layer2->ans.pvalue == 1.5
+        && gParser_command( base, "d + p.x" ) == GPARSE_OK
+        && *(double*)base->ans.pvalue == 1.5;
+    /* The variables of the host are the same */
+    ok = ok && gParser_command( layer2, "host = 6" ) == GPARSE_OK && host == 6
+        && gParser_command( layer1, "host" ) == GPARSE_OK
+        && *(double*)layer1->ans.pvalue == 6;
+    /* And the clone of a layer keeps the values of the layer */
+    gParser* clone = layer1 != nullptr ? gParser_clone( layer1 ) : nullptr;
+    ok = ok && clone != nullptr
+        && gParser_command( clone, "bump( 1 ) + d + p.x" ) == GPARSE_OK
+        && gVariable_getasDouble( clone->ans ) == 6 + 2 + 3
+        && gParser_command( layer1, "counter" ) == GPARSE_OK
+        && *(_int_*)layer1->ans.pvalue == 5;
+    report( "layer variables", ok );
+
+    gProgram_dispose( program );
+    gParser_dispose( clone );
+    gParser_dispose( layer1 );
+    gParser_dispose( layer2 );
+    gParser_dispose( base );
+}
+
+/* The parsers released to the pool are handed out again, reset, and the
+ * sessions of several threads do not see each other */
+void check_pool()
+{
+    const int args_type[] = { t_double };
+    const int nthreads = 8;
+    const int nsessions = 2000;
+    double host = 5;
+    int results[nthreads];
+    std::thread threads[nthreads];
+    int ok;
+
+    gParser* base = gParser_create();
+    gParser_addVariable( base, "host", t_double, &host );
+    gParser_addFunction( base, "half", t_double, 1, args_type, half, nullptr );
+    gParser_command( base, "double d = 1.5; int counter = 0" );
+    gParser_command( base, "function int bump(int n){ counter = counter + n; return counter }" );
+
+    /* Sessions on the same parser, which is reset */
+    gPool* pool = gPool_create( base );
+    gParser* parser = gPool_acquire( pool );
+    ok = parser != nullptr
+        && gParser_command( parser, "struct point{ double x; int id }" ) != GPARSE_ERROR
+        && gParser_command( parser, "point p; double e = 2; d = 4; host = 6" ) != GPARSE_ERROR
+        && gParser_command( parser, "function double g(double v){ return half( v ) + e }" )
+        != GPARSE_ERROR
+        && gParser_command( parser, "bump( 5 ) + g( d )" ) == GPARSE_OK
+        && gVariable_getasDouble( parser->ans ) == 5 + 4;
+    gPool_release( pool, parser );
+    gParser* again = gPool_acquire( pool );
+    ok = ok && again == parser && pool->nparsers == 1 && host == 6
+        && gParser_findVariable( again, "e" ) == nullptr
+        && gParser_command( again, "point q" ) == GPARSE_ERROR
+        && gParser_command( again, "g( 1 )" ) == GPARSE_ERROR
+        && gParser_command( again, "bump( 1 ) + d" ) == GPARSE_OK
+        && gVariable_getasDouble( again->ans ) == 1 + 1.5
+        && gParser_command( base, "counter + d" ) == GPARSE_OK
+        && gVariable_getasDouble( base->ans ) == 1.5;
+    report( "pool", ok );
+
+    /* A second parser while the first one is in use */
+    parser = gPool_acquire( pool );
+    ok = parser != nullptr && parser != again && pool->nparsers == 2
+        && gParser_command( parser, "bump( 2 )" ) == GPARSE_OK
+        && *(_int_*)parser->ans.pvalue == 2;
+    gPool_release( pool, parser );
+    gPool_release( pool, again );
+    gPool_dispose( pool );
+
+    /* Without base, the parsers are empty */
+    pool = gPool_create( nullptr );
+    parser = gPool_acquire( pool );
+    ok = ok && parser != nullptr && gParser_findVariable( parser, "d" ) == nullptr
+        && gParser_command( parser, "double d = 3; d * 2" ) == GPARSE_OK
+        && *(double*)parser->ans.pvalue == 6;
+    gPool_release( pool, parser );
+    parser = gPool_acquire( pool );
+    ok = ok && gParser_findVariable( parser, "d" ) == nullptr
+        && gParser_command( parser, "int d = 1" ) != GPARSE_ERROR;
+    gPool_release( pool, parser );
+    gPool_dispose( pool );
+    report( "pool reuse", ok );
+
+    /* Sessions in several threads */
+    pool = gPool_create( base );
+    for (int t = 0; t < nthreads; t++){
+        results[t] = 1;
+        threads[t] = std::thread( [&, t](){
+            for (int i = 0; i < nsessions && results[t]; i++){
+                gParser* session = gPool_acquire( pool );
+                results[t] = session != nullptr
+                    && gParser_findVariable( session, "k" ) == nullptr
+                    && gParser_command( session, "int k = 3; d = d + k" ) != GPARSE_ERROR
+                    && gParser_command( session, "bump( k ) + bump( 1 ) + d" ) == GPARSE_OK
+                    && gVariable_getasDouble( session->ans ) == 3 + 4 + 4.5;
+                gPool_release( pool, session );
+            }
+        } );
+    }
+    ok = 1;
+    for (int t = 0; t < nthreads; t++){
+        threads[t].join();
+        ok = ok && results[t];
+    }
+    ok = ok && pool->nparsers <= nthreads
+        && gParser_command( base, "counter + d" ) == GPARSE_OK
+        && gVariable_getasDouble( base->ans ) == 1.5;
+    report( "pool threads", ok );
+    gPool_dispose( pool );
+    gParser_dispose( base );
+}
+
+int main( int argc, char* argv[] )
+{
+    clock_t init = clock();
+
+    check_cache();
+    check_state();
+    check_clone();
+    check_layer();
+    check_pool();
+
+    clock_t end = clock();
+    printf( "time:%i", end - init );
+    _CrtDumpMemoryLeaks();
+    getchar();
+
+    return 0;
+}
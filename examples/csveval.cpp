@@ -0,0 +1,1043 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Evaluates expressions for each row of a CSV file.
+
+    csveval [-d delimiter] [-o output.csv] input.csv expression...
+
+The first line of the file names the columns, and each column is a double
+variable for the expressions, e.g.
+
+    csveval -o out.csv trades.csv "price*qty" "mavg(price, 20)"
+
+The names are adapted to variable names: characters other than letters,
+digits and '_' are replaced by '_'. Empty fields, and fields which are not
+numbers, are null, and null results are written as empty fields.
+
+The file is read through a window mapped in memory, which moves along the
+file, so the memory does not depend on the size of the file. A thread
+parses the rows into batches of columns while the main thread evaluates
+the previous batch with gProgram_evalSet and writes the results.
+
+The numbers are parsed 8 digits at a time, with the bytes of the digits in
+a 64-bit word, and the delimiters are searched 8 bytes at a time in the
+same way. Numbers with up to 15 significant digits and small exponents are
+converted exactly with a single multiplication or division; the rest are
+converted by strtod. The results are written with the fewest digits that
+read back as the same value, found in the same way when they have up to
+15 digits, and with 17 digits otherwise.
+
+    csveval -t
+
+checks that random values are written and read back as the same doubles,
+and that the numbers are parsed as strtod does.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "gparser/gparser.h"
+
+/* Rows of each batch */
+#define CSV_BATCH 8192
+
+/* Batches being parsed or evaluated */
+#define CSV_SLOTS 3
+
+/* Bytes of the file mapped at once. Rows must be shorter. */
+#define CSV_WINDOW (64 << 20)
+
+#define CSV_OUTPUT_BUFFER (1 << 20)
+
+/*************/
+/* Map files */
+/*************/
+struct MappedFile
+{
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint64_t size;
+    uint64_t granularity;   /* Alignment of the offset of the window */
+
+    const char* data;       /* Window */
+    uint64_t offset;        /* Offset of the window in the file */
+    size_t length;
+};
+
+static int mapped_open( MappedFile* f, const char* path )
+{
+    memset( f, 0, sizeof( MappedFile ) );
+#if defined(_WIN32)
+    f->file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING
+        , FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+    if (f->file == INVALID_HANDLE_VALUE){
+        return GPARSE_ERROR;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx( f->file, &size );
+    f->size = (uint64_t)size.QuadPart;
+    if (f->size > 0){
+        f->mapping = CreateFileMappingA( f->file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+        if (f->mapping == nullptr){
+            CloseHandle( f->file );
+            return GPARSE_ERROR;
+        }
+    }
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    f->granularity = info.dwAllocationGranularity;
+#else
+    f->fd = open( path, O_RDONLY );
+    if (f->fd < 0){
+        return GPARSE_ERROR;
+    }
+    struct stat st;
+    if (fstat( f->fd, &st ) != 0){
+        close( f->fd );
+        return GPARSE_ERROR;
+    }
+    f->size = (uint64_t)st.st_size;
+    f->granularity = (uint64_t)sysconf( _SC_PAGESIZE );
+#endif
+    return GPARSE_OK;
+}
+
+static void mapped_unmap( MappedFile* f )
+{
+    if (f->data != nullptr){
+#if defined(_WIN32)
+        UnmapViewOfFile( f->data );
+#else
+        munmap( (void*)f->data, f->length );
+#endif
+    }
+    f->data = nullptr;
+    f->length = 0;
+}
+
+/* Maps the window starting at the offset, rounded down */
+static int mapped_window( MappedFile* f, uint64_t offset )
+{
+    mapped_unmap( f );
+    offset -= offset % f->granularity;
+    const uint64_t left = f->size - offset;
+    const size_t length = left < CSV_WINDOW ? (size_t)left : (size_t)CSV_WINDOW;
+    f->offset = offset;
+    if (length == 0){
+        return GPARSE_OK;
+    }
+#if defined(_WIN32)
+    f->data = (const char*)MapViewOfFile( f->mapping, FILE_MAP_READ
+        , DWORD( offset >> 32 ), DWORD( offset & 0xFFFFFFFF ), length );
+    if (f->data == nullptr){
+        return GPARSE_ERROR;
+    }
+#else
+    void* p = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, f->fd, (off_t)offset );
+    if (p == MAP_FAILED){
+        return GPARSE_ERROR;
+    }
+    madvise( p, length, MADV_SEQUENTIAL );
+    f->data = (const char*)p;
+#endif
+    f->length = length;
+    return GPARSE_OK;
+}
+
+static void mapped_close( MappedFile* f )
+{
+    mapped_unmap( f );
+#if defined(_WIN32)
+    if (f->mapping != nullptr){
+        CloseHandle( f->mapping );
+    }
+    CloseHandle( f->file );
+#else
+    close( f->fd );
+#endif
+}
+
+/*************************/
+/* Parse 8 bytes at once */
+/*************************/
+static inline uint64_t load8( const char* p )
+{
+    uint64_t v;
+    memcpy( &v, p, 8 );
+    return v;
+}
+
+/* Non zero if some byte of v is c. The bytes are in memory order on little
+ * endian machines. */
+static inline uint64_t has_byte( const uint64_t v, const unsigned char c )
+{
+    const uint64_t x = v ^ (0x0101010101010101ULL * c);
+    return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+}
+
+/* True if the 8 bytes are digits */
+static inline int is_8digits( const uint64_t v )
+{
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL)
+        | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+        == 0x3333333333333333ULL;
+}
+
+/* Value of 8 digits, the first one being the most significant */
+static inline uint32_t parse_8digits( uint64_t v )
+{
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+        + (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t)v;
+}
+
+static inline int is_little_endian()
+{
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+/* End of the field: the next delimiter, '\n' or 'end' */
+static const char* field_end( const char* p, const char* end, const char delimiter )
+{
+    if (is_little_endian()){
+        while (p + 8 <= end){
+            const uint64_t v = load8( p );
+            if (has_byte( v, (unsigned char)delimiter ) | has_byte( v, '\n' )){
+                break;
+            }
+            p += 8;
+        }
+    }
+    while (p < end && *p != delimiter && *p != '\n'){
+        p++;
+    }
+    return p;
+}
+
+static const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11
+    , 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* Reads a number in [p, end). Returns 1 if the whole field is a number. */
+static int parse_number( const char* p, const char* end, double* value )
+{
+    while (p < end && (*p == ' ' || *p == '\t')){
+        p++;
+    }
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')){
+        end--;
+    }
+    const char* start = p;
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')){
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;         /* Significant digits in the mantissa */
+    int exponent = 0;
+    int any = 0;
+    const int swar = is_little_endian();
+
+    while (p < end && *p == '0'){
+        p++;
+        any = 1;
+    }
+    while (swar && p + 8 <= end && digits <= 11 && is_8digits( load8( p ) )){
+        mantissa = mantissa * 100000000 + parse_8digits( load8( p ) );
+        digits += mantissa != 0 ? 8 : 0;
+        p += 8;
+        any = 1;
+    }
+    while (p < end && *p >= '0' && *p <= '9' && digits < 19){
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        p++;
+        any = 1;
+    }
+    const char* more = p;
+    while (p < end && *p >= '0' && *p <= '9'){
+        p++;
+    }
+    exponent += int( p - more );
+
+    if (p < end && *p == '.'){
+        p++;
+        if (mantissa == 0){
+            while (p < end && *p == '0'){
+                p++;
+                exponent--;
+                any = 1;
+            }
+        }
+        while (swar && p + 8 <= end && digits <= 11 && is_8digits( load8( p ) )){
+            mantissa = mantissa * 100000000 + parse_8digits( load8( p ) );
+            digits += 8;
+            exponent -= 8;
+            p += 8;
+            any = 1;
+        }
+        while (p < end && *p >= '0' && *p <= '9' && digits < 19){
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+            exponent--;
+            p++;
+            any = 1;
+        }
+        while (p < end && *p >= '0' && *p <= '9'){
+            p++;
+            any = 1;
+            digits = 99;    /* Digits were dropped, so it is not exact */
+        }
+    }
+
+    if (any && p < end && (*p == 'e' || *p == 'E')){
+        p++;
+        int eneg = 0;
+        if (p < end && (*p == '-' || *p == '+')){
+            eneg = *p == '-';
+            p++;
+        }
+        int e = 0;
+        const char* edigits = p;
+        while (p < end && *p >= '0' && *p <= '9'){
+            e = e < 100000 ? e * 10 + (*p - '0') : e;
+            p++;
+        }
+        if (p == edigits){
+            return 0;
+        }
+        exponent += eneg ? -e : e;
+    }
+
+    if (any && p == end){
+        /* Exact when the mantissa and the power of 10 are exact doubles */
+        if (digits <= 15 && exponent >= -22 && exponent <= 22){
+            double v = double( mantissa );
+            v = exponent < 0 ? v / pow10_exact[-exponent] : v * pow10_exact[exponent];
+            *value = negative ? -v : v;
+            return 1;
+        }
+    }
+    else if (any){
+        return 0;
+    }
+
+    /* Long mantissas, large exponents, inf and nan */
+    char buffer[128];
+    const size_t len = size_t( end - start );
+    if (len == 0 || len >= sizeof( buffer )){
+        return 0;
+    }
+    memcpy( buffer, start, len );
+    buffer[len] = '\0';
+    char* stop;
+    *value = strtod( buffer, &stop );
+    return stop == buffer + len;
+}
+
+/***********/
+/* Threads */
+/***********/
+
+/* The reader thread and the main thread only exchange the state of the
+ * slots and the failure flag */
+#if defined(_WIN32)
+typedef HANDLE Thread;
+
+static inline int atomic_load( volatile int* p )
+{
+    return (int)InterlockedCompareExchange( (volatile LONG*)p, 0, 0 );
+}
+
+static inline void atomic_store( volatile int* p, const int v )
+{
+    InterlockedExchange( (volatile LONG*)p, v );
+}
+
+static inline void thread_yield()
+{
+    SwitchToThread();
+}
+#else
+typedef pthread_t Thread;
+
+static inline int atomic_load( volatile int* p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+static inline void atomic_store( volatile int* p, const int v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+static inline void thread_yield()
+{
+    sched_yield();
+}
+#endif
+
+/***********/
+/* Batches */
+/***********/
+enum
+{
+    slot_free,
+    slot_ready,     /* Parsed, to be evaluated */
+    slot_last,      /* Last batch, possibly empty */
+};
+
+struct Slot
+{
+    double* columns;        /* CSV_BATCH values of each column */
+    uint64_t* validity;     /* Bitmap of each column */
+    int* nulls;             /* Some value of the column is null */
+    size_t nrows;
+    volatile int state;
+};
+
+struct CsvReader
+{
+    MappedFile file;
+    uint64_t pos;           /* Position in the file */
+    char delimiter;
+    int ncolumns;
+
+    Slot slots[CSV_SLOTS];
+    volatile int failed;
+    char error[256];
+};
+
+#define CSV_WORDS ((CSV_BATCH + 63) / 64)
+
+/* Makes sure the window has the line at 'pos' complete. Returns a pointer
+ * to it and the end of the line, excluding '\n', or nullptr at the end. */
+static const char* reader_line( CsvReader* r, const char** line_end )
+{
+    MappedFile* f = &r->file;
+    if (r->pos >= f->size){
+        return nullptr;
+    }
+    for (int attempt = 0; attempt < 2; attempt++){
+        if (r->pos >= f->offset && r->pos < f->offset + f->length){
+            const char* p = f->data + (r->pos - f->offset);
+            const char* end = f->data + f->length;
+            const char* q = (const char*)memchr( p, '\n', size_t( end - p ) );
+            if (q != nullptr){
+                *line_end = q;
+                r->pos += uint64_t( q - p ) + 1;
+                return p;
+            }
+            if (f->offset + f->length == f->size){
+                /* The last line has no '\n' */
+                *line_end = end;
+                r->pos = f->size;
+                return p;
+            }
+        }
+        if (mapped_window( f, r->pos ) != GPARSE_OK){
+            strcpy( r->error, "Cannot map the file" );
+            return nullptr;
+        }
+    }
+    sprintf( r->error, "Line longer than %d MB", CSV_WINDOW >> 20 );
+    return nullptr;
+}
+
+/* Parses a row into row 'i' of the batch */
+static void parse_row( CsvReader* r, Slot* s, const size_t i, const char* p, const char* end )
+{
+    const size_t word = i >> 6;
+    const uint64_t bit = 1ULL << (i & 63);
+    for (int c = 0; c < r->ncolumns; c++){
+        double* column = s->columns + (size_t)c*CSV_BATCH;
+        uint64_t* valid = s->validity + (size_t)c*CSV_WORDS;
+        int ok = 0;
+        if (p <= end){
+            const char* q;
+            if (p < end && *p == '"'){
+                /* Quoted field, the quotes are removed */
+                q = p + 1;
+                while (q < end && (*q != '"' || (q + 1 < end && q[1] == '"'))){
+                    q += *q == '"' ? 2 : 1;
+                }
+                ok = parse_number( p + 1, q, column + i );
+                q = field_end( q, end, r->delimiter );
+            }
+            else{
+                q = field_end( p, end, r->delimiter );
+                ok = parse_number( p, q, column + i );
+            }
+            p = q + 1;
+        }
+        if (ok){
+            valid[word] |= bit;
+        }
+        else{
+            valid[word] &= ~bit;
+            column[i] = 0;
+            s->nulls[c] = 1;
+        }
+    }
+}
+
+static void reader_thread( void* arg )
+{
+    CsvReader* r = (CsvReader*)arg;
+    for (int k = 0;; k = (k + 1) % CSV_SLOTS){
+        Slot* s = r->slots + k;
+        while (atomic_load( &s->state ) != slot_free){
+            if (atomic_load( &r->failed )){
+                return;
+            }
+            thread_yield();
+        }
+
+        memset( s->nulls, 0, sizeof( int )*r->ncolumns );
+        size_t n = 0;
+        const char* line = nullptr;
+        const char* line_end = nullptr;
+        while (n < CSV_BATCH && (line = reader_line( r, &line_end )) != nullptr){
+            if (line_end > line && line_end[-1] == '\r'){
+                line_end--;
+            }
+            if (line_end > line){
+                parse_row( r, s, n, line, line_end );
+                n++;
+            }
+        }
+        s->nrows = n;
+        if (r->error[0] != '\0'){
+            atomic_store( &r->failed, 1 );
+        }
+        if (line == nullptr){
+            atomic_store( &s->state, slot_last );
+            return;
+        }
+        atomic_store( &s->state, slot_ready );
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI reader_main( LPVOID arg )
+{
+    reader_thread( arg );
+    return 0;
+}
+#else
+static void* reader_main( void* arg )
+{
+    reader_thread( arg );
+    return nullptr;
+}
+#endif
+
+static int reader_start( Thread* thread, CsvReader* r )
+{
+#if defined(_WIN32)
+    *thread = CreateThread( nullptr, 0, reader_main, r, 0, nullptr );
+    return *thread != nullptr ? GPARSE_OK : GPARSE_ERROR;
+#else
+    return pthread_create( thread, nullptr, reader_main, r ) == 0 ? GPARSE_OK : GPARSE_ERROR;
+#endif
+}
+
+static void reader_join( Thread thread )
+{
+#if defined(_WIN32)
+    WaitForSingleObject( thread, INFINITE );
+    CloseHandle( thread );
+#else
+    pthread_join( thread, nullptr );
+#endif
+}
+
+/**********/
+/* Output */
+/**********/
+struct Writer
+{
+    FILE* file;
+    char* buffer;
+    size_t used;
+};
+
+static inline void writer_reserve( Writer* w, const size_t n )
+{
+    if (w->used + n > CSV_OUTPUT_BUFFER){
+        fwrite( w->buffer, 1, w->used, w->file );
+        w->used = 0;
+    }
+}
+
+static inline void writer_char( Writer* w, const char c )
+{
+    writer_reserve( w, 1 );
+    w->buffer[w->used++] = c;
+}
+
+/* Field with quotes if it has the delimiter, quotes or new lines */
+static void writer_text( Writer* w, const char* s, const char delimiter )
+{
+    const int quote = strchr( s, delimiter ) != nullptr || strchr( s, '"' ) != nullptr
+        || strchr( s, '\n' ) != nullptr;
+    if (quote){
+        writer_char( w, '"' );
+    }
+    for (; *s != '\0'; s++){
+        if (*s == '"'){
+            writer_char( w, '"' );
+        }
+        writer_char( w, *s );
+    }
+    if (quote){
+        writer_char( w, '"' );
+    }
+}
+
+static int format_integer( char* out, const long long v )
+{
+    char digits[24];
+    int n = 0;
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do{
+        digits[n++] = char( '0' + u % 10 );
+        u /= 10;
+    } while (u != 0);
+    int k = 0;
+    if (v < 0){
+        out[k++] = '-';
+    }
+    while (n > 0){
+        out[k++] = digits[--n];
+    }
+    out[k] = '\0';
+    return k;
+}
+
+/* Writes the shortest decimal of up to 15 significant digits which reads
+ * back as the same double, or returns 0 if there is none. The decimal is
+ * m / 10^s, which is read back exactly as m and 10^s are exact doubles. */
+static int format_short( char* out, const double v )
+{
+    const double a = v < 0 ? -v : v;
+    if (!(a >= 1e-7 && a < 1e15)){
+        return 0;
+    }
+    /* Decimal exponent from the binary one, log10(2) ~ 78913 / 2^18 */
+    int e2;
+    frexp( a, &e2 );
+    int s = 14 - ((e2 * 78913) >> 18);
+    s = s < 0 ? 0 : s > 22 ? 22 : s;
+    long long m = (long long)(a * pow10_exact[s] + 0.5);
+    if (m >= 1000000000000000LL && s > 0){
+        s--;
+        m = (long long)(a * pow10_exact[s] + 0.5);
+    }
+    /* The product is rounded, so the neighbours are also tried */
+    static const int delta[] = { 0, -1, 1 };
+    long long found = -1;
+    for (int k = 0; k < 3 && found < 0; k++){
+        const long long c = m + delta[k];
+        if (c > 0 && double( c ) / pow10_exact[s] == a){
+            found = c;
+        }
+    }
+    if (found < 0){
+        return 0;
+    }
+    m = found;
+    while (s > 0 && m % 10 == 0){
+        m /= 10;
+        s--;
+    }
+
+    char digits[24];
+    const int n = format_integer( digits, m );
+    int k = 0;
+    if (v < 0){
+        out[k++] = '-';
+    }
+    if (n > s){
+        memcpy( out + k, digits, n - s );
+        k += n - s;
+        if (s > 0){
+            out[k++] = '.';
+            memcpy( out + k, digits + n - s, s );
+            k += s;
+        }
+    }
+    else{
+        out[k++] = '0';
+        out[k++] = '.';
+        for (int z = n; z < s; z++){
+            out[k++] = '0';
+        }
+        memcpy( out + k, digits, n );
+        k += n;
+    }
+    out[k] = '\0';
+    return k;
+}
+
+/* Doubles are written with the digits needed to read them back exactly */
+static int format_double( char* out, const double v )
+{
+    if (v == floor( v ) && v > -9007199254740992.0 && v < 9007199254740992.0){
+        return format_integer( out, (long long)v );
+    }
+    const int n = format_short( out, v );
+    return n > 0 ? n : sprintf( out, "%.17g", v );
+}
+
+static void writer_value( Writer* w, const int type, const void* values, const size_t i )
+{
+    writer_reserve( w, 32 );
+    char* out = w->buffer + w->used;
+    int n;
+    switch (type){
+    case t_bool: n = format_integer( out, ((const unsigned char*)values)[i] != 0 ); break;
+    case t_byte: n = format_integer( out, ((const _byte_*)values)[i] ); break;
+    case t_int: n = format_integer( out, ((const _int_*)values)[i] ); break;
+    case t_l64: n = format_integer( out, ((const _l64_*)values)[i] ); break;
+    case t_float: n = sprintf( out, "%.9g", (double)((const _float_*)values)[i] ); break;
+    default: n = format_double( out, ((const double*)values)[i] ); break;
+    }
+    w->used += n > 0 ? (size_t)n : 0;
+}
+
+/*********/
+/* Check */
+/*********/
+
+static inline uint64_t check_random( uint64_t* state )
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* Writes and reads back random values, which must be the same doubles, and
+ * reads random decimals, which must be the same as for strtod. Returns the
+ * number of values that fail. */
+static size_t check_roundtrip( const size_t count )
+{
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    size_t failed = 0;
+    char text[64];
+
+    for (size_t i = 0; i < count; i++){
+        double v;
+        const uint64_t bits = check_random( &state );
+        switch (i % 3){
+        case 0:
+            /* Any finite double */
+            memcpy( &v, &bits, sizeof( double ) );
+            if (v != v || v - v != 0){
+                v = 0;
+            }
+            break;
+        case 1:
+            /* Prices and quantities, with a few decimals */
+            v = double( bits % 100000000 ) / pow10_exact[(bits >> 60) & 7];
+            break;
+        default:
+            v = double( int64_t( bits ) >> 11 );
+            break;
+        }
+        if (bits >> 63){
+            v = -v;
+        }
+        const int n = format_double( text, v );
+        double back;
+        if (n <= 0 || parse_number( text, text + n, &back ) == 0
+            || (memcmp( &back, &v, sizeof( double ) ) != 0 && !(v == 0 && back == 0))){
+            failed++;
+        }
+
+        /* Decimals of up to 17 digits */
+        const int len = sprintf( text, "%llu.%llue%d"
+            , (unsigned long long)(bits % 1000000000ULL)
+            , (unsigned long long)((bits >> 30) % 100000000ULL), int( bits >> 58 ) - 32 );
+        if (parse_number( text, text + len, &back ) == 0 || back != strtod( text, nullptr )){
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/********/
+/* Main */
+/********/
+
+/* Adapts the name of a column, without its quotes, to a variable name */
+static void column_name( char* name, const size_t size, const char* p, const char* end )
+{
+    while (p < end && *p == ' '){
+        p++;
+    }
+    while (end > p && (end[-1] == ' ' || end[-1] == '\r')){
+        end--;
+    }
+    size_t k = 0;
+    if (p < end && *p >= '0' && *p <= '9'){
+        name[k++] = '_';
+    }
+    for (; p < end && k + 1 < size; p++){
+        const char c = *p;
+        const int ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || (c >= '0' && c <= '9') || c == '_';
+        name[k++] = ok ? c : '_';
+    }
+    if (k == 0){
+        name[k++] = '_';
+    }
+    name[k] = '\0';
+}
+
+static void usage()
+{
+    fprintf( stderr, "usage: csveval [-d delimiter] [-o output.csv] input.csv expression...\n" );
+    fprintf( stderr, "       csveval -t\n" );
+}
+
+int main( int argc, char* argv[] )
+{
+    if (argc == 2 && strcmp( argv[1], "-t" ) == 0){
+        const size_t failed = check_roundtrip( 300000 );
+        fprintf( stderr, "round trip of 300000 values: %llu failed\n"
+            , (unsigned long long)failed );
+        return failed == 0 ? 0 : 1;
+    }
+
+    char delimiter = ',';
+    const char* output = nullptr;
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg += 2){
+        if (strcmp( argv[arg], "-d" ) == 0){
+            delimiter = strcmp( argv[arg + 1], "\\t" ) == 0 ? '\t' : argv[arg + 1][0];
+        }
+        else if (strcmp( argv[arg], "-o" ) == 0){
+            output = argv[arg + 1];
+        }
+        else{
+            usage();
+            return 1;
+        }
+    }
+    if (argc - arg < 2){
+        usage();
+        return 1;
+    }
+    const char* input = argv[arg];
+    const char* const* formulas = (const char* const*)argv + arg + 1;
+    const int nformulas = argc - arg - 1;
+
+    static CsvReader reader;
+    CsvReader* r = &reader;
+    r->delimiter = delimiter;
+    if (mapped_open( &r->file, input ) != GPARSE_OK){
+        fprintf( stderr, "Cannot open %s\n", input );
+        return 1;
+    }
+
+    /* Columns from the header */
+    gParser* parser = gParser_create();
+    const char* line_end;
+    const char* line = reader_line( r, &line_end );
+    if (line == nullptr){
+        fprintf( stderr, "%s has no header\n", input );
+        return 1;
+    }
+    char** names = nullptr;
+    double* scalars;
+    for (const char* p = line; p <= line_end; r->ncolumns++){
+        const char* name = p;
+        const char* name_end;
+        const char* q;
+        if (p < line_end && *p == '"'){
+            /* Quoted name, which can have delimiters */
+            name = p + 1;
+            name_end = name;
+            while (name_end < line_end
+                && (*name_end != '"' || (name_end + 1 < line_end && name_end[1] == '"'))){
+                name_end += *name_end == '"' ? 2 : 1;
+            }
+            q = field_end( name_end, line_end, delimiter );
+        }
+        else{
+            q = field_end( p, line_end, delimiter );
+            name_end = q;
+        }
+        names = (char**)realloc( names, sizeof( char* )*(r->ncolumns + 1) );
+        names[r->ncolumns] = (char*)malloc( size_t( q - p ) + 2 );
+        column_name( names[r->ncolumns], size_t( q - p ) + 2, name, name_end );
+        p = q + 1;
+    }
+    scalars = (double*)calloc( r->ncolumns, sizeof( double ) );
+    int* bound = (int*)calloc( r->ncolumns, sizeof( int ) );
+    for (int c = 0; c < r->ncolumns; c++){
+        bound[c] = gParser_addVariable( parser, names[c], t_double, scalars + c ) != nullptr;
+        if (bound[c] == 0){
+            fprintf( stderr, "Column %s is ignored\n", names[c] );
+        }
+    }
+
+    gProgram* program = gParser_compileSet( parser, formulas, nformulas );
+    if (program == nullptr){
+        fprintf( stderr, "%s\n%*s^\n%s\n", formulas[parser->err_line]
+            , parser->err_column, "", parser->err_msg );
+        return 1;
+    }
+
+    for (int k = 0; k < CSV_SLOTS; k++){
+        Slot* s = r->slots + k;
+        s->columns = (double*)malloc( sizeof( double )*CSV_BATCH*(r->ncolumns + 1) );
+        s->validity = (uint64_t*)calloc( (size_t)CSV_WORDS*(r->ncolumns + 1), sizeof( uint64_t ) );
+        s->nulls = (int*)calloc( r->ncolumns + 1, sizeof( int ) );
+        s->state = slot_free;
+        if (s->columns == nullptr || s->validity == nullptr || s->nulls == nullptr){
+            fprintf( stderr, "Out of memory\n" );
+            return 1;
+        }
+    }
+    void** outs = (void**)malloc( sizeof( void* )*nformulas );
+    uint64_t** validity = (uint64_t**)malloc( sizeof( uint64_t* )*nformulas );
+    int* types = (int*)malloc( sizeof( int )*nformulas );
+    for (int k = 0; k < nformulas; k++){
+        types[k] = gProgram_outputType( program, k );
+        outs[k] = malloc( sizeof( double )*CSV_BATCH );
+        validity[k] = (uint64_t*)malloc( sizeof( uint64_t )*CSV_WORDS );
+    }
+
+    Writer w;
+    w.file = output != nullptr ? fopen( output, "wb" ) : stdout;
+    w.buffer = (char*)malloc( CSV_OUTPUT_BUFFER );
+    w.used = 0;
+    if (w.file == nullptr){
+        fprintf( stderr, "Cannot create %s\n", output );
+        return 1;
+    }
+    for (int k = 0; k < nformulas; k++){
+        if (k > 0){
+            writer_char( &w, delimiter );
+        }
+        writer_text( &w, formulas[k], delimiter );
+    }
+    writer_char( &w, '\n' );
+
+    /* Parse and evaluate in parallel */
+    Thread thread;
+    int status = reader_start( &thread, r );
+    size_t nrows = 0;
+    for (int k = 0; status == GPARSE_OK; k = (k + 1) % CSV_SLOTS){
+        Slot* s = r->slots + k;
+        int state;
+        while ((state = atomic_load( &s->state )) == slot_free){
+            thread_yield();
+        }
+        if (atomic_load( &r->failed )){
+            status = GPARSE_ERROR;
+            break;
+        }
+
+        for (int c = 0; c < r->ncolumns; c++){
+            if (bound[c] == 0){
+                continue;
+            }
+            gProgram_bindColumn( program, names[c], s->columns + (size_t)c*CSV_BATCH, 0 );
+            if (s->nulls[c]){
+                gProgram_bindValidity( program, names[c], s->validity + (size_t)c*CSV_WORDS );
+            }
+        }
+        if (s->nrows > 0 && gProgram_evalSet( program, s->nrows, outs, validity ) != GPARSE_OK){
+            strcpy( r->error, "Evaluation error" );
+            atomic_store( &r->failed, 1 );
+            status = GPARSE_ERROR;
+            break;
+        }
+        for (size_t i = 0; i < s->nrows; i++){
+            for (int f = 0; f < nformulas; f++){
+                if (f > 0){
+                    writer_char( &w, delimiter );
+                }
+                if ((validity[f][i >> 6] >> (i & 63)) & 1){
+                    writer_value( &w, types[f], outs[f], i );
+                }
+            }
+            writer_char( &w, '\n' );
+        }
+        nrows += s->nrows;
+
+        atomic_store( &s->state, slot_free );
+        if (state == slot_last){
+            break;
+        }
+    }
+    if (status == GPARSE_OK || atomic_load( &r->failed )){
+        reader_join( thread );
+    }
+    fwrite( w.buffer, 1, w.used, w.file );
+    if (output != nullptr){
+        fclose( w.file );
+    }
+
+    if (r->error[0] != '\0'){
+        fprintf( stderr, "%s\n", r->error );
+        status = GPARSE_ERROR;
+    }
+    fprintf( stderr, "%llu rows\n", (unsigned long long)nrows );
+
+    for (int k = 0; k < CSV_SLOTS; k++){
+        free( r->slots[k].columns );
+        free( r->slots[k].validity );
+        free( r->slots[k].nulls );
+    }
+    for (int k = 0; k < nformulas; k++){
+        free( outs[k] );
+        free( validity[k] );
+    }
+    for (int c = 0; c < r->ncolumns; c++){
+        free( names[c] );
+    }
+    free( names );
+    free( scalars );
+    free( bound );
+    free( outs );
+    free( validity );
+    free( types );
+    free( w.buffer );
+    gProgram_dispose( program );
+    gParser_dispose( parser );
+    mapped_close( &r->file );
+    return status == GPARSE_OK ? 0 : 1;
+}
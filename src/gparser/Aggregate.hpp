@@ -0,0 +1,377 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Aggregates of the results of a program.
+
+The program is evaluated block by block, and each block is reduced while
+its results are still in the cache, so the results are never written to
+memory. A block is reduced to a partial aggregate with the count, sum,
+minimum, maximum and the sum of squared deviations from its mean, which is
+computed in a second pass over the block. Partials are merged with the
+formulas of Chan et al., so the variance does not lose precision when the
+mean is large.
+
+The values of a block are accumulated in AGGREGATE_LANES independent lanes,
+which the compiler maps to vector registers. The blocks are taken in
+groups by a pool of threads, each one with its own workspace, and each
+thread merges its partials, which are merged at the end.
+
+Pairwise summation adds the values of a block and the partials of a group
+as a balanced tree, and the groups too. The order of the operations does
+not depend on the threads, so the results are always the same, and the
+rounding error grows with log(n) instead of n.
+*******************************************************************************/
+
+#ifndef H_GAGGREGATE_H
+#define H_GAGGREGATE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Program.hpp"
+#include "Thread.hpp"
+
+/* Independent accumulators of a block */
+#define AGGREGATE_LANES 8
+
+/* Blocks of each group taken by a thread */
+#define AGGREGATE_GROUP 16
+
+/* Values of a block summed without splitting it in pairwise summation */
+#define PAIRWISE_BASE 64
+
+/* Aggregate of some rows */
+struct Partial
+{
+    double count;
+    double sum;
+    double m2;      /* Sum of the squared deviations from the mean */
+    double min;
+    double max;
+};
+
+static inline void partial_init( Partial* p )
+{
+    p->count = 0;
+    p->sum = 0;
+    p->m2 = 0;
+    p->min = HUGE_VAL;
+    p->max = -HUGE_VAL;
+}
+
+/* a = a + b */
+static inline void partial_merge( Partial* a, const Partial* b )
+{
+    if (b->count == 0){
+        return;
+    }
+    if (a->count == 0){
+        *a = *b;
+        return;
+    }
+    const double n = a->count + b->count;
+    const double delta = b->sum / b->count - a->sum / a->count;
+    a->m2 += b->m2 + delta*delta*a->count*b->count / n;
+    a->count = n;
+    a->sum += b->sum;
+    a->min = b->min < a->min ? b->min : a->min;
+    a->max = b->max > a->max ? b->max : a->max;
+}
+
+/* Copies the results of a block as doubles, skipping the null ones.
+ * Returns the number of values. */
+template< typename T >
+static int block_values( double* _restrict_ out, const void* reg
+    , const uint64_t* valid, const int n )
+{
+    const T* v = (const T*)reg;
+    if (valid == nullptr){
+        for (int i = 0; i < n; i++){
+            out[i] = double( v[i] );
+        }
+        return n;
+    }
+    int k = 0;
+    for (int i = 0; i < n; i++){
+        out[k] = double( v[i] );
+        k += int( (valid[i >> 6] >> (i & 63)) & 1 );
+    }
+    return k;
+}
+
+/* Booleans are read as bytes, as any value other than 0 is true */
+template<>
+int block_values< _bool_ >( double* _restrict_ out, const void* reg
+    , const uint64_t* valid, const int n )
+{
+    const unsigned char* v = (const unsigned char*)reg;
+    int k = 0;
+    for (int i = 0; i < n; i++){
+        out[k] = v[i] != 0 ? 1.0 : 0.0;
+        k += valid == nullptr ? 1 : int( (valid[i >> 6] >> (i & 63)) & 1 );
+    }
+    return k;
+}
+
+/* Sum of the values, with AGGREGATE_LANES accumulators */
+static double lanes_sum( const double* _restrict_ x, const int n )
+{
+    double s[AGGREGATE_LANES] = { 0 };
+    int i = 0;
+    for (; i + AGGREGATE_LANES <= n; i += AGGREGATE_LANES){
+        for (int j = 0; j < AGGREGATE_LANES; j++){
+            s[j] += x[i + j];
+        }
+    }
+    for (; i < n; i++){
+        s[i % AGGREGATE_LANES] += x[i];
+    }
+    for (int w = AGGREGATE_LANES / 2; w > 0; w /= 2){
+        for (int j = 0; j < w; j++){
+            s[j] += s[j + w];
+        }
+    }
+    return s[0];
+}
+
+/* Sum of the squared deviations from the mean */
+static double lanes_m2( const double* _restrict_ x, const int n, const double mean )
+{
+    double s[AGGREGATE_LANES] = { 0 };
+    int i = 0;
+    for (; i + AGGREGATE_LANES <= n; i += AGGREGATE_LANES){
+        for (int j = 0; j < AGGREGATE_LANES; j++){
+            const double d = x[i + j] - mean;
+            s[j] += d*d;
+        }
+    }
+    for (; i < n; i++){
+        const double d = x[i] - mean;
+        s[i % AGGREGATE_LANES] += d*d;
+    }
+    for (int w = AGGREGATE_LANES / 2; w > 0; w /= 2){
+        for (int j = 0; j < w; j++){
+            s[j] += s[j + w];
+        }
+    }
+    return s[0];
+}
+
+static double pairwise_sum( const double* x, const int n )
+{
+    if (n <= PAIRWISE_BASE){
+        return lanes_sum( x, n );
+    }
+    const int half = n / 2;
+    return pairwise_sum( x, half ) + pairwise_sum( x + half, n - half );
+}
+
+static double pairwise_m2( const double* x, const int n, const double mean )
+{
+    if (n <= PAIRWISE_BASE){
+        return lanes_m2( x, n, mean );
+    }
+    const int half = n / 2;
+    return pairwise_m2( x, half, mean ) + pairwise_m2( x + half, n - half, mean );
+}
+
+/* Reduces the values of a block */
+static void block_partial( Partial* p, const double* _restrict_ x, const int n
+    , const int pairwise )
+{
+    partial_init( p );
+    if (n == 0){
+        return;
+    }
+
+    double lo[AGGREGATE_LANES];
+    double hi[AGGREGATE_LANES];
+    for (int j = 0; j < AGGREGATE_LANES; j++){
+        lo[j] = HUGE_VAL;
+        hi[j] = -HUGE_VAL;
+    }
+    int i = 0;
+    for (; i + AGGREGATE_LANES <= n; i += AGGREGATE_LANES){
+        for (int j = 0; j < AGGREGATE_LANES; j++){
+            lo[j] = x[i + j] < lo[j] ? x[i + j] : lo[j];
+            hi[j] = x[i + j] > hi[j] ? x[i + j] : hi[j];
+        }
+    }
+    for (; i < n; i++){
+        lo[0] = x[i] < lo[0] ? x[i] : lo[0];
+        hi[0] = x[i] > hi[0] ? x[i] : hi[0];
+    }
+    for (int j = 0; j < AGGREGATE_LANES; j++){
+        p->min = lo[j] < p->min ? lo[j] : p->min;
+        p->max = hi[j] > p->max ? hi[j] : p->max;
+    }
+
+    p->count = n;
+    p->sum = pairwise ? pairwise_sum( x, n ) : lanes_sum( x, n );
+    const double mean = p->sum / n;
+    p->m2 = pairwise ? pairwise_m2( x, n, mean ) : lanes_m2( x, n, mean );
+}
+
+/* Merges the partials as a balanced tree, so the result does not depend on
+ * how they are grouped */
+static void pairwise_merge( Partial* out, const Partial* parts, const int n )
+{
+    if (n <= 1){
+        if (n == 1){
+            *out = parts[0];
+        }
+        else{
+            partial_init( out );
+        }
+        return;
+    }
+    const int half = n / 2;
+    Partial right;
+    pairwise_merge( out, parts, half );
+    pairwise_merge( &right, parts + half, n - half );
+    partial_merge( out, &right );
+}
+
+struct Aggregation
+{
+    const Program* prog;
+    size_t nrows;
+    int pairwise;
+    volatile int next;      /* Next group to take */
+    int ngroups;
+    Partial* groups;        /* Partial of each group, for pairwise summation */
+    Partial* threads;       /* Partial of each thread */
+    volatile int failed;
+};
+
+struct AggregationWorker
+{
+    Aggregation* agg;
+    int index;
+};
+
+static void aggregation_worker( void* arg )
+{
+    const AggregationWorker* worker = (const AggregationWorker*)arg;
+    Aggregation* agg = worker->agg;
+    const Program* prog = agg->prog;
+    Partial* total = agg->threads + worker->index;
+    partial_init( total );
+
+    Workspace ws;
+    double* values = (double*)malloc( sizeof( double )*GPARSE_BATCH );
+    if (values == nullptr || workspace_prepare( &ws, prog, GPARSE_BATCH ) != GPARSE_OK){
+        atomic_store( &agg->failed, 1 );
+        free( values );
+        return;
+    }
+
+    const size_t group_rows = (size_t)AGGREGATE_GROUP * GPARSE_BATCH;
+    int g;
+    while ((g = atomic_add( &agg->next, 1 ) - 1) < agg->ngroups
+        && atomic_load( &agg->failed ) == 0){
+        Partial parts[AGGREGATE_GROUP];
+        int nparts = 0;
+        const size_t end = (g + 1)*group_rows < agg->nrows ? (g + 1)*group_rows : agg->nrows;
+        for (size_t row0 = g*group_rows; row0 < end; row0 += GPARSE_BATCH){
+            const int n = int( end - row0 < GPARSE_BATCH ? end - row0 : GPARSE_BATCH );
+            if (program_run( prog, &ws, row0, n, 1 ) != GPARSE_OK){
+                atomic_store( &agg->failed, 1 );
+                break;
+            }
+            const char* reg = ws.reg( prog->result );
+            const uint64_t* valid = prog->nulls ? ws.valid_reg( prog->result ) : nullptr;
+            int k;
+            switch (prog->type){
+            case t_bool: k = block_values< _bool_ >( values, reg, valid, n ); break;
+            case t_byte: k = block_values< _byte_ >( values, reg, valid, n ); break;
+            case t_int: k = block_values< _int_ >( values, reg, valid, n ); break;
+            case t_l64: k = block_values< _l64_ >( values, reg, valid, n ); break;
+            case t_float: k = block_values< _float_ >( values, reg, valid, n ); break;
+            default: k = block_values< _double_ >( values, reg, valid, n ); break;
+            }
+            block_partial( parts + nparts, values, k, agg->pairwise );
+            nparts++;
+        }
+
+        if (agg->pairwise){
+            pairwise_merge( agg->groups + g, parts, nparts );
+        }
+        else{
+            for (int i = 0; i < nparts; i++){
+                partial_merge( total, parts + i );
+            }
+        }
+    }
+    free( values );
+}
+
+/* Evaluates the program for the rows and aggregates the results. The
+ * program runs in 'nthreads' threads, including the calling one. */
+static int program_aggregate( const Program* prog, const size_t nrows
+    , Partial* result, const int pairwise, int nthreads )
+{
+    const size_t group_rows = (size_t)AGGREGATE_GROUP * GPARSE_BATCH;
+    Aggregation agg;
+    memset( &agg, 0, sizeof( Aggregation ) );
+    agg.prog = prog;
+    agg.nrows = nrows;
+    agg.pairwise = pairwise;
+    agg.ngroups = int( (nrows + group_rows - 1) / group_rows );
+
+    nthreads = nthreads < agg.ngroups ? nthreads : agg.ngroups;
+    nthreads = nthreads > 1 ? nthreads : 1;
+
+    agg.threads = (Partial*)malloc( sizeof( Partial )*nthreads );
+    agg.groups = pairwise ? (Partial*)malloc( sizeof( Partial )*(agg.ngroups + 1) ) : nullptr;
+    AggregationWorker* workers = (AggregationWorker*)malloc
+        ( sizeof( AggregationWorker )*nthreads );
+    Thread* threads = (Thread*)malloc( sizeof( Thread )*nthreads );
+    int status = GPARSE_ERROR;
+    if (agg.threads != nullptr && workers != nullptr && threads != nullptr
+        && (pairwise == 0 || agg.groups != nullptr)){
+        for (int w = 0; w < nthreads; w++){
+            workers[w].agg = &agg;
+            workers[w].index = w;
+            partial_init( agg.threads + w );
+        }
+        int nstarted;
+        for (nstarted = 1; nstarted < nthreads; nstarted++){
+            if (thread_start( threads + nstarted, aggregation_worker, workers + nstarted )){
+                break;
+            }
+        }
+        /* If some thread cannot start, the others take its groups */
+        aggregation_worker( workers );
+        for (int w = 1; w < nstarted; w++){
+            thread_join( threads[w] );
+        }
+
+        if (agg.failed == 0){
+            if (pairwise){
+                pairwise_merge( result, agg.groups, agg.ngroups );
+            }
+            else{
+                partial_init( result );
+                for (int w = 0; w < nthreads; w++){
+                    partial_merge( result, agg.threads + w );
+                }
+            }
+            status = GPARSE_OK;
+        }
+    }
+
+    free( agg.threads );
+    free( agg.groups );
+    free( workers );
+    free( threads );
+    return status;
+}
+
+#endif /* H_GAGGREGATE_H */
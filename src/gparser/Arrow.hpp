@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Apache Arrow C Data Interface.
+
+Columns of primitive Arrow arrays are bound to the variables of a program
+without copies: the executor reads the data buffer with the stride of the
+type, and the booleans directly from the bitmap. The supported formats are
+
+    b   bool        (bit-packed)
+    C   byte        (uint8)
+    i   int         (int32)
+    l   int64
+    f   float
+    g   double
+
+Imported arrays are immutable, so programs cannot assign them. The validity
+bitmaps are bound with the columns, and nulls propagate through the program
+as described in Program.hpp.
+
+Results are exported as an Arrow array that owns the buffer where the
+program wrote them, released by the consumer with the release callback.
+*******************************************************************************/
+
+#ifndef H_GARROW_H
+#define H_GARROW_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+
+/* Type of the variables for the Arrow format, or t_undefined */
+static int arrow_type( const char* format )
+{
+    if (format == nullptr || format[0] == '\0' || format[1] != '\0'){
+        return t_undefined;
+    }
+    switch (format[0]){
+    case 'b': return t_bool;
+    case 'C': return t_byte;
+    case 'i': return t_int;
+    case 'l': return t_l64;
+    case 'f': return t_float;
+    case 'g': return t_double;
+    default: return t_undefined;
+    }
+}
+
+/* Arrow format of a basic type, or nullptr */
+static const char* arrow_format( const int type )
+{
+    switch (type){
+    case t_bool: return "b";
+    case t_byte: return "C";
+    case t_int: return "i";
+    case t_l64: return "l";
+    case t_float: return "f";
+    case t_double: return "g";
+    default: return nullptr;
+    }
+}
+
+/* Returns 1 if the program assigns the symbol */
+static int program_writes( const Program* prog, const int isym )
+{
+    for (int pc = 0; pc < prog->ncode; pc++){
+        if (prog->code[pc].op == op_store && prog->code[pc].b == isym){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Binds the symbol to a primitive Arrow array. 'offset' is added to the
+ * offset of the array, for the children of a struct array. */
+static int arrow_bind_symbol( Program* prog, const int isym
+    , const ArrowSchema* schema, const ArrowArray* array, const int64_t offset )
+{
+    Symbol* sym = prog->symbols + isym;
+    const int type = arrow_type( schema->format );
+
+    if (type == t_undefined || type != sym->var->type || array->n_buffers != 2
+        || array->buffers == nullptr || array->buffers[1] == nullptr
+        || array->dictionary != nullptr || program_writes( prog, isym )){
+        return GPARSE_ERROR;
+    }
+
+    const size_t first = size_t( array->offset + offset );
+    if (type == t_bool){
+        sym->column = (char*)array->buffers[1];
+        sym->stride = 0;
+        sym->packed = 1;
+        sym->offset = first;
+    }
+    else{
+        const size_t size = numeric_type_size( type );
+        sym->column = (char*)array->buffers[1] + first*size;
+        sym->stride = size;
+        sym->packed = 0;
+        sym->offset = 0;
+    }
+
+    if (array->null_count != 0 && array->buffers[0] != nullptr){
+        /* Never written, as the program does not assign the symbol */
+        sym->validity = (unsigned char*)array->buffers[0];
+        sym->validity_offset = first;
+    }
+    else{
+        sym->validity = nullptr;
+        sym->validity_offset = 0;
+    }
+    return GPARSE_OK;
+}
+
+/* Index of the symbol of the variable, or -1 */
+static int program_find_symbol( const Program* prog, const char* name )
+{
+    for (int i = 0; i < prog->nsymbols; i++){
+        if (strcmp( prog->symbols[i].var->name, name ) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Binds a variable to a primitive array, or each variable to the child of a
+ * struct array (a record batch) with the same name. */
+static int arrow_bind( Program* prog, const char* varname
+    , const ArrowSchema* schema, const ArrowArray* array )
+{
+    if (schema == nullptr || array == nullptr || schema->format == nullptr
+        || array->release == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    if (strcmp( schema->format, "+s" ) != 0){
+        const int isym = varname != nullptr ? program_find_symbol( prog, varname ) : -1;
+        if (isym < 0){
+            return GPARSE_ERROR;
+        }
+        const int status = arrow_bind_symbol( prog, isym, schema, array, 0 );
+        program_update_nulls( prog );
+        return status;
+    }
+
+    /* Record batch */
+    if (varname != nullptr || schema->n_children != array->n_children){
+        return GPARSE_ERROR;
+    }
+    int status = GPARSE_ERROR;
+    for (int64_t k = 0; k < schema->n_children; k++){
+        const ArrowSchema* child_schema = schema->children[k];
+        const int isym = child_schema->name != nullptr
+            ? program_find_symbol( prog, child_schema->name ) : -1;
+        if (isym >= 0){
+            if (arrow_bind_symbol( prog, isym, child_schema, array->children[k]
+                , array->offset ) != GPARSE_OK){
+                status = GPARSE_ERROR;
+                break;
+            }
+            status = GPARSE_OK;
+        }
+    }
+    program_update_nulls( prog );
+    return status;
+}
+
+/* Buffers of an exported array */
+struct ArrowExport
+{
+    const void* buffers[2];
+};
+
+static void arrow_release_array( ArrowArray* array )
+{
+    ArrowExport* data = (ArrowExport*)array->private_data;
+    if (data != nullptr){
+        free( (void*)data->buffers[0] );
+        free( (void*)data->buffers[1] );
+        free( data );
+    }
+    array->release = nullptr;
+}
+
+static void arrow_release_schema( ArrowSchema* schema )
+{
+    schema->release = nullptr;
+}
+
+/* Fills the schema and the array with the buffers, which are owned by the
+ * array from now on */
+static int arrow_export( ArrowArray* array, ArrowSchema* schema, const int type
+    , const size_t nrows, void* data, uint64_t* validity, const int64_t null_count )
+{
+    ArrowExport* exported = (ArrowExport*)malloc( sizeof( ArrowExport ) );
+    if (exported == nullptr){
+        return GPARSE_ERROR;
+    }
+    exported->buffers[0] = validity;
+    exported->buffers[1] = data;
+
+    memset( schema, 0, sizeof( ArrowSchema ) );
+    schema->format = arrow_format( type );
+    schema->name = "";
+    schema->flags = validity != nullptr ? ARROW_FLAG_NULLABLE : 0;
+    schema->release = arrow_release_schema;
+
+    memset( array, 0, sizeof( ArrowArray ) );
+    array->length = int64_t( nrows );
+    array->null_count = null_count;
+    array->n_buffers = 2;
+    array->buffers = exported->buffers;
+    array->release = arrow_release_array;
+    array->private_data = exported;
+    return GPARSE_OK;
+}
+
+#endif /* H_GARROW_H */
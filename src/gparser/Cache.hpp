@@ -0,0 +1,947 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Cache of compiled programs in a file.
+
+Compiling many expressions at startup costs more than loading them, so the
+programs are written to a file, and the next runs map it and take the
+programs instead of compiling them again. The file has a header and an
+entry for each program:
+
+    CacheHeader         magic, version, number of entries
+    CacheEntry          hash, fingerprint, counts of each section
+    CacheConstant[]     value, type and register of each constant
+    CacheInstruction[]  instructions, with the functions as indices
+    CacheSymbol[]       name and type of each variable
+    int32_t[]           registers of the arguments of the calls
+    CacheTerm[]         terms of the filters
+    CacheFunction[]     name and signature of each function
+    char[]              source, then the names, padded to 8 bytes
+
+The values are in the byte order of the machine that wrote them. An entry
+is found by the hash of its source, and the source is compared as well.
+It is used only if the fingerprint of the functions of the parser is the
+same that when it was compiled: the built-in functions, and the name and
+signature of the functions added to the parser, with the code of the
+functions declared by scripts, which may be inlined in the programs. The
+functions implemented in C are matched by name and signature only. The
+variables are found by name in the parser, and must have the same type.
+The members of structures are found again, so their offsets follow the
+current layout. An entry that does not match is compiled, and replaces
+the old one when the cache is saved.
+
+Programs with window functions are not cached, as each call keeps its
+state, nor formula sets, whose results are variables of the program. The
+programs taken from the cache are independent of it, and the cache is
+used by a single thread, as the parser.
+*******************************************************************************/
+
+#ifndef H_GCACHE_H
+#define H_GCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+#include "Function.hpp"
+#include "Structure.hpp"
+#include "Layer.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC "GLNTPRG"
+#define CACHE_VERSION 1
+
+/* Limit of the counts of an entry, which keeps the sizes in 32 bits */
+#define CACHE_MAX_COUNT (1 << 20)
+
+/* Distinct functions called by a cached program */
+#define CACHE_MAX_FUNCTIONS 64
+
+/* Kind of compilation */
+#define CACHE_EXPRESSION 0
+#define CACHE_FILTER 1
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nentries;
+    uint64_t reserved[2];
+};
+
+struct CacheEntry
+{
+    uint64_t hash;          /* Hash of the kind and the source */
+    uint64_t fingerprint;   /* Functions of the parser when compiled */
+    uint32_t size;          /* Bytes of the entry, a multiple of 8 */
+    int32_t kind;
+    int32_t type;
+    int32_t result;
+    int32_t nregisters;
+    int32_t max_depth;
+    int32_t reorder;
+    int32_t ncode;
+    int32_t nsymbols;
+    int32_t nconstants;
+    int32_t nargs;
+    int32_t nterms;
+    int32_t nfunctions;
+    uint32_t source_len;
+    uint32_t nstrings;      /* Bytes of the strings */
+    int32_t reserved;
+};
+
+struct CacheConstant
+{
+    uint64_t value;
+    int32_t type;
+    int32_t reg;
+};
+
+struct CacheInstruction
+{
+    int32_t op;
+    int32_t type;
+    int32_t type_a;
+    int32_t dst;
+    int32_t a;
+    int32_t b;
+    int32_t func;   /* Index of the function, or -1 */
+};
+
+/* Names are offsets in the strings */
+struct CacheSymbol
+{
+    int32_t name;
+    int32_t type;
+};
+
+struct CacheTerm
+{
+    int32_t pc0;
+    int32_t pc1;
+    int32_t result;
+};
+
+struct CacheFunction
+{
+    int32_t name;
+    int32_t type;
+    int32_t nargs;
+    int32_t args_type[GPARSE_MAX_ARGS];
+};
+
+struct ProgramCache : gCache
+{
+    Parser* parser;
+    char* path;
+    void* map;              /* File mapped when the cache was opened */
+    size_t map_size;
+    const CacheEntry** entries; /* In the map, or allocated if new */
+    int entries_capacity;
+    int* table;             /* Index of the entries + 1 by hash, or 0 */
+    int table_mask;
+    int dirty;              /* Some entry is not in the file */
+    uint64_t fingerprint;
+    int fingerprint_functions;  /* Functions of the parser when computed */
+};
+
+/* FNV-1a */
+static inline uint64_t cache_hash( uint64_t h, const void* data, const size_t n )
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < n; i++){
+        h = (h ^ p[i])*0x100000001B3ull;
+    }
+    return h;
+}
+
+#define CACHE_HASH_SEED 0xCBF29CE484222325ull
+
+static inline uint64_t cache_hash_int( const uint64_t h, const int32_t v )
+{
+    return cache_hash( h, &v, sizeof( v ) );
+}
+
+static uint64_t cache_hash_function( uint64_t h, const Function* f )
+{
+    h = cache_hash( h, f->name, strlen( f->name ) + 1 );
+    h = cache_hash_int( h, f->type );
+    h = cache_hash_int( h, f->nargs );
+    for (int k = 0; k < f->nargs; k++){
+        h = cache_hash_int( h, f->args_type[k] );
+    }
+    return cache_hash_int( h, f->window != nullptr );
+}
+
+/* Code of a function declared by a script */
+static uint64_t cache_hash_body( uint64_t h, const Program* body )
+{
+    for (int i = 0; i < body->ncode; i++){
+        const Instruction* ins = body->code + i;
+        const int32_t v[6] = { ins->op, ins->type, ins->type_a, ins->dst, ins->a, ins->b };
+        h = cache_hash( h, v, sizeof( v ) );
+        if (ins->func != nullptr){
+            h = cache_hash_function( h, ins->func );
+        }
+    }
+    for (int i = 0; i < body->nconstants; i++){
+        const Constant* c = body->constants + i;
+        uint64_t value = 0;
+        memcpy( &value, &c->value, numeric_type_size( c->type ) );
+        h = cache_hash( h, &value, sizeof( value ) );
+        h = cache_hash_int( h, c->type );
+        h = cache_hash_int( h, c->reg );
+    }
+    for (int i = 0; i < body->nsymbols; i++){
+        const Variable* var = body->symbols[i].var;
+        h = cache_hash( h, var->name, strlen( var->name ) + 1 );
+        h = cache_hash_int( h, var->type );
+    }
+    h = cache_hash( h, body->args, sizeof( int )*body->nargs );
+    h = cache_hash_int( h, body->nregisters );
+    h = cache_hash_int( h, body->max_depth );
+    return cache_hash_int( h, body->result );
+}
+
+/* Fingerprint of the functions of the parser, computed again when some
+ * function is added */
+static uint64_t cache_fingerprint( ProgramCache* cache )
+{
+    const Parser* parser = cache->parser;
+    if (cache->fingerprint_functions == parser->nfunctions){
+        return cache->fingerprint;
+    }
+    uint64_t h = cache_hash_int( CACHE_HASH_SEED, CACHE_VERSION );
+    for (size_t i = 0; i < NUM_BUILTINS; i++){
+        h = cache_hash_function( h, builtin_functions + i );
+    }
+    for (int i = 0; i < parser->nfunctions; i++){
+        const Function* f = parser->functions[i];
+        h = cache_hash_function( h, f );
+        h = cache_hash_int( h, function_is_script( f ) );
+        if (function_is_script( f )){
+            h = cache_hash_body( h, script_body( f ) );
+        }
+    }
+    cache->fingerprint = h;
+    cache->fingerprint_functions = parser->nfunctions;
+    return h;
+}
+
+static inline uint64_t cache_source_hash( const int kind, const char* source, const size_t len )
+{
+    return cache_hash( cache_hash_int( CACHE_HASH_SEED, kind ), source, len );
+}
+
+/* Sections of the entry */
+static inline const CacheConstant* entry_constants( const CacheEntry* e )
+{
+    return (const CacheConstant*)(e + 1);
+}
+
+static inline const CacheInstruction* entry_code( const CacheEntry* e )
+{
+    return (const CacheInstruction*)(entry_constants( e ) + e->nconstants);
+}
+
+static inline const CacheSymbol* entry_symbols( const CacheEntry* e )
+{
+    return (const CacheSymbol*)(entry_code( e ) + e->ncode);
+}
+
+static inline const int32_t* entry_args( const CacheEntry* e )
+{
+    return (const int32_t*)(entry_symbols( e ) + e->nsymbols);
+}
+
+static inline const CacheTerm* entry_terms( const CacheEntry* e )
+{
+    return (const CacheTerm*)(entry_args( e ) + e->nargs);
+}
+
+static inline const CacheFunction* entry_functions( const CacheEntry* e )
+{
+    return (const CacheFunction*)(entry_terms( e ) + e->nterms);
+}
+
+static inline const char* entry_strings( const CacheEntry* e )
+{
+    return (const char*)(entry_functions( e ) + e->nfunctions);
+}
+
+/* Bytes of an entry with the counts, or 0 if they are not valid */
+static uint64_t entry_size( const CacheEntry* e )
+{
+    if (e->ncode < 0 || e->ncode > CACHE_MAX_COUNT || e->nsymbols < 0
+        || e->nsymbols > CACHE_MAX_COUNT || e->nconstants < 0
+        || e->nconstants > CACHE_MAX_COUNT || e->nargs < 0 || e->nargs > CACHE_MAX_COUNT
+        || e->nterms < 0 || e->nterms > CACHE_MAX_COUNT || e->nfunctions < 0
+        || e->nfunctions > CACHE_MAX_COUNT || e->nstrings > CACHE_MAX_COUNT*64u){
+        return 0;
+    }
+    const uint64_t size = sizeof( CacheEntry )
+        + sizeof( CacheConstant )*uint64_t( e->nconstants )
+        + sizeof( CacheInstruction )*uint64_t( e->ncode )
+        + sizeof( CacheSymbol )*uint64_t( e->nsymbols )
+        + sizeof( int32_t )*uint64_t( e->nargs )
+        + sizeof( CacheTerm )*uint64_t( e->nterms )
+        + sizeof( CacheFunction )*uint64_t( e->nfunctions )
+        + e->nstrings;
+    return (size + 7) & ~uint64_t( 7 );
+}
+
+static inline int cache_is_mapped( const ProgramCache* cache, const CacheEntry* e )
+{
+    const char* map = (const char*)cache->map;
+    return map != nullptr && (const char*)e >= map && (const char*)e < map + cache->map_size;
+}
+
+/* Returns the slot of the table for the source */
+static int* cache_slot( ProgramCache* cache, const uint64_t hash, const int kind
+    , const char* source, const size_t len )
+{
+    size_t i = size_t( hash ) & size_t( cache->table_mask );
+    for (;;){
+        int* slot = cache->table + i;
+        if (*slot == 0){
+            return slot;
+        }
+        const CacheEntry* e = cache->entries[*slot - 1];
+        if (e->hash == hash && e->kind == kind && e->source_len == len
+            && memcmp( entry_strings( e ), source, len ) == 0){
+            return slot;
+        }
+        i = (i + 1) & size_t( cache->table_mask );
+    }
+}
+
+/* Doubles the table when it is half full */
+static int cache_grow( ProgramCache* cache )
+{
+    if (cache->nentries < cache->entries_capacity){
+        return GPARSE_OK;
+    }
+    const int capacity = cache->entries_capacity > 0 ? cache->entries_capacity*2 : 256;
+    const CacheEntry** entries = (const CacheEntry**)realloc
+        ( cache->entries, sizeof( CacheEntry* )*capacity );
+    if (entries == nullptr){
+        return GPARSE_ERROR;
+    }
+    cache->entries = entries;
+    int* table = (int*)calloc( size_t( capacity )*2, sizeof( int ) );
+    if (table == nullptr){
+        return GPARSE_ERROR;
+    }
+    free( cache->table );
+    cache->table = table;
+    cache->table_mask = capacity*2 - 1;
+    cache->entries_capacity = capacity;
+    for (int i = 0; i < cache->nentries; i++){
+        const CacheEntry* e = entries[i];
+        *cache_slot( cache, e->hash, e->kind, entry_strings( e ), e->source_len ) = i + 1;
+    }
+    return GPARSE_OK;
+}
+
+/* Adds the entry, or replaces the one with the same source */
+static int cache_insert( ProgramCache* cache, const CacheEntry* e )
+{
+    if (cache_grow( cache ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    int* slot = cache_slot( cache, e->hash, e->kind, entry_strings( e ), e->source_len );
+    if (*slot != 0){
+        const CacheEntry* old = cache->entries[*slot - 1];
+        if (cache_is_mapped( cache, old ) == 0){
+            free( (void*)old );
+        }
+        cache->entries[*slot - 1] = e;
+        return GPARSE_OK;
+    }
+    cache->entries[cache->nentries++] = e;
+    *slot = cache->nentries;
+    return GPARSE_OK;
+}
+
+/* Checks the header and adds the entries of a mapped file */
+static int cache_index( ProgramCache* cache )
+{
+    const char* map = (const char*)cache->map;
+    const CacheHeader* header = (const CacheHeader*)map;
+    if (cache->map_size < sizeof( CacheHeader )
+        || memcmp( header->magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) != 0
+        || header->version != CACHE_VERSION){
+        return GPARSE_ERROR;
+    }
+    size_t offset = sizeof( CacheHeader );
+    for (uint32_t i = 0; i < header->nentries; i++){
+        if (cache->map_size - offset < sizeof( CacheEntry )){
+            return GPARSE_ERROR;
+        }
+        const CacheEntry* e = (const CacheEntry*)(map + offset);
+        const uint64_t size = entry_size( e );
+        if (size == 0 || size != e->size || size > cache->map_size - offset
+            || e->source_len >= e->nstrings || entry_strings( e )[e->source_len] != '\0'
+            || entry_strings( e )[e->nstrings - 1] != '\0'){
+            return GPARSE_ERROR;
+        }
+        if (cache_insert( cache, e ) != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+        offset += size_t( size );
+    }
+    return GPARSE_OK;
+}
+
+/* Maps the file read only, if it exists */
+static void cache_map( ProgramCache* cache )
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA( cache->path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE
+        , nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if (file == INVALID_HANDLE_VALUE){
+        return;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx( file, &size ) && size.QuadPart > 0
+        && uint64_t( size.QuadPart ) <= uint64_t( ~size_t( 0 ) )){
+        mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    }
+    if (mapping != nullptr){
+        cache->map = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        cache->map_size = cache->map != nullptr ? size_t( size.QuadPart ) : 0;
+        CloseHandle( mapping );
+    }
+    CloseHandle( file );
+#else
+    const int fd = open( cache->path, O_RDONLY );
+    if (fd < 0){
+        return;
+    }
+    struct stat st;
+    if (fstat( fd, &st ) == 0 && st.st_size > 0
+        && uint64_t( st.st_size ) <= uint64_t( ~size_t( 0 ) )){
+        void* p = mmap( nullptr, size_t( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+        if (p != MAP_FAILED){
+            cache->map = p;
+            cache->map_size = size_t( st.st_size );
+        }
+    }
+    close( fd );
+#endif
+}
+
+static void cache_unmap( ProgramCache* cache )
+{
+    if (cache->map == nullptr){
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile( cache->map );
+#else
+    munmap( cache->map, cache->map_size );
+#endif
+    cache->map = nullptr;
+    cache->map_size = 0;
+}
+
+static void cache_close( ProgramCache* cache )
+{
+    for (int i = 0; i < cache->nentries; i++){
+        if (cache_is_mapped( cache, cache->entries[i] ) == 0){
+            free( (void*)cache->entries[i] );
+        }
+    }
+    cache_unmap( cache );
+    free( cache->entries );
+    free( cache->table );
+    free( cache->path );
+    free( cache );
+}
+
+/* Opens the cache of the file. A file that does not exist, or that is not
+ * valid, gives an empty cache. */
+static ProgramCache* cache_open( Parser* parser, const char* path )
+{
+    ProgramCache* cache = (ProgramCache*)calloc( 1, sizeof( ProgramCache ) );
+    if (cache == nullptr){
+        return nullptr;
+    }
+    cache->parser = parser;
+    cache->fingerprint_functions = -1;
+    cache->path = (char*)malloc( strlen( path ) + 1 );
+    if (cache->path == nullptr || cache_grow( cache ) != GPARSE_OK){
+        cache_close( cache );
+        return nullptr;
+    }
+    strcpy( cache->path, path );
+
+    cache_map( cache );
+    if (cache->map != nullptr && cache_index( cache ) != GPARSE_OK){
+        /* Entries written by other versions are compiled again */
+        for (int i = 0; i < cache->nentries; i++){
+            if (cache_is_mapped( cache, cache->entries[i] ) == 0){
+                free( (void*)cache->entries[i] );
+            }
+        }
+        cache->nentries = 0;
+        memset( cache->table, 0, sizeof( int )*(cache->table_mask + 1) );
+        cache_unmap( cache );
+    }
+    return cache;
+}
+
+/* Returns the entry of the source, if it was compiled with the same
+ * functions */
+static const CacheEntry* cache_find( ProgramCache* cache, const int kind, const char* source )
+{
+    const size_t len = strlen( source );
+    const uint64_t hash = cache_source_hash( kind, source, len );
+    const int index = *cache_slot( cache, hash, kind, source, len );
+    if (index == 0){
+        return nullptr;
+    }
+    const CacheEntry* e = cache->entries[index - 1];
+    return e->fingerprint == cache_fingerprint( cache ) ? e : nullptr;
+}
+
+/* Function with the same name and signature, as function_find would
+ * resolve it with arguments of these types */
+static const Function* cache_function( const Parser* parser, const CacheEntry* e
+    , const CacheFunction* cf )
+{
+    const char* name = entry_strings( e ) + cf->name;
+    if (cf->nargs < 0 || cf->nargs > GPARSE_MAX_ARGS){
+        return nullptr;
+    }
+    for (int i = 0; i < parser->nfunctions; i++){
+        const Function* f = parser->functions[i];
+        if (f->type == cf->type && f->nargs == cf->nargs && strcmp( f->name, name ) == 0
+            && memcmp( f->args_type, cf->args_type, sizeof( int )*f->nargs ) == 0){
+            return f;
+        }
+    }
+    for (size_t i = 0; i < NUM_BUILTINS; i++){
+        const Function* f = builtin_functions + i;
+        if (f->type == cf->type && f->nargs == cf->nargs && strcmp( f->name, name ) == 0
+            && memcmp( f->args_type, cf->args_type, sizeof( int )*f->nargs ) == 0
+            && f->window == nullptr){
+            return f;
+        }
+    }
+    return nullptr;
+}
+
+/* Variable of the parser with the name, or the member of a structure, as
+ * the compiler binds it */
+static Variable* cache_variable( Parser* parser, const char* name )
+{
+    Variable* var = parser->global.find_variable( name, name + strlen( name ) );
+    if (var == nullptr){
+        var = struct_find_member( parser, &parser->global, name );
+    }
+    return layer_own( &parser->global, var );
+}
+
+/* Checks the instructions, so a damaged entry cannot run out of the
+ * registers, the symbols or the selections */
+static int cache_check_code( const CacheEntry* e, const Program* prog )
+{
+    const int nreg = prog->nregisters;
+    int depth = 0;
+    for (int pc = 0; pc < prog->ncode; pc++){
+        const Instruction* ins = prog->code + pc;
+        if (ins->op < op_load || ins->op > op_call || ins->dst < 0 || ins->dst >= nreg){
+            return GPARSE_ERROR;
+        }
+        switch (ins->op){
+        case op_load:
+            if (ins->a < 0 || ins->a >= prog->nsymbols
+                || prog->symbols[ins->a].var->type != ins->type){
+                return GPARSE_ERROR;
+            }
+            break;
+        case op_store:
+            if (ins->a < 0 || ins->a >= nreg || ins->b < 0 || ins->b >= prog->nsymbols
+                || prog->symbols[ins->b].var->type != ins->type){
+                return GPARSE_ERROR;
+            }
+            break;
+        case op_and:
+        case op_or:
+            if (ins->a < 0 || ins->a >= nreg || ins->b <= pc || ins->b > prog->ncode
+                || ++depth > prog->max_depth){
+                return GPARSE_ERROR;
+            }
+            break;
+        case op_logic_end:
+            if (ins->a < 0 || ins->a >= nreg || --depth < 0){
+                return GPARSE_ERROR;
+            }
+            break;
+        case op_call:
+            if (ins->func == nullptr || ins->a < 0 || ins->b != ins->func->nargs
+                || ins->a + ins->b > prog->nargs){
+                return GPARSE_ERROR;
+            }
+            break;
+        default:
+            if (ins->a < 0 || ins->a >= nreg || ins->b < 0 || ins->b >= nreg){
+                return GPARSE_ERROR;
+            }
+        }
+        if (ins->op != op_call && ins->func != nullptr){
+            return GPARSE_ERROR;
+        }
+    }
+    for (int i = 0; i < prog->nargs; i++){
+        if (prog->args[i] < 0 || prog->args[i] >= nreg){
+            return GPARSE_ERROR;
+        }
+    }
+    for (int i = 0; i < e->nterms; i++){
+        const CacheTerm* t = entry_terms( e ) + i;
+        if (t->pc0 < 0 || t->pc0 > t->pc1 || t->pc1 > prog->ncode
+            || t->result < 0 || t->result >= nreg){
+            return GPARSE_ERROR;
+        }
+    }
+    return prog->result < nreg ? GPARSE_OK : GPARSE_ERROR;
+}
+
+/* Builds the program of the entry, or returns nullptr if some variable or
+ * function does not match */
+static Program* cache_load( ProgramCache* cache, const CacheEntry* e )
+{
+    Parser* parser = cache->parser;
+    if (e->nregisters <= 0 || e->nregisters > CACHE_MAX_COUNT || e->max_depth < 0
+        || e->max_depth > e->ncode || e->result < -1
+        || (e->kind == CACHE_EXPRESSION && numeric_type_size( e->type ) == 0)){
+        return nullptr;
+    }
+
+    if (e->nfunctions > CACHE_MAX_FUNCTIONS){
+        return nullptr;
+    }
+    const Function* functions[CACHE_MAX_FUNCTIONS];
+    Program* prog = new Program;
+    prog->parser = parser;
+    prog->code = (Instruction*)malloc( sizeof( Instruction )*(e->ncode + 1) );
+    prog->symbols = (Symbol*)calloc( size_t( e->nsymbols ) + 1, sizeof( Symbol ) );
+    prog->constants = (Constant*)calloc( size_t( e->nconstants ) + 1, sizeof( Constant ) );
+    prog->args = (int*)malloc( sizeof( int )*(e->nargs + 1) );
+    int status = prog->code != nullptr && prog->symbols != nullptr
+        && prog->constants != nullptr && prog->args != nullptr ? GPARSE_OK : GPARSE_ERROR;
+
+    const char* strings = entry_strings( e );
+    for (int i = 0; i < e->nfunctions && status == GPARSE_OK; i++){
+        const CacheFunction* cf = entry_functions( e ) + i;
+        functions[i] = uint32_t( cf->name ) < e->nstrings ? cache_function( parser, e, cf ) : nullptr;
+        status = functions[i] != nullptr ? GPARSE_OK : GPARSE_ERROR;
+    }
+    for (int i = 0; i < e->nsymbols && status == GPARSE_OK; i++){
+        const CacheSymbol* cs = entry_symbols( e ) + i;
+        Variable* var = uint32_t( cs->name ) < e->nstrings
+            ? cache_variable( parser, strings + cs->name ) : nullptr;
+        if (var == nullptr || var->type != cs->type || numeric_type_size( var->type ) == 0){
+            status = GPARSE_ERROR;
+            break;
+        }
+        prog->symbols[i].var = var;
+        prog->nsymbols = prog->symbols_capacity = i + 1;
+    }
+    for (int i = 0; i < e->nconstants && status == GPARSE_OK; i++){
+        const CacheConstant* cc = entry_constants( e ) + i;
+        Constant* c = prog->constants + i;
+        if (numeric_type_size( cc->type ) == 0 || cc->reg < 0 || cc->reg >= e->nregisters){
+            status = GPARSE_ERROR;
+            break;
+        }
+        memcpy( &c->value, &cc->value, numeric_type_size( cc->type ) );
+        c->type = cc->type;
+        c->reg = cc->reg;
+        prog->nconstants = prog->constants_capacity = i + 1;
+    }
+    for (int i = 0; i < e->ncode && status == GPARSE_OK; i++){
+        const CacheInstruction* ci = entry_code( e ) + i;
+        Instruction* ins = prog->code + i;
+        if (ci->func < -1 || ci->func >= e->nfunctions){
+            status = GPARSE_ERROR;
+            break;
+        }
+        ins->op = ci->op;
+        ins->type = ci->type;
+        ins->type_a = ci->type_a;
+        ins->dst = ci->dst;
+        ins->a = ci->a;
+        ins->b = ci->b;
+        ins->func = ci->func >= 0 ? functions[ci->func] : nullptr;
+        prog->ncode = prog->code_capacity = i + 1;
+    }
+    if (status == GPARSE_OK){
+        memcpy( prog->args, entry_args( e ), sizeof( int32_t )*e->nargs );
+        prog->nargs = prog->args_capacity = e->nargs;
+        prog->nregisters = e->nregisters;
+        prog->max_depth = e->max_depth;
+        prog->result = e->result;
+        prog->reorder = e->reorder;
+        prog->type = e->type;
+        prog->ans.type = e->kind == CACHE_FILTER ? t_undefined : e->type;
+        prog->ans.size = numeric_type_size( prog->ans.type );
+        status = cache_check_code( e, prog );
+    }
+    for (int i = 0; i < e->nterms && status == GPARSE_OK; i++){
+        const CacheTerm* t = entry_terms( e ) + i;
+        status = program_add_term( prog, t->pc0, t->pc1, t->result );
+    }
+    if (status == GPARSE_OK){
+        status = workspace_prepare( &prog->ws, prog, 1 );
+    }
+
+    if (status != GPARSE_OK){
+        delete prog;
+        return nullptr;
+    }
+    return prog;
+}
+
+/* Index of the name in the strings, adding it if it is new */
+static int cache_string( char* strings, uint32_t* nstrings, const char* name )
+{
+    const size_t len = strlen( name ) + 1;
+    for (uint32_t i = 0; i + len <= *nstrings; i += uint32_t( strlen( strings + i ) ) + 1){
+        if (memcmp( strings + i, name, len ) == 0){
+            return int( i );
+        }
+    }
+    const int index = int( *nstrings );
+    memcpy( strings + index, name, len );
+    *nstrings += uint32_t( len );
+    return index;
+}
+
+/* Writes the entry of a compiled program, or returns nullptr if it cannot
+ * be cached */
+static CacheEntry* cache_entry( ProgramCache* cache, const int kind, const char* source
+    , const Program* prog )
+{
+    if (prog->nwindows > 0 || prog->noutputs > 0 || prog->nlocals > 0){
+        return nullptr;
+    }
+
+    /* Distinct functions, and the room for the strings */
+    const Function* funcs[CACHE_MAX_FUNCTIONS];
+    int nfunctions = 0;
+    const size_t len = strlen( source );
+    size_t nstrings = len + 1;
+    for (int i = 0; i < prog->ncode; i++){
+        const Function* f = prog->code[i].func;
+        int k = 0;
+        while (f != nullptr && k < nfunctions && funcs[k] != f){
+            k++;
+        }
+        if (f != nullptr && k == nfunctions){
+            if (nfunctions == CACHE_MAX_FUNCTIONS){
+                return nullptr;
+            }
+            funcs[nfunctions++] = f;
+            nstrings += strlen( f->name ) + 1;
+        }
+    }
+    for (int i = 0; i < prog->nsymbols; i++){
+        nstrings += strlen( prog->symbols[i].var->name ) + 1;
+    }
+
+    CacheEntry header;
+    memset( &header, 0, sizeof( header ) );
+    header.kind = kind;
+    header.ncode = prog->ncode;
+    header.nsymbols = prog->nsymbols;
+    header.nconstants = prog->nconstants;
+    header.nargs = prog->nargs;
+    header.nterms = prog->nterms;
+    header.nfunctions = nfunctions;
+    header.nstrings = uint32_t( nstrings );
+    const uint64_t size = entry_size( &header );
+    if (size == 0 || nstrings > CACHE_MAX_COUNT*64u){
+        return nullptr;
+    }
+    CacheEntry* e = (CacheEntry*)calloc( 1, size_t( size ) );
+    if (e == nullptr){
+        return nullptr;
+    }
+    *e = header;
+    e->size = uint32_t( size );
+    e->hash = cache_source_hash( kind, source, len );
+    e->fingerprint = cache_fingerprint( cache );
+    e->type = prog->type;
+    e->result = prog->result;
+    e->nregisters = prog->nregisters;
+    e->max_depth = prog->max_depth;
+    e->reorder = prog->reorder;
+    e->source_len = uint32_t( len );
+
+    char* strings = (char*)entry_strings( e );
+    memcpy( strings, source, len + 1 );
+    uint32_t used = uint32_t( len + 1 );
+    for (int i = 0; i < nfunctions; i++){
+        const Function* f = funcs[i];
+        CacheFunction* cf = (CacheFunction*)entry_functions( e ) + i;
+        cf->name = cache_string( strings, &used, f->name );
+        cf->type = f->type;
+        cf->nargs = f->nargs;
+        for (int k = 0; k < f->nargs; k++){
+            cf->args_type[k] = f->args_type[k];
+        }
+    }
+    for (int i = 0; i < prog->nsymbols; i++){
+        const Variable* var = prog->symbols[i].var;
+        CacheSymbol* cs = (CacheSymbol*)entry_symbols( e ) + i;
+        cs->name = cache_string( strings, &used, var->name );
+        cs->type = var->type;
+    }
+    for (int i = 0; i < prog->nconstants; i++){
+        const Constant* c = prog->constants + i;
+        CacheConstant* cc = (CacheConstant*)entry_constants( e ) + i;
+        memcpy( &cc->value, &c->value, numeric_type_size( c->type ) );
+        cc->type = c->type;
+        cc->reg = c->reg;
+    }
+    for (int i = 0; i < prog->ncode; i++){
+        const Instruction* ins = prog->code + i;
+        CacheInstruction* ci = (CacheInstruction*)entry_code( e ) + i;
+        ci->op = ins->op;
+        ci->type = ins->type;
+        ci->type_a = ins->type_a;
+        ci->dst = ins->dst;
+        ci->a = ins->a;
+        ci->b = ins->b;
+        ci->func = -1;
+        for (int k = 0; k < nfunctions; k++){
+            if (funcs[k] == ins->func){
+                ci->func = k;
+            }
+        }
+    }
+    if (prog->nargs > 0){
+        memcpy( (int32_t*)entry_args( e ), prog->args, sizeof( int32_t )*prog->nargs );
+    }
+    for (int i = 0; i < prog->nterms; i++){
+        CacheTerm* t = (CacheTerm*)entry_terms( e ) + i;
+        t->pc0 = prog->terms[i].pc0;
+        t->pc1 = prog->terms[i].pc1;
+        t->result = prog->terms[i].result;
+    }
+    return e;
+}
+
+/* Adds the compiled program to the cache */
+static void cache_store( ProgramCache* cache, const int kind, const char* source
+    , const Program* prog )
+{
+    CacheEntry* e = cache_entry( cache, kind, source, prog );
+    if (e == nullptr){
+        return;
+    }
+    if (cache_insert( cache, e ) != GPARSE_OK){
+        free( e );
+        return;
+    }
+    cache->dirty = 1;
+}
+
+#if defined(_WIN32)
+/* Copies the entries of the file, before it is replaced. Windows does not
+ * replace a mapped file. */
+static int cache_detach( ProgramCache* cache )
+{
+    for (int i = 0; i < cache->nentries; i++){
+        const CacheEntry* e = cache->entries[i];
+        if (cache_is_mapped( cache, e )){
+            void* copy = malloc( e->size );
+            if (copy == nullptr){
+                return GPARSE_ERROR;
+            }
+            memcpy( copy, e, e->size );
+            cache->entries[i] = (const CacheEntry*)copy;
+        }
+    }
+    cache_unmap( cache );
+    return GPARSE_OK;
+}
+#endif
+
+/* Writes the entries in a new file, which replaces the old one at once, so
+ * other processes map either of them */
+static int cache_save( ProgramCache* cache )
+{
+    if (cache->dirty == 0){
+        return GPARSE_OK;
+    }
+    char* tmp = (char*)malloc( strlen( cache->path ) + 16 );
+    if (tmp == nullptr){
+        return GPARSE_ERROR;
+    }
+#if defined(_WIN32)
+    sprintf( tmp, "%s.%lu", cache->path, (unsigned long)GetCurrentProcessId() );
+#else
+    sprintf( tmp, "%s.%lu", cache->path, (unsigned long)getpid() );
+#endif
+    FILE* f = fopen( tmp, "wb" );
+    if (f == nullptr){
+        free( tmp );
+        return GPARSE_ERROR;
+    }
+
+    CacheHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+    header.version = CACHE_VERSION;
+    header.nentries = uint32_t( cache->nentries );
+    int status = fwrite( &header, sizeof( header ), 1, f ) == 1 ? GPARSE_OK : GPARSE_ERROR;
+    for (int i = 0; i < cache->nentries && status == GPARSE_OK; i++){
+        const CacheEntry* e = cache->entries[i];
+        status = fwrite( e, e->size, 1, f ) == 1 ? GPARSE_OK : GPARSE_ERROR;
+    }
+    if (fclose( f ) != 0){
+        status = GPARSE_ERROR;
+    }
+
+#if defined(_WIN32)
+    if (status == GPARSE_OK){
+        status = cache_detach( cache );
+    }
+    if (status == GPARSE_OK && MoveFileExA( tmp, cache->path, MOVEFILE_REPLACE_EXISTING ) == 0){
+        status = GPARSE_ERROR;
+    }
+#else
+    if (status == GPARSE_OK && rename( tmp, cache->path ) != 0){
+        status = GPARSE_ERROR;
+    }
+#endif
+    if (status != GPARSE_OK){
+        remove( tmp );
+    }
+    free( tmp );
+    cache->dirty = status == GPARSE_OK ? 0 : 1;
+    return status;
+}
+
+#endif /* H_GCACHE_H */
@@ -0,0 +1,367 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Binary column files.
+
+A column is stored in a file 'name.gcol' as a raw little-endian array,
+after a header of 128 bytes:
+
+    offset  size
+    0       8       magic "GLNTCOL\0"
+    8       4       version, 1
+    12      4       type, from BasicTypes
+    16      8       count, number of values
+    24      8       offset of the values
+    32      8       offset of the validity bitmap, or 0 if there are no nulls
+    40      88      name of the variable, ended by '\0'
+
+The values start at a multiple of 64 bytes, so they are aligned for any
+type and for the cache lines. Booleans take a byte each. The validity
+bitmap follows the values, also aligned: bit i%64 of word i/64 is set if
+the row i has a value. A big-endian host reads the version as another
+number, so it rejects the files.
+
+A directory of column files is mapped in memory, read only, and the
+columns are bound to the variables with the same names. Nothing is read
+until the program touches the pages, so a large dataset is ready at once,
+and the pages come from the file cache without copies. The mappings are
+advised for sequential access, so the system reads ahead and may drop the
+pages behind. Programs cannot assign the mapped columns.
+*******************************************************************************/
+
+#ifndef H_GCOLUMN_H
+#define H_GCOLUMN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+#include "Arrow.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define COLUMN_MAGIC "GLNTCOL"
+#define COLUMN_VERSION 1
+#define COLUMN_ALIGN 64
+#define COLUMN_EXTENSION ".gcol"
+#define COLUMN_NAME_SIZE 88
+
+struct ColumnHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t type;
+    uint64_t count;
+    uint64_t data;      /* Offset of the values */
+    uint64_t validity;  /* Offset of the validity bitmap, or 0 */
+    char name[COLUMN_NAME_SIZE];
+};
+
+static inline uint64_t column_align( const uint64_t offset )
+{
+    return (offset + COLUMN_ALIGN - 1) & ~uint64_t( COLUMN_ALIGN - 1 );
+}
+
+static inline int column_type_valid( const int type )
+{
+    return type == t_bool || type == t_byte || type == t_int || type == t_l64
+        || type == t_float || type == t_double;
+}
+
+/* Writes the values, and pads the file to the next aligned offset */
+static int column_write_block( FILE* f, const void* data, const uint64_t bytes )
+{
+    static const char zeros[COLUMN_ALIGN] = { 0 };
+    const size_t pad = size_t( column_align( bytes ) - bytes );
+    if (bytes > 0 && fwrite( data, 1, size_t( bytes ), f ) != size_t( bytes )){
+        return GPARSE_ERROR;
+    }
+    return pad > 0 && fwrite( zeros, 1, pad, f ) != pad ? GPARSE_ERROR : GPARSE_OK;
+}
+
+/* Writes the file 'dir/name.gcol' */
+static int column_write( const char* dir, const char* name, const int type
+    , const void* data, const uint64_t* validity, const size_t count )
+{
+    const size_t len = strlen( name );
+    if (name_is_valid( name, name + len ) == 0 || len >= COLUMN_NAME_SIZE
+        || column_type_valid( type ) == 0 || (data == nullptr && count > 0)){
+        return GPARSE_ERROR;
+    }
+
+    const uint64_t bytes = uint64_t( count )*numeric_type_size( type );
+    ColumnHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, COLUMN_MAGIC, sizeof( COLUMN_MAGIC ) );
+    header.version = COLUMN_VERSION;
+    header.type = type;
+    header.count = count;
+    header.data = column_align( sizeof( ColumnHeader ) );
+    header.validity = validity != nullptr ? header.data + column_align( bytes ) : 0;
+    memcpy( header.name, name, len );
+
+    char* path = (char*)malloc( strlen( dir ) + len + sizeof( COLUMN_EXTENSION ) + 1 );
+    if (path == nullptr){
+        return GPARSE_ERROR;
+    }
+    sprintf( path, "%s/%s%s", dir, name, COLUMN_EXTENSION );
+    FILE* f = fopen( path, "wb" );
+    free( path );
+    if (f == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    int status = fwrite( &header, sizeof( header ), 1, f ) == 1
+        ? column_write_block( f, nullptr, header.data - sizeof( header ) )
+        : GPARSE_ERROR;
+    if (status == GPARSE_OK){
+        status = column_write_block( f, data, bytes );
+    }
+    if (status == GPARSE_OK && validity != nullptr){
+        status = column_write_block( f, validity, ((uint64_t( count ) + 63) / 64)*8 );
+    }
+    if (fclose( f ) != 0){
+        status = GPARSE_ERROR;
+    }
+    return status;
+}
+
+/* Checks the header of a mapped file and fills the column */
+static int column_check( gColumn* col, const char* map, const uint64_t size )
+{
+    const ColumnHeader* header = (const ColumnHeader*)map;
+    if (size < sizeof( ColumnHeader ) || memcmp( header->magic, COLUMN_MAGIC
+        , sizeof( COLUMN_MAGIC ) ) != 0 || header->version != COLUMN_VERSION
+        || column_type_valid( header->type ) == 0
+        || memchr( header->name, '\0', COLUMN_NAME_SIZE ) == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    /* The sections must be aligned and inside the file */
+    const uint64_t count = header->count;
+    const uint64_t type_size = numeric_type_size( header->type );
+    if (count > size / type_size || header->data % COLUMN_ALIGN != 0
+        || header->data < sizeof( ColumnHeader ) || header->data > size
+        || count*type_size > size - header->data){
+        return GPARSE_ERROR;
+    }
+    if (header->validity != 0 && (header->validity % COLUMN_ALIGN != 0
+        || header->validity < header->data + count*type_size || header->validity > size
+        || (count + 63) / 64 * 8 > size - header->validity)){
+        return GPARSE_ERROR;
+    }
+
+    col->name = header->name;
+    col->type = header->type;
+    col->count = size_t( count );
+    col->data = map + header->data;
+    col->validity = header->validity != 0
+        ? (const uint64_t*)(map + header->validity) : nullptr;
+    return GPARSE_OK;
+}
+
+/* Maps the file read only */
+static int column_map( gColumn* col, const char* path )
+{
+    col->map = nullptr;
+    col->map_size = 0;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, nullptr
+        , OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+    if (file == INVALID_HANDLE_VALUE){
+        return GPARSE_ERROR;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx( file, &size ) && size.QuadPart > 0
+        && uint64_t( size.QuadPart ) <= uint64_t( ~size_t( 0 ) )){
+        mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    }
+    if (mapping != nullptr){
+        col->map = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+        col->map_size = col->map != nullptr ? size_t( size.QuadPart ) : 0;
+        CloseHandle( mapping );
+    }
+    CloseHandle( file );
+#else
+    const int fd = open( path, O_RDONLY );
+    if (fd < 0){
+        return GPARSE_ERROR;
+    }
+    struct stat st;
+    if (fstat( fd, &st ) == 0 && st.st_size > 0
+        && uint64_t( st.st_size ) <= uint64_t( ~size_t( 0 ) )){
+        void* p = mmap( nullptr, size_t( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+        if (p != MAP_FAILED){
+            col->map = p;
+            col->map_size = size_t( st.st_size );
+            madvise( p, col->map_size, MADV_SEQUENTIAL );
+        }
+    }
+    close( fd );
+#endif
+    if (col->map == nullptr){
+        return GPARSE_ERROR;
+    }
+    return column_check( col, (const char*)col->map, col->map_size );
+}
+
+static void column_unmap( gColumn* col )
+{
+    if (col->map == nullptr){
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile( col->map );
+#else
+    munmap( col->map, col->map_size );
+#endif
+    col->map = nullptr;
+    col->map_size = 0;
+}
+
+/* Returns 1 if the file name ends with the extension of the columns */
+static int column_file_name( const char* name )
+{
+    const size_t len = strlen( name );
+    const size_t ext = sizeof( COLUMN_EXTENSION ) - 1;
+    return len > ext && strcmp( name + len - ext, COLUMN_EXTENSION ) == 0;
+}
+
+/* Maps the file 'dir/name' as the next column */
+static int columns_add( gColumns* columns, int* capacity, const char* dir, const char* name )
+{
+    char* path = (char*)malloc( strlen( dir ) + strlen( name ) + 2 );
+    if (path == nullptr){
+        return GPARSE_ERROR;
+    }
+    sprintf( path, "%s/%s", dir, name );
+
+    gColumn col;
+    int status = column_map( &col, path );
+    free( path );
+    gColumn* item = status == GPARSE_OK
+        ? array_push( &columns->columns, &columns->ncolumns, capacity ) : nullptr;
+    if (item == nullptr){
+        column_unmap( &col );
+        return GPARSE_ERROR;
+    }
+    *item = col;
+    return GPARSE_OK;
+}
+
+static int column_compare( const void* a, const void* b )
+{
+    return strcmp( ((const gColumn*)a)->name, ((const gColumn*)b)->name );
+}
+
+static void columns_close( gColumns* columns )
+{
+    for (int i = 0; i < columns->ncolumns; i++){
+        column_unmap( columns->columns + i );
+    }
+    free( columns->columns );
+    columns->columns = nullptr;
+    columns->ncolumns = 0;
+    columns->nrows = 0;
+}
+
+/* Maps the column files of the directory, sorted by name */
+static int columns_open( gColumns* columns, const char* dir )
+{
+    columns->ncolumns = 0;
+    columns->nrows = 0;
+    columns->columns = nullptr;
+    int capacity = 0;
+    int status = GPARSE_OK;
+
+#if defined(_WIN32)
+    char* pattern = (char*)malloc( strlen( dir ) + sizeof( COLUMN_EXTENSION ) + 3 );
+    if (pattern == nullptr){
+        return GPARSE_ERROR;
+    }
+    sprintf( pattern, "%s/*%s", dir, COLUMN_EXTENSION );
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA( pattern, &entry );
+    free( pattern );
+    if (find == INVALID_HANDLE_VALUE){
+        return GetLastError() == ERROR_FILE_NOT_FOUND ? GPARSE_OK : GPARSE_ERROR;
+    }
+    do{
+        if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0
+            && column_file_name( entry.cFileName )){
+            status = columns_add( columns, &capacity, dir, entry.cFileName );
+        }
+    } while (status == GPARSE_OK && FindNextFileA( find, &entry ));
+    FindClose( find );
+#else
+    DIR* d = opendir( dir );
+    if (d == nullptr){
+        return GPARSE_ERROR;
+    }
+    const struct dirent* entry;
+    while (status == GPARSE_OK && (entry = readdir( d )) != nullptr){
+        if (column_file_name( entry->d_name )){
+            status = columns_add( columns, &capacity, dir, entry->d_name );
+        }
+    }
+    closedir( d );
+#endif
+
+    if (status != GPARSE_OK){
+        columns_close( columns );
+        return GPARSE_ERROR;
+    }
+
+    qsort( columns->columns, size_t( columns->ncolumns ), sizeof( gColumn ), column_compare );
+    for (int i = 0; i < columns->ncolumns; i++){
+        const size_t count = columns->columns[i].count;
+        columns->nrows = i == 0 || count < columns->nrows ? count : columns->nrows;
+    }
+    return GPARSE_OK;
+}
+
+/* Binds each column to the variable of the program with the same name */
+static int columns_bind( Program* prog, const gColumns* columns )
+{
+    int status = GPARSE_ERROR;
+    for (int i = 0; i < columns->ncolumns; i++){
+        const gColumn* col = columns->columns + i;
+        const int isym = program_find_symbol( prog, col->name );
+        if (isym < 0){
+            continue;
+        }
+        Symbol* sym = prog->symbols + isym;
+        if (sym->var->type != col->type || program_writes( prog, isym )){
+            status = GPARSE_ERROR;
+            break;
+        }
+        /* Never written, as the program does not assign the symbol */
+        sym->column = (char*)col->data;
+        sym->stride = numeric_type_size( col->type );
+        sym->packed = 0;
+        sym->offset = 0;
+        sym->validity = (unsigned char*)col->validity;
+        sym->validity_offset = 0;
+        status = GPARSE_OK;
+    }
+    program_update_nulls( prog );
+    return status;
+}
+
+#endif /* H_GCOLUMN_H */
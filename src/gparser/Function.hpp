@@ -0,0 +1,771 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Built-in functions.
+
+Each function has a scalar implementation, used by the interpreter, and a
+batch implementation used by compiled programs. The transcendental functions
+are branch-free polynomial approximations, so the compiler can vectorize the
+loops over the block (e.g. with AVX2). The scalar implementations use the
+same approximations, so both give the same results. Their maximum error,
+measured against the C library over the whole double range, is:
+
+    exp                 1 ulp
+    log, sin, cos       2 ulp
+    log10, tan          4 ulp
+    sqrt, abs, min, max, floor, ceil    exact
+
+Functions with float arguments are evaluated in double precision, and are
+correctly rounded in most cases. See check_builtins in dev/zdev03.
+
+Overloaded functions are resolved at compile time by the types of the
+arguments, and the program calls the resolved function directly.
+*******************************************************************************/
+
+#ifndef H_GFUNCTION_H
+#define H_GFUNCTION_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+#include "Window.hpp"
+
+/***************************/
+/* Vectorizable math */
+/***************************/
+static inline double as_double( const uint64_t u )
+{
+    double d;
+    memcpy( &d, &u, sizeof( d ) );
+    return d;
+}
+
+static inline uint64_t as_u64( const double d )
+{
+    uint64_t u;
+    memcpy( &u, &d, sizeof( u ) );
+    return u;
+}
+
+/* c ? a : b with bit masks. Compilers do not vectorize the conditional
+ * operator on doubles when floating point exceptions may trap. */
+static inline double math_select( const int c, const double a, const double b )
+{
+    const uint64_t mask = uint64_t( 0 ) - uint64_t( c != 0 );
+    return as_double( (as_u64( a ) & mask) | (as_u64( b ) & ~mask) );
+}
+
+/* Changes the sign of x if c is not zero */
+static inline double math_negate( const int64_t c, const double x )
+{
+    return as_double( as_u64( x ) ^ (uint64_t( c != 0 ) << 63) );
+}
+
+/* 1.5 * 2^52. Adding it rounds to an integer, which is kept in the low bits */
+#define MATH_SHIFTER 6755399441055744.0
+
+#define MATH_LN2_HI 6.93147180369123816490e-01
+#define MATH_LN2_LO 1.90821492927058770002e-10
+
+struct f_exp
+{
+    static inline double apply( const double x )
+    {
+        /* Out of this range the result is 0 or infinity anyway */
+        double xc = math_select( x > 710.0, 710.0, x );
+        xc = math_select( xc < -746.0, -746.0, xc );
+
+        /* x = k ln2 + r, |r| <= ln2/2 */
+        const double t = xc * 1.4426950408889634 + MATH_SHIFTER;
+        const double kd = t - MATH_SHIFTER;
+        const int64_t k = (int32_t)(uint32_t)as_u64( t );
+        const double r = (xc - kd * MATH_LN2_HI) - kd * MATH_LN2_LO;
+
+        /* Taylor series up to r^13 */
+        double p = 1.0 / 6227020800.0;
+        p = p * r + 1.0 / 479001600.0;
+        p = p * r + 1.0 / 39916800.0;
+        p = p * r + 1.0 / 3628800.0;
+        p = p * r + 1.0 / 362880.0;
+        p = p * r + 1.0 / 40320.0;
+        p = p * r + 1.0 / 5040.0;
+        p = p * r + 1.0 / 720.0;
+        p = p * r + 1.0 / 120.0;
+        p = p * r + 1.0 / 24.0;
+        p = p * r + 1.0 / 6.0;
+        p = p * r + 0.5;
+        p = p * r + 1.0;
+        p = p * r + 1.0;
+
+        /* 2^k in two steps, so subnormal and overflowed results are right */
+        const int64_t k1 = k >> 1;
+        const int64_t k2 = k - k1;
+        const double y = p * as_double( uint64_t( k1 + 1023 ) << 52 )
+            * as_double( uint64_t( k2 + 1023 ) << 52 );
+        return math_select( x == x, y, x );
+    }
+    static inline int exact( const double ){ return 1; }
+    static inline double fallback( const double x ){ return exp( x ); }
+};
+
+struct f_log
+{
+    static inline double apply( const double x )
+    {
+        /* Subnormal numbers are scaled by 2^54 */
+        const double scaled = x * 18014398509481984.0;
+        const int sub = x < 2.2250738585072014e-308;
+        const uint64_t u = as_u64( math_select( sub, scaled, x ) );
+
+        /* x = m 2^e, m in [sqrt(2)/2, sqrt(2)). The exponent is converted
+         * with the shifter, as there is no vector conversion of int64. */
+        const double m1 = as_double( (u & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL );
+        const double mh = m1 * 0.5;
+        const int big = m1 > 1.4142135623730951;
+        const double m = math_select( big, mh, m1 );
+        const double ed = as_double( 0x4330000000000000ULL | ((u >> 52) & 0x7ff) )
+            - 4503599627370496.0 - math_select( sub, 1077.0, 1023.0 ) + math_select( big, 1.0, 0.0 );
+
+        /* log(m) = 2 atanh(s), s = (m - 1)/(m + 1), |s| < 0.172 */
+        const double s = (m - 1.0) / (m + 1.0);
+        const double z = s * s;
+        double p = 1.0 / 21.0;
+        p = p * z + 1.0 / 19.0;
+        p = p * z + 1.0 / 17.0;
+        p = p * z + 1.0 / 15.0;
+        p = p * z + 1.0 / 13.0;
+        p = p * z + 1.0 / 11.0;
+        p = p * z + 1.0 / 9.0;
+        p = p * z + 1.0 / 7.0;
+        p = p * z + 1.0 / 5.0;
+        p = p * z + 1.0 / 3.0;
+        const double s2 = s + s;
+        double y = ed * MATH_LN2_HI + (s2 + (s2 * z * p + ed * MATH_LN2_LO));
+
+        y = math_select( x == 0.0, -HUGE_VAL, y );
+        y = math_select( x == HUGE_VAL, x, y );
+        y = math_select( x < 0.0, as_double( 0x7ff8000000000000ULL ), y );
+        return math_select( x == x, y, x );
+    }
+    static inline int exact( const double ){ return 1; }
+    static inline double fallback( const double x ){ return log( x ); }
+};
+
+struct f_log10
+{
+    static inline double apply( const double x )
+    {
+        return f_log::apply( x ) * 0.43429448190325182765;
+    }
+    static inline int exact( const double ){ return 1; }
+    static inline double fallback( const double x ){ return log10( x ); }
+};
+
+/* Reduction of the trigonometric functions, accurate while |x| < 2^20 pi/2.
+ * Larger or not finite arguments use the C library. */
+#define MATH_TRIG_LIMIT 1.0e6
+
+/* x = q pi/2 + r, |r| <= pi/4. Returns the quadrant q mod 4. */
+static inline int64_t trig_reduce( const double x, double* r )
+{
+    const double ax = fabs( x );
+    const double xc = math_select( ax <= MATH_TRIG_LIMIT, x, 0.0 );
+    const double t = xc * 6.36619772367581382433e-01 + MATH_SHIFTER;
+    const double q = t - MATH_SHIFTER;
+
+    /* pi/2 in chunks of 33 bits, so the products by q are exact */
+    double y = xc - q * 1.57079632673412561417e+00;
+    y = y - q * 6.07710050630396597660e-11;
+    y = y - q * 2.02226624871116645580e-21;
+    *r = y - q * 8.47842766036889956997e-32;
+    return int64_t( as_u64( t ) & 3 );
+}
+
+static inline double trig_sin( const double r )
+{
+    const double z = r * r;
+    double p = 1.58969099521155010221e-10;
+    p = p * z - 2.50507602534068634195e-08;
+    p = p * z + 2.75573137070700676789e-06;
+    p = p * z - 1.98412698298579493134e-04;
+    p = p * z + 8.33333333332248946124e-03;
+    p = p * z - 1.66666666666666324348e-01;
+    return r + r * z * p;
+}
+
+static inline double trig_cos( const double r )
+{
+    const double z = r * r;
+    double p = -1.13596475577881948265e-11;
+    p = p * z + 2.08757232129817482790e-09;
+    p = p * z - 2.75573143513906633035e-07;
+    p = p * z + 2.48015872894767294178e-05;
+    p = p * z - 1.38888888888741095749e-03;
+    p = p * z + 4.16666666666666019037e-02;
+    const double hz = 0.5 * z;
+    const double w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + z * z * p);
+}
+
+struct f_sin
+{
+    static inline double apply( const double x )
+    {
+        double r;
+        const int64_t q = trig_reduce( x, &r );
+        const double s = trig_sin( r );
+        const double c = trig_cos( r );
+        return math_negate( q & 2, math_select( int( q & 1 ), c, s ) );
+    }
+    static inline int exact( const double x ){ return fabs( x ) <= MATH_TRIG_LIMIT; }
+    static inline double fallback( const double x ){ return sin( x ); }
+};
+
+struct f_cos
+{
+    static inline double apply( const double x )
+    {
+        double r;
+        const int64_t q = trig_reduce( x, &r );
+        const double s = trig_sin( r );
+        const double c = trig_cos( r );
+        return math_negate( (q + 1) & 2, math_select( int( q & 1 ), s, c ) );
+    }
+    static inline int exact( const double x ){ return fabs( x ) <= MATH_TRIG_LIMIT; }
+    static inline double fallback( const double x ){ return cos( x ); }
+};
+
+struct f_tan
+{
+    static inline double apply( const double x )
+    {
+        double r;
+        const int64_t q = trig_reduce( x, &r );
+        const double s = trig_sin( r );
+        const double c = trig_cos( r );
+        const double cot = -c / s;
+        const double t = s / c;
+        return math_select( int( q & 1 ), cot, t );
+    }
+    static inline int exact( const double x ){ return fabs( x ) <= MATH_TRIG_LIMIT; }
+    static inline double fallback( const double x ){ return tan( x ); }
+};
+
+struct f_sqrt
+{
+    static inline double apply( const double x ){ return sqrt( x ); }
+    static inline int exact( const double ){ return 1; }
+    static inline double fallback( const double x ){ return sqrt( x ); }
+};
+
+struct f_floor
+{
+    static inline double apply( const double x ){ return floor( x ); }
+    static inline int exact( const double ){ return 1; }
+    static inline double fallback( const double x ){ return floor( x ); }
+};
+
+struct f_ceil
+{
+    static inline double apply( const double x ){ return ceil( x ); }
+    static inline int exact( const double ){ return 1; }
+    static inline double fallback( const double x ){ return ceil( x ); }
+};
+
+struct f_abs{ template< typename T > static inline T apply( T a ){ return a < 0 ? T( -a ) : a; } };
+struct f_min{ template< typename T > static inline T apply( T a, T b ){ return b < a ? b : a; } };
+struct f_max{ template< typename T > static inline T apply( T a, T b ){ return a < b ? b : a; } };
+
+/***********/
+/* Kernels */
+/***********/
+
+/* Transcendental function F of a float or double column */
+template< typename T, class F >
+static int batch_math
+    ( const Function*, void* result, const void* const* args, const Selection* sel )
+{
+    T* _restrict_ d = (T*)result;
+    const T* _restrict_ pa = (const T*)args[0];
+    const int n = sel->n;
+
+    if (sel->idx == nullptr){
+        /* Dense loop, the compiler can vectorize it */
+        for (int i = 0; i < n; i++){
+            d[i] = T( F::apply( double( pa[i] ) ) );
+        }
+        /* The few arguments out of the range of the approximation */
+        for (int i = 0; i < n; i++){
+            if (F::exact( double( pa[i] ) ) == 0){
+                d[i] = T( F::fallback( double( pa[i] ) ) );
+            }
+        }
+    }
+    else{
+        const unsigned short* idx = sel->idx;
+        for (int k = 0; k < n; k++){
+            const int i = idx[k];
+            const double x = double( pa[i] );
+            d[i] = T( F::exact( x ) ? F::apply( x ) : F::fallback( x ) );
+        }
+    }
+    return GPARSE_OK;
+}
+
+/* Same approximation as the batch kernel, so the interpreter, the constant
+ * folding and the compiled programs give the same results */
+template< typename T, class F >
+static int scalar_math( const Function*, void* result, const void* const* args )
+{
+    const double x = double( *(const T*)args[0] );
+    *(T*)result = T( F::exact( x ) ? F::apply( x ) : F::fallback( x ) );
+    return GPARSE_OK;
+}
+
+template< typename T, class F >
+static int batch_unary
+    ( const Function*, void* result, const void* const* args, const Selection* sel )
+{
+    kernel_unary< T, F >( result, args[0], sel );
+    return GPARSE_OK;
+}
+
+template< typename T, class F >
+static int scalar_unary( const Function*, void* result, const void* const* args )
+{
+    *(T*)result = F::apply( *(const T*)args[0] );
+    return GPARSE_OK;
+}
+
+template< typename T, class F >
+static int batch_binary
+    ( const Function*, void* result, const void* const* args, const Selection* sel )
+{
+    kernel_binary< T, T, F >( result, args[0], args[1], sel );
+    return GPARSE_OK;
+}
+
+template< typename T, class F >
+static int scalar_binary( const Function*, void* result, const void* const* args )
+{
+    *(T*)result = F::apply( *(const T*)args[0], *(const T*)args[1] );
+    return GPARSE_OK;
+}
+
+/* Initialises every field of a built-in function. The types of the
+ * arguments are the last ones. */
+#define BUILTIN( name, scalar, batch, pure, window, type, nargs, ... ) \
+    { name, type, nargs, { __VA_ARGS__ }, scalar, batch, pure \
+    , nullptr, nullptr, nullptr, window, nullptr }
+
+#define BUILTIN_MATH( name, T, F ) \
+    BUILTIN( name, ( scalar_math< T, F > ), ( batch_math< T, F > ), 1, nullptr \
+    , TYPE( T ), 1, TYPE( T ) )
+
+#define BUILTIN_UNARY( name, T, F ) \
+    BUILTIN( name, ( scalar_unary< T, F > ), ( batch_unary< T, F > ), 1, nullptr \
+    , TYPE( T ), 1, TYPE( T ) )
+
+#define BUILTIN_BINARY( name, T, F ) \
+    BUILTIN( name, ( scalar_binary< T, F > ), ( batch_binary< T, F > ), 1, nullptr \
+    , TYPE( T ), 2, TYPE( T ), TYPE( T ) )
+
+/* Window functions are not pure, as each call changes their state */
+#define BUILTIN_WINDOW( name, W ) \
+    BUILTIN( name, window_scalar< W >, window_batch< W >, 0, W::create \
+    , TYPE( _double_ ), 2, TYPE( _double_ ), TYPE( _double_ ) )
+
+static const Function builtin_functions[] = {
+    BUILTIN_UNARY( "abs", _int_, f_abs ),
+    BUILTIN_UNARY( "abs", _l64_, f_abs ),
+    BUILTIN_UNARY( "abs", _float_, f_abs ),
+    BUILTIN_UNARY( "abs", _double_, f_abs ),
+    BUILTIN_BINARY( "min", _int_, f_min ),
+    BUILTIN_BINARY( "min", _l64_, f_min ),
+    BUILTIN_BINARY( "min", _float_, f_min ),
+    BUILTIN_BINARY( "min", _double_, f_min ),
+    BUILTIN_BINARY( "max", _int_, f_max ),
+    BUILTIN_BINARY( "max", _l64_, f_max ),
+    BUILTIN_BINARY( "max", _float_, f_max ),
+    BUILTIN_BINARY( "max", _double_, f_max ),
+    BUILTIN_MATH( "sqrt", _float_, f_sqrt ),
+    BUILTIN_MATH( "sqrt", _double_, f_sqrt ),
+    BUILTIN_MATH( "floor", _float_, f_floor ),
+    BUILTIN_MATH( "floor", _double_, f_floor ),
+    BUILTIN_MATH( "ceil", _float_, f_ceil ),
+    BUILTIN_MATH( "ceil", _double_, f_ceil ),
+    BUILTIN_MATH( "exp", _float_, f_exp ),
+    BUILTIN_MATH( "exp", _double_, f_exp ),
+    BUILTIN_MATH( "log", _float_, f_log ),
+    BUILTIN_MATH( "log", _double_, f_log ),
+    BUILTIN_MATH( "log10", _float_, f_log10 ),
+    BUILTIN_MATH( "log10", _double_, f_log10 ),
+    BUILTIN_MATH( "sin", _float_, f_sin ),
+    BUILTIN_MATH( "sin", _double_, f_sin ),
+    BUILTIN_MATH( "cos", _float_, f_cos ),
+    BUILTIN_MATH( "cos", _double_, f_cos ),
+    BUILTIN_MATH( "tan", _float_, f_tan ),
+    BUILTIN_MATH( "tan", _double_, f_tan ),
+    BUILTIN_WINDOW( "mavg", w_mavg ),
+    BUILTIN_WINDOW( "mstd", w_mstd ),
+    BUILTIN_WINDOW( "ema", w_ema ),
+    BUILTIN_WINDOW( "rmin", w_rmin ),
+    BUILTIN_WINDOW( "rmax", w_rmax ),
+};
+
+#define NUM_BUILTINS (sizeof( builtin_functions ) / sizeof( Function ))
+
+/******************/
+/* User functions */
+/******************/
+static int user_scalar( const Function* f, void* result, const void* const* args )
+{
+    f->user( result, args, f->data );
+    return GPARSE_OK;
+}
+
+/* Dense blocks are passed to the batch function of the user, if there is
+ * one. Otherwise, the scalar function is called for each row. */
+static int user_batch
+    ( const Function* f, void* result, const void* const* args, const Selection* sel )
+{
+    if (f->user_batch != nullptr && sel->idx == nullptr){
+        f->user_batch( result, args, (size_t)sel->n, f->data );
+        return GPARSE_OK;
+    }
+
+    const size_t size = numeric_type_size( f->type );
+    size_t sizes[GPARSE_MAX_ARGS];
+    const void* row[GPARSE_MAX_ARGS];
+    for (int k = 0; k < f->nargs; k++){
+        sizes[k] = numeric_type_size( f->args_type[k] );
+    }
+    for (int j = 0; j < sel->n; j++){
+        const size_t i = sel->idx == nullptr ? j : sel->idx[j];
+        for (int k = 0; k < f->nargs; k++){
+            row[k] = (const char*)args[k] + i*sizes[k];
+        }
+        f->user( (char*)result + i*size, row, f->data );
+    }
+    return GPARSE_OK;
+}
+
+static inline int function_valid_type( const int type )
+{
+    return type == t_bool || type == t_byte || type == t_int || type == t_l64
+        || type == t_float || type == t_double;
+}
+
+/* Creates a function in the parser. The same name can be added with
+ * different argument types. Returns nullptr and sets the status if the
+ * function cannot be added. */
+static Function* function_new( Parser* parser, const char* name
+    , const char* name_end, const int type, const int nargs, const int* args_type
+    , int* status )
+{
+    *status = GPARSE_ERROR;
+    if (name == nullptr || nargs < 0 || nargs > GPARSE_MAX_ARGS
+        || (nargs > 0 && args_type == nullptr) || function_valid_type( type ) == 0){
+        return nullptr;
+    }
+    for (int k = 0; k < nargs; k++){
+        if (function_valid_type( args_type[k] ) == 0){
+            return nullptr;
+        }
+    }
+
+    /* Names follow the same rules than variables */
+    const size_t len = name_end - name;
+    if (name_is_valid( name, name_end ) == 0){
+        return nullptr;
+    }
+
+    for (int i = 0; i < parser->nfunctions; i++){
+        const Function* f = parser->functions[i];
+        if (f->nargs == nargs && strtok_compare( f->name, name, name_end ) == 0
+            && (nargs == 0 || memcmp( f->args_type, args_type, sizeof( int )*nargs ) == 0)){
+            *status = GPARSE_NAME_COLLISION;
+            return nullptr;
+        }
+    }
+
+    Function** functions = (Function**)realloc
+        ( parser->functions, sizeof( Function* )*(parser->nfunctions + 1) );
+    if (functions == nullptr){
+        return nullptr;
+    }
+    parser->functions = functions;
+
+    Function* f = (Function*)malloc( sizeof( Function ) + len + 1 );
+    if (f == nullptr){
+        return nullptr;
+    }
+    memset( f, 0, sizeof( Function ) );
+    memcpy( f + 1, name, len );
+    ((char*)(f + 1))[len] = '\0';
+    f->name = (const char*)(f + 1);
+    f->type = type;
+    f->nargs = nargs;
+    for (int k = 0; k < nargs; k++){
+        f->args_type[k] = args_type[k];
+    }
+
+    parser->functions[parser->nfunctions] = f;
+    parser->nfunctions++;
+    *status = GPARSE_OK;
+    return f;
+}
+
+/* Adds a function implemented in C */
+static int function_add( Parser* parser, const char* name, const int type
+    , const int nargs, const int* args_type
+    , gFunction scalar, gFunctionBatch batch, void* data )
+{
+    int status;
+    if (name == nullptr || scalar == nullptr){
+        return GPARSE_ERROR;
+    }
+    Function* f = function_new
+        ( parser, name, name + strlen( name ), type, nargs, args_type, &status );
+    if (f == nullptr){
+        return status;
+    }
+    f->scalar = user_scalar;
+    f->batch = user_batch;
+    f->user = scalar;
+    f->user_batch = batch;
+    f->data = data;
+    return GPARSE_OK;
+}
+
+/* Adds to the parser a copy of a function implemented in C */
+static int function_copy( Parser* parser, const Function* from )
+{
+    int status;
+    Function* f = function_new( parser, from->name, from->name + strlen( from->name )
+        , from->type, from->nargs, from->args_type, &status );
+    if (f == nullptr){
+        return status;
+    }
+    f->scalar = from->scalar;
+    f->batch = from->batch;
+    f->pure = from->pure;
+    f->user = from->user;
+    f->user_batch = from->user_batch;
+    f->data = from->data;
+    f->window = from->window;
+    return GPARSE_OK;
+}
+
+/*********************/
+/* Defined functions */
+/*********************/
+
+/* Functions declared with 'function type name( args ){ body }' are compiled
+ * into a program. Arguments are in the registers 0 to nargs - 1, and each
+ * call runs the body in a frame: a workspace kept by the caller for the
+ * call, see workspace_frame, or by the parser for the calls of the
+ * interpreter. Small bodies are inlined by the compiler instead, unless
+ * they use global variables: these are always read from the scope, never
+ * from the columns bound to the caller. */
+#define FUNCTION_INLINE_MAX 32
+
+static inline const Program* script_body( const Function* f )
+{
+    return (const Program*)f->data;
+}
+
+/* Runs the body for the selected rows in the frame, prepared for blocks of
+ * 'capacity' rows */
+static int script_call( const Function* f, Workspace* frame, const int capacity
+    , void* result, const void* const* args, const Selection* sel )
+{
+    if (sel->n == 0){
+        return GPARSE_OK;
+    }
+    /* Rows are in increasing order */
+    const int nrows = sel->idx == nullptr ? sel->n : sel->idx[sel->n - 1] + 1;
+    const Program* body = script_body( f );
+    if (workspace_prepare( frame, body, capacity > nrows ? capacity : nrows ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    for (int k = 0; k < f->nargs; k++){
+        memcpy( frame->reg( k ), args[k], numeric_type_size( f->args_type[k] )*nrows );
+    }
+    if (program_run_range( body, frame, 0, sel, 0, body->ncode, 0 ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    return exec_cast( f->type, f->type, result, frame->reg( body->result ), sel );
+}
+
+/* Calls without the workspace of a caller, which use a frame of their own */
+static int script_scalar( const Function* f, void* result, const void* const* args )
+{
+    Workspace frame;
+    Selection sel;
+    sel.idx = nullptr;
+    sel.n = 1;
+    return script_call( f, &frame, 1, result, args, &sel );
+}
+
+static int script_batch
+    ( const Function* f, void* result, const void* const* args, const Selection* sel )
+{
+    Workspace frame;
+    return script_call( f, &frame, 0, result, args, sel );
+}
+
+static inline int function_is_script( const Function* f )
+{
+    return f->scalar == script_scalar;
+}
+
+/* Calls the function for one value. The functions of scripts run in the
+ * frame of the parser, as the interpreter does not nest calls. */
+static int function_call_scalar
+    ( Parser* parser, const Function* f, void* result, const void* const* args )
+{
+    if (!function_is_script( f )){
+        return f->scalar( f, result, args );
+    }
+    if (parser->frame == nullptr){
+        parser->frame = new Workspace;
+    }
+    Selection sel;
+    sel.idx = nullptr;
+    sel.n = 1;
+    return script_call( f, parser->frame, 1, result, args, &sel );
+}
+
+/* Releases the functions added to the parser, not those of its base, and
+ * the frame of the interpreter, which may be prepared for them */
+static void functions_release_own( Parser* parser )
+{
+    for (int i = parser->nbase_functions; i < parser->nfunctions; i++){
+        Function* f = parser->functions[i];
+        if (function_is_script( f )){
+            delete (Program*)f->data;
+        }
+        free( f->source );
+        free( f );
+    }
+    parser->nfunctions = parser->nbase_functions;
+    delete parser->frame;
+    parser->frame = nullptr;
+}
+
+/* Releases the functions and the array */
+static void functions_dispose( Parser* parser )
+{
+    functions_release_own( parser );
+    free( parser->functions );
+    parser->functions = nullptr;
+    parser->nfunctions = 0;
+    parser->nbase_functions = 0;
+}
+
+/**************/
+/* Resolution */
+/**************/
+
+/* Order of the implicit upcasting between numeric types */
+static int function_type_rank( const int type )
+{
+    switch (type){
+    case t_byte: return 1;
+    case t_int: return 2;
+    case t_l64: return 3;
+    case t_float: return 4;
+    case t_double: return 5;
+    default: return 0;
+    }
+}
+
+/* Cost of the implicit conversion of an argument, or -1 if it is not
+ * allowed. Integers prefer double to float, as in the divisions. */
+static int function_arg_cost( const int from, const int to )
+{
+    const int rfrom = function_type_rank( from );
+    const int rto = function_type_rank( to );
+
+    if (from == to){
+        return 0;
+    }
+    if (rfrom == 0 || rto == 0 || rfrom > rto){
+        return -1;
+    }
+    if (to == t_float){
+        return 8;
+    }
+    if (to == t_double && from != t_float){
+        return 4;
+    }
+    return rto - rfrom;
+}
+
+/* Conversion cost of the arguments for the function, or -1 if it is not
+ * compatible. 'found' is set if the function has that name. */
+static int function_cost( const Function* f
+    , const char* name_ini, const char* name_end
+    , const int* types, const int nargs, int* found )
+{
+    if (strtok_compare( f->name, name_ini, name_end ) != 0){
+        return -1;
+    }
+    *found = 1;
+    if (f->nargs != nargs){
+        return -1;
+    }
+    int cost = 0;
+    for (int k = 0; k < nargs && cost >= 0; k++){
+        int c = function_arg_cost( types[k], f->args_type[k] );
+        cost = c < 0 ? -1 : cost + c;
+    }
+    return cost;
+}
+
+/* Finds the function called with arguments of the given types: the overload
+ * with the lowest conversion cost, or nullptr if none is compatible. 'found'
+ * is set if there is any function with that name. Functions added to the
+ * parser have priority over the built-in ones, which are read in place, so
+ * parsers in different threads can resolve them at once. */
+static const Function* function_find( const Parser* parser
+    , const char* name_ini, const char* name_end
+    , const int* types, const int nargs, int* found )
+{
+    const Function* best = nullptr;
+    int best_cost = 0;
+
+    *found = 0;
+    for (int i = 0; i < parser->nfunctions; i++){
+        const Function* f = parser->functions[i];
+        const int cost = function_cost( f, name_ini, name_end, types, nargs, found );
+        if (cost >= 0 && (best == nullptr || cost < best_cost)){
+            best = f;
+            best_cost = cost;
+        }
+    }
+    if (best != nullptr){
+        return best;
+    }
+
+    for (size_t i = 0; i < NUM_BUILTINS; i++){
+        const Function* f = builtin_functions + i;
+        const int cost = function_cost( f, name_ini, name_end, types, nargs, found );
+        if (cost >= 0 && (best == nullptr || cost < best_cost)){
+            best = f;
+            best_cost = cost;
+        }
+    }
+    return best;
+}
+
+#endif /* H_GFUNCTION_H */
@@ -0,0 +1,597 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Hash aggregation of the results of a program, grouped by the results of
+another one.
+
+The groups are kept in hash tables with open addressing and linear probing.
+Each slot is a cache line with the key and the aggregate of its values, so
+finding the group of a row and updating it touches a single line. The sums
+are shifted by the first value of the group, so the variance does not lose
+precision when the mean is large.
+
+The keys are split in partitions by the high bits of their hash, with a
+table for each partition. Each thread aggregates its rows in small local
+tables, one per partition, which stay in the cache. When a local table is
+half full, it is merged into the table of the partition, which is locked
+only for the merge. Keys which repeat are merged once per flush instead of
+once per row, and threads merging different partitions do not wait for
+each other.
+
+The tables of the partitions grow as needed, within the memory budget. If
+the groups do not fit, the aggregation fails instead of writing to disk.
+*******************************************************************************/
+
+#ifndef H_GGROUPBY_H
+#define H_GGROUPBY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Program.hpp"
+#include "Thread.hpp"
+#include "Aggregate.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <xmmintrin.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* Slots of each local table */
+#define GROUP_LOCAL_SLOTS 256
+
+/* Tables from this size are mapped from the system, in huge pages where
+ * possible, as the kernel gives them cleared and with fewer TLB misses */
+#define GROUP_MAP_BYTES (2 << 20)
+
+/* Rows ahead whose slot is prefetched, to overlap the cache misses in the
+ * tables which do not fit in the cache */
+#define GROUP_PREFETCH 16
+
+/* Aggregate of a group, in a cache line */
+struct GroupSlot
+{
+    uint64_t key;       /* Bits of the key, as a 64-bit value */
+    double rows;        /* Rows of the group, 0 if the slot is empty */
+    double count;       /* Values which are not null */
+    double shift;       /* First value of the group */
+    double s1;          /* Sum of (x - shift) */
+    double s2;          /* Sum of (x - shift)^2 */
+    double min;
+    double max;
+};
+
+struct GroupTable
+{
+    GroupSlot* slots;
+    size_t mask;        /* Number of slots - 1, a power of 2 */
+    size_t used;
+    volatile int lock;
+};
+
+struct GroupBy
+{
+    const Program* key;
+    const Program* value;
+    size_t nrows;
+
+    GroupTable* tables;     /* Table of each partition */
+    int npartitions;
+    int partition_shift;    /* Bits of the hash after the partition bits */
+
+    volatile int64_t bytes; /* Memory of the tables of the partitions */
+    int64_t budget;         /* Maximum memory, or 0 */
+
+    volatile int next;      /* Next chunk of rows to take */
+    int nchunks;
+    int nthreads;
+    volatile int failed;
+};
+
+struct GroupByWorker
+{
+    GroupBy* gb;
+    int index;
+};
+
+static inline void group_prefetch( const void* p )
+{
+#if defined(_MSC_VER)
+    _mm_prefetch( (const char*)p, _MM_HINT_T0 );
+#else
+    __builtin_prefetch( p, 1 );
+#endif
+}
+
+/* Mixes the bits of the key, so close keys go to distant slots */
+static inline uint64_t group_hash( uint64_t k )
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/* Keys of a block as 64-bit values. Integers are extended to 64 bits, and
+ * floating point values are compared as doubles, with a single zero and a
+ * single NaN. */
+template< typename T >
+static void block_keys( uint64_t* _restrict_ out, const void* reg, const int n )
+{
+    const T* v = (const T*)reg;
+    for (int i = 0; i < n; i++){
+        out[i] = uint64_t( int64_t( v[i] ) );
+    }
+}
+
+template<>
+void block_keys< _bool_ >( uint64_t* _restrict_ out, const void* reg, const int n )
+{
+    const unsigned char* v = (const unsigned char*)reg;
+    for (int i = 0; i < n; i++){
+        out[i] = v[i] != 0;
+    }
+}
+
+static inline uint64_t double_key( double d )
+{
+    if (d == 0){
+        d = 0;
+    }
+    else if (d != d){
+        d = NAN;
+    }
+    uint64_t k;
+    memcpy( &k, &d, sizeof( uint64_t ) );
+    return k;
+}
+
+template<>
+void block_keys< _float_ >( uint64_t* _restrict_ out, const void* reg, const int n )
+{
+    const float* v = (const float*)reg;
+    for (int i = 0; i < n; i++){
+        out[i] = double_key( v[i] );
+    }
+}
+
+template<>
+void block_keys< _double_ >( uint64_t* _restrict_ out, const void* reg, const int n )
+{
+    const double* v = (const double*)reg;
+    for (int i = 0; i < n; i++){
+        out[i] = double_key( v[i] );
+    }
+}
+
+/* Writes the key as a value of the type */
+static void group_key_value( void* out, const int type, const uint64_t key )
+{
+    double d;
+    memcpy( &d, &key, sizeof( double ) );
+    switch (type){
+    case t_bool: *(_bool_*)out = key != 0; break;
+    case t_byte: *(_byte_*)out = _byte_( key ); break;
+    case t_int: *(_int_*)out = _int_( key ); break;
+    case t_l64: *(_l64_*)out = _l64_( key ); break;
+    case t_float: *(_float_*)out = _float_( d ); break;
+    default: *(_double_*)out = d; break;
+    }
+}
+
+static GroupSlot* group_slots_alloc( const size_t nslots )
+{
+    const size_t bytes = nslots*sizeof( GroupSlot );
+    if (bytes < GROUP_MAP_BYTES){
+        return (GroupSlot*)calloc( nslots, sizeof( GroupSlot ) );
+    }
+#if defined(_WIN32)
+    return (GroupSlot*)VirtualAlloc( nullptr, bytes, MEM_COMMIT | MEM_RESERVE
+        , PAGE_READWRITE );
+#else
+    void* p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+        , -1, 0 );
+    if (p == MAP_FAILED){
+        return nullptr;
+    }
+#if defined(MADV_HUGEPAGE)
+    madvise( p, bytes, MADV_HUGEPAGE );
+#endif
+    return (GroupSlot*)p;
+#endif
+}
+
+static void group_slots_free( GroupSlot* slots, const size_t nslots )
+{
+    const size_t bytes = nslots*sizeof( GroupSlot );
+    if (slots == nullptr || bytes < GROUP_MAP_BYTES){
+        free( slots );
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree( slots, 0, MEM_RELEASE );
+#else
+    munmap( slots, bytes );
+#endif
+}
+
+static int group_table_init( GroupTable* t, const size_t nslots )
+{
+    t->slots = group_slots_alloc( nslots );
+    t->mask = nslots - 1;
+    t->used = 0;
+    t->lock = 0;
+    return t->slots != nullptr ? GPARSE_OK : GPARSE_ERROR;
+}
+
+static void group_table_free( GroupTable* t )
+{
+    group_slots_free( t->slots, t->mask + 1 );
+    t->slots = nullptr;
+}
+
+/* Slot of the key, which is empty if the key is not in the table. The
+ * table must have some empty slot. */
+static inline GroupSlot* group_find( const GroupTable* t, const uint64_t key
+    , const uint64_t hash )
+{
+    size_t i = size_t( hash ) & t->mask;
+    while (t->slots[i].rows != 0 && t->slots[i].key != key){
+        i = (i + 1) & t->mask;
+    }
+    return t->slots + i;
+}
+
+/* Adds a row to the group */
+static inline void group_add( GroupSlot* s, const double x, const int valid )
+{
+    s->rows += 1;
+    if (valid == 0){
+        return;
+    }
+    if (s->count == 0){
+        s->shift = x;
+        s->min = x;
+        s->max = x;
+    }
+    const double d = x - s->shift;
+    s->count += 1;
+    s->s1 += d;
+    s->s2 += d*d;
+    s->min = x < s->min ? x : s->min;
+    s->max = x > s->max ? x : s->max;
+}
+
+static inline void group_partial( Partial* p, const GroupSlot* s )
+{
+    partial_init( p );
+    if (s->count > 0){
+        p->count = s->count;
+        p->sum = s->s1 + s->count*s->shift;
+        p->m2 = s->s2 - s->s1*s->s1 / s->count;
+        p->m2 = p->m2 > 0 ? p->m2 : 0;
+        p->min = s->min;
+        p->max = s->max;
+    }
+}
+
+/* Merges the group into another with the same key */
+static void group_merge( GroupSlot* a, const GroupSlot* b )
+{
+    if (a->rows == 0){
+        *a = *b;
+        return;
+    }
+    a->rows += b->rows;
+    if (b->count == 0){
+        return;
+    }
+    if (a->count == 0){
+        const double rows = a->rows;
+        *a = *b;
+        a->rows = rows;
+        return;
+    }
+    /* b is shifted to the value of a */
+    const double delta = b->shift - a->shift;
+    a->s2 += b->s2 + 2*delta*b->s1 + b->count*delta*delta;
+    a->s1 += b->s1 + b->count*delta;
+    a->count += b->count;
+    a->min = b->min < a->min ? b->min : a->min;
+    a->max = b->max > a->max ? b->max : a->max;
+}
+
+/* Doubles the slots of the table of a partition */
+static int group_table_grow( GroupBy* gb, GroupTable* t )
+{
+    const size_t nslots = 2*(t->mask + 1);
+    const int64_t bytes = int64_t( nslots/2*sizeof( GroupSlot ) );
+    if (gb->budget > 0 && atomic_add64( &gb->bytes, bytes ) > gb->budget){
+        return GPARSE_ERROR;
+    }
+    GroupTable grown;
+    if (group_table_init( &grown, nslots ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    for (size_t i = 0; i <= t->mask; i++){
+        const GroupSlot* s = t->slots + i;
+        if (i + GROUP_PREFETCH <= t->mask && s[GROUP_PREFETCH].rows != 0){
+            const uint64_t hash = group_hash( s[GROUP_PREFETCH].key );
+            group_prefetch( grown.slots + (size_t( hash ) & grown.mask) );
+        }
+        if (s->rows != 0){
+            *group_find( &grown, s->key, group_hash( s->key ) ) = *s;
+        }
+    }
+    group_table_free( t );
+    t->slots = grown.slots;
+    t->mask = grown.mask;
+    return GPARSE_OK;
+}
+
+/* Merges the group into the table of its partition, which must be locked */
+static int group_merge_partition( GroupBy* gb, GroupTable* t, const GroupSlot* s
+    , const uint64_t hash )
+{
+    /* At most 70% of the slots are used */
+    if (10*(t->used + 1) > 7*(t->mask + 1) && group_table_grow( gb, t ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    GroupSlot* dst = group_find( t, s->key, hash );
+    t->used += dst->rows == 0;
+    group_merge( dst, s );
+    return GPARSE_OK;
+}
+
+static inline int group_partition( const GroupBy* gb, const uint64_t hash )
+{
+    return gb->npartitions > 1 ? int( hash >> gb->partition_shift ) : 0;
+}
+
+/* Merges the local table into the tables of the partitions, and clears it */
+static int group_flush( GroupBy* gb, GroupTable* local, const int p )
+{
+    GroupTable* t = gb->tables + p;
+    int status = GPARSE_OK;
+    spin_lock( &t->lock );
+    for (size_t i = 0; i <= local->mask && status == GPARSE_OK; i++){
+        const GroupSlot* s = local->slots + i;
+        if (i + GROUP_PREFETCH <= local->mask && s[GROUP_PREFETCH].rows != 0){
+            const uint64_t hash = group_hash( s[GROUP_PREFETCH].key );
+            group_prefetch( t->slots + (size_t( hash ) & t->mask) );
+        }
+        if (s->rows != 0){
+            status = group_merge_partition( gb, t, s, group_hash( s->key ) );
+        }
+    }
+    spin_unlock( &t->lock );
+    memset( local->slots, 0, sizeof( GroupSlot )*(local->mask + 1) );
+    local->used = 0;
+    return status;
+}
+
+/* Adds the rows of a block to the local tables, or directly to the tables
+ * of the partitions if there is a single thread. Without values, only the
+ * rows are counted. */
+static int group_block( GroupBy* gb, GroupTable* locals, const uint64_t* keys
+    , uint64_t* _restrict_ hashes, const uint64_t* key_valid, const double* values
+    , const uint64_t* valid, const int n )
+{
+    for (int i = 0; i < n; i++){
+        hashes[i] = group_hash( keys[i] );
+    }
+    for (int i = 0; i < n; i++){
+        if (locals == nullptr && i + GROUP_PREFETCH < n){
+            const uint64_t h = hashes[i + GROUP_PREFETCH];
+            const GroupTable* t = gb->tables + group_partition( gb, h );
+            group_prefetch( t->slots + (size_t( h ) & t->mask) );
+        }
+        if (key_valid != nullptr && ((key_valid[i >> 6] >> (i & 63)) & 1) == 0){
+            continue;
+        }
+        const int v = values == nullptr ? 0
+            : valid == nullptr ? 1 : int( (valid[i >> 6] >> (i & 63)) & 1 );
+        const uint64_t hash = hashes[i];
+        const int p = group_partition( gb, hash );
+
+        if (locals == nullptr){
+            GroupTable* t = gb->tables + p;
+            if (10*(t->used + 1) > 7*(t->mask + 1) && group_table_grow( gb, t ) != GPARSE_OK){
+                return GPARSE_ERROR;
+            }
+            GroupSlot* s = group_find( t, keys[i], hash );
+            if (s->rows == 0){
+                s->key = keys[i];
+                t->used++;
+            }
+            group_add( s, v ? values[i] : 0, v );
+            continue;
+        }
+
+        GroupTable* local = locals + p;
+        GroupSlot* s = group_find( local, keys[i], hash );
+        if (s->rows == 0){
+            if (2*(local->used + 1) > local->mask + 1){
+                if (group_flush( gb, local, p ) != GPARSE_OK){
+                    return GPARSE_ERROR;
+                }
+                s = group_find( local, keys[i], hash );
+            }
+            s->key = keys[i];
+            local->used++;
+        }
+        group_add( s, v ? values[i] : 0, v );
+    }
+    return GPARSE_OK;
+}
+
+static void group_worker( void* arg )
+{
+    const GroupByWorker* worker = (const GroupByWorker*)arg;
+    GroupBy* gb = worker->gb;
+    const Program* kprog = gb->key;
+    const Program* vprog = gb->value;
+
+    Workspace wk;
+    Workspace wv;
+    uint64_t* keys = (uint64_t*)malloc( sizeof( uint64_t )*GPARSE_BATCH );
+    uint64_t* hashes = (uint64_t*)malloc( sizeof( uint64_t )*GPARSE_BATCH );
+    double* values = (double*)calloc( GPARSE_BATCH, sizeof( double ) );
+    GroupTable* locals = gb->nthreads > 1
+        ? (GroupTable*)calloc( gb->npartitions, sizeof( GroupTable ) ) : nullptr;
+    int status = keys != nullptr && hashes != nullptr && values != nullptr
+        && (gb->nthreads == 1 || locals != nullptr)
+        && workspace_prepare( &wk, kprog, GPARSE_BATCH ) == GPARSE_OK
+        && (vprog == nullptr || workspace_prepare( &wv, vprog, GPARSE_BATCH ) == GPARSE_OK)
+        ? GPARSE_OK : GPARSE_ERROR;
+    for (int p = 0; locals != nullptr && p < gb->npartitions && status == GPARSE_OK; p++){
+        status = group_table_init( locals + p, GROUP_LOCAL_SLOTS );
+    }
+
+    const size_t chunk_rows = (size_t)AGGREGATE_GROUP * GPARSE_BATCH;
+    int c;
+    while (status == GPARSE_OK && atomic_load( &gb->failed ) == 0
+        && (c = atomic_add( &gb->next, 1 ) - 1) < gb->nchunks){
+        const size_t end = (c + 1)*chunk_rows < gb->nrows ? (c + 1)*chunk_rows : gb->nrows;
+        for (size_t row0 = c*chunk_rows; row0 < end && status == GPARSE_OK; row0 += GPARSE_BATCH){
+            const int n = int( end - row0 < GPARSE_BATCH ? end - row0 : GPARSE_BATCH );
+            if (program_run( kprog, &wk, row0, n, 1 ) != GPARSE_OK
+                || (vprog != nullptr && program_run( vprog, &wv, row0, n, 1 ) != GPARSE_OK)){
+                status = GPARSE_ERROR;
+                break;
+            }
+
+            const char* kreg = wk.reg( kprog->result );
+            switch (kprog->type){
+            case t_bool: block_keys< _bool_ >( keys, kreg, n ); break;
+            case t_byte: block_keys< _byte_ >( keys, kreg, n ); break;
+            case t_int: block_keys< _int_ >( keys, kreg, n ); break;
+            case t_l64: block_keys< _l64_ >( keys, kreg, n ); break;
+            case t_float: block_keys< _float_ >( keys, kreg, n ); break;
+            default: block_keys< _double_ >( keys, kreg, n ); break;
+            }
+            const uint64_t* key_valid = kprog->nulls ? wk.valid_reg( kprog->result ) : nullptr;
+
+            /* The values are not compacted, as the rows must match the keys */
+            const uint64_t* valid = nullptr;
+            if (vprog != nullptr){
+                const char* vreg = wv.reg( vprog->result );
+                switch (vprog->type){
+                case t_bool: block_values< _bool_ >( values, vreg, nullptr, n ); break;
+                case t_byte: block_values< _byte_ >( values, vreg, nullptr, n ); break;
+                case t_int: block_values< _int_ >( values, vreg, nullptr, n ); break;
+                case t_l64: block_values< _l64_ >( values, vreg, nullptr, n ); break;
+                case t_float: block_values< _float_ >( values, vreg, nullptr, n ); break;
+                default: block_values< _double_ >( values, vreg, nullptr, n ); break;
+                }
+                valid = vprog->nulls ? wv.valid_reg( vprog->result ) : nullptr;
+            }
+
+            status = group_block( gb, locals, keys, hashes, key_valid
+                , vprog != nullptr ? values : nullptr, valid, n );
+        }
+    }
+
+    for (int p = 0; locals != nullptr && p < gb->npartitions; p++){
+        if (status == GPARSE_OK && locals[p].slots != nullptr && locals[p].used > 0){
+            status = group_flush( gb, locals + p, p );
+        }
+        group_table_free( locals + p );
+    }
+    if (status != GPARSE_OK){
+        atomic_store( &gb->failed, 1 );
+    }
+    free( locals );
+    free( keys );
+    free( hashes );
+    free( values );
+}
+
+/* Groups the rows by the results of 'key', and aggregates the results of
+ * 'value' for each group. The tables of the partitions are left in gb. */
+static int program_group_by( GroupBy* gb, const Program* key, const Program* value
+    , const size_t nrows, const int64_t budget, int nthreads )
+{
+    const size_t chunk_rows = (size_t)AGGREGATE_GROUP * GPARSE_BATCH;
+    memset( gb, 0, sizeof( GroupBy ) );
+    gb->key = key;
+    gb->value = value;
+    gb->nrows = nrows;
+    gb->budget = budget;
+    gb->nchunks = int( (nrows + chunk_rows - 1) / chunk_rows );
+
+    nthreads = nthreads < gb->nchunks ? nthreads : gb->nchunks;
+    nthreads = nthreads > 1 ? nthreads : 1;
+    gb->nthreads = nthreads;
+
+    /* Enough partitions to merge in parallel */
+    int bits = 0;
+    while (nthreads > 1 && (1 << bits) < 4*nthreads){
+        bits++;
+    }
+    gb->npartitions = 1 << bits;
+    gb->partition_shift = 64 - bits;
+
+    const size_t nslots = 64;
+    gb->bytes = int64_t( gb->npartitions*nslots*sizeof( GroupSlot ) );
+    if (budget > 0 && gb->bytes > budget){
+        return GPARSE_ERROR;
+    }
+    gb->tables = (GroupTable*)calloc( gb->npartitions, sizeof( GroupTable ) );
+    if (gb->tables == nullptr){
+        return GPARSE_ERROR;
+    }
+    for (int p = 0; p < gb->npartitions; p++){
+        if (group_table_init( gb->tables + p, nslots ) != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+    }
+
+    GroupByWorker* workers = (GroupByWorker*)malloc( sizeof( GroupByWorker )*nthreads );
+    Thread* threads = (Thread*)malloc( sizeof( Thread )*nthreads );
+    if (workers == nullptr || threads == nullptr){
+        free( workers );
+        free( threads );
+        return GPARSE_ERROR;
+    }
+    for (int w = 0; w < nthreads; w++){
+        workers[w].gb = gb;
+        workers[w].index = w;
+    }
+    int nstarted;
+    for (nstarted = 1; nstarted < nthreads; nstarted++){
+        if (thread_start( threads + nstarted, group_worker, workers + nstarted )){
+            break;
+        }
+    }
+    /* If some thread cannot start, the others take its rows */
+    group_worker( workers );
+    for (int w = 1; w < nstarted; w++){
+        thread_join( threads[w] );
+    }
+    free( workers );
+    free( threads );
+
+    return gb->failed ? GPARSE_ERROR : GPARSE_OK;
+}
+
+static void group_by_dispose( GroupBy* gb )
+{
+    for (int p = 0; gb->tables != nullptr && p < gb->npartitions; p++){
+        group_table_free( gb->tables + p );
+    }
+    free( gb->tables );
+    gb->tables = nullptr;
+}
+
+#endif /* H_GGROUPBY_H */
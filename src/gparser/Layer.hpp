@@ -0,0 +1,172 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Layers of a shared global scope.
+
+A layer is a parser whose global scope is searched first, and then the
+global scope of a base parser, which many layers can share. Creating a
+layer only copies the lists of functions and structure types of the base:
+the variables of the base are read in place, whatever their number.
+
+The base is never modified by its layers. The first time that a layer
+writes a variable of the base, the variable is copied to the scope of the
+layer, where the next searches find it. A variable is copied:
+
+    - when the interpreter assigns it
+    - when a program that reads or writes it is compiled, so the program
+      is bound to the variable of the layer even if it is written later
+    - when the host finds it with gParser_findVariable, as it may write it
+
+A member of a structure is copied with the whole instance, and the members
+already resolved in the layer point to the copy, while those resolved in
+the base are resolved again in the layer. The variables of the host
+are not copied: the variable of the layer points to the same memory.
+
+The functions of the base are shared until the first function of a script
+that reads or writes global variables. That one and the next ones are
+compiled again in the layer from their source, so they use the variables
+of the layer, as the expressions of the layer do. The base must be alive
+and must not change while it has layers, but layers of the same base can
+be used by different threads.
+*******************************************************************************/
+
+#ifndef H_GLAYER_H
+#define H_GLAYER_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Structure.hpp"
+#include "Function.hpp"
+
+/* Functions implemented in C, or in scripts without global variables, can
+ * be called by any layer */
+static inline int layer_can_share( const Function* f )
+{
+    return !function_is_script( f ) || script_body( f )->nsymbols == 0;
+}
+
+/* Shares the global scope and the structure types of the base with a new
+ * parser, and the first functions of the base that can be shared. The next
+ * ones are added by the caller, from parser->nfunctions. */
+static int layer_attach( Parser* parser, const Parser* base )
+{
+    int nshared = 0;
+    while (nshared < base->nfunctions && layer_can_share( base->functions[nshared] )){
+        nshared++;
+    }
+    if (nshared > 0){
+        parser->functions = (Function**)malloc( sizeof( Function* )*nshared );
+        if (parser->functions == nullptr){
+            return GPARSE_ERROR;
+        }
+        memcpy( parser->functions, base->functions, sizeof( Function* )*nshared );
+    }
+    parser->nfunctions = nshared;
+    parser->nbase_functions = nshared;
+
+    /* The structures are owned by the scope of the base */
+    if (base->ntypes > 0){
+        parser->types = (Struct**)malloc( sizeof( Struct* )*base->ntypes );
+        if (parser->types == nullptr){
+            return GPARSE_ERROR;
+        }
+        memcpy( parser->types, base->types, sizeof( Struct* )*base->ntypes );
+    }
+    parser->ntypes = base->ntypes;
+
+    parser->base = base;
+    parser->global.base = &base->global;
+    parser->option_explicit_decl = base->option_explicit_decl;
+    return GPARSE_OK;
+}
+
+/* Points the members of the instance to its copy */
+static void layer_rebind( BinaryTree< Variable >* node, const Variable* from, Variable* to )
+{
+    while (node != nullptr){
+        if (node->base == from){
+            node->base = to;
+            node->pvalue = (char*)to->pvalue + node->offset;
+        }
+        layer_rebind( node->upper_name, from, to );
+        node = node->lower_name;
+    }
+}
+
+/* Adds to the scope a copy of the variable of the base */
+static Variable* layer_copy( Struct* scope, const Variable* var )
+{
+    int status;
+    Variable* copy = scope->add_variable( var->name, var->name + strlen( var->name ), &status );
+    if (copy == nullptr || status != GPARSE_NEW_NAME){
+        return nullptr;
+    }
+    copy->type = var->type;
+    copy->size = var->size;
+    copy->base = nullptr;
+    if (var->free_data || var->value_in_block){
+        const int size = var->size > 0 ? var->size : numeric_type_size( var->type );
+        copy->pvalue = malloc( size );
+        if (copy->pvalue == nullptr){
+            return nullptr;
+        }
+        memcpy( copy->pvalue, var->pvalue, size );
+        copy->free_data = true;
+    }
+    else{
+        copy->pvalue = var->pvalue;
+    }
+    return copy;
+}
+
+/* Returns the variable of the scope which can be written instead of the
+ * variable found, copying it if it is of the base. Returns nullptr if there
+ * is not enough memory. */
+static Variable* layer_own( Struct* scope, Variable* var )
+{
+    if (scope->base == nullptr || var == nullptr){
+        return var;
+    }
+    const char* end = var->name + strlen( var->name );
+
+    if (var->base != nullptr){
+        /* Member of a structure */
+        Variable* instance = layer_own( scope, var->base );
+        if (instance == nullptr || instance == var->base){
+            return instance == nullptr ? nullptr : var;
+        }
+        layer_rebind( scope->vars, var->base, instance );
+        Variable* member = scope->find_own_variable( var->name, end );
+        if (member != nullptr){
+            return member;
+        }
+        int status;
+        member = scope->add_variable( var->name, end, &status );
+        if (member == nullptr){
+            return nullptr;
+        }
+        member->type = var->type;
+        member->size = var->size;
+        member->pvalue = (char*)instance->pvalue + var->offset;
+        member->free_data = false;
+        member->base = instance;
+        member->offset = var->offset;
+        return member;
+    }
+
+    /* Variables of the scope, or local variables of a function */
+    if (scope->base->find_variable( var->name, end ) != var){
+        return var;
+    }
+    Variable* own = scope->find_own_variable( var->name, end );
+    return own != nullptr ? own : layer_copy( scope, var );
+}
+
+#endif /* H_GLAYER_H */
@@ -82,6 +82,27 @@ const char* numeric_type_name( const int type )
     }
 }
 
+/* Size in bytes of a basic type, or 0 if it is not a basic type */
+int numeric_type_size( const int type )
+{
+    switch (type){
+    case t_bool:
+        return sizeof( _bool_ );
+    case t_byte:
+        return sizeof( _byte_ );
+    case t_int:
+        return sizeof( _int_ );
+    case t_l64:
+        return sizeof( _l64_ );
+    case t_float:
+        return sizeof( _float_ );
+    case t_double:
+        return sizeof( _double_ );
+    default:
+        return 0;
+    }
+}
+
 inline void numeric_copy( Numeric* ans, const Numeric a )
 {
     ans->pool = a.pool;
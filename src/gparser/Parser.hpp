@@ -76,7 +76,11 @@ static TokenType identify_keyword
     }
     else if (strtok_compare( "function", p, end ) == 0){
         *vartype = 0;
-        return token_struct;
+        return token_function;
+    }
+    else if (strtok_compare( "return", p, end ) == 0){
+        *vartype = 0;
+        return token_return;
     }
     else{
         return token_null;
@@ -206,7 +210,8 @@ static const char* parse_tokens
             p = p0;
         }
 
-        const char next = *(p + 1);
+        /* Nothing is read after the end of the string */
+        const char next = *p != '\0' ? *(p + 1) : '\0';
 
         if (code_end != nullptr && p0 > code_end){
             parser_push_name( parser, p0, p );
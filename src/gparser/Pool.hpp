@@ -0,0 +1,144 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Pools of parsers for short sessions.
+
+A session that declares a few variables and evaluates some expressions
+costs less than creating the parser, with its tokens and its tables, and
+releasing it, which frees the variables one by one. A pool keeps the
+parsers released, and hands them out again after a reset:
+
+    - the nodes and the names of the global variables are allocated in an
+      arena of the parser, which is rewound instead of freeing them, so the
+      next session fills the same chunks
+    - the values owned by the parser are freed, and those of the host are
+      not touched
+    - the functions, structure types, formulas, snapshots, states and
+      messages of the session are released, but not the arrays that hold
+      them, nor the parser
+
+If the pool has a base, its parsers are layers of it (see Layer.hpp), so a
+session reads the variables and calls the functions of the base without
+copying them, and the reset keeps the parser attached. The functions of the
+base that the layer compiles are released by the reset, and compiled again
+when the parser is taken.
+
+The parsers released are kept in shards, each one with its own lock. A
+thread releases the parsers to the shard of its identifier and takes them
+from there, so the threads seldom wait for each other, and a thread gets
+back the parser whose memory it used last. When its shard is empty, it
+takes a parser from the others, or a new one is created.
+*******************************************************************************/
+
+#ifndef H_GPOOL_H
+#define H_GPOOL_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Program.hpp"
+#include "Function.hpp"
+#include "Reactive.hpp"
+#include "Snapshot.hpp"
+#include "Thread.hpp"
+
+#define POOL_SHARD_BITS 4
+#define POOL_SHARDS (1 << POOL_SHARD_BITS)
+
+struct PoolShard
+{
+    volatile int lock;
+    Parser** parsers;       /* Parsers released, ready to be taken */
+    int nparsers;
+    int capacity;
+    char pad[64];           /* Keeps the locks in different cache lines */
+};
+
+struct Pool : gPool
+{
+    const Parser* base;
+    PoolShard shards[POOL_SHARDS];
+};
+
+/* Shard of the calling thread */
+static inline PoolShard* pool_shard( Pool* pool )
+{
+    const size_t id = thread_id();
+    const unsigned int h = ((unsigned int)id ^ (unsigned int)(id >> 12))*2654435761u;
+    return pool->shards + (h >> (32 - POOL_SHARD_BITS));
+}
+
+/* Takes a parser released, or returns nullptr if there is none. The shards
+ * of the other threads are skipped while they are locked. */
+static Parser* pool_take( Pool* pool )
+{
+    const int first = int( pool_shard( pool ) - pool->shards );
+    for (int i = 0; i < POOL_SHARDS; i++){
+        PoolShard* shard = pool->shards + ((first + i) & (POOL_SHARDS - 1));
+        if (i == 0){
+            spin_lock( &shard->lock );
+        }
+        else if (!atomic_cas( &shard->lock, 0, 1 )){
+            continue;
+        }
+        Parser* parser = shard->nparsers > 0 ? shard->parsers[--shard->nparsers] : nullptr;
+        spin_unlock( &shard->lock );
+        if (parser != nullptr){
+            return parser;
+        }
+    }
+    return nullptr;
+}
+
+/* Leaves the parser as the pool created it, keeping its memory */
+static void pool_reset( Pool* pool, Parser* parser )
+{
+    graph_dispose( parser );
+    snapshots_dispose( parser );
+    functions_release_own( parser );
+
+    /* The structures of the session are released with the global scope */
+    parser->ntypes = pool->base != nullptr ? pool->base->ntypes : 0;
+    parser->global.dispose();
+    for (int i = 0; i < parser->nblocks; i++){
+        free( parser->blocks[i] );
+    }
+    parser->nblocks = 0;
+    parser->arena.reset();
+
+    free( parser->err_msg );
+    parser->err_msg = nullptr;
+    parser->err_line = 0;
+    parser->err_column = 0;
+    free( parser->ans.pvalue );
+    parser->ans.pvalue = nullptr;
+    parser->ans.type = t_undefined;
+    parser->ans.size = 0;
+    parser->code_pos = nullptr;
+    parser->num_tokens = 0;
+    parser->option_explicit_decl = pool->base != nullptr
+        ? pool->base->option_explicit_decl : 0;
+}
+
+/* Resets the parser and keeps it in the shard of the thread. Returns
+ * GPARSE_ERROR if there is not enough memory to keep it. */
+static int pool_put( Pool* pool, Parser* parser )
+{
+    pool_reset( pool, parser );
+
+    PoolShard* shard = pool_shard( pool );
+    spin_lock( &shard->lock );
+    Parser** slot = array_push( &shard->parsers, &shard->nparsers, &shard->capacity );
+    if (slot != nullptr){
+        *slot = parser;
+    }
+    spin_unlock( &shard->lock );
+    return slot != nullptr ? GPARSE_OK : GPARSE_ERROR;
+}
+
+#endif /* H_GPOOL_H */
@@ -0,0 +1,1724 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Compiled expressions.
+
+A program is a flat list of typed instructions. Each instruction reads and
+writes registers, and each register holds the values of up to GPARSE_BATCH
+rows, so one pass through the instructions evaluates a whole block of rows.
+Scalar evaluation is just a block of one row.
+
+Boolean operators '&&' and '||' narrow the selection of active rows before
+evaluating their right operand, and jump over it when no row is left.
+
+Bound columns may have a validity bitmap. Then each register has a bitmap
+too, and each instruction combines the bitmaps of its operands 64 rows at a
+time: the result is null if any operand is null. Boolean operators follow
+the three-valued logic of SQL, so 'null && false' is false and
+'null || true' is true.
+
+A formula set is a program with several results. Its formulas are compiled
+one after the other, and the values computed for all the rows (outside of
+'&&' and '||') are remembered, so a later formula loading the same column or
+computing the same operation reuses the register. Such registers have more
+than one reference, and they are released with the last one. The result of
+each formula is stored in a variable of the program, bound to the output
+column, so its register is released at once.
+*******************************************************************************/
+
+#ifndef H_GPROGRAM_H
+#define H_GPROGRAM_H
+
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Variable.hpp"
+
+/* Number of rows evaluated at once in batch mode */
+#define GPARSE_BATCH 1024
+
+/* Size of each element in a register, enough for any basic type */
+#define REGISTER_ITEM 8
+
+enum OpCode
+{
+    op_load = 1,        /* dst = symbol[a] */
+    op_store,           /* symbol[b] = a */
+    op_cast,            /* dst = (type)a */
+
+    /* Unary */
+    op_neg,             /* dst = -a */
+    op_not,             /* dst = !a */
+    op_bitinv,          /* dst = ~a */
+
+    /* Arithmetic */
+    op_add,             /* dst = a + b */
+    op_sub,             /* dst = a - b */
+    op_mul,             /* dst = a * b */
+    op_div,             /* dst = a / b */
+    op_intdiv,          /* dst = a %% b */
+    op_remainder,       /* dst = a % b */
+    op_pow,             /* dst = a ^ b */
+
+    /* Comparison */
+    op_equal,           /* dst = a == b */
+    op_notequal,        /* dst = a != b */
+    op_less,            /* dst = a < b */
+    op_greater,         /* dst = a > b */
+    op_lessequal,       /* dst = a <= b */
+    op_greaterequal,    /* dst = a >= b */
+
+    /* Bitwise */
+    op_bitand,          /* dst = a & b */
+    op_bitor,           /* dst = a | b */
+    op_bitxor,          /* dst = a xor b */
+    op_lshift,          /* dst = a << b */
+    op_rshift,          /* dst = a >> b */
+
+    /* Short-circuit. Keeps the rows where 'a' does not determine the result,
+     * or jumps to 'b' if there is none */
+    op_and,             /* a && ... */
+    op_or,              /* a || ... */
+    op_logic_end,       /* dst = a for the kept rows, restores the selection.
+                         * 'b' is 1 for '&&' and 0 for '||' */
+
+    /* Functions */
+    op_call,            /* dst = func( args[a], ..., args[a + b - 1] ) */
+};
+
+/* Maximum number of arguments in a function call */
+#define GPARSE_MAX_ARGS 8
+
+struct Selection;
+struct Function;
+struct Program;
+
+/* Calls the function for one value: *result = f( *args[0], *args[1], ... ).
+ * Returns GPARSE_ERROR if the call fails. */
+typedef int( *f_call_scalar )
+    ( const Function* f, void* result, const void* const* args );
+
+/* Calls the function for the selected rows of a block:
+ * result[i] = f( args[0][i], args[1][i], ... ). Returns GPARSE_ERROR if the
+ * call fails. */
+typedef int( *f_call_batch )
+    ( const Function* f, void* result, const void* const* args, const Selection* sel );
+
+/* Creates the state of a window function from its constant parameter, or
+ * returns nullptr if the parameter is not valid. See Window.hpp. */
+struct Window;
+typedef Window*( *f_window_new )( const double param );
+
+/* Function callable from the expressions */
+struct Function
+{
+    const char* name;
+    int type;                       /* Type of the result */
+    int nargs;
+    int args_type[GPARSE_MAX_ARGS];
+    f_call_scalar scalar;           /* Used by the interpreter */
+    f_call_batch batch;             /* Used by compiled programs */
+    int pure;                       /* No side effects; it can be evaluated
+                                     * at compile time or for discarded rows */
+
+    /* Functions added with gParser_addFunction */
+    gFunction user;
+    gFunctionBatch user_batch;
+    void* data;                     /* Also the state of window functions */
+
+    f_window_new window;            /* Window functions */
+    char* source;                   /* Declaration of a function of a script,
+                                     * compiled again by the clones */
+};
+
+struct Instruction
+{
+    int op;         /* OpCode */
+    int type;       /* Type of the result */
+    int type_a;     /* Type of the operands */
+    int dst;        /* Destination register */
+    int a;          /* Left operand register, or symbol index for op_load */
+    int b;          /* Right operand register, symbol index for op_store
+                     * jump target, or number of arguments */
+    const Function* func;   /* Function for op_call */
+};
+
+/* Variable read or written by a program */
+struct Symbol
+{
+    Variable* var;  /* Variable in the parser scope */
+    char* column;   /* Bound column, or nullptr for the scalar value */
+    size_t stride;  /* Bytes between consecutive rows in the column */
+
+    /* Columns imported from Arrow. Booleans are packed as bits, starting at
+     * bit 'offset'. */
+    int packed;
+    size_t offset;
+
+    /* Rows with a value have the bit set, starting at bit 'validity_offset'.
+     * Assignments update the bitmap. */
+    unsigned char* validity;
+    size_t validity_offset;
+
+    /* Register with the values assigned by the program + 1, or 0. The loads
+     * after an assignment read it, so each row of a batch sees its own
+     * value even if the variable is not bound to a column. */
+    int reg;
+};
+
+/* Argument or local variable of a function. It lives in a register of the
+ * frame for the whole body. */
+struct Local
+{
+    Variable* var;  /* Variable in the scope of the function, used to
+                     * resolve the names while compiling */
+    int reg;
+};
+
+/* Constant loaded in a register before the evaluation */
+struct Constant
+{
+    Numeric::Pool value;
+    int type;
+    int reg;
+};
+
+/* Independent condition of a filter. Filters are split in the terms of the
+ * top level '&&', so they can be evaluated in any order. */
+struct Term
+{
+    int pc0;            /* First instruction */
+    int pc1;            /* Last instruction + 1 */
+    int result;         /* Register with the boolean result */
+    int safe;           /* It can be evaluated for rows already discarded */
+    double evaluated;   /* Rows evaluated, to estimate the selectivity */
+    double passed;      /* Rows evaluated as true */
+};
+
+/* Value computed for all the rows, which later instructions can reuse */
+struct Shared
+{
+    Instruction ins;    /* Instruction computing it, 'dst' is the register */
+    int nargs;          /* Arguments of op_call, in 'args' from ins.a */
+};
+
+/* Values remembered by a formula set. The least recently used ones are
+ * forgotten, so the registers are not kept alive forever. */
+#define PROGRAM_SHARED_MAX 64
+
+/* Rows active in a block */
+struct Selection
+{
+    const unsigned short* idx;  /* Active rows, or nullptr if all are active */
+    int n;                      /* Number of active rows */
+};
+
+/* Registers and selections for the evaluation of a program. The code and
+ * the constants of a program are not modified when evaluated, so each
+ * thread can run them with its own workspace, unless the program keeps
+ * state: program_filter_block reorders prog->terms and prog->order and
+ * counts prog->blocks, and the window functions keep theirs in
+ * prog->windows. Those programs run in a single thread. */
+struct Workspace
+{
+    char* registers;            /* nregisters blocks of 'capacity' items */
+    int nregisters;
+    int capacity;               /* Rows per register */
+    Selection* stack;           /* Nested selections of '&&' and '||' */
+    unsigned short* selections; /* Row indices for each selection level */
+    int depth;
+    _bool_* mask;               /* Rows selected by a filter */
+    unsigned short* filtered;   /* Two buffers of rows selected by a filter */
+    uint64_t* valid;            /* Validity bitmap of each register */
+    int words;                  /* Words of each validity bitmap */
+    const Program* prog;        /* Program of the registers and constants */
+    Workspace** frames;         /* Frames of the calls to functions of
+                                 * scripts, by instruction, or nullptr */
+    int nframes;
+
+    Workspace()
+    {
+        memset( this, 0, sizeof( Workspace ) );
+    }
+
+    ~Workspace()
+    {
+        free( registers );
+        free( stack );
+        free( selections );
+        free( mask );
+        free( filtered );
+        free( valid );
+        for (int i = 0; i < nframes; i++){
+            delete frames[i];
+        }
+        free( frames );
+    }
+
+    inline char* reg( const int r ) const
+    {
+        return registers + (size_t)r * capacity * REGISTER_ITEM;
+    }
+
+    inline uint64_t* valid_reg( const int r ) const
+    {
+        return valid + (size_t)r * words;
+    }
+};
+
+/* Plain data of a program, value-initialised by its constructor */
+struct ProgramData : gProgram
+{
+    Parser* parser;
+
+    Instruction* code;
+    int ncode;
+    int code_capacity;
+
+    Symbol* symbols;
+    int nsymbols;
+    int symbols_capacity;
+
+    Constant* constants;
+    int nconstants;
+    int constants_capacity;
+
+    /* Registers of the arguments of op_call */
+    int* args;
+    int nargs;
+    int args_capacity;
+
+    /* Arguments and local variables of a function body */
+    Local* locals;
+    int nlocals;
+    int locals_capacity;
+
+    /* Register allocation */
+    int nregisters;
+    int* free_registers;
+    int nfree;
+
+    /* Nesting of '&&' and '||' */
+    int depth;
+    int max_depth;
+
+    int result;     /* Register with the result */
+
+    /* Terms of filters, see gParser_compileFilter */
+    Term* terms;
+    int nterms;
+    int terms_capacity;
+    int* order;         /* Order of evaluation of the terms */
+    int reorder;        /* Terms can be reordered */
+    int blocks;         /* Blocks filtered since the last reordering */
+
+    int nulls;          /* Some bound column has a validity bitmap */
+
+    /* Formula sets, see gParser_compileSet */
+    int share;          /* Values are reused by later instructions */
+    int* refs;          /* References to each register */
+    Shared* shared;
+    int nshared;
+    int shared_capacity;
+    Variable** outputs; /* Variables assigned with the result of each
+                         * formula, bound to the output columns */
+    int* output_symbols;
+    int noutputs;
+
+    /* Calls to window functions, with their state in 'data' */
+    Function** windows;
+    int nwindows;
+    int windows_capacity;
+};
+
+struct Program : ProgramData
+{
+    Workspace ws;   /* Used by gProgram_eval and gProgram_evalBatch */
+    Numeric::Pool ans_pool;
+
+    Program() : ProgramData(), ans_pool()
+    {
+        ans.pvalue = &ans_pool;
+        result = -1;
+    }
+
+    ~Program()
+    {
+        free( code );
+        free( symbols );
+        free( constants );
+        free( args );
+        free( locals );
+        free( free_registers );
+        free( terms );
+        free( order );
+        free( refs );
+        free( shared );
+        for (int i = 0; i < noutputs; i++){
+            delete outputs[i];
+        }
+        free( outputs );
+        free( output_symbols );
+        for (int i = 0; i < nwindows; i++){
+            free( windows[i]->data );
+            free( windows[i] );
+        }
+        free( windows );
+    }
+};
+
+template< typename T >
+static T* array_push( T** parray, int* count, int* capacity )
+{
+    if (*count >= *capacity){
+        int new_capacity = *capacity > 0 ? 2 * *capacity : 16;
+        T* p = (T*)realloc( *parray, sizeof( T )*new_capacity );
+        if (p == nullptr){
+            return nullptr;
+        }
+        *parray = p;
+        *capacity = new_capacity;
+    }
+    T* item = *parray + *count;
+    memset( item, 0, sizeof( T ) );
+    (*count)++;
+    return item;
+}
+
+/* Returns a register not used by any live value. Pinned registers are never
+ * reused, as they are loaded before running the program. */
+static int program_alloc_register( Program* prog, const int pinned = 0 )
+{
+    if (prog->nfree > 0 && pinned == 0){
+        prog->nfree--;
+        const int reg = prog->free_registers[prog->nfree];
+        if (prog->share){
+            prog->refs[reg] = 1;
+        }
+        return reg;
+    }
+    int* p = (int*)realloc( prog->free_registers
+        , sizeof( int )*(prog->nregisters + 1) );
+    if (p == nullptr){
+        return -1;
+    }
+    prog->free_registers = p;
+    if (prog->share){
+        p = (int*)realloc( prog->refs, sizeof( int )*(prog->nregisters + 1) );
+        if (p == nullptr){
+            return -1;
+        }
+        prog->refs = p;
+        prog->refs[prog->nregisters] = 1;
+    }
+    return prog->nregisters++;
+}
+
+static void program_forget_operand( Program* prog, const int reg );
+
+/* Returns 1 if the register holds a variable: a local variable, or the
+ * values assigned to a symbol */
+static inline int program_owns_register( const Program* prog, const int reg )
+{
+    for (int i = 0; i < prog->nlocals; i++){
+        if (prog->locals[i].reg == reg){
+            return 1;
+        }
+    }
+    for (int i = 0; i < prog->nsymbols; i++){
+        if (prog->symbols[i].reg == reg + 1){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void program_free_register( Program* prog, const int reg )
+{
+    /* The registers of the variables are kept */
+    if (program_owns_register( prog, reg )){
+        return;
+    }
+    /* Shared values are released with the last reference */
+    if (prog->share){
+        if (--prog->refs[reg] > 0){
+            return;
+        }
+        program_forget_operand( prog, reg );
+    }
+    prog->free_registers[prog->nfree] = reg;
+    prog->nfree++;
+}
+
+static int program_emit( Program* prog, const int op, const int type
+    , const int type_a, const int dst, const int a, const int b )
+{
+    Instruction* ins = array_push
+        ( &prog->code, &prog->ncode, &prog->code_capacity );
+    if (ins == nullptr){
+        return -1;
+    }
+    ins->op = op;
+    ins->type = type;
+    ins->type_a = type_a;
+    ins->dst = dst;
+    ins->a = a;
+    ins->b = b;
+    return prog->ncode - 1;
+}
+
+static int program_is_safe( const Program* prog, const int pc0, const int pc1 );
+
+/**********/
+/* Shared */
+/**********/
+
+/* Returns 1 if the shared value is computed from the register */
+static int shared_uses( const Program* prog, const Shared* v, const int reg )
+{
+    switch (v->ins.op){
+    case op_load:
+        return 0;
+    case op_cast:
+    case op_neg:
+    case op_not:
+    case op_bitinv:
+        return v->ins.a == reg;
+    case op_call:
+        for (int k = 0; k < v->nargs; k++){
+            if (prog->args[v->ins.a + k] == reg){
+                return 1;
+            }
+        }
+        return 0;
+    default:
+        return v->ins.a == reg || v->ins.b == reg;
+    }
+}
+
+/* Forgets the shared value, releasing its register */
+static void program_forget( Program* prog, const int k )
+{
+    const int reg = prog->shared[k].ins.dst;
+    memmove( prog->shared + k, prog->shared + k + 1
+        , sizeof( Shared )*(prog->nshared - k - 1) );
+    prog->nshared--;
+    program_free_register( prog, reg );
+}
+
+/* Forgets the values computed from a released register, as the register
+ * will hold other values */
+static void program_forget_operand( Program* prog, const int reg )
+{
+    int k = 0;
+    while (k < prog->nshared){
+        if (shared_uses( prog, prog->shared + k, reg )){
+            /* Releasing it may forget others, so start again */
+            program_forget( prog, k );
+            k = 0;
+        }
+        else{
+            k++;
+        }
+    }
+}
+
+/* Forgets the loads of the symbol, after it is assigned, or all the loads
+ * if 'isym' is -1 */
+static void program_forget_symbol( Program* prog, const int isym )
+{
+    int k = 0;
+    while (k < prog->nshared){
+        const Instruction* ins = &prog->shared[k].ins;
+        if (ins->op == op_load && (isym < 0 || ins->a == isym)){
+            program_forget( prog, k );
+            k = 0;
+        }
+        else{
+            k++;
+        }
+    }
+}
+
+/* Register with the value of the instruction if it is already computed for
+ * all the rows, with a new reference, or -1. 'args' are the arguments of
+ * op_call. */
+static int program_find_shared
+    ( Program* prog, const Instruction* ins, const int* args, const int nargs )
+{
+    for (int k = 0; k < prog->nshared; k++){
+        const Shared* v = prog->shared + k;
+        if (v->ins.op != ins->op || v->ins.type != ins->type
+            || v->ins.type_a != ins->type_a || v->ins.func != ins->func){
+            continue;
+        }
+        int same;
+        if (ins->op == op_call){
+            same = v->nargs == nargs
+                && memcmp( prog->args + v->ins.a, args, sizeof( int )*nargs ) == 0;
+        }
+        else{
+            same = v->ins.a == ins->a && v->ins.b == ins->b;
+        }
+        if (same){
+            /* The most recently used values are forgotten last */
+            const Shared used = *v;
+            memmove( prog->shared + k, prog->shared + k + 1
+                , sizeof( Shared )*(prog->nshared - k - 1) );
+            prog->shared[prog->nshared - 1] = used;
+            prog->refs[used.ins.dst]++;
+            return used.ins.dst;
+        }
+    }
+    return -1;
+}
+
+/* Remembers the value computed by the instruction, if it is computed for
+ * all the rows and it has no side effects */
+static void program_remember( Program* prog, const int pc, const int nargs )
+{
+    const Instruction* ins = prog->code + pc;
+    if (prog->share == 0 || prog->depth > 0
+        || (ins->op == op_call && ins->func->pure == 0)){
+        return;
+    }
+    if (prog->nshared >= PROGRAM_SHARED_MAX){
+        program_forget( prog, 0 );
+    }
+    Shared* v = array_push( &prog->shared, &prog->nshared, &prog->shared_capacity );
+    if (v != nullptr){
+        v->ins = *ins;
+        v->nargs = nargs;
+        prog->refs[ins->dst]++;
+    }
+}
+
+/* Emits an instruction computing a new value, or reuses the register with
+ * the same value. Returns the register, or -1. */
+static int program_emit_value( Program* prog, const int op, const int type
+    , const int type_a, const int a, const int b )
+{
+    if (prog->share){
+        Instruction ins;
+        memset( &ins, 0, sizeof( Instruction ) );
+        ins.op = op;
+        ins.type = type;
+        ins.type_a = type_a;
+        ins.a = a;
+        ins.b = b;
+        const int reg = program_find_shared( prog, &ins, nullptr, 0 );
+        if (reg >= 0){
+            return reg;
+        }
+    }
+    const int reg = program_alloc_register( prog );
+    const int pc = reg < 0 ? -1 : program_emit( prog, op, type, type_a, reg, a, b );
+    if (pc < 0){
+        return -1;
+    }
+    program_remember( prog, pc, 0 );
+    return reg;
+}
+
+/* Removes an instruction, updating the jumps over it */
+static void program_remove( Program* prog, const int pc )
+{
+    memmove( prog->code + pc, prog->code + pc + 1
+        , sizeof( Instruction )*(prog->ncode - pc - 1) );
+    prog->ncode--;
+    for (int i = 0; i < prog->ncode; i++){
+        Instruction* ins = prog->code + i;
+        if ((ins->op == op_and || ins->op == op_or) && ins->b > pc){
+            ins->b--;
+        }
+    }
+}
+
+/* Adds a term evaluated by the filters */
+static int program_add_term
+    ( Program* prog, const int pc0, const int pc1, const int result )
+{
+    Term* term = array_push( &prog->terms, &prog->nterms, &prog->terms_capacity );
+    int* order = (int*)realloc( prog->order, sizeof( int )*prog->terms_capacity );
+    if (term == nullptr || order == nullptr){
+        return GPARSE_ERROR;
+    }
+    prog->order = order;
+    prog->order[prog->nterms - 1] = prog->nterms - 1;
+    term->pc0 = pc0;
+    term->pc1 = pc1;
+    term->result = result;
+    term->safe = program_is_safe( prog, pc0, pc1 );
+    return GPARSE_OK;
+}
+
+/* Returns the symbol index of the variable, adding it if necessary */
+static int program_symbol( Program* prog, Variable* var )
+{
+    for (int i = 0; i < prog->nsymbols; i++){
+        if (prog->symbols[i].var == var){
+            return i;
+        }
+    }
+    Symbol* sym = array_push
+        ( &prog->symbols, &prog->nsymbols, &prog->symbols_capacity );
+    if (sym == nullptr){
+        return -1;
+    }
+    sym->var = var;
+    return prog->nsymbols - 1;
+}
+
+/* Returns the register of the local variable, or -1 if it is not local */
+static int program_local( const Program* prog, const Variable* var )
+{
+    for (int i = 0; i < prog->nlocals; i++){
+        if (prog->locals[i].var == var){
+            return prog->locals[i].reg;
+        }
+    }
+    return -1;
+}
+
+/* Returns the register holding the constant. Equal constants share it. */
+static int program_constant( Program* prog, const Numeric* num )
+{
+    for (int i = 0; i < prog->nconstants; i++){
+        const Constant* c = prog->constants + i;
+        if (c->type == num->type
+            && memcmp( &c->value, &num->pool, sizeof( Numeric::Pool ) ) == 0){
+            return c->reg;
+        }
+    }
+    int reg = program_alloc_register( prog, 1 );
+    Constant* c = array_push
+        ( &prog->constants, &prog->nconstants, &prog->constants_capacity );
+    if (reg < 0 || c == nullptr){
+        return -1;
+    }
+    c->value = num->pool;
+    c->type = num->type;
+    c->reg = reg;
+    return reg;
+}
+
+/*************/
+/* Workspace */
+/*************/
+template< typename T >
+static void kernel_fill( void* dst, const T value, const int n )
+{
+    T* d = (T*)dst;
+    for (int i = 0; i < n; i++){
+        d[i] = value;
+    }
+}
+
+static void fill_constant( void* dst, const Constant* c, const int n )
+{
+    switch (c->type){
+    case t_bool: kernel_fill( dst, c->value.vbool, n ); break;
+    case t_byte: kernel_fill( dst, c->value.vbyte, n ); break;
+    case t_int: kernel_fill( dst, c->value.vint, n ); break;
+    case t_l64: kernel_fill( dst, c->value.vl64, n ); break;
+    case t_float: kernel_fill( dst, c->value.vfloat, n ); break;
+    case t_double: kernel_fill( dst, c->value.vdouble, n ); break;
+    }
+}
+
+/* Makes room for 'capacity' rows per register and loads the constants */
+static int workspace_prepare
+    ( Workspace* ws, const Program* prog, const int capacity )
+{
+    if (ws->prog == prog && ws->capacity >= capacity
+        && ws->nregisters == prog->nregisters && ws->depth == prog->max_depth){
+        return GPARSE_OK;
+    }
+
+    size_t size = (size_t)prog->nregisters * capacity * REGISTER_ITEM;
+    char* registers = (char*)realloc( ws->registers, size > 0 ? size : 1 );
+    Selection* stack = (Selection*)realloc
+        ( ws->stack, sizeof( Selection )*(prog->max_depth + 1) );
+    /* One more level for the rows of window functions which are not null */
+    unsigned short* selections = (unsigned short*)realloc( ws->selections
+        , sizeof( unsigned short )*capacity*(prog->max_depth + 2) );
+    _bool_* mask = (_bool_*)realloc( ws->mask, sizeof( _bool_ )*capacity );
+    unsigned short* filtered = (unsigned short*)realloc
+        ( ws->filtered, sizeof( unsigned short )*capacity * 2 );
+    const int words = (capacity + 63) / 64;
+    size_t valid_size = sizeof( uint64_t )*prog->nregisters*words;
+    uint64_t* valid = (uint64_t*)realloc( ws->valid, valid_size > 0 ? valid_size : 1 );
+    if (registers != nullptr) ws->registers = registers;
+    if (stack != nullptr) ws->stack = stack;
+    if (selections != nullptr) ws->selections = selections;
+    if (mask != nullptr) ws->mask = mask;
+    if (filtered != nullptr) ws->filtered = filtered;
+    if (valid != nullptr) ws->valid = valid;
+    if (registers == nullptr || stack == nullptr || selections == nullptr
+        || mask == nullptr || filtered == nullptr || valid == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    ws->capacity = capacity;
+    ws->nregisters = prog->nregisters;
+    ws->depth = prog->max_depth;
+    ws->words = words;
+    ws->prog = prog;
+
+    /* Constants are never null */
+    memset( ws->valid, 0xFF, valid_size );
+
+    for (int i = 0; i < prog->nconstants; i++){
+        const Constant* c = prog->constants + i;
+        fill_constant( ws->reg( c->reg ), c, capacity );
+    }
+
+    return GPARSE_OK;
+}
+
+/* Frame of the call to a function of a script at the instruction 'pc',
+ * kept by the workspace of the caller, so the calls of the next rows and
+ * blocks reuse it. Returns nullptr if there is not enough memory. */
+static Workspace* workspace_frame( Workspace* ws, const int pc )
+{
+    if (pc >= ws->nframes){
+        Workspace** frames = (Workspace**)realloc( ws->frames, sizeof( Workspace* )*(pc + 1) );
+        if (frames == nullptr){
+            return nullptr;
+        }
+        memset( frames + ws->nframes, 0, sizeof( Workspace* )*(pc + 1 - ws->nframes) );
+        ws->frames = frames;
+        ws->nframes = pc + 1;
+    }
+    if (ws->frames[pc] == nullptr){
+        ws->frames[pc] = new Workspace;
+    }
+    return ws->frames[pc];
+}
+
+/***********/
+/* Kernels */
+/***********/
+struct f_add{ template< typename T > static inline T apply( T a, T b ){ return T( a + b ); } };
+struct f_sub{ template< typename T > static inline T apply( T a, T b ){ return T( a - b ); } };
+struct f_mul{ template< typename T > static inline T apply( T a, T b ){ return T( a * b ); } };
+struct f_div{ template< typename T > static inline T apply( T a, T b ){ return T( a / b ); } };
+struct f_rem{ template< typename T > static inline T apply( T a, T b ){ return T( a % b ); } };
+struct f_pow{ template< typename T > static inline T apply( T a, T b ){ return T( pow( a, b ) ); } };
+struct f_bitand{ template< typename T > static inline T apply( T a, T b ){ return T( a & b ); } };
+struct f_bitor{ template< typename T > static inline T apply( T a, T b ){ return T( a | b ); } };
+struct f_bitxor{ template< typename T > static inline T apply( T a, T b ){ return T( a ^ b ); } };
+struct f_lshift{ template< typename T > static inline T apply( T a, T b ){ return T( a << b ); } };
+struct f_rshift{ template< typename T > static inline T apply( T a, T b ){ return T( a >> b ); } };
+struct f_equal{ template< typename T > static inline _bool_ apply( T a, T b ){ return a == b; } };
+struct f_notequal{ template< typename T > static inline _bool_ apply( T a, T b ){ return a != b; } };
+struct f_less{ template< typename T > static inline _bool_ apply( T a, T b ){ return a < b; } };
+struct f_greater{ template< typename T > static inline _bool_ apply( T a, T b ){ return a > b; } };
+struct f_lessequal{ template< typename T > static inline _bool_ apply( T a, T b ){ return a <= b; } };
+struct f_greaterequal{ template< typename T > static inline _bool_ apply( T a, T b ){ return a >= b; } };
+
+template< typename R, typename T, class F >
+static void kernel_binary
+    ( void* dst, const void* a, const void* b, const Selection* sel )
+{
+    R* _restrict_ d = (R*)dst;
+    const T* _restrict_ pa = (const T*)a;
+    const T* _restrict_ pb = (const T*)b;
+    const int n = sel->n;
+
+    if (sel->idx == nullptr){
+        /* Dense loop, the compiler can vectorize it */
+        for (int i = 0; i < n; i++){
+            d[i] = F::apply( pa[i], pb[i] );
+        }
+    }
+    else{
+        const unsigned short* idx = sel->idx;
+        for (int k = 0; k < n; k++){
+            const int i = idx[k];
+            d[i] = F::apply( pa[i], pb[i] );
+        }
+    }
+}
+
+template< class F >
+static int exec_arithmetic( const int type
+    , void* dst, const void* a, const void* b, const Selection* sel )
+{
+    switch (type){
+    case t_byte: kernel_binary< _byte_, _byte_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_int: kernel_binary< _int_, _int_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_l64: kernel_binary< _l64_, _l64_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_float: kernel_binary< _float_, _float_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_double: kernel_binary< _double_, _double_, F >( dst, a, b, sel ); return GPARSE_OK;
+    default: return GPARSE_ERROR;
+    }
+}
+
+template< class F >
+static int exec_integer( const int type
+    , void* dst, const void* a, const void* b, const Selection* sel )
+{
+    switch (type){
+    case t_bool: kernel_binary< _bool_, _bool_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_byte: kernel_binary< _byte_, _byte_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_int: kernel_binary< _int_, _int_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_l64: kernel_binary< _l64_, _l64_, F >( dst, a, b, sel ); return GPARSE_OK;
+    default: return GPARSE_ERROR;
+    }
+}
+
+template< class F >
+static int exec_floating( const int type
+    , void* dst, const void* a, const void* b, const Selection* sel )
+{
+    switch (type){
+    case t_float: kernel_binary< _float_, _float_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_double: kernel_binary< _double_, _double_, F >( dst, a, b, sel ); return GPARSE_OK;
+    default: return GPARSE_ERROR;
+    }
+}
+
+template< class F >
+static int exec_compare( const int type
+    , void* dst, const void* a, const void* b, const Selection* sel )
+{
+    switch (type){
+    case t_bool: kernel_binary< _bool_, _bool_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_byte: kernel_binary< _bool_, _byte_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_int: kernel_binary< _bool_, _int_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_l64: kernel_binary< _bool_, _l64_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_float: kernel_binary< _bool_, _float_, F >( dst, a, b, sel ); return GPARSE_OK;
+    case t_double: kernel_binary< _bool_, _double_, F >( dst, a, b, sel ); return GPARSE_OK;
+    default: return GPARSE_ERROR;
+    }
+}
+
+struct f_neg{ template< typename T > static inline T apply( T a ){ return T( -a ); } };
+struct f_not{ template< typename T > static inline T apply( T a ){ return !a; } };
+struct f_bitinv{ template< typename T > static inline T apply( T a ){ return T( ~a ); } };
+
+template< typename T, class F >
+static void kernel_unary( void* dst, const void* a, const Selection* sel )
+{
+    T* _restrict_ d = (T*)dst;
+    const T* _restrict_ pa = (const T*)a;
+    const int n = sel->n;
+
+    if (sel->idx == nullptr){
+        for (int i = 0; i < n; i++){
+            d[i] = F::apply( pa[i] );
+        }
+    }
+    else{
+        const unsigned short* idx = sel->idx;
+        for (int k = 0; k < n; k++){
+            const int i = idx[k];
+            d[i] = F::apply( pa[i] );
+        }
+    }
+}
+
+template< typename R, typename T >
+static void kernel_cast( void* dst, const void* a, const Selection* sel )
+{
+    R* _restrict_ d = (R*)dst;
+    const T* _restrict_ pa = (const T*)a;
+    const int n = sel->n;
+
+    if (sel->idx == nullptr){
+        for (int i = 0; i < n; i++){
+            d[i] = R( pa[i] );
+        }
+    }
+    else{
+        const unsigned short* idx = sel->idx;
+        for (int k = 0; k < n; k++){
+            const int i = idx[k];
+            d[i] = R( pa[i] );
+        }
+    }
+}
+
+template< typename R >
+static int exec_cast_from( const int type_a
+    , void* dst, const void* a, const Selection* sel )
+{
+    switch (type_a){
+    case t_bool: kernel_cast< R, _bool_ >( dst, a, sel ); return GPARSE_OK;
+    case t_byte: kernel_cast< R, _byte_ >( dst, a, sel ); return GPARSE_OK;
+    case t_int: kernel_cast< R, _int_ >( dst, a, sel ); return GPARSE_OK;
+    case t_l64: kernel_cast< R, _l64_ >( dst, a, sel ); return GPARSE_OK;
+    case t_float: kernel_cast< R, _float_ >( dst, a, sel ); return GPARSE_OK;
+    case t_double: kernel_cast< R, _double_ >( dst, a, sel ); return GPARSE_OK;
+    default: return GPARSE_ERROR;
+    }
+}
+
+static int exec_cast( const int type, const int type_a
+    , void* dst, const void* a, const Selection* sel )
+{
+    switch (type){
+    case t_bool: return exec_cast_from< _bool_ >( type_a, dst, a, sel );
+    case t_byte: return exec_cast_from< _byte_ >( type_a, dst, a, sel );
+    case t_int: return exec_cast_from< _int_ >( type_a, dst, a, sel );
+    case t_l64: return exec_cast_from< _l64_ >( type_a, dst, a, sel );
+    case t_float: return exec_cast_from< _float_ >( type_a, dst, a, sel );
+    case t_double: return exec_cast_from< _double_ >( type_a, dst, a, sel );
+    default: return GPARSE_ERROR;
+    }
+}
+
+/* Reads the symbol. Bound columns are only read in batch mode. */
+template< typename T >
+static void kernel_load( void* dst, const Symbol* sym, const size_t row0
+    , const Selection* sel, const int batch )
+{
+    T* _restrict_ d = (T*)dst;
+    const int n = sel->n;
+
+    if (batch == 0 || sym->column == nullptr){
+        const T value = *(const T*)sym->var->pvalue;
+        for (int i = 0; i < n; i++){
+            d[sel->idx == nullptr ? i : sel->idx[i]] = value;
+        }
+    }
+    else{
+        const char* col = sym->column + row0 * sym->stride;
+        const size_t stride = sym->stride;
+        if (sel->idx == nullptr){
+            if (stride == sizeof( T )){
+                memcpy( d, col, sizeof( T )*n );
+            }
+            else{
+                for (int i = 0; i < n; i++){
+                    d[i] = *(const T*)(col + i*stride);
+                }
+            }
+        }
+        else{
+            const unsigned short* idx = sel->idx;
+            for (int k = 0; k < n; k++){
+                const int i = idx[k];
+                d[i] = *(const T*)(col + i*stride);
+            }
+        }
+    }
+}
+
+/* Reads a column of booleans packed as bits, least significant bit first */
+static void kernel_load_bits( void* dst, const Symbol* sym, const size_t row0
+    , const Selection* sel )
+{
+    _bool_* _restrict_ d = (_bool_*)dst;
+    const unsigned char* bits = (const unsigned char*)sym->column;
+    const size_t first = sym->offset + row0;
+    const int n = sel->n;
+
+    for (int k = 0; k < n; k++){
+        const int i = sel->idx == nullptr ? k : sel->idx[k];
+        const size_t b = first + i;
+        d[i] = (bits[b >> 3] >> (b & 7)) & 1;
+    }
+}
+
+/* Writes the symbol. A scalar variable keeps the value of the last row. */
+template< typename T >
+static void kernel_store( const void* src, const Symbol* sym, const size_t row0
+    , const Selection* sel, const int batch )
+{
+    const T* s = (const T*)src;
+    const int n = sel->n;
+
+    if (n == 0){
+        return;
+    }
+    if (batch == 0 || sym->column == nullptr){
+        *(T*)sym->var->pvalue = s[sel->idx == nullptr ? n - 1 : sel->idx[n - 1]];
+    }
+    else{
+        char* col = sym->column + row0 * sym->stride;
+        const size_t stride = sym->stride;
+        for (int k = 0; k < n; k++){
+            const int i = sel->idx == nullptr ? k : sel->idx[k];
+            *(T*)(col + i*stride) = s[i];
+        }
+    }
+}
+
+#define EXEC_SYMBOL(kernel, type, ...) \
+    switch (type){ \
+    case t_bool: kernel< _bool_ >( __VA_ARGS__ ); break; \
+    case t_byte: kernel< _byte_ >( __VA_ARGS__ ); break; \
+    case t_int: kernel< _int_ >( __VA_ARGS__ ); break; \
+    case t_l64: kernel< _l64_ >( __VA_ARGS__ ); break; \
+    case t_float: kernel< _float_ >( __VA_ARGS__ ); break; \
+    case t_double: kernel< _double_ >( __VA_ARGS__ ); break; \
+    default: return GPARSE_ERROR; \
+    }
+
+/* Keeps the rows of 'in' where mask[i] == keep. There are no branches in the
+ * loop, so its cost does not depend on the selectivity. */
+static void narrow_selection( Selection* out, unsigned short* buffer
+    , const Selection* in, const _bool_* mask, const _bool_ keep )
+{
+    const int n = in->n;
+    int k = 0;
+
+    if (in->idx == nullptr){
+        for (int i = 0; i < n; i++){
+            buffer[k] = (unsigned short)i;
+            k += mask[i] == keep;
+        }
+    }
+    else{
+        for (int j = 0; j < n; j++){
+            const int i = in->idx[j];
+            buffer[k] = (unsigned short)i;
+            k += mask[i] == keep;
+        }
+    }
+
+    if (k == n){
+        /* Nothing is removed; dense selections remain dense */
+        *out = *in;
+    }
+    else{
+        out->idx = buffer;
+        out->n = k;
+    }
+}
+
+/* Returns true if the instructions can be evaluated for any row without
+ * side effects or faults, so there is no need to skip discarded rows */
+static int program_is_safe( const Program* prog, const int pc0, const int pc1 )
+{
+    for (int pc = pc0; pc < pc1; pc++){
+        switch (prog->code[pc].op){
+        case op_store:
+        case op_intdiv:
+        case op_remainder:
+            return 0;
+        case op_call:
+            if (prog->code[pc].func->pure == 0){
+                return 0;
+            }
+            break;
+        }
+    }
+    return 1;
+}
+
+/* Returns true if some instruction writes the register of a variable */
+static int program_writes_variables( const Program* prog, const int pc0, const int pc1 )
+{
+    for (int pc = pc0; pc < pc1; pc++){
+        if (program_owns_register( prog, prog->code[pc].dst )){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*********/
+/* Nulls */
+/*********/
+
+/* Number of bits set in the word */
+static inline int bitmap_count( uint64_t w )
+{
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return int( (w * 0x0101010101010101ULL) >> 56 );
+}
+
+/* Copies 'nbits' of the bitmap, starting at bit 'offset', into 64-bit
+ * words. The bits after the last one are set to 0. */
+static void bitmap_extract( uint64_t* dst, const unsigned char* src
+    , const size_t offset, const size_t nbits )
+{
+    const unsigned char* p = src + offset / 8;
+    const int shift = offset % 8;
+    const size_t nbytes = (nbits + shift + 7) / 8;
+    const size_t nwords = (nbits + 63) / 64;
+
+    for (size_t w = 0; w < nwords; w++){
+        uint64_t lo = 0;
+        for (int k = 0; k < 8 && w*8 + k < nbytes; k++){
+            lo |= uint64_t( p[w*8 + k] ) << (8*k);
+        }
+        if (shift != 0){
+            const uint64_t hi = w*8 + 8 < nbytes ? p[w*8 + 8] : 0;
+            lo = (lo >> shift) | (hi << (64 - shift));
+        }
+        dst[w] = lo;
+    }
+    if (nbits % 64 != 0){
+        dst[nwords - 1] &= (uint64_t( 1 ) << (nbits % 64)) - 1;
+    }
+}
+
+/* Packs 64 booleans as the bits of a word. They are read as bytes, since
+ * the rows out of the selection may hold any value. */
+static inline uint64_t pack_bools( const _bool_* v )
+{
+    const unsigned char* b = (const unsigned char*)v;
+    uint64_t bits = 0;
+    for (int i = 0; i < 64; i++){
+        bits |= uint64_t( b[i] != 0 ) << i;
+    }
+    return bits;
+}
+
+/* Updates the flag of the program after binding columns */
+static void program_update_nulls( Program* prog )
+{
+    prog->nulls = 0;
+    for (int i = 0; i < prog->nsymbols; i++){
+        const Symbol* sym = prog->symbols + i;
+        if (sym->column != nullptr && sym->validity != nullptr){
+            prog->nulls = 1;
+        }
+    }
+}
+
+/* Computes the validity of the result of the instruction for the first
+ * 'nrows' rows of the block, before the instruction is executed. Rows out of
+ * the selection get meaningless bits, which are never read. */
+static void program_validity( const Program* prog, const Workspace* ws
+    , const Instruction* ins, const size_t row0, const Selection* sel
+    , const int nrows )
+{
+    const int nwords = (nrows + 63) / 64;
+    uint64_t* _restrict_ d = ws->valid_reg( ins->dst );
+
+    switch (ins->op){
+    case op_load:{
+        const Symbol* sym = prog->symbols + ins->a;
+        if (sym->column != nullptr && sym->validity != nullptr){
+            bitmap_extract( d, sym->validity, sym->validity_offset + row0, nrows );
+        }
+        else{
+            memset( d, 0xFF, sizeof( uint64_t )*nwords );
+        }
+        break;
+    }
+    case op_store:{
+        const Symbol* sym = prog->symbols + ins->b;
+        if (sym->column == nullptr || sym->validity == nullptr){
+            break;
+        }
+        const uint64_t* va = ws->valid_reg( ins->a );
+        const size_t first = sym->validity_offset + row0;
+        for (int k = 0; k < sel->n; k++){
+            const int i = sel->idx == nullptr ? k : sel->idx[k];
+            const size_t b = first + i;
+            const unsigned char bit = (unsigned char)(1 << (b & 7));
+            if ((va[i >> 6] >> (i & 63)) & 1){
+                sym->validity[b >> 3] |= bit;
+            }
+            else{
+                sym->validity[b >> 3] &= (unsigned char)~bit;
+            }
+        }
+        break;
+    }
+
+    case op_and:
+    case op_or:
+        /* Only the selection changes */
+        break;
+
+    case op_logic_end:
+    case op_bitand:
+    case op_bitor:
+        if (ins->type == t_bool){
+            /* Three-valued logic. The left operand of op_logic_end is in
+             * 'dst', and it is kept where it determines the result. */
+            const int left = ins->op == op_logic_end ? ins->dst : ins->a;
+            const int right = ins->op == op_logic_end ? ins->a : ins->b;
+            const int is_and = ins->op == op_logic_end ? ins->b : ins->op == op_bitand;
+            const _bool_* a = (const _bool_*)ws->reg( left );
+            const _bool_* b = (const _bool_*)ws->reg( right );
+            const uint64_t* va = ws->valid_reg( left );
+            const uint64_t* vb = ws->valid_reg( right );
+            for (int w = 0; w < nwords; w++){
+                uint64_t pa = pack_bools( a + w*64 );
+                uint64_t pb = pack_bools( b + w*64 );
+                if (is_and){
+                    pa = ~pa;
+                    pb = ~pb;
+                }
+                /* Known if both are known, or one of them decides */
+                d[w] = (va[w] & vb[w]) | (va[w] & pa) | (vb[w] & pb);
+            }
+            break;
+        }
+        /* Bitwise operation of integers, as the arithmetic ones */
+        /* Fall through */
+    case op_add:
+    case op_sub:
+    case op_mul:
+    case op_div:
+    case op_intdiv:
+    case op_remainder:
+    case op_pow:
+    case op_equal:
+    case op_notequal:
+    case op_less:
+    case op_greater:
+    case op_lessequal:
+    case op_greaterequal:
+    case op_bitxor:
+    case op_lshift:
+    case op_rshift:{
+        const uint64_t* va = ws->valid_reg( ins->a );
+        const uint64_t* vb = ws->valid_reg( ins->b );
+        for (int w = 0; w < nwords; w++){
+            d[w] = va[w] & vb[w];
+        }
+        break;
+    }
+
+    case op_call:
+        memset( d, 0xFF, sizeof( uint64_t )*nwords );
+        for (int k = 0; k < ins->b; k++){
+            const uint64_t* va = ws->valid_reg( prog->args[ins->a + k] );
+            for (int w = 0; w < nwords; w++){
+                d[w] &= va[w];
+            }
+        }
+        break;
+
+    default:
+        /* Unary operators and casts */
+        if (ins->dst != ins->a){
+            memcpy( d, ws->valid_reg( ins->a ), sizeof( uint64_t )*nwords );
+        }
+    }
+}
+
+/* Version of narrow_selection for op_and and op_or that also keeps the null
+ * rows, since the right operand may still decide the result */
+static void narrow_selection_nulls( Selection* out, unsigned short* buffer
+    , const Selection* in, const _bool_* mask, const uint64_t* valid
+    , const _bool_ keep )
+{
+    const int n = in->n;
+    int k = 0;
+
+    for (int j = 0; j < n; j++){
+        const int i = in->idx == nullptr ? j : in->idx[j];
+        buffer[k] = (unsigned short)i;
+        k += (mask[i] == keep) | !((valid[i >> 6] >> (i & 63)) & 1);
+    }
+
+    if (k == n){
+        *out = *in;
+    }
+    else{
+        out->idx = buffer;
+        out->n = k;
+    }
+}
+
+/* Keeps the selected rows which are not null */
+static void select_valid( Selection* out, unsigned short* buffer
+    , const Selection* in, const uint64_t* valid )
+{
+    const int n = in->n;
+    int k = 0;
+
+    for (int j = 0; j < n; j++){
+        const int i = in->idx == nullptr ? j : in->idx[j];
+        buffer[k] = (unsigned short)i;
+        k += int( (valid[i >> 6] >> (i & 63)) & 1 );
+    }
+
+    if (k == n){
+        *out = *in;
+    }
+    else{
+        out->idx = buffer;
+        out->n = k;
+    }
+}
+
+/* Sets the null rows of a boolean register to false, as a filter does not
+ * select the rows where the condition is unknown */
+static void nulls_to_false( _bool_* r, const uint64_t* valid, const int n )
+{
+    for (int i = 0; i < n; i++){
+        r[i] &= (valid[i >> 6] >> (i & 63)) & 1;
+    }
+}
+
+/* Functions of scripts, see Function.hpp */
+static inline int function_is_script( const Function* f );
+static int script_call( const Function* f, Workspace* frame, const int capacity
+    , void* result, const void* const* args, const Selection* sel );
+
+/* Evaluates the instructions [pc0, pc1) for the selected rows of the block
+ * starting at 'row0' in the bound columns. If 'batch' is zero, the variables
+ * are read as scalars and the block has one row. */
+static int program_run_range( const Program* prog, Workspace* ws
+    , const size_t row0, const Selection* rows, const int pc0, const int pc1
+    , const int batch )
+{
+    Selection* sel = ws->stack;
+    *sel = *rows;
+
+    const Instruction* code = prog->code;
+
+    /* Rows of the block, for the validity bitmaps. Selections are sorted. */
+    const int nulls = prog->nulls && batch;
+    const int nrows = rows->idx == nullptr || rows->n == 0
+        ? rows->n : rows->idx[rows->n - 1] + 1;
+
+    for (int pc = pc0; pc < pc1; pc++){
+        const Instruction* ins = code + pc;
+        void* dst = ws->reg( ins->dst );
+
+        if (nulls){
+            program_validity( prog, ws, ins, row0, sel, nrows );
+        }
+
+        int status = GPARSE_OK;
+        switch (ins->op){
+        case op_load:{
+            const Symbol* sym = prog->symbols + ins->a;
+            if (sym->packed && batch && sym->column != nullptr){
+                kernel_load_bits( dst, sym, row0, sel );
+                break;
+            }
+            EXEC_SYMBOL( kernel_load, ins->type, dst, sym, row0, sel, batch );
+            break;
+        }
+        case op_store:{
+            const Symbol* sym = prog->symbols + ins->b;
+            EXEC_SYMBOL( kernel_store, ins->type, ws->reg( ins->a ), sym, row0, sel, batch );
+            break;
+        }
+        case op_cast:
+            status = exec_cast( ins->type, ins->type_a, dst, ws->reg( ins->a ), sel );
+            break;
+
+        case op_neg:
+            switch (ins->type){
+            case t_byte: kernel_unary< _byte_, f_neg >( dst, ws->reg( ins->a ), sel ); break;
+            case t_int: kernel_unary< _int_, f_neg >( dst, ws->reg( ins->a ), sel ); break;
+            case t_l64: kernel_unary< _l64_, f_neg >( dst, ws->reg( ins->a ), sel ); break;
+            case t_float: kernel_unary< _float_, f_neg >( dst, ws->reg( ins->a ), sel ); break;
+            case t_double: kernel_unary< _double_, f_neg >( dst, ws->reg( ins->a ), sel ); break;
+            default: return GPARSE_ERROR;
+            }
+            break;
+        case op_not:
+            kernel_unary< _bool_, f_not >( dst, ws->reg( ins->a ), sel );
+            break;
+        case op_bitinv:
+            switch (ins->type){
+            case t_byte: kernel_unary< _byte_, f_bitinv >( dst, ws->reg( ins->a ), sel ); break;
+            case t_int: kernel_unary< _int_, f_bitinv >( dst, ws->reg( ins->a ), sel ); break;
+            case t_l64: kernel_unary< _l64_, f_bitinv >( dst, ws->reg( ins->a ), sel ); break;
+            default: return GPARSE_ERROR;
+            }
+            break;
+
+        case op_add:
+            status = exec_arithmetic< f_add >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_sub:
+            status = exec_arithmetic< f_sub >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_mul:
+            status = exec_arithmetic< f_mul >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_div:
+            status = exec_floating< f_div >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_intdiv:
+        case op_remainder:{
+            /* Null rows usually hold a zero divisor, so they are skipped */
+            Selection valid = *sel;
+            if (nulls){
+                select_valid( &valid, ws->selections + (size_t)(ws->depth + 1) * ws->capacity
+                    , sel, ws->valid_reg( ins->dst ) );
+            }
+            if (ins->op == op_intdiv){
+                status = exec_integer< f_div >( ins->type, dst
+                    , ws->reg( ins->a ), ws->reg( ins->b ), &valid );
+            }
+            else{
+                status = exec_integer< f_rem >( ins->type, dst
+                    , ws->reg( ins->a ), ws->reg( ins->b ), &valid );
+            }
+            break;
+        }
+        case op_pow:
+            status = exec_floating< f_pow >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+
+        case op_equal:
+            status = exec_compare< f_equal >( ins->type_a, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_notequal:
+            status = exec_compare< f_notequal >( ins->type_a, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_less:
+            status = exec_compare< f_less >( ins->type_a, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_greater:
+            status = exec_compare< f_greater >( ins->type_a, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_lessequal:
+            status = exec_compare< f_lessequal >( ins->type_a, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_greaterequal:
+            status = exec_compare< f_greaterequal >( ins->type_a, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+
+        case op_bitand:
+            status = exec_integer< f_bitand >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_bitor:
+            status = exec_integer< f_bitor >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_bitxor:
+            status = exec_integer< f_bitxor >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_lshift:
+            status = exec_integer< f_lshift >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+        case op_rshift:
+            status = exec_integer< f_rshift >( ins->type, dst
+                , ws->reg( ins->a ), ws->reg( ins->b ), sel );
+            break;
+
+        case op_and:
+        case op_or:{
+            /* Keep the rows that still need the right operand */
+            const int level = int( sel - ws->stack ) + 1;
+            unsigned short* buffer = ws->selections + (size_t)level * ws->capacity;
+            const _bool_ keep = ins->op == op_and;
+            if (nulls){
+                narrow_selection_nulls( sel + 1, buffer, sel
+                    , (const _bool_*)ws->reg( ins->a ), ws->valid_reg( ins->a ), keep );
+            }
+            else{
+                narrow_selection( sel + 1, buffer, sel, (const _bool_*)ws->reg( ins->a ), keep );
+            }
+            sel++;
+            if (sel->n == 0){
+                /* Jump to op_logic_end */
+                pc = ins->b - 1;
+            }
+            break;
+        }
+        case op_logic_end:{
+            kernel_cast< _bool_, _bool_ >( dst, ws->reg( ins->a ), sel );
+            sel--;
+            break;
+        }
+
+        case op_call:{
+            const void* args[GPARSE_MAX_ARGS];
+            for (int k = 0; k < ins->b; k++){
+                args[k] = ws->reg( prog->args[ins->a + k] );
+            }
+            Selection valid = *sel;
+            if (nulls && ins->func->window != nullptr){
+                /* Null values do not enter the window */
+                select_valid( &valid, ws->selections + (size_t)(ws->depth + 1) * ws->capacity
+                    , sel, ws->valid_reg( ins->dst ) );
+            }
+            if (function_is_script( ins->func )){
+                Workspace* frame = workspace_frame( ws, pc );
+                status = frame != nullptr
+                    ? script_call( ins->func, frame, ws->capacity, dst, args, &valid )
+                    : GPARSE_ERROR;
+            }
+            else{
+                status = ins->func->batch( ins->func, dst, args, &valid );
+            }
+            break;
+        }
+
+        default:
+            return GPARSE_ERROR;
+        }
+        if (status != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+    }
+
+    return GPARSE_OK;
+}
+
+/* Evaluates the program for the rows [row0, row0 + n) */
+static inline int program_run( const Program* prog, Workspace* ws
+    , const size_t row0, const int n, const int batch )
+{
+    Selection rows;
+    rows.idx = nullptr;
+    rows.n = n;
+    return program_run_range( prog, ws, row0, &rows, 0, prog->ncode, batch );
+}
+
+/***********/
+/* Filters */
+/***********/
+
+/* Blocks filtered between reorderings of the terms */
+#define FILTER_REORDER 16
+
+static inline int count_true( const _bool_* mask, const int n )
+{
+    int count = 0;
+    for (int i = 0; i < n; i++){
+        count += mask[i];
+    }
+    return count;
+}
+
+/* Sorts the terms so the ones discarding more rows per instruction are
+ * evaluated first. The statistics decay, so the order follows the data. */
+static void filter_reorder( Program* prog )
+{
+    double score[64];
+    const int nterms = prog->nterms < 64 ? prog->nterms : 64;
+
+    for (int k = 0; k < nterms; k++){
+        const Term* term = prog->terms + k;
+        const double discarded = term->evaluated > 0
+            ? 1 - term->passed / term->evaluated : 0;
+        score[k] = discarded / (term->pc1 - term->pc0 + 1);
+    }
+
+    /* Insertion sort, as there are few terms */
+    for (int i = 1; i < nterms; i++){
+        const int k = prog->order[i];
+        int j = i - 1;
+        while (j >= 0 && score[prog->order[j]] < score[k]){
+            prog->order[j + 1] = prog->order[j];
+            j--;
+        }
+        prog->order[j + 1] = k;
+    }
+
+    for (int k = 0; k < prog->nterms; k++){
+        prog->terms[k].evaluated *= 0.5;
+        prog->terms[k].passed *= 0.5;
+    }
+}
+
+/* Evaluates the filter for the rows [row0, row0 + n). The selected rows are
+ * returned either in 'ws->mask' (dense) or in 'out' (selection).
+ * Safe terms are evaluated for all the rows while most of them are still
+ * selected, and combined with bitwise operations. Otherwise only the selected
+ * rows are evaluated.
+ * @return 1 if the result is in the mask, 0 if it is in 'out', or -1 */
+static int program_filter_block( Program* prog, Workspace* ws
+    , const size_t row0, const int n, Selection* out )
+{
+    Selection dense;
+    dense.idx = nullptr;
+    dense.n = n;
+    *out = dense;
+
+    int in_mask = 0;
+    _bool_* _restrict_ mask = ws->mask;
+
+    for (int k = 0; k < prog->nterms; k++){
+        Term* term = prog->terms + prog->order[k];
+
+        if (term->safe && (in_mask || out->n * 4 >= n)){
+            /* Vectorized evaluation of all the rows */
+            if (program_run_range( prog, ws, row0, &dense, term->pc0, term->pc1, 1 )){
+                return -1;
+            }
+            _bool_* _restrict_ r = (_bool_*)ws->reg( term->result );
+            if (prog->nulls){
+                nulls_to_false( r, ws->valid_reg( term->result ), n );
+            }
+
+            if (in_mask){
+                for (int i = 0; i < n; i++){
+                    mask[i] = mask[i] & r[i];
+                }
+            }
+            else if (out->idx == nullptr){
+                memcpy( mask, r, sizeof( _bool_ )*n );
+            }
+            else{
+                memset( mask, 0, sizeof( _bool_ )*n );
+                for (int j = 0; j < out->n; j++){
+                    mask[out->idx[j]] = r[out->idx[j]];
+                }
+            }
+            in_mask = 1;
+            term->evaluated += n;
+            term->passed += count_true( r, n );
+        }
+        else{
+            if (in_mask){
+                narrow_selection( out, ws->filtered, &dense, mask, 1 );
+                in_mask = 0;
+            }
+            if (out->n == 0){
+                return 0;
+            }
+            if (program_run_range( prog, ws, row0, out, term->pc0, term->pc1, 1 )){
+                return -1;
+            }
+            if (prog->nulls){
+                nulls_to_false( (_bool_*)ws->reg( term->result )
+                    , ws->valid_reg( term->result ), n );
+            }
+            /* Alternate the buffers, so the input is not overwritten */
+            const int evaluated = out->n;
+            Selection in = *out;
+            unsigned short* buffer = in.idx == ws->filtered
+                ? ws->filtered + ws->capacity : ws->filtered;
+            narrow_selection( out, buffer, &in
+                , (const _bool_*)ws->reg( term->result ), 1 );
+            term->evaluated += evaluated;
+            term->passed += out->n;
+        }
+    }
+
+    if (prog->reorder){
+        prog->blocks++;
+        if (prog->blocks >= FILTER_REORDER){
+            filter_reorder( prog );
+            prog->blocks = 0;
+        }
+    }
+
+    return in_mask;
+}
+
+#endif /* H_GPROGRAM_H */
@@ -0,0 +1,338 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Formulas and their dependencies.
+
+    gParser_define( parser, "margin", "price - cost" );
+    gParser_define( parser, "ratio", "margin / price" );
+    ...
+    gParser_write( parser, "price", &new_price );
+    gParser_update( parser );
+
+A formula is compiled once into a program that assigns its variable. The
+variables read by the program are its inputs, and the formula is added to
+the users of each input, so the variables and the formulas form a graph
+without cycles.
+
+Changed variables are queued. An update collects the formulas reachable
+from them, sorts them by rank (a formula has a higher rank than any of its
+inputs) and evaluates them in that order, so each one runs once, after its
+inputs. A formula whose inputs did not change is skipped, and a formula
+whose value did not change does not propagate.
+*******************************************************************************/
+
+#ifndef H_GREACTIVE_H
+#define H_GREACTIVE_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Program.hpp"
+
+/* Returns the node of the variable, adding it if necessary, or -1 */
+static int graph_node( Parser* parser, Variable* var )
+{
+    if (var->node > 0){
+        return var->node - 1;
+    }
+    Node* node = array_push( &parser->nodes, &parser->nnodes, &parser->nodes_capacity );
+    if (node == nullptr){
+        return -1;
+    }
+    node->var = var;
+    var->node = parser->nnodes;
+    return parser->nnodes - 1;
+}
+
+/* Returns 1 if the node 'to' is a user of 'from', maybe through other
+ * formulas */
+static int graph_reaches( const Parser* parser, const int from, const int to )
+{
+    if (from == to){
+        return 1;
+    }
+    char* visited = (char*)calloc( parser->nnodes, 1 );
+    int* stack = (int*)malloc( sizeof( int )*parser->nnodes );
+    int found = visited == nullptr || stack == nullptr ? -1 : 0;
+    int n = 0;
+    if (found == 0){
+        stack[n++] = from;
+        visited[from] = 1;
+    }
+    while (n > 0 && found == 0){
+        const Node* node = parser->nodes + stack[--n];
+        for (int k = 0; k < node->nusers; k++){
+            const int u = node->users[k];
+            if (u == to){
+                found = 1;
+                break;
+            }
+            if (visited[u] == 0){
+                visited[u] = 1;
+                stack[n++] = u;
+            }
+        }
+    }
+    free( visited );
+    free( stack );
+    return found;
+}
+
+/* Raises the rank of the users of the node over its own rank */
+static int graph_raise_rank( Parser* parser, const int inode )
+{
+    int* stack = nullptr;
+    int n = 0;
+    int capacity = 0;
+    int status = GPARSE_OK;
+
+    int* top = array_push( &stack, &n, &capacity );
+    if (top == nullptr){
+        return GPARSE_ERROR;
+    }
+    *top = inode;
+    while (n > 0 && status == GPARSE_OK){
+        const Node* node = parser->nodes + stack[--n];
+        for (int k = 0; k < node->nusers; k++){
+            Node* user = parser->nodes + node->users[k];
+            if (user->rank <= node->rank){
+                /* Ranks only grow and there are no cycles, so it ends */
+                user->rank = node->rank + 1;
+                top = array_push( &stack, &n, &capacity );
+                if (top == nullptr){
+                    status = GPARSE_ERROR;
+                    break;
+                }
+                *top = node->users[k];
+            }
+        }
+    }
+    free( stack );
+    return status;
+}
+
+/* Removes the formula of the node and its edges */
+static void graph_clear( Parser* parser, const int inode )
+{
+    Node* node = parser->nodes + inode;
+    for (int k = 0; k < node->ninputs; k++){
+        Node* input = parser->nodes + node->inputs[k];
+        for (int j = 0; j < input->nusers; j++){
+            if (input->users[j] == inode){
+                input->users[j] = input->users[input->nusers - 1];
+                input->nusers--;
+                break;
+            }
+        }
+    }
+    node->ninputs = 0;
+    delete node->prog;
+    node->prog = nullptr;
+}
+
+/* Queues the node, so the next update evaluates its users */
+static int graph_touch( Parser* parser, const int inode )
+{
+    Node* node = parser->nodes + inode;
+    if (node->queued){
+        return GPARSE_OK;
+    }
+    int* p = array_push( &parser->dirty, &parser->ndirty, &parser->dirty_capacity );
+    if (p == nullptr){
+        return GPARSE_ERROR;
+    }
+    *p = inode;
+    node->queued = 1;
+    return GPARSE_OK;
+}
+
+/* Makes the program the formula of the variable. The program is owned by
+ * the graph from now on, even if there is an error. */
+static int graph_define( Parser* parser, Variable* var, Program* prog )
+{
+    const int self = graph_node( parser, var );
+    if (self < 0){
+        delete prog;
+        return GPARSE_ERROR;
+    }
+
+    /* The inputs cannot depend on the variable */
+    for (int i = 0; i < prog->nsymbols; i++){
+        Variable* input = prog->symbols[i].var;
+        if (input == var){
+            continue;
+        }
+        const int k = input->node > 0 ? input->node - 1 : -1;
+        if (k >= 0 && graph_reaches( parser, self, k ) != 0){
+            parser_error( parser, "Circular dependency with the variable '%s'"
+                , input->name );
+            delete prog;
+            return GPARSE_ERROR;
+        }
+    }
+
+    graph_clear( parser, self );
+
+    int rank = 0;
+    for (int i = 0; i < prog->nsymbols; i++){
+        if (prog->symbols[i].var == var){
+            continue;
+        }
+        const int k = graph_node( parser, prog->symbols[i].var );
+        Node* node = parser->nodes + self;
+        int* input = k >= 0 ? array_push
+            ( &node->inputs, &node->ninputs, &node->inputs_capacity ) : nullptr;
+        Node* in = parser->nodes + k;
+        int* user = input != nullptr ? array_push
+            ( &in->users, &in->nusers, &in->users_capacity ) : nullptr;
+        if (user == nullptr){
+            delete prog;
+            graph_clear( parser, self );
+            return GPARSE_ERROR;
+        }
+        *input = k;
+        *user = self;
+        rank = in->rank + 1 > rank ? in->rank + 1 : rank;
+    }
+
+    Node* node = parser->nodes + self;
+    node->prog = prog;
+    if (rank > node->rank){
+        node->rank = rank;
+    }
+    return graph_raise_rank( parser, self );
+}
+
+/* Evaluates the formula with the current values of its inputs. Returns 1 if
+ * the value of the variable changed, 0 if not, or -1 */
+static int graph_eval( Node* node )
+{
+    Program* prog = node->prog;
+    const Variable* var = node->var;
+    Numeric::Pool old;
+    const int size = var->size;
+    memcpy( &old, var->pvalue, size );
+
+    if (workspace_prepare( &prog->ws, prog, 1 ) != GPARSE_OK
+        || program_run( prog, &prog->ws, 0, 1, 0 ) != GPARSE_OK){
+        return -1;
+    }
+    return memcmp( &old, var->pvalue, size ) != 0;
+}
+
+/* Evaluates the formulas that depend on the queued variables */
+static int graph_update( Parser* parser )
+{
+    Node* nodes = parser->nodes;
+    int status = GPARSE_OK;
+
+    /* Nodes reachable from the queued variables. The list starts with the
+     * queued ones, and grows while it is traversed. A queued formula is
+     * evaluated too if some of its inputs changed. */
+    int* list = (int*)malloc( sizeof( int )*(parser->nnodes + 1) );
+    int n = 0;
+    if (list == nullptr){
+        return GPARSE_ERROR;
+    }
+    for (int k = 0; k < parser->ndirty; k++){
+        list[n++] = parser->dirty[k];
+        nodes[parser->dirty[k]].reached = 1;
+        nodes[parser->dirty[k]].changed = 1;
+    }
+    for (int k = 0; k < n; k++){
+        const Node* node = nodes + list[k];
+        for (int j = 0; j < node->nusers; j++){
+            const int u = node->users[j];
+            if (nodes[u].reached == 0){
+                nodes[u].reached = 1;
+                list[n++] = u;
+            }
+        }
+    }
+
+    /* Sort the formulas by rank, counting the formulas of each rank */
+    int max_rank = 0;
+    int nformulas = 0;
+    for (int k = 0; k < n; k++){
+        if (nodes[list[k]].prog != nullptr){
+            max_rank = nodes[list[k]].rank > max_rank ? nodes[list[k]].rank : max_rank;
+            nformulas++;
+        }
+    }
+    int* start = (int*)calloc( max_rank + 2, sizeof( int ) );
+    int* order = (int*)malloc( sizeof( int )*(nformulas + 1) );
+    if (start == nullptr || order == nullptr){
+        status = GPARSE_ERROR;
+    }
+    else{
+        for (int k = 0; k < n; k++){
+            if (nodes[list[k]].prog != nullptr){
+                start[nodes[list[k]].rank + 1]++;
+            }
+        }
+        for (int r = 1; r <= max_rank + 1; r++){
+            start[r] += start[r - 1];
+        }
+        for (int k = 0; k < n; k++){
+            if (nodes[list[k]].prog != nullptr){
+                order[start[nodes[list[k]].rank]++] = list[k];
+            }
+        }
+
+        /* Evaluate the formulas with some changed input. A queued formula
+         * still propagates, even if its value is the same. */
+        for (int k = 0; k < nformulas && status == GPARSE_OK; k++){
+            Node* node = nodes + order[k];
+            int changed = 0;
+            for (int j = 0; j < node->ninputs && changed == 0; j++){
+                changed = nodes[node->inputs[j]].changed;
+            }
+            if (changed){
+                const int c = graph_eval( node );
+                if (c < 0){
+                    parser_error( parser, "Cannot evaluate the formula of '%s'"
+                        , node->var->name );
+                    status = GPARSE_ERROR;
+                }
+                node->changed = node->changed || c > 0;
+            }
+        }
+    }
+
+    for (int k = 0; k < n; k++){
+        nodes[list[k]].queued = 0;
+        nodes[list[k]].reached = 0;
+        nodes[list[k]].changed = 0;
+    }
+    parser->ndirty = 0;
+    free( list );
+    free( start );
+    free( order );
+    return status;
+}
+
+/* Releases the formulas and the graph */
+static void graph_dispose( Parser* parser )
+{
+    for (int i = 0; i < parser->nnodes; i++){
+        Node* node = parser->nodes + i;
+        delete node->prog;
+        free( node->inputs );
+        free( node->users );
+    }
+    free( parser->nodes );
+    free( parser->dirty );
+    parser->nodes = nullptr;
+    parser->nnodes = 0;
+    parser->nodes_capacity = 0;
+    parser->dirty = nullptr;
+    parser->ndirty = 0;
+    parser->dirty_capacity = 0;
+}
+
+#endif /* H_GREACTIVE_H */
@@ -0,0 +1,317 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Registry of named formulas, replaced while other threads evaluate them.
+
+Each formula has a slot with a pointer to its current version, a compiled
+program. A writer compiles the new version and swaps the pointer, so the
+readers that already took the old one finish with it, and the next ones
+take the new one. The readers never wait for the writers, nor the writers
+for the readers.
+
+The old versions are reclaimed by epochs. Each reader announces the epoch
+of the registry while it evaluates, and 0 when it is done. A writer tags
+the version it replaces with the current epoch, and then advances the
+epoch, so a reader that announces a later epoch takes the new version. The
+old version is released when every reader that is evaluating announced a
+later epoch. Readers that stay out of the registry do not hold back any
+version.
+
+Each reader is used by a single thread, and keeps a workspace for each
+formula, prepared again when the version changes. The programs of the
+registry cannot assign variables or call functions with side effects, as
+several threads run them at once. The writers compile the formulas with
+the parser of the registry, so they take a lock among them.
+*******************************************************************************/
+
+#ifndef H_GREGISTRY_H
+#define H_GREGISTRY_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+#include "Thread.hpp"
+
+/* Compiled program of a formula */
+struct FormulaVersion
+{
+    Program* prog;
+    int serial;     /* Different for each version of the registry */
+    int epoch;      /* Epoch when it was replaced */
+};
+
+struct Formula
+{
+    char* name;
+    FormulaVersion* volatile version;   /* Current version, or nullptr */
+};
+
+struct Reader : gReader
+{
+    /* Epoch when the current evaluation started, or 0. It has its own
+     * cache line, as the writers read it. */
+    volatile int epoch;
+    char pad[60];
+    Workspace* ws;          /* Workspace of each formula */
+    int* serials;           /* Version prepared in each workspace, or 0 */
+};
+
+struct Registry : gRegistry
+{
+    Parser* parser;
+    volatile int lock;      /* Lock of the writers */
+    volatile int epoch;
+    int serial;
+    Formula* formulas;      /* Never moved, so the readers index them */
+    int capacity;
+    Reader** readers;
+    int nreaders;
+    int readers_capacity;
+    FormulaVersion** retired;
+    int nretired;
+    int retired_capacity;
+};
+
+static inline void registry_lock( Registry* reg )
+{
+    while (!atomic_cas( &reg->lock, 0, 1 )){
+        thread_yield();
+    }
+}
+
+static inline void registry_unlock( Registry* reg )
+{
+    spin_unlock( &reg->lock );
+}
+
+static void version_free( FormulaVersion* version )
+{
+    if (version != nullptr){
+        delete version->prog;
+        free( version );
+    }
+}
+
+static Registry* registry_create( Parser* parser, const int capacity )
+{
+    Registry* reg = (Registry*)calloc( 1, sizeof( Registry ) );
+    if (reg == nullptr){
+        return nullptr;
+    }
+    reg->formulas = (Formula*)calloc( size_t( capacity ), sizeof( Formula ) );
+    if (reg->formulas == nullptr){
+        free( reg );
+        return nullptr;
+    }
+    reg->parser = parser;
+    reg->capacity = capacity;
+    reg->epoch = 1;
+    return reg;
+}
+
+/* Releases the versions replaced before the epoch of every reader which
+ * is evaluating. The writer lock is taken. */
+static void registry_reclaim( Registry* reg )
+{
+    /* The readers announce their epoch before they take a version, and the
+     * fence orders the swap before these loads */
+    atomic_fence();
+    int oldest = atomic_load( &reg->epoch );
+    for (int i = 0; i < reg->nreaders; i++){
+        const int e = atomic_load( &reg->readers[i]->epoch );
+        if (e != 0 && e < oldest){
+            oldest = e;
+        }
+    }
+
+    int n = 0;
+    for (int i = 0; i < reg->nretired; i++){
+        FormulaVersion* version = reg->retired[i];
+        if (version->epoch < oldest){
+            version_free( version );
+        }
+        else{
+            reg->retired[n++] = version;
+        }
+    }
+    reg->nretired = n;
+}
+
+/* Swaps the version of the formula. The writer lock is taken. */
+static int registry_swap( Registry* reg, Formula* formula, FormulaVersion* version )
+{
+    FormulaVersion** slot = array_push( &reg->retired, &reg->nretired, &reg->retired_capacity );
+    if (slot == nullptr){
+        return GPARSE_ERROR;
+    }
+    reg->nretired--;
+
+    FormulaVersion* old = (FormulaVersion*)atomic_exchange_ptr
+        ( (void* volatile*)&formula->version, version );
+    if (old != nullptr){
+        old->epoch = atomic_load( &reg->epoch );
+        reg->retired[reg->nretired++] = old;
+        atomic_add( &reg->epoch, 1 );
+    }
+    registry_reclaim( reg );
+    return GPARSE_OK;
+}
+
+static int registry_find( Registry* reg, const char* name )
+{
+    const int n = atomic_load( &reg->nformulas );
+    for (int i = 0; i < n; i++){
+        if (strcmp( reg->formulas[i].name, name ) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Sets the program as the new version of the formula. The writer lock is
+ * taken. */
+static int registry_set( Registry* reg, const char* name, Program* prog )
+{
+    int index = registry_find( reg, name );
+    if (index < 0){
+        if (reg->nformulas >= reg->capacity){
+            return GPARSE_ERROR;
+        }
+        index = reg->nformulas;
+        reg->formulas[index].name = (char*)malloc( strlen( name ) + 1 );
+        if (reg->formulas[index].name == nullptr){
+            return GPARSE_ERROR;
+        }
+        strcpy( reg->formulas[index].name, name );
+        reg->formulas[index].version = nullptr;
+        /* The readers see the name before the count */
+        atomic_store( &reg->nformulas, index + 1 );
+    }
+
+    FormulaVersion* version = nullptr;
+    if (prog != nullptr){
+        version = (FormulaVersion*)malloc( sizeof( FormulaVersion ) );
+        if (version == nullptr){
+            return GPARSE_ERROR;
+        }
+        version->prog = prog;
+        version->serial = ++reg->serial;
+        version->epoch = 0;
+    }
+    if (registry_swap( reg, reg->formulas + index, version ) != GPARSE_OK){
+        free( version );
+        return GPARSE_ERROR;
+    }
+    return GPARSE_OK;
+}
+
+static void registry_dispose( Registry* reg )
+{
+    for (int i = 0; i < reg->nformulas; i++){
+        free( reg->formulas[i].name );
+        version_free( reg->formulas[i].version );
+    }
+    for (int i = 0; i < reg->nretired; i++){
+        version_free( reg->retired[i] );
+    }
+    for (int i = 0; i < reg->nreaders; i++){
+        Reader* r = reg->readers[i];
+        delete[] r->ws;
+        free( r->serials );
+        free( r );
+    }
+    free( reg->formulas );
+    free( reg->retired );
+    free( reg->readers );
+    free( reg );
+}
+
+static void reader_dispose( Reader* r )
+{
+    Registry* reg = (Registry*)r->registry;
+    registry_lock( reg );
+    for (int i = 0; i < reg->nreaders; i++){
+        if (reg->readers[i] == r){
+            reg->readers[i] = reg->readers[--reg->nreaders];
+            break;
+        }
+    }
+    registry_unlock( reg );
+
+    delete[] r->ws;
+    free( r->serials );
+    free( r );
+}
+
+static Reader* registry_reader( Registry* reg )
+{
+    Reader* r = (Reader*)calloc( 1, sizeof( Reader ) );
+    if (r == nullptr){
+        return nullptr;
+    }
+    r->registry = reg;
+    r->ws = new Workspace[reg->capacity];
+    r->serials = (int*)calloc( size_t( reg->capacity ), sizeof( int ) );
+
+    registry_lock( reg );
+    Reader** slot = array_push( &reg->readers, &reg->nreaders, &reg->readers_capacity );
+    if (slot != nullptr){
+        *slot = r;
+    }
+    registry_unlock( reg );
+
+    if (slot == nullptr || r->serials == nullptr){
+        reader_dispose( r );
+        return nullptr;
+    }
+    return r;
+}
+
+/* Evaluates the current version of the formula. The result has the size of
+ * its type, which is written in 'type'. */
+static int reader_eval( Reader* r, const int index, void* result, int* type )
+{
+    Registry* reg = (Registry*)r->registry;
+    if (index < 0 || index >= atomic_load( &reg->nformulas )){
+        return GPARSE_ERROR;
+    }
+
+    atomic_store( &r->epoch, atomic_load( &reg->epoch ) );
+    atomic_fence();
+    const FormulaVersion* version = (const FormulaVersion*)atomic_load_ptr
+        ( (void* const volatile*)&reg->formulas[index].version );
+
+    int status = GPARSE_ERROR;
+    if (version != nullptr){
+        const Program* prog = version->prog;
+        Workspace* ws = r->ws + index;
+        if (r->serials[index] != version->serial){
+            /* The constants are loaded for the program */
+            ws->nregisters = -1;
+            r->serials[index] = version->serial;
+        }
+        if (workspace_prepare( ws, prog, 1 ) == GPARSE_OK
+            && program_run( prog, ws, 0, 1, 0 ) == GPARSE_OK){
+            memcpy( result, ws->reg( prog->result ), numeric_type_size( prog->type ) );
+            if (type != nullptr){
+                *type = prog->type;
+            }
+            status = GPARSE_OK;
+        }
+        else{
+            r->serials[index] = 0;
+        }
+    }
+
+    atomic_store( &r->epoch, 0 );
+    return status;
+}
+
+#endif /* H_GREGISTRY_H */
@@ -0,0 +1,333 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Variables in shared memory.
+
+A named segment of shared memory holds the values of a fixed set of
+variables, so a process writes them and others evaluate expressions over
+them. The layout is set when the segment is created:
+
+    SharedHeader    magic, version, number of variables, locks
+    SharedVar[n]    name and type of each variable
+    uint64_t[n]     value of each variable, in 8 bytes for any type
+
+The writers publish the values under a sequence lock. The sequence is odd
+while a writer changes the values, so a reader copies them between two
+reads of an even sequence which did not change, and tries again
+otherwise. Several values are published together, so the readers never
+see some of them updated and others not. Readers do not write to the
+segment, and neither of them makes system calls. The writers take a spin
+lock in the segment among them, so a writer that dies while it publishes
+leaves the segment locked.
+
+Each process maps the segment with its own handle, which keeps a copy of
+the values. The variables added to a parser point to the copy, and
+gShared_read takes a new one, so the expressions see the same values for
+a whole evaluation.
+*******************************************************************************/
+
+#ifndef H_GSHARED_H
+#define H_GSHARED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Thread.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define SHARED_MAGIC "GLNTSHM"
+#define SHARED_VERSION 1
+#define SHARED_NAME_SIZE 56
+#define SHARED_MAX_VARS 65536
+
+/* The sequence has its own cache line, as the readers poll it */
+struct SharedHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t nvars;
+    volatile int lock;  /* Lock of the writers */
+    char pad0[44];
+    volatile int seq;   /* Odd while the values are being written */
+    char pad1[60];
+};
+
+struct SharedVar
+{
+    char name[SHARED_NAME_SIZE];
+    int32_t type;
+    int32_t reserved;
+};
+
+struct SharedSegment : gShared
+{
+    SharedHeader* header;
+    SharedVar* vars;
+    volatile uint64_t* values;  /* Values in the segment */
+    uint64_t* copy;             /* Values of the last read */
+    size_t size;
+#if defined(_WIN32)
+    HANDLE mapping;
+#endif
+};
+
+static inline size_t shared_size( const int nvars )
+{
+    return sizeof( SharedHeader ) + (sizeof( SharedVar ) + sizeof( uint64_t ))*size_t( nvars );
+}
+
+/* Maps the segment, of the given size or of the size in its header */
+static SharedSegment* shared_map( const char* name, const size_t size )
+{
+    const size_t len = strlen( name );
+    char* path = (char*)malloc( len + 8 );
+    if (path == nullptr){
+        return nullptr;
+    }
+    char* p = nullptr;
+#if defined(_WIN32)
+    sprintf( path, "Local\\%s", name );
+    HANDLE mapping = size != 0
+        ? CreateFileMappingA( INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE
+            , DWORD( uint64_t( size ) >> 32 ), DWORD( size ), path )
+        : OpenFileMappingA( FILE_MAP_ALL_ACCESS, FALSE, path );
+    free( path );
+    if (mapping == nullptr){
+        return nullptr;
+    }
+    if (size != 0 && GetLastError() == ERROR_ALREADY_EXISTS){
+        CloseHandle( mapping );
+        return nullptr;
+    }
+    p = (char*)MapViewOfFile( mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0 );
+    MEMORY_BASIC_INFORMATION info;
+    const size_t mapped = p != nullptr && VirtualQuery( p, &info, sizeof( info ) ) != 0
+        ? info.RegionSize : 0;
+    if (p == nullptr || mapped < sizeof( SharedHeader )){
+        if (p != nullptr){
+            UnmapViewOfFile( p );
+        }
+        CloseHandle( mapping );
+        return nullptr;
+    }
+#else
+    sprintf( path, "/%s", name );
+    int fd;
+    if (size != 0){
+        /* A new segment replaces the old one, which stays alive for the
+         * processes that mapped it */
+        shm_unlink( path );
+        fd = shm_open( path, O_RDWR | O_CREAT | O_EXCL, 0666 );
+        if (fd >= 0 && ftruncate( fd, off_t( size ) ) != 0){
+            close( fd );
+            shm_unlink( path );
+            fd = -1;
+        }
+    }
+    else{
+        fd = shm_open( path, O_RDWR, 0 );
+    }
+    free( path );
+    if (fd < 0){
+        return nullptr;
+    }
+    struct stat st;
+    const size_t mapped = fstat( fd, &st ) == 0 ? size_t( st.st_size ) : 0;
+    if (mapped >= sizeof( SharedHeader )){
+        p = (char*)mmap( nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        p = p != (char*)MAP_FAILED ? p : nullptr;
+    }
+    close( fd );
+    if (p == nullptr){
+        return nullptr;
+    }
+#endif
+
+    SharedSegment* shared = (SharedSegment*)calloc( 1, sizeof( SharedSegment ) );
+    if (shared == nullptr){
+#if defined(_WIN32)
+        UnmapViewOfFile( p );
+        CloseHandle( mapping );
+#else
+        munmap( p, mapped );
+#endif
+        return nullptr;
+    }
+    shared->header = (SharedHeader*)p;
+    shared->size = mapped;
+#if defined(_WIN32)
+    shared->mapping = mapping;
+#endif
+    return shared;
+}
+
+static void shared_close( SharedSegment* shared )
+{
+#if defined(_WIN32)
+    UnmapViewOfFile( shared->header );
+    CloseHandle( shared->mapping );
+#else
+    munmap( shared->header, shared->size );
+#endif
+    free( shared->copy );
+    free( shared );
+}
+
+/* Points to the sections of the segment, after checking the header */
+static int shared_layout( SharedSegment* shared )
+{
+    const SharedHeader* header = shared->header;
+    if (memcmp( header->magic, SHARED_MAGIC, sizeof( SHARED_MAGIC ) ) != 0
+        || header->version != SHARED_VERSION || header->nvars < 0
+        || header->nvars > SHARED_MAX_VARS || shared_size( header->nvars ) > shared->size){
+        return GPARSE_ERROR;
+    }
+    shared->nvars = header->nvars;
+    shared->vars = (SharedVar*)(shared->header + 1);
+    shared->values = (volatile uint64_t*)(shared->vars + shared->nvars);
+    shared->copy = (uint64_t*)calloc( size_t( shared->nvars ) + 1, sizeof( uint64_t ) );
+    return shared->copy != nullptr ? GPARSE_OK : GPARSE_ERROR;
+}
+
+/* Creates the segment with the variables, all of them zero */
+static SharedSegment* shared_create( const char* name, const int nvars
+    , const char* const* names, const int* types )
+{
+    if (nvars <= 0 || nvars > SHARED_MAX_VARS){
+        return nullptr;
+    }
+    for (int i = 0; i < nvars; i++){
+        const size_t len = names[i] != nullptr ? strlen( names[i] ) : 0;
+        if (name_is_valid( names[i], names[i] + len ) == 0 || len >= SHARED_NAME_SIZE
+            || numeric_type_size( types[i] ) == 0){
+            return nullptr;
+        }
+    }
+
+    SharedSegment* shared = shared_map( name, shared_size( nvars ) );
+    if (shared == nullptr){
+        return nullptr;
+    }
+    /* The segment is zero, and the magic goes last, so a process that
+     * opens it early does not take it as valid */
+    SharedHeader* header = shared->header;
+    header->version = SHARED_VERSION;
+    header->nvars = nvars;
+    SharedVar* vars = (SharedVar*)(header + 1);
+    for (int i = 0; i < nvars; i++){
+        memcpy( vars[i].name, names[i], strlen( names[i] ) );
+        vars[i].type = types[i];
+    }
+    atomic_fence();
+    memcpy( header->magic, SHARED_MAGIC, sizeof( SHARED_MAGIC ) );
+
+    if (shared_layout( shared ) != GPARSE_OK){
+        shared_close( shared );
+        return nullptr;
+    }
+    return shared;
+}
+
+static SharedSegment* shared_open( const char* name )
+{
+    SharedSegment* shared = shared_map( name, 0 );
+    if (shared != nullptr && shared_layout( shared ) != GPARSE_OK){
+        shared_close( shared );
+        return nullptr;
+    }
+    return shared;
+}
+
+/* Removes the name of the segment. The processes that mapped it keep it. */
+static int shared_remove( const char* name )
+{
+#if defined(_WIN32)
+    /* Named mappings are removed with the last handle */
+    return GPARSE_OK;
+#else
+    char* path = (char*)malloc( strlen( name ) + 2 );
+    if (path == nullptr){
+        return GPARSE_ERROR;
+    }
+    sprintf( path, "/%s", name );
+    const int status = shm_unlink( path ) == 0 ? GPARSE_OK : GPARSE_ERROR;
+    free( path );
+    return status;
+#endif
+}
+
+static int shared_find( const SharedSegment* shared, const char* varname )
+{
+    for (int i = 0; i < shared->nvars; i++){
+        if (strncmp( shared->vars[i].name, varname, SHARED_NAME_SIZE ) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Publishes the values together. Each value is stored in the first bytes
+ * of its slot. */
+static int shared_write( SharedSegment* shared, const int n, const int* index
+    , const void* const* values )
+{
+    for (int k = 0; k < n; k++){
+        if (index[k] < 0 || index[k] >= shared->nvars || values[k] == nullptr){
+            return GPARSE_ERROR;
+        }
+    }
+
+    SharedHeader* header = shared->header;
+    spin_lock( &header->lock );
+    const int seq = atomic_load( &header->seq );
+    atomic_store( &header->seq, seq + 1 );
+    atomic_fence();
+    for (int k = 0; k < n; k++){
+        const int i = index[k];
+        uint64_t v = 0;
+        memcpy( &v, values[k], numeric_type_size( shared->vars[i].type ) );
+        shared->values[i] = v;
+    }
+    atomic_store( &header->seq, seq + 2 );
+    spin_unlock( &header->lock );
+    return GPARSE_OK;
+}
+
+/* Copies the values published last */
+static void shared_read( SharedSegment* shared )
+{
+    const SharedHeader* header = shared->header;
+    const int n = shared->nvars;
+    for (;;){
+        const int seq = atomic_load( &header->seq );
+        if ((seq & 1) != 0){
+            /* A writer may have been preempted while it publishes */
+            thread_yield();
+            continue;
+        }
+        for (int i = 0; i < n; i++){
+            shared->copy[i] = shared->values[i];
+        }
+        atomic_fence();
+        if (atomic_load( &header->seq ) == seq){
+            return;
+        }
+    }
+}
+
+#endif /* H_GSHARED_H */
@@ -0,0 +1,236 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Consistent snapshots of variables of the host.
+
+The variables added with gParser_addVariable are used in place, so a
+thread of the host that writes them while an expression is evaluated may
+leave the expression with some values old and others new. A snapshot is a
+group of such variables that the writers update together, between
+gSnapshot_begin and gSnapshot_end, and that the expressions see as a
+whole.
+
+The variables of a snapshot point to a copy of the values, taken at the
+start of each evaluation under a sequence lock: the sequence is odd while
+a writer updates the values, so a copy taken between two reads of the
+same even sequence is consistent. The copy is taken in a scratch buffer,
+and it replaces the values seen by the expressions only when it is
+consistent. If the writers keep the values busy for several tries, the
+evaluation uses the previous copy, which is older but consistent, so the
+readers never wait, and the snapshot counts it in 'stale'.
+
+The values are copied with relaxed atomic loads, by words where they are
+aligned, as the writers may store them during the copy. The copy is
+discarded when the sequence changes.
+
+The writers take a spin lock among them, so several threads may write the
+same snapshot. Each update costs them a compare-and-swap, a fence and two
+stores.
+*******************************************************************************/
+
+#ifndef H_GSNAPSHOT_H
+#define H_GSNAPSHOT_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+#include "Structure.hpp"
+#include "Thread.hpp"
+
+/* Copies tried before using the previous one */
+#define SNAPSHOT_TRIES 16
+
+struct Snapshot : gSnapshot
+{
+    volatile int seq;       /* Odd while a writer updates the values */
+    volatile int lock;      /* Lock of the writers */
+    Variable** vars;
+    const char** sources;   /* Memory of the host of each variable */
+    size_t* offsets;        /* Offset of each variable in the copy */
+    int* sizes;
+    char* copy;             /* Values seen by the expressions */
+    char* scratch;          /* Copy being taken */
+    size_t size;
+};
+
+static void snapshot_free( Snapshot* snap )
+{
+    if (snap == nullptr){
+        return;
+    }
+    free( snap->vars );
+    free( snap->sources );
+    free( snap->offsets );
+    free( snap->sizes );
+    free( snap->copy );
+    free( snap->scratch );
+    free( snap );
+}
+
+/* Returns 1 if the variable is in a snapshot of the parser */
+static int snapshot_contains( const Parser* parser, const Variable* var )
+{
+    for (int i = 0; i < parser->nsnapshots; i++){
+        const Snapshot* snap = parser->snapshots[i];
+        for (int k = 0; k < snap->nvars; k++){
+            if (snap->vars[k] == var){
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Memory of the host of the variable, which points to the copy if it is in
+ * a snapshot */
+static void* snapshot_source( const Parser* parser, const Variable* var )
+{
+    for (int i = 0; i < parser->nsnapshots; i++){
+        const Snapshot* snap = parser->snapshots[i];
+        for (int k = 0; k < snap->nvars; k++){
+            if (snap->vars[k] == var){
+                return (void*)snap->sources[k];
+            }
+        }
+    }
+    return var->pvalue;
+}
+
+/* Points the variables to the copy of their values. They must be variables
+ * of the host, which are not in other snapshot. */
+static Snapshot* snapshot_create( Parser* parser, const int nvars, Variable** vars )
+{
+    for (int i = 0; i < nvars; i++){
+        if (vars[i] == nullptr || vars[i]->free_data || vars[i]->base != nullptr
+            || vars[i]->pvalue == nullptr || vars[i]->size <= 0
+            || snapshot_contains( parser, vars[i] )){
+            return nullptr;
+        }
+        for (int k = 0; k < i; k++){
+            if (vars[k] == vars[i]){
+                return nullptr;
+            }
+        }
+    }
+
+    Snapshot* snap = (Snapshot*)calloc( 1, sizeof( Snapshot ) );
+    if (snap == nullptr){
+        return nullptr;
+    }
+    snap->nvars = nvars;
+    snap->vars = (Variable**)malloc( sizeof( Variable* )*nvars );
+    snap->sources = (const char**)malloc( sizeof( const char* )*nvars );
+    snap->offsets = (size_t*)malloc( sizeof( size_t )*nvars );
+    snap->sizes = (int*)malloc( sizeof( int )*nvars );
+    for (int i = 0; i < nvars && snap->offsets != nullptr && snap->sizes != nullptr; i++){
+        /* Aligned for any type */
+        snap->size = (snap->size + 7) & ~size_t( 7 );
+        snap->offsets[i] = snap->size;
+        snap->sizes[i] = vars[i]->size;
+        snap->size += size_t( snap->sizes[i] );
+    }
+    snap->copy = (char*)malloc( snap->size );
+    snap->scratch = (char*)calloc( 1, snap->size );
+    Snapshot** slot = array_push( &parser->snapshots, &parser->nsnapshots
+        , &parser->snapshots_capacity );
+    if (snap->vars == nullptr || snap->sources == nullptr || snap->offsets == nullptr
+        || snap->sizes == nullptr || snap->copy == nullptr || snap->scratch == nullptr
+        || slot == nullptr){
+        if (slot != nullptr){
+            parser->nsnapshots--;
+        }
+        snapshot_free( snap );
+        return nullptr;
+    }
+    *slot = snap;
+
+    for (int i = 0; i < nvars; i++){
+        Variable* var = vars[i];
+        snap->vars[i] = var;
+        snap->sources[i] = (const char*)var->pvalue;
+        memcpy( snap->copy + snap->offsets[i], var->pvalue, snap->sizes[i] );
+        var->pvalue = snap->copy + snap->offsets[i];
+        if (struct_type( parser, var->type ) != nullptr){
+            struct_update_members( parser->global.vars, var );
+        }
+    }
+    return snap;
+}
+
+static inline void snapshot_begin( Snapshot* snap )
+{
+    spin_lock( &snap->lock );
+    atomic_store( &snap->seq, snap->seq + 1 );
+    atomic_fence();
+}
+
+static inline void snapshot_end( Snapshot* snap )
+{
+    atomic_store( &snap->seq, snap->seq + 1 );
+    spin_unlock( &snap->lock );
+}
+
+/* Copies the memory of the host that the writers may be storing */
+static void snapshot_copy( char* dst, const char* src, const size_t size )
+{
+    size_t i = 0;
+    for (; i < size && ((uintptr_t)(src + i) & 7) != 0; i++){
+        dst[i] = (char)atomic_load_relaxed8( (const volatile unsigned char*)(src + i) );
+    }
+    for (; i + 8 <= size; i += 8){
+        const uint64_t word = atomic_load_relaxed64( (const volatile uint64_t*)(src + i) );
+        memcpy( dst + i, &word, 8 );
+    }
+    for (; i < size; i++){
+        dst[i] = (char)atomic_load_relaxed8( (const volatile unsigned char*)(src + i) );
+    }
+}
+
+/* Takes a consistent copy of the values, or keeps the previous one and
+ * counts it in 'stale' */
+static void snapshot_read( Snapshot* snap )
+{
+    for (int t = 0; t < SNAPSHOT_TRIES; t++){
+        const int seq = atomic_load( &snap->seq );
+        if ((seq & 1) != 0){
+            continue;
+        }
+        for (int i = 0; i < snap->nvars; i++){
+            snapshot_copy( snap->scratch + snap->offsets[i], snap->sources[i], snap->sizes[i] );
+        }
+        atomic_fence();
+        if (atomic_load( &snap->seq ) == seq){
+            memcpy( snap->copy, snap->scratch, snap->size );
+            return;
+        }
+    }
+    snap->stale++;
+}
+
+/* Takes the snapshots before an evaluation */
+static inline void parser_snapshot( Parser* parser )
+{
+    for (int i = 0; i < parser->nsnapshots; i++){
+        snapshot_read( parser->snapshots[i] );
+    }
+}
+
+static void snapshots_dispose( Parser* parser )
+{
+    for (int i = 0; i < parser->nsnapshots; i++){
+        snapshot_free( parser->snapshots[i] );
+    }
+    free( parser->snapshots );
+    parser->snapshots = nullptr;
+    parser->nsnapshots = 0;
+    parser->snapshots_capacity = 0;
+}
+
+#endif /* H_GSNAPSHOT_H */
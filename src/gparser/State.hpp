@@ -0,0 +1,563 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+State of a parser: the structure types and the global variables declared
+by scripts, with their values.
+
+The state is an image of consecutive sections:
+
+    StateHeader     magic, version, counts and sizes of the sections
+    StateType[]     name, fields, size and alignment of each structure
+    StateField[]    name, type and offset of each field
+    StateVar[]      name, type and size of each variable
+    char[]          names, each one ending with '\0'
+    char[]          values, each one aligned to 8 bytes
+
+The values are in the byte order of the machine that wrote them. The
+variables are in preorder of the tree of the parser: strtok_compare is not
+an order of the names when one is a prefix of the other, so they cannot be
+sorted, but linking them in preorder builds a tree of the same shape.
+
+Loading a state does not declare the variables one by one: all the nodes,
+names and values go in a single block, the values and the names are
+copied at once, and the nodes are linked without allocating them. The
+block is released with the parser. The structure types are found by name, and must
+have the same layout, or they are added in the same order, so the types of
+the image can be numbered as in the parser.
+
+Only the variables owned by the parser are saved. The variables of the
+host point to its memory, so the host adds them again, and the members of
+structures are resolved again when they are used. Functions and formulas
+are not part of the state.
+
+A clone of a parser loads the image of its template, so it also gets its
+own copy of the values in a single block. The variables of the host are
+added again pointing to the same memory, and the functions are copied.
+*******************************************************************************/
+
+#ifndef H_GSTATE_H
+#define H_GSTATE_H
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+#include "Structure.hpp"
+#include "Snapshot.hpp"
+
+#define STATE_MAGIC "GLNTSTA"
+#define STATE_VERSION 1
+
+/* Limit of the counts, which keeps the offsets in 32 bits */
+#define STATE_MAX_COUNT (1 << 26)
+
+struct StateHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t ntypes;
+    int32_t nfields;
+    int32_t nvars;
+    uint32_t names_size;
+    uint32_t reserved;
+    uint64_t values_size;
+};
+
+/* Names are offsets in the names section */
+struct StateType
+{
+    int32_t name;
+    int32_t first;      /* First field */
+    int32_t nfields;
+    int32_t size;
+    int32_t align;
+};
+
+struct StateField
+{
+    int32_t name;
+    int32_t type;
+    int32_t offset;
+};
+
+struct StateVar
+{
+    int32_t name;
+    int32_t type;
+    int32_t size;
+};
+
+static inline uint64_t state_align( const uint64_t offset )
+{
+    return (offset + 7) & ~uint64_t( 7 );
+}
+
+/* Returns 1 if the parser owns the value of the variable */
+static inline int state_owned( const Variable* var )
+{
+    return (var->free_data || var->value_in_block) && var->base == nullptr && var->size > 0;
+}
+
+/* Returns 1 if the value of the variable is in the memory of the host */
+static inline int state_host( const Variable* var )
+{
+    return !var->free_data && !var->value_in_block && var->base == nullptr
+        && var->type != 0 && var->pvalue != nullptr;
+}
+
+/* Variables owned by the parser, or added by the host, in preorder of the
+ * tree */
+static Variable** state_variables( const Parser* parser, const int owned, int* count )
+{
+    Variable** vars = nullptr;
+    int capacity = 0;
+    BinaryTree< Variable >** stack = nullptr;
+    int depth = 0;
+    int stack_capacity = 0;
+    int status = GPARSE_OK;
+    *count = 0;
+
+    /* The tree may be as deep as the number of variables */
+    BinaryTree< Variable >* node = parser->global.vars;
+    while (node != nullptr && status == GPARSE_OK){
+        if (owned ? state_owned( node ) : state_host( node )){
+            Variable** slot = array_push( &vars, count, &capacity );
+            if (slot == nullptr){
+                status = GPARSE_ERROR;
+                break;
+            }
+            *slot = node;
+        }
+
+        /* The lower branch first, and the upper one later */
+        if (node->upper_name != nullptr){
+            BinaryTree< Variable >** slot = array_push( &stack, &depth, &stack_capacity );
+            if (slot == nullptr){
+                status = GPARSE_ERROR;
+                break;
+            }
+            *slot = node->upper_name;
+        }
+        if (node->lower_name != nullptr){
+            node = node->lower_name;
+        }
+        else{
+            node = depth > 0 ? stack[--depth] : nullptr;
+        }
+    }
+    free( stack );
+
+    if (status != GPARSE_OK){
+        free( vars );
+        *count = -1;
+        return nullptr;
+    }
+    return vars;
+}
+
+/* Writes the state in a new image. Returns nullptr if there is no memory. */
+static char* state_image( const Parser* parser, size_t* size )
+{
+    int nvars;
+    Variable** vars = state_variables( parser, 1, &nvars );
+    if (nvars < 0){
+        return nullptr;
+    }
+
+    StateHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, STATE_MAGIC, sizeof( STATE_MAGIC ) );
+    header.version = STATE_VERSION;
+    header.ntypes = parser->ntypes;
+    header.nvars = nvars;
+    uint64_t names_size = 0;
+    for (int i = 0; i < parser->ntypes; i++){
+        const Struct* str = parser->types[i];
+        names_size += strlen( str->name ) + 1;
+        header.nfields += str->nfields;
+        for (int k = 0; k < str->nfields; k++){
+            names_size += strlen( str->fields[k].name ) + 1;
+        }
+    }
+    for (int i = 0; i < nvars; i++){
+        names_size += strlen( vars[i]->name ) + 1;
+        header.values_size = state_align( header.values_size ) + vars[i]->size;
+    }
+    header.values_size = state_align( header.values_size );
+    if (names_size >= 0x80000000u){
+        free( vars );
+        return nullptr;
+    }
+    header.names_size = uint32_t( names_size );
+
+    const size_t total = sizeof( StateHeader ) + sizeof( StateType )*header.ntypes
+        + sizeof( StateField )*header.nfields + sizeof( StateVar )*nvars
+        + header.names_size + size_t( header.values_size );
+    char* image = (char*)calloc( 1, total );
+    if (image == nullptr){
+        free( vars );
+        return nullptr;
+    }
+    memcpy( image, &header, sizeof( header ) );
+    StateType* types = (StateType*)(image + sizeof( StateHeader ));
+    StateField* fields = (StateField*)(types + header.ntypes);
+    StateVar* svars = (StateVar*)(fields + header.nfields);
+    char* names = (char*)(svars + nvars);
+    char* values = names + header.names_size;
+
+    int32_t used = 0;
+    int first = 0;
+    for (int i = 0; i < parser->ntypes; i++){
+        const Struct* str = parser->types[i];
+        StateType* t = types + i;
+        t->name = used;
+        strcpy( names + used, str->name );
+        used += int32_t( strlen( str->name ) + 1 );
+        t->first = first;
+        t->nfields = str->nfields;
+        t->size = str->size;
+        t->align = str->align;
+        for (int k = 0; k < str->nfields; k++){
+            StateField* f = fields + first + k;
+            f->name = used;
+            strcpy( names + used, str->fields[k].name );
+            used += int32_t( strlen( str->fields[k].name ) + 1 );
+            f->type = str->fields[k].type;
+            f->offset = str->fields[k].offset;
+        }
+        first += str->nfields;
+    }
+    uint64_t offset = 0;
+    for (int i = 0; i < nvars; i++){
+        const Variable* var = vars[i];
+        StateVar* v = svars + i;
+        v->name = used;
+        strcpy( names + used, var->name );
+        used += int32_t( strlen( var->name ) + 1 );
+        v->type = var->type;
+        v->size = var->size;
+        offset = state_align( offset );
+        memcpy( values + offset, var->pvalue, var->size );
+        offset += var->size;
+    }
+
+    free( vars );
+    *size = total;
+    return image;
+}
+
+/* Name at the offset, or nullptr if it is not a valid name */
+static const char* state_name( const char* names, const uint32_t names_size, const int32_t offset )
+{
+    if (offset < 0 || uint32_t( offset ) >= names_size){
+        return nullptr;
+    }
+    const char* name = names + offset;
+    return name_is_valid( name, name + strlen( name ) ) ? name : nullptr;
+}
+
+/* Returns 1 if the structure of the parser has the layout of the image */
+static int state_same_struct( const Struct* str, const StateType* t, const StateField* fields
+    , const char* names, const int* map )
+{
+    if (str->nfields != t->nfields || str->size != t->size || str->align != t->align){
+        return 0;
+    }
+    for (int k = 0; k < t->nfields; k++){
+        const StateField* f = fields + t->first + k;
+        const int type = f->type >= STRUCT_TYPE_MIN ? map[f->type - STRUCT_TYPE_MIN] : f->type;
+        if (strcmp( str->fields[k].name, names + f->name ) != 0
+            || str->fields[k].type != type || str->fields[k].offset != f->offset){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Checks the structures of the image, and numbers them as types of the
+ * parser. The types which are not in the parser are numbered after the
+ * last one. */
+static int state_check_types( Parser* parser, const StateHeader* header
+    , const StateType* types, const StateField* fields, const char* names, int* map )
+{
+    int added = 0;
+    for (int i = 0; i < header->ntypes; i++){
+        const StateType* t = types + i;
+        const char* name = state_name( names, header->names_size, t->name );
+        if (name == nullptr || t->nfields <= 0 || t->first < 0
+            || t->first > header->nfields - t->nfields || t->size <= 0
+            || (t->align != 1 && t->align != 2 && t->align != 4 && t->align != 8)
+            || t->size % t->align != 0){
+            return GPARSE_ERROR;
+        }
+        for (int k = 0; k < t->nfields; k++){
+            const StateField* f = fields + t->first + k;
+            const int fsize = f->type >= STRUCT_TYPE_MIN
+                ? (f->type < STRUCT_TYPE_MIN + i ? types[f->type - STRUCT_TYPE_MIN].size : 0)
+                : numeric_type_size( f->type );
+            const int falign = f->type >= STRUCT_TYPE_MIN
+                ? (fsize > 0 ? types[f->type - STRUCT_TYPE_MIN].align : 1) : fsize;
+            if (state_name( names, header->names_size, f->name ) == nullptr || fsize == 0
+                || f->offset < 0 || f->offset > t->size - fsize || f->offset % falign != 0){
+                return GPARSE_ERROR;
+            }
+        }
+
+        const char* end = name + strlen( name );
+        const Struct* str = parser->global.find_struct( name, end );
+        if (str != nullptr){
+            if (state_same_struct( str, t, fields, names, map ) == 0){
+                return GPARSE_ERROR;
+            }
+            map[i] = str->type;
+            continue;
+        }
+        if (parser->global.find_variable( name, end ) != nullptr){
+            return GPARSE_ERROR;
+        }
+        for (int k = 0; k < i; k++){
+            if (strcmp( names + types[k].name, name ) == 0){
+                return GPARSE_ERROR;
+            }
+        }
+        map[i] = parser->ntypes + STRUCT_TYPE_MIN + added;
+        added++;
+    }
+    return GPARSE_OK;
+}
+
+/* Adds the structures of the image which are not in the parser. They were
+ * numbered in order after the last type, so each one is the next type. */
+static int state_add_types( Parser* parser, const StateHeader* header
+    , const StateType* types, const StateField* fields, const char* names, const int* map )
+{
+    for (int i = 0; i < header->ntypes; i++){
+        if (map[i] != parser->ntypes + STRUCT_TYPE_MIN){
+            continue;
+        }
+        const StateType* t = types + i;
+        const char* name = names + t->name;
+        int status;
+        Struct* str = parser->global.add_struct( name, name + strlen( name ), &status );
+        if (str == nullptr || status != GPARSE_NEW_NAME){
+            return GPARSE_ERROR;
+        }
+        str->fields = (Field*)calloc( size_t( t->nfields ), sizeof( Field ) );
+        if (str->fields == nullptr){
+            return GPARSE_ERROR;
+        }
+        str->nfields = t->nfields;
+        str->size = t->size;
+        str->align = t->align;
+        for (int k = 0; k < t->nfields; k++){
+            const StateField* f = fields + t->first + k;
+            const char* fname = names + f->name;
+            str->fields[k].name = tok2str( fname, fname + strlen( fname ) );
+            str->fields[k].type = f->type >= STRUCT_TYPE_MIN
+                ? map[f->type - STRUCT_TYPE_MIN] : f->type;
+            str->fields[k].offset = f->offset;
+            if (str->fields[k].name == nullptr){
+                return GPARSE_ERROR;
+            }
+        }
+        if (struct_register( parser, str ) != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+    }
+    return GPARSE_OK;
+}
+
+/* Adds the node to the tree, as BinaryTree::push would do. Returns
+ * GPARSE_NAME_COLLISION if the name is already in the tree. */
+static int state_link( BinaryTree< Variable >** root, BinaryTree< Variable >* node )
+{
+    BinaryTree< Variable >** link = root;
+    const char* end = node->name + strlen( node->name );
+    while (*link != nullptr){
+        const int cmp = strtok_compare( (*link)->name, node->name, end );
+        if (cmp == 0){
+            return GPARSE_NAME_COLLISION;
+        }
+        link = cmp > 0 ? &(*link)->upper_name : &(*link)->lower_name;
+    }
+    *link = node;
+    return GPARSE_OK;
+}
+
+/* Loads the image of a state in the parser. Nothing is added if it is not
+ * valid, or if some variable is already declared. */
+static int state_load( Parser* parser, const char* image, const size_t size )
+{
+    const StateHeader* header = (const StateHeader*)image;
+    if (size < sizeof( StateHeader ) || memcmp( header->magic, STATE_MAGIC
+        , sizeof( STATE_MAGIC ) ) != 0 || header->version != STATE_VERSION
+        || header->ntypes < 0 || header->ntypes > STATE_MAX_COUNT
+        || header->nfields < 0 || header->nfields > STATE_MAX_COUNT
+        || header->nvars < 0 || header->nvars > STATE_MAX_COUNT
+        || header->names_size >= 0x80000000u){
+        parser_error( parser, "The state is not valid" );
+        return GPARSE_ERROR;
+    }
+    const uint64_t total = sizeof( StateHeader ) + sizeof( StateType )*uint64_t( header->ntypes )
+        + sizeof( StateField )*uint64_t( header->nfields )
+        + sizeof( StateVar )*uint64_t( header->nvars ) + header->names_size;
+    if (total > size || header->values_size > size - total
+        || (header->names_size > 0 && image[total - 1] != '\0')){
+        parser_error( parser, "The state is not valid" );
+        return GPARSE_ERROR;
+    }
+    const StateType* types = (const StateType*)(image + sizeof( StateHeader ));
+    const StateField* fields = (const StateField*)(types + header->ntypes);
+    const StateVar* svars = (const StateVar*)(fields + header->nfields);
+    const char* names = (const char*)(svars + header->nvars);
+    const char* values = names + header->names_size;
+
+    int* map = (int*)malloc( sizeof( int )*(header->ntypes + 1) );
+    if (map == nullptr){
+        parser_error( parser, "Not enough memory for the state" );
+        return GPARSE_ERROR;
+    }
+    if (state_check_types( parser, header, types, fields, names, map ) != GPARSE_OK){
+        free( map );
+        parser_error( parser, "A structure of the state does not match the parser" );
+        return GPARSE_ERROR;
+    }
+
+    /* Variables not declared yet */
+    uint64_t offset = 0;
+    int status = GPARSE_OK;
+    for (int i = 0; i < header->nvars && status == GPARSE_OK; i++){
+        const StateVar* v = svars + i;
+        const char* name = state_name( names, header->names_size, v->name );
+        const int str_size = v->type >= STRUCT_TYPE_MIN
+            ? (v->type < STRUCT_TYPE_MIN + header->ntypes ? types[v->type - STRUCT_TYPE_MIN].size : 0)
+            : numeric_type_size( v->type );
+        offset = state_align( offset );
+        if (name == nullptr || str_size == 0 || v->size <= 0 || v->size % str_size != 0
+            || (v->type < STRUCT_TYPE_MIN && v->size != str_size)
+            || uint64_t( v->size ) > header->values_size - offset){
+            parser_error( parser, "The state is not valid" );
+            status = GPARSE_ERROR;
+        }
+        else if (parser->global.find_own_variable( name, name + strlen( name ) ) != nullptr){
+            parser_error( parser, "Variable name is already declared" );
+            status = GPARSE_ERROR;
+        }
+        offset += v->size;
+    }
+    if (status != GPARSE_OK || header->nvars == 0){
+        if (status == GPARSE_OK
+            && state_add_types( parser, header, types, fields, names, map ) != GPARSE_OK){
+            parser_error( parser, "Not enough memory for the state" );
+            status = GPARSE_ERROR;
+        }
+        free( map );
+        return status;
+    }
+
+    /* A single block with the nodes, the values and the names */
+    const size_t nodes_size = size_t( state_align( sizeof( BinaryTree< Variable > )
+        *uint64_t( header->nvars ) ) );
+    char* block = (char*)malloc( nodes_size + size_t( header->values_size ) + header->names_size );
+    if (block == nullptr){
+        free( map );
+        parser_error( parser, "Not enough memory for the state" );
+        return GPARSE_ERROR;
+    }
+    BinaryTree< Variable >* nodes = (BinaryTree< Variable >*)block;
+    char* block_values = block + nodes_size;
+    char* block_names = block_values + header->values_size;
+    memcpy( block_values, values, size_t( header->values_size ) );
+    memcpy( block_names, names, header->names_size );
+
+    /* The nodes are linked in a tree of their own, which finds the names
+     * repeated in the image */
+    BinaryTree< Variable >* tree = nullptr;
+    offset = 0;
+    for (int i = 0; i < header->nvars && status == GPARSE_OK; i++){
+        const StateVar* v = svars + i;
+        BinaryTree< Variable >* node = new (nodes + i) BinaryTree< Variable >( block_names + v->name );
+        offset = state_align( offset );
+        node->type = v->type >= STRUCT_TYPE_MIN ? map[v->type - STRUCT_TYPE_MIN] : v->type;
+        node->size = v->size;
+        node->pvalue = block_values + offset;
+        node->in_block = true;
+        node->value_in_block = true;
+        offset += v->size;
+        if (state_link( &tree, node ) != GPARSE_OK){
+            parser_error( parser, "The state is not valid" );
+            status = GPARSE_ERROR;
+        }
+    }
+
+    void** slot = nullptr;
+    if (status == GPARSE_OK){
+        slot = array_push( &parser->blocks, &parser->nblocks, &parser->blocks_capacity );
+        if (slot == nullptr || state_add_types( parser, header, types, fields, names, map ) != GPARSE_OK){
+            parser_error( parser, "Not enough memory for the state" );
+            status = GPARSE_ERROR;
+        }
+    }
+    free( map );
+    if (status != GPARSE_OK){
+        if (slot != nullptr){
+            parser->nblocks--;
+        }
+        free( block );
+        return status;
+    }
+    *slot = block;
+
+    if (parser->global.vars == nullptr){
+        parser->global.vars = tree;
+    }
+    else{
+        /* Linked again in preorder, so the tree keeps its shape */
+        for (int i = 0; i < header->nvars; i++){
+            nodes[i].lower_name = nullptr;
+            nodes[i].upper_name = nullptr;
+        }
+        for (int i = 0; i < header->nvars; i++){
+            state_link( &parser->global.vars, nodes + i );
+        }
+    }
+    return GPARSE_OK;
+}
+
+/* Adds the variables of the host of the template to the clone. The
+ * variables in a snapshot point to the memory of the host again. */
+static int state_clone_host( Parser* parser, const Parser* from )
+{
+    int nvars;
+    Variable** vars = state_variables( from, 0, &nvars );
+    if (nvars < 0){
+        return GPARSE_ERROR;
+    }
+
+    int status = GPARSE_OK;
+    for (int i = 0; i < nvars && status == GPARSE_OK; i++){
+        const Variable* var = vars[i];
+        Variable* pvar = parser->global.add_variable
+            ( var->name, var->name + strlen( var->name ), &status );
+        if (pvar == nullptr || status != GPARSE_NEW_NAME){
+            status = GPARSE_ERROR;
+            break;
+        }
+        pvar->type = var->type;
+        pvar->size = var->size;
+        pvar->pvalue = snapshot_source( from, var );
+        status = GPARSE_OK;
+    }
+    free( vars );
+    return status;
+}
+
+#endif /* H_GSTATE_H */
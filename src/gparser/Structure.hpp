@@ -0,0 +1,389 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Structure types.
+
+    struct point{ double x; double y; int id }
+    point p
+    point ps[100]
+
+The layout of a structure is computed once, when it is declared, with the
+alignment rules of C. An instance is a single block of memory, and an array
+of instances is a single allocation of 'count*size' bytes.
+
+A member like 'p.x' or 'ps[3].x' is resolved the first time it is used: the
+offset of the field is added to the address of the instance, and the result
+is kept in the scope as a variable that points inside the block. Programs
+read and write it as any other variable, so the access costs a single load
+from a known address.
+
+The host describes its own C structures with gParser_addStruct, giving the
+offset of each field, and binds instances in its memory with
+gParser_addVariable or gParser_addStructArray. For batch evaluation,
+gProgram_bindStruct binds an array of structures as the rows: each member
+is read and written at 'data + row*stride + offset', without copies.
+*******************************************************************************/
+
+#ifndef H_GSTRUCTURE_H
+#define H_GSTRUCTURE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Numeric.hpp"
+#include "Program.hpp"
+
+/* Returns the structure of the type, or nullptr if it is a basic type */
+static inline Struct* struct_type( const Parser* parser, const int type )
+{
+    const int index = type - STRUCT_TYPE_MIN;
+    if (index < 0 || index >= parser->ntypes){
+        return nullptr;
+    }
+    return parser->types[index];
+}
+
+/* Size in bytes of any type, or 0 if it is unknown */
+static int type_size( const Parser* parser, const int type )
+{
+    const Struct* str = struct_type( parser, type );
+    return str != nullptr ? str->size : numeric_type_size( type );
+}
+
+/* Alignment of any type. Basic types are aligned to their size. */
+static int type_align( const Parser* parser, const int type )
+{
+    const Struct* str = struct_type( parser, type );
+    return str != nullptr ? str->align : numeric_type_size( type );
+}
+
+/* Finds the field by name, or returns nullptr */
+static const Field* struct_field
+    ( const Struct* str, const char* _restrict_ const ini
+    , const char* _restrict_ const end )
+{
+    for (int i = 0; i < str->nfields; i++){
+        if (strtok_compare( str->fields[i].name, ini, end ) == 0){
+            return str->fields + i;
+        }
+    }
+    return nullptr;
+}
+
+/* Adds a field at the end of the structure. The layout is computed later by
+ * struct_layout. */
+static int struct_add_field( Struct* str, int* capacity
+    , const char* _restrict_ const ini, const char* _restrict_ const end
+    , const int type )
+{
+    if (struct_field( str, ini, end ) != nullptr){
+        return GPARSE_NAME_COLLISION;
+    }
+    Field* field = array_push( &str->fields, &str->nfields, capacity );
+    if (field == nullptr){
+        return GPARSE_ERROR;
+    }
+    field->name = tok2str( ini, end );
+    field->type = type;
+    field->offset = 0;
+    return field->name != nullptr ? GPARSE_OK : GPARSE_ERROR;
+}
+
+/* Places each field at the next offset aligned to its type, as a C compiler
+ * does, and pads the size to the alignment of the structure so consecutive
+ * instances are aligned too. */
+static void struct_layout( const Parser* parser, Struct* str )
+{
+    int offset = 0;
+    int align = 1;
+
+    for (int i = 0; i < str->nfields; i++){
+        Field* field = str->fields + i;
+        const int a = type_align( parser, field->type );
+        offset = (offset + a - 1) / a * a;
+        field->offset = offset;
+        offset += type_size( parser, field->type );
+        align = a > align ? a : align;
+    }
+
+    str->align = align;
+    str->size = (offset + align - 1) / align * align;
+}
+
+/* Registers the structure as a type of the parser */
+static int struct_register( Parser* parser, Struct* str )
+{
+    Struct** types = (Struct**)realloc
+        ( parser->types, sizeof( Struct* )*(parser->ntypes + 1) );
+    if (types == nullptr){
+        return GPARSE_ERROR;
+    }
+    parser->types = types;
+    parser->types[parser->ntypes] = str;
+    str->type = parser->ntypes + STRUCT_TYPE_MIN;
+    parser->ntypes++;
+    return GPARSE_OK;
+}
+
+/* Allocates 'count' instances of the structure in a single block, set to 0 */
+static int struct_alloc
+    ( const Parser* parser, Variable* var, const int type, const int count )
+{
+    const Struct* str = struct_type( parser, type );
+    if (str == nullptr || count <= 0 || count > INT_MAX / str->size){
+        return GPARSE_ERROR;
+    }
+    var->type = type;
+    var->size = count*str->size;
+    var->pvalue = malloc( var->size );
+    if (var->pvalue == nullptr){
+        return GPARSE_ERROR;
+    }
+    memset( var->pvalue, 0, var->size );
+    return GPARSE_OK;
+}
+
+/* Reads the number of a '[n]' suffix. Returns the position after ']', or
+ * nullptr if it is not a valid index. */
+static const char* struct_parse_index
+    ( const char* p, const char* const end, int* index )
+{
+    if (p >= end || *p != '['){
+        return nullptr;
+    }
+    p++;
+    if (p >= end || *p < '0' || *p > '9'){
+        return nullptr;
+    }
+    long long n = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+        n = n*10 + (*p - '0');
+        if (n > INT_MAX){
+            return nullptr;
+        }
+        p++;
+    }
+    if (p >= end || *p != ']'){
+        return nullptr;
+    }
+    *index = (int)n;
+    return p + 1;
+}
+
+/* Resolves a member 'name[index].field.field...' of a structure. The address
+ * is computed here, once, and the member is added to the scope of the
+ * instance, so the next uses find it as a variable. The status is
+ * GPARSE_NO_COMMAND if the name is not a member of a structure. */
+static Variable* struct_member
+    ( Parser* parser, Struct* scope, const Token* tok, int* status )
+{
+    *status = GPARSE_NO_COMMAND;
+
+    const char* const end = tok->str_end;
+    const char* p = tok->str_ini;
+    while (p < end && *p != '.' && *p != '['){
+        p++;
+    }
+    if (p == end){
+        return nullptr;
+    }
+    Variable* base = scope->find_variable( tok->str_ini, p );
+    if (base == nullptr){
+        return nullptr;
+    }
+    const Struct* str = struct_type( parser, base->type );
+    if (str == nullptr){
+        parser_error( parser, "The variable is not a structure" );
+        parser->code_pos = tok->str_ini;
+        *status = GPARSE_ERROR;
+        return nullptr;
+    }
+
+    /* Instance of the array */
+    const int count = base->size / str->size;
+    int index = 0;
+    if (*p == '['){
+        p = struct_parse_index( p, end, &index );
+        if (p == nullptr){
+            parser_error( parser, "Expecting a constant index" );
+            parser->code_pos = tok->str_ini;
+            *status = GPARSE_ERROR;
+            return nullptr;
+        }
+        if (index >= count){
+            parser_error( parser, "Index out of bounds" );
+            parser->code_pos = tok->str_ini;
+            *status = GPARSE_ERROR;
+            return nullptr;
+        }
+    }
+    else if (count > 1){
+        parser_error( parser, "Expecting the index of the array" );
+        parser->code_pos = tok->str_ini;
+        *status = GPARSE_ERROR;
+        return nullptr;
+    }
+    int offset = index*str->size;
+    int type = base->type;
+
+    /* Fields, maybe of nested structures */
+    while (p < end){
+        if (*p != '.' || str == nullptr){
+            parser_error( parser, "Expecting a field of a structure" );
+            parser->code_pos = p;
+            *status = GPARSE_ERROR;
+            return nullptr;
+        }
+        const char* name = ++p;
+        while (p < end && *p != '.'){
+            p++;
+        }
+        const Field* field = struct_field( str, name, p );
+        if (field == nullptr){
+            parser_error( parser, "Unknown field of the structure" );
+            parser->code_pos = name;
+            *status = GPARSE_ERROR;
+            return nullptr;
+        }
+        offset += field->offset;
+        type = field->type;
+        str = struct_type( parser, type );
+    }
+    if (str != nullptr){
+        parser_error( parser, "Structures cannot be used in expressions" );
+        parser->code_pos = tok->str_ini;
+        *status = GPARSE_ERROR;
+        return nullptr;
+    }
+
+    Variable* var = scope->add_variable( tok->str_ini, tok->str_end, status );
+    if (var == nullptr){
+        *status = GPARSE_ERROR;
+        return nullptr;
+    }
+    var->type = type;
+    var->size = numeric_type_size( type );
+    var->pvalue = (char*)base->pvalue + offset;
+    var->free_data = false;
+    var->base = base;
+    var->offset = offset;
+    *status = GPARSE_OK;
+    return var;
+}
+
+/* Points the members of the instance to its current value, after the host
+ * binds it to other memory */
+static void struct_update_members( BinaryTree< Variable >* node, const Variable* base )
+{
+    while (node != nullptr){
+        if (node->base == base){
+            node->pvalue = (char*)base->pvalue + node->offset;
+        }
+        struct_update_members( node->upper_name, base );
+        node = node->lower_name;
+    }
+}
+
+/* Finds a member of a structure by its name, e.g. "ps[3].x" */
+static Variable* struct_find_member( Parser* parser, Struct* scope, const char* name )
+{
+    Token tok;
+    int status;
+    memset( &tok, 0, sizeof( Token ) );
+    tok.str_ini = name;
+    tok.str_end = name + strlen( name );
+    tok.token_type = token_name;
+    return struct_member( parser, scope, &tok, &status );
+}
+
+/* Adds a structure type with the layout of a host C structure. The fields
+ * must be aligned to their type, and inside the 'size' bytes. */
+static int struct_add_host( Parser* parser, const char* name, const size_t size
+    , const int nfields, const gField* fields )
+{
+    const char* name_end = name + strlen( name );
+    if (name_is_valid( name, name_end ) == 0 || nfields <= 0 || fields == nullptr
+        || size == 0 || size > INT_MAX
+        || parser->global.find_struct( name, name_end ) != nullptr
+        || parser->global.find_variable( name, name_end ) != nullptr){
+        return t_undefined;
+    }
+
+    Struct layout;
+    int capacity = 0;
+    int align = 1;
+    for (int i = 0; i < nfields; i++){
+        const gField* field = fields + i;
+        const int fsize = type_size( parser, field->type );
+        const int falign = type_align( parser, field->type );
+        if (field->name == nullptr || fsize == 0 || field->offset % falign != 0
+            || field->offset + fsize > size){
+            return t_undefined;
+        }
+        const char* field_end = field->name + strlen( field->name );
+        if (name_is_valid( field->name, field_end ) == 0
+            || struct_add_field( &layout, &capacity, field->name, field_end
+            , field->type ) != GPARSE_OK){
+            return t_undefined;
+        }
+        layout.fields[i].offset = (int)field->offset;
+        align = falign > align ? falign : align;
+    }
+    if (size % align != 0){
+        return t_undefined;
+    }
+
+    int status;
+    Struct* str = parser->global.add_struct( name, name_end, &status );
+    if (str == nullptr || status != GPARSE_NEW_NAME){
+        return t_undefined;
+    }
+    str->fields = layout.fields;
+    str->nfields = layout.nfields;
+    str->size = (int)size;
+    str->align = align;
+    layout.fields = nullptr;
+    layout.nfields = 0;
+
+    if (struct_register( parser, str ) != GPARSE_OK){
+        return t_undefined;
+    }
+    return str->type;
+}
+
+/* Detects the names of structure types and the members of the structures
+ * of the scope. Returns GPARSE_ERROR if a member cannot be resolved. */
+static int detect_structures( Parser* parser, Struct* scope )
+{
+    const Token* tok_end = parser->tokens + parser->num_tokens - 1;
+
+    for (Token* tok = parser->tokens; tok <= tok_end; tok++){
+        if (tok->token_type != token_name){
+            continue;
+        }
+        const Struct* str = parser->global.find_struct( tok->str_ini, tok->str_end );
+        if (str != nullptr){
+            tok->token_type = token_vartype;
+            tok->var_type = str->type;
+            continue;
+        }
+        int status;
+        tok->pvar = struct_member( parser, scope, tok, &status );
+        if (status == GPARSE_ERROR){
+            return GPARSE_ERROR;
+        }
+        if (tok->pvar != nullptr){
+            tok->token_type = token_varname;
+        }
+    }
+
+    return GPARSE_OK;
+}
+
+#endif /* H_GSTRUCTURE_H */
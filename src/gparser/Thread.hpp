@@ -0,0 +1,424 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Threads, atomic operations and a scheduler of task graphs.
+
+The primitives map to the Win32 API and the Interlocked functions with
+Visual Studio, and to pthreads and the __atomic builtins elsewhere.
+
+A task graph is run by a pool of workers with work stealing: each worker
+keeps its ready tasks in its own deque, runs the newest one, and when it
+has none, it steals the oldest task of another worker. A task is ready when
+all its predecessors are finished, and the worker finishing the last one
+pushes it to its own deque, so chains of tasks stay in the same thread.
+*******************************************************************************/
+
+#ifndef H_GTHREAD_H
+#define H_GTHREAD_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <intrin.h>
+typedef HANDLE Thread;
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+typedef pthread_t Thread;
+#endif
+
+#include "gdata.h"
+
+/*********************/
+/* Atomic operations */
+/*********************/
+#if defined(_MSC_VER)
+
+/* Returns the new value */
+static inline int atomic_add( volatile int* p, const int v )
+{
+    return _InterlockedExchangeAdd( (volatile long*)p, v ) + v;
+}
+
+static inline int64_t atomic_add64( volatile int64_t* p, const int64_t v )
+{
+    return _InterlockedExchangeAdd64( (volatile __int64*)p, v ) + v;
+}
+
+static inline int atomic_load( const volatile int* p )
+{
+    const int v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+static inline void atomic_store( volatile int* p, const int v )
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+/* Sets *p = desired if it is equal to expected. Returns 1 if it is set. */
+static inline int atomic_cas( volatile int* p, const int expected, const int desired )
+{
+    return _InterlockedCompareExchange( (volatile long*)p, desired, expected ) == expected;
+}
+
+static inline void* atomic_load_ptr( void* const volatile* p )
+{
+    void* v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+/* Loads without ordering, for the copies taken under a sequence lock */
+static inline uint64_t atomic_load_relaxed64( const volatile uint64_t* p )
+{
+    return (uint64_t)__iso_volatile_load64( (const volatile __int64*)p );
+}
+
+static inline unsigned char atomic_load_relaxed8( const volatile unsigned char* p )
+{
+    return (unsigned char)__iso_volatile_load8( (const volatile char*)p );
+}
+
+/* Returns the previous value */
+static inline void* atomic_exchange_ptr( void* volatile* p, void* v )
+{
+    return _InterlockedExchangePointer( p, v );
+}
+
+static inline void atomic_fence()
+{
+    MemoryBarrier();
+}
+
+#else
+
+static inline int atomic_add( volatile int* p, const int v )
+{
+    return __atomic_add_fetch( p, v, __ATOMIC_ACQ_REL );
+}
+
+static inline int64_t atomic_add64( volatile int64_t* p, const int64_t v )
+{
+    return __atomic_add_fetch( p, v, __ATOMIC_ACQ_REL );
+}
+
+static inline int atomic_load( const volatile int* p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+static inline void atomic_store( volatile int* p, const int v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+static inline int atomic_cas( volatile int* p, int expected, const int desired )
+{
+    return __atomic_compare_exchange_n( p, &expected, desired, false
+        , __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+}
+
+static inline void* atomic_load_ptr( void* const volatile* p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+static inline uint64_t atomic_load_relaxed64( const volatile uint64_t* p )
+{
+    return __atomic_load_n( p, __ATOMIC_RELAXED );
+}
+
+static inline unsigned char atomic_load_relaxed8( const volatile unsigned char* p )
+{
+    return __atomic_load_n( p, __ATOMIC_RELAXED );
+}
+
+static inline void* atomic_exchange_ptr( void* volatile* p, void* v )
+{
+    return __atomic_exchange_n( p, v, __ATOMIC_ACQ_REL );
+}
+
+static inline void atomic_fence()
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+#endif
+
+/* Lock for short critical sections */
+static inline void spin_lock( volatile int* lock )
+{
+    while (!atomic_cas( lock, 0, 1 )){
+        while (atomic_load( lock ) != 0){
+        }
+    }
+}
+
+static inline void spin_unlock( volatile int* lock )
+{
+    atomic_store( lock, 0 );
+}
+
+/***********/
+/* Threads */
+/***********/
+typedef void( *f_thread )( void* arg );
+
+struct ThreadStart
+{
+    f_thread f;
+    void* arg;
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI thread_main( LPVOID p )
+#else
+static void* thread_main( void* p )
+#endif
+{
+    ThreadStart start = *(ThreadStart*)p;
+    free( p );
+    start.f( start.arg );
+    return 0;
+}
+
+/* Runs f( arg ) in a new thread */
+static int thread_start( Thread* thread, f_thread f, void* arg )
+{
+    ThreadStart* start = (ThreadStart*)malloc( sizeof( ThreadStart ) );
+    if (start == nullptr){
+        return GPARSE_ERROR;
+    }
+    start->f = f;
+    start->arg = arg;
+#if defined(_WIN32)
+    *thread = CreateThread( nullptr, 0, thread_main, start, 0, nullptr );
+    if (*thread == nullptr){
+#else
+    if (pthread_create( thread, nullptr, thread_main, start ) != 0){
+#endif
+        free( start );
+        return GPARSE_ERROR;
+    }
+    return GPARSE_OK;
+}
+
+static void thread_join( Thread thread )
+{
+#if defined(_WIN32)
+    WaitForSingleObject( thread, INFINITE );
+    CloseHandle( thread );
+#else
+    pthread_join( thread, nullptr );
+#endif
+}
+
+static inline void thread_yield()
+{
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+/* Identifier of the calling thread */
+static inline size_t thread_id()
+{
+#if defined(_WIN32)
+    return (size_t)GetCurrentThreadId();
+#else
+    return (size_t)pthread_self();
+#endif
+}
+
+/* Number of processors */
+static int thread_count()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    const int n = (int)info.dwNumberOfProcessors;
+#else
+    const int n = (int)sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+    return n > 0 ? n : 1;
+}
+
+/***************/
+/* Task graphs */
+/***************/
+
+/* Runs a task. Returns GPARSE_OK or GPARSE_ERROR. */
+typedef int( *f_task )( void* data, const int task );
+
+/* Ready tasks of a worker. The owner takes from the bottom, and the others
+ * steal from the top. */
+struct Deque
+{
+    int* tasks;
+    int top;
+    int bottom;
+    volatile int lock;
+};
+
+struct TaskGraph
+{
+    int ntasks;
+    const int* first;       /* Successors of task i are succ[first[i]] to
+                             * succ[first[i + 1] - 1] */
+    const int* succ;
+    volatile int* pending;  /* Unfinished predecessors of each task */
+    volatile int remaining; /* Unfinished tasks */
+    volatile int failed;    /* Some task failed, so the rest are skipped */
+    int* status;            /* Status of each task */
+
+    f_task run;
+    void* data;
+
+    Deque* deques;
+    int nworkers;
+};
+
+struct Worker
+{
+    TaskGraph* graph;
+    int index;
+};
+
+static void deque_push( Deque* d, const int task )
+{
+    spin_lock( &d->lock );
+    d->tasks[d->bottom++] = task;
+    spin_unlock( &d->lock );
+}
+
+/* Returns the newest task, or -1 */
+static int deque_pop( Deque* d )
+{
+    spin_lock( &d->lock );
+    const int task = d->bottom > d->top ? d->tasks[--d->bottom] : -1;
+    if (d->bottom == d->top){
+        d->top = d->bottom = 0;
+    }
+    spin_unlock( &d->lock );
+    return task;
+}
+
+/* Returns the oldest task, or -1 */
+static int deque_steal( Deque* d )
+{
+    spin_lock( &d->lock );
+    const int task = d->bottom > d->top ? d->tasks[d->top++] : -1;
+    spin_unlock( &d->lock );
+    return task;
+}
+
+static void taskgraph_worker( void* arg )
+{
+    const Worker* worker = (const Worker*)arg;
+    TaskGraph* g = worker->graph;
+    Deque* own = g->deques + worker->index;
+    int victim = worker->index;
+
+    while (atomic_load( &g->remaining ) > 0){
+        int task = deque_pop( own );
+        for (int k = 1; task < 0 && k < g->nworkers; k++){
+            victim = (victim + 1) % g->nworkers;
+            if (victim != worker->index){
+                task = deque_steal( g->deques + victim );
+            }
+        }
+        if (task < 0){
+            thread_yield();
+            continue;
+        }
+
+        g->status[task] = atomic_load( &g->failed )
+            ? GPARSE_ERROR : g->run( g->data, task );
+        if (g->status[task] != GPARSE_OK){
+            atomic_store( &g->failed, 1 );
+        }
+        for (int k = g->first[task]; k < g->first[task + 1]; k++){
+            if (atomic_add( g->pending + g->succ[k], -1 ) == 0){
+                deque_push( own, g->succ[k] );
+            }
+        }
+        atomic_add( &g->remaining, -1 );
+    }
+}
+
+/* Runs the tasks with 'nthreads' workers, including the calling thread.
+ * 'pending' has the number of predecessors of each task, and it is
+ * consumed. The status of each task is written in 'status'; the tasks
+ * after a failure are not run, and their status is GPARSE_ERROR. */
+static int taskgraph_run( const int ntasks, const int* first, const int* succ
+    , int* pending, int* status, f_task run, void* data, int nthreads )
+{
+    TaskGraph g;
+    memset( &g, 0, sizeof( TaskGraph ) );
+    g.ntasks = ntasks;
+    g.first = first;
+    g.succ = succ;
+    g.pending = pending;
+    g.remaining = ntasks;
+    g.status = status;
+    g.run = run;
+    g.data = data;
+
+    nthreads = nthreads < ntasks ? nthreads : ntasks;
+    nthreads = nthreads > 1 ? nthreads : 1;
+    g.nworkers = nthreads;
+
+    g.deques = (Deque*)calloc( nthreads, sizeof( Deque ) );
+    Worker* workers = (Worker*)calloc( nthreads, sizeof( Worker ) );
+    Thread* threads = (Thread*)calloc( nthreads, sizeof( Thread ) );
+    int ok = g.deques != nullptr && workers != nullptr && threads != nullptr;
+    for (int w = 0; w < nthreads && ok; w++){
+        g.deques[w].tasks = (int*)malloc( sizeof( int )*(ntasks + 1) );
+        ok = g.deques[w].tasks != nullptr;
+        workers[w].graph = &g;
+        workers[w].index = w;
+    }
+
+    int nstarted = 0;
+    if (ok){
+        /* Deal the initial ready tasks among the workers */
+        int w = 0;
+        for (int t = 0; t < ntasks; t++){
+            if (pending[t] == 0){
+                deque_push( g.deques + w, t );
+                w = (w + 1) % nthreads;
+            }
+        }
+        for (nstarted = 1; nstarted < nthreads; nstarted++){
+            if (thread_start( threads + nstarted, taskgraph_worker, workers + nstarted )){
+                break;
+            }
+        }
+        /* If some thread cannot start, the others steal its tasks */
+        taskgraph_worker( workers );
+    }
+    for (int w = 1; w < nstarted; w++){
+        thread_join( threads[w] );
+    }
+
+    for (int w = 0; g.deques != nullptr && w < nthreads; w++){
+        free( g.deques[w].tasks );
+    }
+    free( g.deques );
+    free( workers );
+    free( threads );
+    return ok && g.failed == 0 ? GPARSE_OK : GPARSE_ERROR;
+}
+
+#endif /* H_GTHREAD_H */
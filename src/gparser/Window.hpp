@@ -0,0 +1,314 @@
+/*
+Copyright (c) 2016 Mario J. Martin-Burgos <dominonurbs$gmail.com>
+This softaware is licensed under Apache 2.0 license
+http://www.apache.org/licenses/LICENSE-2.0
+
+
+Window functions over the sequence of values of an expression.
+
+    mavg( x, n )    mean of the last n values
+    mstd( x, n )    sample standard deviation of the last n values
+    ema( x, a )     exponential moving average with smoothing factor a
+    rmin( x, n )    minimum of the last n values
+    rmax( x, n )    maximum of the last n values
+
+The second argument must be a constant. Each call in a compiled program
+keeps its own state, and each row it evaluates is a new value: the rows of
+gProgram_evalBatch in order, and each call to gProgram_eval. Null values
+are skipped. The state lasts until gProgram_resetWindows.
+
+Each value is added in constant time. The last n values are kept in a ring
+buffer. The mean and the sum of squared deviations are updated as values
+enter and leave the window, and computed again from the buffer after every
+n values, so the rounding errors do not accumulate. The extremes are kept
+in a monotonic deque: a value is dropped when a newer one is at least as
+extreme, as it cannot be the extreme of any later window.
+
+The interpreter has no state, so it evaluates them for a single value.
+*******************************************************************************/
+
+#ifndef H_GWINDOW_H
+#define H_GWINDOW_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gdata.h"
+#include "data_wrap.hpp"
+#include "Program.hpp"
+
+/* State of a window function for a call in a program */
+struct Window
+{
+    double param;       /* Size of the window, or smoothing factor */
+    size_t count;       /* Values added */
+    void( *reset )( Window* w );
+};
+
+/* Mean and squared deviations of the last n values */
+struct WindowMoving : Window
+{
+    int size;
+    int pos;            /* Next position in the ring */
+    int updates;        /* Values since the last exact computation */
+    double mean;
+    double m2;
+    double* ring;
+};
+
+struct WindowEma : Window
+{
+    double alpha;
+    double value;
+};
+
+/* Extremes of the last n values. The deque keeps the values in the ring,
+ * from 'head', with their positions in the sequence. */
+struct WindowExtreme : Window
+{
+    int size;
+    int head;
+    int len;
+    double* values;
+    size_t* seq;
+};
+
+/**********************/
+/* Mean and deviation */
+/**********************/
+static void moving_reset( Window* w )
+{
+    WindowMoving* m = (WindowMoving*)w;
+    m->count = 0;
+    m->pos = 0;
+    m->updates = 0;
+    m->mean = 0;
+    m->m2 = 0;
+}
+
+static Window* moving_new( const double param )
+{
+    if (!(param >= 1 && param <= 1.0e8)){
+        return nullptr;
+    }
+    const int size = int( param );
+    WindowMoving* m = (WindowMoving*)malloc( sizeof( WindowMoving ) + sizeof( double )*size );
+    if (m == nullptr){
+        return nullptr;
+    }
+    m->param = param;
+    m->reset = moving_reset;
+    m->size = size;
+    m->ring = (double*)(m + 1);
+    moving_reset( m );
+    return m;
+}
+
+static inline void moving_push( WindowMoving* m, const double x )
+{
+    if (m->count < (size_t)m->size){
+        m->count++;
+        const double d = x - m->mean;
+        m->mean += d / double( m->count );
+        m->m2 += d*(x - m->mean);
+    }
+    else{
+        const double old = m->ring[m->pos];
+        const double mean = m->mean + (x - old) / m->size;
+        m->m2 += (x - old)*(x - mean + old - m->mean);
+        m->mean = mean;
+        m->updates++;
+    }
+    m->ring[m->pos] = x;
+    m->pos = m->pos + 1 < m->size ? m->pos + 1 : 0;
+
+    if (m->updates >= m->size){
+        double sum = 0;
+        for (int i = 0; i < m->size; i++){
+            sum += m->ring[i];
+        }
+        const double mean = sum / m->size;
+        double m2 = 0;
+        for (int i = 0; i < m->size; i++){
+            m2 += (m->ring[i] - mean)*(m->ring[i] - mean);
+        }
+        m->mean = mean;
+        m->m2 = m2;
+        m->updates = 0;
+    }
+}
+
+struct w_mavg
+{
+    typedef WindowMoving State;
+    static inline Window* create( const double param ){ return moving_new( param ); }
+    static inline double push( State* m, const double x )
+    {
+        moving_push( m, x );
+        return m->mean;
+    }
+};
+
+struct w_mstd
+{
+    typedef WindowMoving State;
+    static inline Window* create( const double param ){ return moving_new( param ); }
+    static inline double push( State* m, const double x )
+    {
+        moving_push( m, x );
+        return m->count > 1 ? sqrt( (m->m2 > 0 ? m->m2 : 0) / double( m->count - 1 ) ) : NAN;
+    }
+};
+
+/*******/
+/* EMA */
+/*******/
+static void ema_reset( Window* w )
+{
+    WindowEma* e = (WindowEma*)w;
+    e->count = 0;
+    e->value = 0;
+}
+
+struct w_ema
+{
+    typedef WindowEma State;
+    static Window* create( const double param )
+    {
+        if (!(param > 0 && param <= 1)){
+            return nullptr;
+        }
+        WindowEma* e = (WindowEma*)malloc( sizeof( WindowEma ) );
+        if (e == nullptr){
+            return nullptr;
+        }
+        e->param = param;
+        e->reset = ema_reset;
+        e->alpha = param;
+        ema_reset( e );
+        return e;
+    }
+    static inline double push( State* e, const double x )
+    {
+        e->value = e->count == 0 ? x : e->value + e->alpha*(x - e->value);
+        e->count++;
+        return e->value;
+    }
+};
+
+/************/
+/* Extremes */
+/************/
+static void extreme_reset( Window* w )
+{
+    WindowExtreme* e = (WindowExtreme*)w;
+    e->count = 0;
+    e->head = 0;
+    e->len = 0;
+}
+
+static Window* extreme_new( const double param )
+{
+    if (!(param >= 1 && param <= 1.0e8)){
+        return nullptr;
+    }
+    const int size = int( param );
+    WindowExtreme* e = (WindowExtreme*)malloc( sizeof( WindowExtreme )
+        + (sizeof( double ) + sizeof( size_t ))*size );
+    if (e == nullptr){
+        return nullptr;
+    }
+    e->param = param;
+    e->reset = extreme_reset;
+    e->size = size;
+    e->seq = (size_t*)(e + 1);
+    e->values = (double*)(e->seq + size);
+    extreme_reset( e );
+    return e;
+}
+
+/* Adds the value and returns the extreme of the window. C::before( a, b )
+ * is true if a is more extreme than b. */
+template< class C >
+static inline double extreme_push( WindowExtreme* e, const double x )
+{
+    /* The values no more extreme than x leave from the back */
+    while (e->len > 0){
+        const int back = e->head + e->len - 1 < e->size
+            ? e->head + e->len - 1 : e->head + e->len - 1 - e->size;
+        if (C::before( e->values[back], x )){
+            break;
+        }
+        e->len--;
+    }
+    /* The oldest value leaves from the front when it is out of the window */
+    if (e->len > 0 && e->seq[e->head] + e->size <= e->count){
+        e->head = e->head + 1 < e->size ? e->head + 1 : 0;
+        e->len--;
+    }
+    const int pos = e->head + e->len < e->size ? e->head + e->len : e->head + e->len - e->size;
+    e->values[pos] = x;
+    e->seq[pos] = e->count;
+    e->len++;
+    e->count++;
+    return e->values[e->head];
+}
+
+struct c_min{ static inline int before( const double a, const double b ){ return a < b; } };
+struct c_max{ static inline int before( const double a, const double b ){ return a > b; } };
+
+struct w_rmin
+{
+    typedef WindowExtreme State;
+    static inline Window* create( const double param ){ return extreme_new( param ); }
+    static inline double push( State* e, const double x ){ return extreme_push< c_min >( e, x ); }
+};
+
+struct w_rmax
+{
+    typedef WindowExtreme State;
+    static inline Window* create( const double param ){ return extreme_new( param ); }
+    static inline double push( State* e, const double x ){ return extreme_push< c_max >( e, x ); }
+};
+
+/***********/
+/* Kernels */
+/***********/
+
+/* The state of the call is in f->data, see compile_call */
+template< class W >
+static int window_batch
+    ( const Function* f, void* result, const void* const* args, const Selection* sel )
+{
+    typename W::State* state = (typename W::State*)f->data;
+    double* _restrict_ d = (double*)result;
+    const double* _restrict_ x = (const double*)args[0];
+    const int n = sel->n;
+
+    if (sel->idx == nullptr){
+        for (int i = 0; i < n; i++){
+            d[i] = W::push( state, x[i] );
+        }
+    }
+    else{
+        for (int k = 0; k < n; k++){
+            const int i = sel->idx[k];
+            d[i] = W::push( state, x[i] );
+        }
+    }
+    return GPARSE_OK;
+}
+
+/* The interpreter evaluates the function for a single value */
+template< class W >
+static int window_scalar( const Function*, void* result, const void* const* args )
+{
+    Window* w = W::create( *(const double*)args[1] );
+    *(double*)result = w != nullptr
+        ? W::push( (typename W::State*)w, *(const double*)args[0] ) : NAN;
+    free( w );
+    return GPARSE_OK;
+}
+
+#endif /* H_GWINDOW_H */
@@ -11,6 +11,7 @@ http://www.apache.org/licenses/LICENSE-2.0
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <new>
 
 #include "gdata.h"
 
@@ -58,6 +59,7 @@ enum TokenType : unsigned int
     token_void = KEYWORD_MASK + 1,     // void
     token_struct = KEYWORD_MASK + 2,   // struct
     token_function = KEYWORD_MASK + 3, // function
+    token_return = KEYWORD_MASK + 4,   // return
 
     /* Arithmetic */
     token_plus = ARITMETIC_MASK + 1,    // +
@@ -148,6 +150,25 @@ static inline int strtok_compare
     }
 }
 
+/* Returns 1 if the string is a valid name: letters, digits and '_', not
+ * starting with a digit */
+static inline int name_is_valid
+( const char* _restrict_ const ini
+, const char* _restrict_ const end
+)
+{
+    if (ini >= end || (*ini >= '0' && *ini <= '9')){
+        return 0;
+    }
+    for (const char* p = ini; p < end; p++){
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')
+            || (*p >= '0' && *p <= '9') || *p == '_')){
+            return 0;
+        }
+    }
+    return 1;
+}
+
 char* tok2str
 ( const char* _restrict_ const ini
 , const char* _restrict_ const end
@@ -179,6 +200,17 @@ char* tok2str
     return varname;
 }
 
+struct Variable;
+template< class T > struct BinaryTree;
+
+/* Releases a node of a tree */
+template< class T >
+static inline void tree_delete( BinaryTree< T >* node )
+{
+    delete node;
+}
+static inline void tree_delete( BinaryTree< Variable >* node );
+
 template< class T >
 struct BinaryTree : T
 {
@@ -258,11 +290,11 @@ struct BinaryTree : T
     {
         if (upper_name != nullptr){
             upper_name->dispose();
-            delete upper_name;
+            tree_delete( upper_name );
         }
         if (lower_name != nullptr){
             lower_name->dispose();
-            delete lower_name;
+            tree_delete( lower_name );
         }
     }
 };
@@ -271,6 +303,19 @@ struct Variable : gVariable
 {
     bool free_data;
 
+    /* A member of a structure points at 'offset' bytes from the value of the
+     * instance 'base' */
+    Variable* base;
+    int offset;
+
+    /* Node of the graph of formulas + 1, or 0. See Reactive.hpp */
+    int node;
+
+    /* The node and the name are in a block of the parser, released with
+     * it, and so is the value if value_in_block. See State.hpp and Pool.hpp */
+    bool in_block;
+    bool value_in_block;
+
     Variable( char* _varname )
     {
         memset( this, 0, sizeof( Variable ) );
@@ -278,23 +323,133 @@ struct Variable : gVariable
     }
 
     ~Variable(){
-        free( name );
+        if (!in_block){
+            free( name );
+        }
         if (free_data){
             free( pvalue );
         }
     }
 };
 
+/* Variables of a block are destroyed in place */
+static inline void tree_delete( BinaryTree< Variable >* node )
+{
+    if (node->in_block){
+        node->~BinaryTree();
+    }
+    else{
+        delete node;
+    }
+}
+
+/* Memory released all at once. The chunks are kept when it is reset, so
+ * the next allocations reuse them. See Pool.hpp */
+#define ARENA_CHUNK_SIZE 4096
+
+struct ArenaChunk
+{
+    ArenaChunk* next;
+    size_t size;            /* Bytes after the header */
+};
+
+struct Arena
+{
+    ArenaChunk* chunks;
+    ArenaChunk* current;    /* Chunk being filled */
+    size_t used;            /* Bytes used of the current chunk */
+
+    Arena()
+    {
+        memset( this, 0, sizeof( Arena ) );
+    }
+
+    ~Arena()
+    {
+        while (chunks != nullptr){
+            ArenaChunk* next = chunks->next;
+            free( chunks );
+            chunks = next;
+        }
+    }
+
+    /* Returns nullptr if there is not enough memory */
+    void* alloc( size_t size )
+    {
+        size = (size + 7) & ~size_t( 7 );
+        while (current != nullptr && used + size > current->size
+            && current->next != nullptr){
+            current = current->next;
+            used = 0;
+        }
+        if (current == nullptr || used + size > current->size){
+            const size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+            ArenaChunk* chunk = (ArenaChunk*)malloc( sizeof( ArenaChunk ) + chunk_size );
+            if (chunk == nullptr){
+                return nullptr;
+            }
+            chunk->next = nullptr;
+            chunk->size = chunk_size;
+            if (current == nullptr){
+                chunks = chunk;
+            }
+            else{
+                current->next = chunk;
+            }
+            current = chunk;
+            used = 0;
+        }
+        void* p = (char*)(current + 1) + used;
+        used += size;
+        return p;
+    }
+
+    void reset()
+    {
+        current = chunks;
+        used = 0;
+    }
+};
+
+/* Structure types are numbered from STRUCT_TYPE_MIN, after t_bool, which is
+ * the only positive basic type. */
+#define STRUCT_TYPE_MIN 2
+
+/* Member of a structure type */
+struct Field
+{
+    char* name;
+    int type;       /* Basic type, or the index of a structure type */
+    int offset;     /* Bytes from the start of the instance */
+};
+
 struct Struct : gStruct
 {
     int nvars;
     BinaryTree< Variable >* vars;
     BinaryTree< Struct >* strs;
 
+    /* Layout of the structure type, computed when it is declared. The
+     * fields follow the C rules of alignment, so an instance is a single
+     * block of 'size' bytes, compatible with the same C structure. */
+    Field* fields;
+    int nfields;
+    int size;
+    int align;
+    int type;       /* Index as registered in the parser */
+
     /* Data structures are stored in a binary tree for quick search */
     Struct* upper_name;
     Struct* lower_name;
 
+    /* Scope shared with other parsers, searched after this one. It is not
+     * modified, see Layer.hpp */
+    const Struct* base;
+
+    /* Memory of the nodes and the names of the variables, or nullptr if
+     * they are allocated one by one */
+    Arena* arena;
+
     Struct(){
         memset( this, 0, sizeof( Struct ) );
     }
@@ -312,9 +467,16 @@ struct Struct : gStruct
     {
         free( name );
 
+        for (int i = 0; i < nfields; i++){
+            free( fields[i].name );
+        }
+        free( fields );
+        fields = nullptr;
+        nfields = 0;
+
         if (vars != nullptr){
             vars->dispose();
-            delete vars;
+            tree_delete( vars );
             vars = nullptr;
         }
 
@@ -332,6 +494,9 @@ struct Struct : gStruct
     Variable* add_variable( const char* _restrict_ const ini
         , const char* _restrict_ const end, int* status )
     {
+        if (arena != nullptr){
+            return add_arena_variable( ini, end, status );
+        }
         if (vars != nullptr){
             return vars->push( ini, end, status );
         }
@@ -343,9 +508,60 @@ struct Struct : gStruct
         }
     }
 
+    /* Same as add_variable, but the node and the name are allocated in the
+     * arena. Returns nullptr if there is not enough memory */
+    Variable* add_arena_variable( const char* _restrict_ const ini
+        , const char* _restrict_ const end, int* status )
+    {
+        BinaryTree< Variable >** link = &vars;
+        while (*link != nullptr){
+            const int cmp = strtok_compare( (*link)->name, ini, end );
+            if (cmp == 0){
+                *status = GPARSE_NAME_COLLISION;
+                return *link;
+            }
+            link = cmp > 0 ? &(*link)->upper_name : &(*link)->lower_name;
+        }
+
+        const size_t len = end - ini;
+        char* mem = (char*)arena->alloc( sizeof( BinaryTree< Variable > ) + len + 1 );
+        if (mem == nullptr){
+            return nullptr;
+        }
+        char* varname = mem + sizeof( BinaryTree< Variable > );
+        memcpy( varname, ini, len );
+        varname[len] = '\0';
+
+        BinaryTree< Variable >* node = new (mem) BinaryTree< Variable >( varname );
+        node->in_block = true;
+        *link = node;
+        *status = GPARSE_NEW_NAME;
+        return node;
+    }
+
     Variable* find_variable 
         ( const char* _restrict_ const ini
         , const char* _restrict_ const end ) const
+    {
+        Variable* obj = find_own_variable( ini, end );
+        if (obj == nullptr && base != nullptr){
+            obj = base->find_variable( ini, end );
+
+            /* A member of an instance which this scope has copied is resolved
+             * again in this scope, see Layer.hpp */
+            if (obj != nullptr && obj->base != nullptr && find_own_variable( obj->base->name
+                , obj->base->name + strlen( obj->base->name ) ) != nullptr){
+                obj = nullptr;
+            }
+        }
+
+        return obj;
+    }
+
+    /* Variable of this scope, not of the base */
+    Variable* find_own_variable
+        ( const char* _restrict_ const ini
+        , const char* _restrict_ const end ) const
     {
         Variable* obj;
         if (vars != nullptr){
@@ -376,7 +592,7 @@ struct Struct : gStruct
     }
 
     Struct* find_struct
-        ( const char* _restrict_ const ini, const char* _restrict_ const end )
+        ( const char* _restrict_ const ini, const char* _restrict_ const end ) const
     {
         Struct* obj;
         if (strs != nullptr){
@@ -385,19 +601,44 @@ struct Struct : gStruct
         else{
             obj = nullptr;
         }
+        if (obj == nullptr && base != nullptr){
+            obj = base->find_struct( ini, end );
+        }
 
         return obj;
     }
 };
 
+struct Function;
+struct Program;
+struct Snapshot;
+struct Workspace;
+
+/* Variable of the graph of formulas. Inputs have no program. */
+struct Node
+{
+    Variable* var;
+    Program* prog;      /* Formula that assigns the variable, or nullptr */
+    int* inputs;        /* Nodes read by the formula */
+    int ninputs;
+    int inputs_capacity;
+    int* users;         /* Formulas that read the variable */
+    int nusers;
+    int users_capacity;
+    int rank;           /* Higher than the rank of any input */
+    int queued;         /* Waiting for the next update */
+    int reached;        /* Collected by the update */
+    int changed;        /* The value changed during the update */
+};
+
 struct Token
 {
     const char* str_ini;  /* Pointer to the string at the start of the token */
     const char* str_end;  /* Pointer to the string at the end of the token */
     TokenType token_type; /* Indicates if it is an operand, a var name, ... */
     int var_type;         /* If the token is a variable, indicates the type.
-                          * Basic types are negative, while positive types
-                          * are the index as registered in the parser. */
+                          * Basic types are negative, while structures are
+                          * numbered from STRUCT_TYPE_MIN. */
     Variable* pvar;      /* Pointer if the token is a variable */
 };
 
@@ -412,6 +653,51 @@ struct Parser : gParser
     Token tokens[256];
     size_t num_tokens;
 
+    /* Functions added with gParser_addFunction or declared in the code.
+     * Each one is allocated with its name, so programs can keep pointers to
+     * them. They are released by functions_dispose. */
+    Function** functions;
+    int nfunctions;
+
+    /* Structure types. The type of a structure is its index in this array
+     * + STRUCT_TYPE_MIN; the structures are owned by the global scope. */
+    Struct** types;
+    int ntypes;
+
+    /* Graph of formulas, released by graph_dispose */
+    Node* nodes;
+    int nnodes;
+    int nodes_capacity;
+    int* dirty;         /* Nodes changed since the last update */
+    int ndirty;
+    int dirty_capacity;
+
+    /* Groups of variables of the host read together before each
+     * evaluation, released by snapshots_dispose */
+    Snapshot** snapshots;
+    int nsnapshots;
+    int snapshots_capacity;
+
+    /* Parser with the global scope shared by this one, and the number of its
+     * functions, which are the first ones of this parser but not released
+     * by it. See Layer.hpp */
+    const Parser* base;
+    int nbase_functions;
+
+    /* Frame of the calls of the interpreter to functions of scripts,
+     * released by functions_release_own. See Function.hpp */
+    Workspace* frame;
+
+    /* Blocks with the variables of the states loaded, released after the
+     * global scope. See State.hpp */
+    void** blocks;
+    int nblocks;
+    int blocks_capacity;
+
+    /* Nodes and names of the global variables of a parser of a pool, kept
+     * when it is reset. It is not used otherwise. See Pool.hpp */
+    Arena arena;
+
     Parser()
     {
         memset( this, 0, sizeof( Parser ) );
@@ -421,6 +707,10 @@ struct Parser : gParser
     {
         /* Erase global variables and structure, function definitions */
         global.dispose();
+        for (int i = 0; i < nblocks; i++){
+            free( blocks[i] );
+        }
+        free( blocks );
 
         /* Delete output messages */
         free( this->err_msg );
@@ -428,6 +718,8 @@ struct Parser : gParser
         /* Release the 'ans' varable */
         free( ans.pvalue );
         free( ans.name );
+
+        free( types );
     }
 
     void add_token
@@ -9,6 +9,7 @@ http://www.apache.org/licenses/LICENSE-2.0
 #define H_GDATA_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define GPARSE_OK   0
 #define GPARSE_ERROR     1
@@ -58,6 +59,60 @@ typedef struct
     void* pvalue;
 }gVariable;
 
+/* Field of a structure of the host, for gParser_addStruct */
+typedef struct
+{
+    const char* name;
+    int type;       /* Basic type, or a type returned by gParser_addStruct */
+    size_t offset;  /* offsetof( struct, field ) */
+}gField;
+
+/* Apache Arrow C Data Interface, as defined by the Arrow specification.
+ * Programs read and write columns of Arrow arrays in place. */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+    /* Array type description */
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    /* Release callback */
+    void (*release)( struct ArrowSchema* );
+    /* Opaque producer-specific data */
+    void* private_data;
+};
+
+struct ArrowArray
+{
+    /* Array data description */
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    /* Release callback */
+    void (*release)( struct ArrowArray* );
+    /* Opaque producer-specific data */
+    void* private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
 /* Data structure to hold structures */
 typedef struct
 {
@@ -85,4 +140,103 @@ typedef struct
     int option_explicit_decl;
 }gParser;
 
+/* Function implemented in C: *result = f( *args[0], *args[1], ... ).
+ * Arguments and result have the types given when the function is added. */
+typedef void( *gFunction )( void* result, const void* const* args, void* data );
+
+/* Batch version: result[i] = f( args[0][i], args[1][i], ... ), i < n */
+typedef void( *gFunctionBatch )
+    ( void* result, const void* const* args, size_t n, void* data );
+
+/* Compiled expression */
+typedef struct
+{
+    int type;       /* Type of the result */
+    gVariable ans;  /* Result of the last scalar evaluation */
+}gProgram;
+
+/* Aggregates of the results of a program, see gProgram_aggregate. They are
+ * NaN if there are not enough values. */
+typedef struct
+{
+    size_t count;       /* Results which are not null */
+    double sum;
+    double mean;
+    double variance;    /* Sample variance, with count - 1 degrees of freedom */
+    double min;
+    double max;
+}gAggregate;
+
+/* Options of gProgram_aggregate */
+#define GPARSE_PAIRWISE 1   /* Pairwise summation, in the same order for any
+                             * number of threads */
+
+/* Groups of rows with the same key, see gProgram_groupBy */
+typedef struct
+{
+    int key_type;           /* Type of the keys */
+    size_t ngroups;
+    void* keys;             /* Key of each group, as values of key_type */
+    gAggregate* aggregates; /* Aggregates of the values of each group */
+}gGroups;
+
+/* Column of a file mapped in memory, see gColumns_open */
+typedef struct
+{
+    const char* name;           /* Name of the variable */
+    int type;
+    size_t count;               /* Number of values */
+    const void* data;
+    const uint64_t* validity;   /* Bitmap of the rows with a value, or nullptr */
+    void* map;                  /* Mapping of the whole file */
+    size_t map_size;
+}gColumn;
+
+/* Column files of a directory */
+typedef struct
+{
+    int ncolumns;
+    size_t nrows;               /* Values of the shortest column */
+    gColumn* columns;           /* Sorted by name */
+}gColumns;
+
+/* Variables in a segment of shared memory, see gShared_create */
+typedef struct
+{
+    int nvars;
+}gShared;
+
+/* Variables of the host updated together, see gParser_addSnapshot */
+typedef struct
+{
+    int nvars;
+    int stale;      /* Evaluations that kept the previous copy */
+}gSnapshot;
+
+/* Named formulas replaced while they are evaluated, see gRegistry_create */
+typedef struct
+{
+    volatile int nformulas;
+}gRegistry;
+
+/* Thread evaluating the formulas of a registry */
+typedef struct
+{
+    gRegistry* registry;
+}gReader;
+
+/* Compiled programs kept in a file, see gCache_open */
+typedef struct
+{
+    int nentries;
+    int hits;       /* Programs taken from the cache */
+    int misses;     /* Programs compiled */
+}gCache;
+
+/* Parsers reused by short sessions, see gPool_create */
+typedef struct
+{
+    volatile int nparsers;  /* Parsers created */
+}gPool;
+
 #endif /* H_GDATA_H */
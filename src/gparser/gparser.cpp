@@ -16,6 +16,22 @@ http://www.apache.org/licenses/LICENSE-2.0
 #include "Numeric.hpp"
 #include "Variable.hpp"
 #include "Parser.hpp"
+#include "Program.hpp"
+#include "Function.hpp"
+#include "Structure.hpp"
+#include "Arrow.hpp"
+#include "Reactive.hpp"
+#include "Thread.hpp"
+#include "Aggregate.hpp"
+#include "GroupBy.hpp"
+#include "Column.hpp"
+#include "Shared.hpp"
+#include "Snapshot.hpp"
+#include "Registry.hpp"
+#include "Layer.hpp"
+#include "Cache.hpp"
+#include "State.hpp"
+#include "Pool.hpp"
 
 /* Predeclaration of functions */
 int parse_command( Numeric* ans, Parser* parser, Struct* strwct
@@ -25,6 +41,12 @@ int parse_command( Numeric* ans, Parser* parser, Struct* strwct
 int parser_code( Parser* parser, Struct* str
     , const char* code_ini, const char* code_end );
 
+int parse_function_declaration( Parser* parser
+    , const Token* const tok_ini, const Token* const tok_end );
+
+int parse_struct_declaration( Parser* parser, Struct* strwct
+    , const Token* const tok_ini, const Token* const tok_end );
+
 /*******************************/
 
 static int str2num( Numeric* ans, const Token* const token )
@@ -53,7 +75,7 @@ static int str2num( Numeric* ans, const Token* const token )
         token_type = token_hexadecimal;
         p += 2;
     }
-    else if (*p == '0' && (*(p + 1) == 'b' || *(p + 2) == 'B')){
+    else if (*p == '0' && (*(p + 1) == 'b' || *(p + 1) == 'B')){
         /* It is an binary */
         token_type = token_binary;
         p += 2;
@@ -372,6 +394,140 @@ static const int bracket
     }
 }
 
+/* Splits the arguments of a function call 'name( a, b, ... )' between the
+ * open bracket and tok_end, which must be its closing bracket. */
+static int split_arguments
+    ( Parser* parser
+    , const Token* const tok_open
+    , const Token* const tok_end
+    , const Token** args_ini, const Token** args_end, int* nargs
+    )
+{
+    int ibr = 0;
+    const Token* arg = tok_open + 1;
+
+    *nargs = 0;
+    for (const Token* p = tok_open; p <= tok_end; p++){
+        switch (p->token_type){
+        case token_bracket_round_open:
+            ibr++;
+            break;
+        case token_bracket_round_close:
+            ibr--;
+            break;
+        }
+        if (ibr < 0 || (ibr == 0 && p != tok_end)){
+            /* It is not a single function call */
+            return GPARSE_NO_COMMAND;
+        }
+        if ((ibr == 1 && p->token_type == token_comma) || p == tok_end){
+            if (p == arg){
+                if (p == tok_end && *nargs == 0){
+                    /* No arguments */
+                    return GPARSE_OK;
+                }
+                parser_error( parser, "Expecting an argument" );
+                parser->code_pos = p->str_ini;
+                return GPARSE_ERROR;
+            }
+            if (*nargs >= GPARSE_MAX_ARGS){
+                parser_error( parser, "Too many arguments" );
+                parser->code_pos = p->str_ini;
+                return GPARSE_ERROR;
+            }
+            args_ini[*nargs] = arg;
+            args_end[*nargs] = p - 1;
+            (*nargs)++;
+            arg = p + 1;
+        }
+    }
+    if (ibr != 0){
+        parser_error( parser, "Unmatching bracket" );
+        parser->code_pos = tok_end->str_end;
+        return GPARSE_ERROR;
+    }
+
+    return GPARSE_OK;
+}
+
+/* Returns true if the tokens may be a function call 'name( ... )' */
+static inline int is_function_call
+    ( const Token* const tok_ini, const Token* const tok_end )
+{
+    return (tok_ini->token_type == token_name
+        || tok_ini->token_type == token_varname)
+        && tok_ini + 1 < tok_end
+        && (tok_ini + 1)->token_type == token_bracket_round_open
+        && tok_end->token_type == token_bracket_round_close;
+}
+
+/* Error of a call to an unknown function, or with invalid arguments */
+static int function_not_found
+    ( Parser* parser, const Token* const tok_name, const int found )
+{
+    if (found){
+        parser_error( parser, "Invalid arguments for the function" );
+    }
+    else{
+        parser_error( parser, "Unknown function" );
+    }
+    parser->code_pos = tok_name->str_ini;
+    return GPARSE_ERROR;
+}
+
+static int function_call
+    ( Numeric* ans
+    , Parser* parser, Struct* strwct
+    , const Token* const tok_ini
+    , const Token* const tok_end
+    )
+{
+    const Token* args_ini[GPARSE_MAX_ARGS];
+    const Token* args_end[GPARSE_MAX_ARGS];
+    int nargs;
+    int status;
+
+    if (is_function_call( tok_ini, tok_end ) == 0){
+        return GPARSE_NO_COMMAND;
+    }
+    status = split_arguments
+        ( parser, tok_ini + 1, tok_end, args_ini, args_end, &nargs );
+    if (status != GPARSE_OK){
+        return status;
+    }
+
+    Numeric args[GPARSE_MAX_ARGS];
+    int types[GPARSE_MAX_ARGS] = { 0 };
+    for (int k = 0; k < nargs; k++){
+        status = parse_command( args + k, parser, strwct, args_ini[k], args_end[k] );
+        if (status != GPARSE_OK){
+            return status;
+        }
+        types[k] = args[k].type;
+    }
+
+    int found;
+    const Function* f = function_find
+        ( parser, tok_ini->str_ini, tok_ini->str_end, types, nargs, &found );
+    if (f == nullptr){
+        return function_not_found( parser, tok_ini, found );
+    }
+
+    const void* pargs[GPARSE_MAX_ARGS];
+    for (int k = 0; k < nargs; k++){
+        numeric_explicit_cast( args + k, f->args_type[k] );
+        pargs[k] = args[k].pvalue;
+    }
+    if (function_call_scalar( parser, f, ans->pvalue, pargs ) != GPARSE_OK){
+        parser_error( parser, "Not enough memory for the call" );
+        parser->code_pos = tok_ini->str_ini;
+        return GPARSE_ERROR;
+    }
+    ans->type = f->type;
+
+    return GPARSE_OK;
+}
+
 static int unary_operation
     ( Numeric* ans
     , Parser* parser, Struct* strwct
@@ -408,181 +564,126 @@ static int unary_operation
     return GPARSE_NO_COMMAND;
 }
 
-static int dual_operation
-    ( Numeric* ans
-    , Parser* parser, Struct* strwct
-    , const Token* _restrict_ const tok_ini
-    , const Token* _restrict_ const tok_end
-    , const int operator_mask 
-    )
+/* Applies the dual operator: ans = ans (op) b */
+static int numeric_operation
+    ( const unsigned int token_type
+    , Numeric* _restrict_ ans, Numeric* _restrict_ b, Parser* parser )
 {
-    Numeric a;
-    Numeric b;
-    int status;
-
-    const Token* op = get_dual_operand
-        ( parser, tok_ini, tok_end, operator_mask, RIGHT2LEFT, &status );
-
-    if (op == nullptr){
-        /* The dual operator is not present or there is an error */
-        return status;
-    }
-
-    /* Gets the left operand */
-    status = parse_command( &a, parser, strwct, tok_ini, op - 1 );
-    if (status) return status;
-
-    /* Gets the right operand */
-    status = parse_command( &b, parser, strwct, op + 1, tok_end );
-    if (status) return status;
-
-    numeric_copy( ans, a );
-
-    switch (op->token_type){
+    switch (token_type){
     case token_plus: /*ans = a + b */
-        if (numeric_add( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_add( ans, b, parser );
 
     case token_minus: /* ans = a - b */
-        if (numeric_sub( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_sub( ans, b, parser );
 
     case token_mul: /* ans = a * b */
-        if (numeric_mul( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_mul( ans, b, parser );
 
     case token_div: /* ans = a / b */
-        if (numeric_div( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_div( ans, b, parser );
 
     case token_remainder: /* ans = a % b */
-        if (numeric_remainder( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_remainder( ans, b, parser );
 
     case token_intdiv: /* ans = a %% b */
-        if (numeric_intdiv( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_intdiv( ans, b, parser );
 
     case token_pow: /* ans = a ^ b */
-        if (numeric_pow( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_pow( ans, b, parser );
 
     case token_equal: /* ans = a == b */
-        if (numeric_equal( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_equal( ans, b, parser );
 
     case token_notequal: /* ans = a != b */
-        if (numeric_notequal( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_notequal( ans, b, parser );
 
     case token_greater: /* ans = a > b */
-        if (numeric_greater( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_greater( ans, b, parser );
 
     case token_greaterequal: /* ans = a >= b */
-        if (numeric_greater_equal( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_greater_equal( ans, b, parser );
 
     case token_less: /* ans = a < b */
-        if (numeric_less( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_less( ans, b, parser );
 
     case token_lessequal: /* ans = a <= b */
-        if (numeric_less_equal( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_less_equal( ans, b, parser );
 
     case token_and: /* ans = a && b */
-        if (numeric_and( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_and( ans, b, parser );
 
     case token_or: /* ans = a || b */
-        if (numeric_or( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_or( ans, b, parser );
     case token_bitand: /* ans = a & b */
-        if (numeric_bit_and( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_bit_and( ans, b, parser );
 
     case token_bitxor: /* ans = a xor b */
-        if (numeric_bit_xor( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_bit_xor( ans, b, parser );
 
     case token_bitor: /* ans = a | b */
-        if (numeric_bit_or( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_bit_or( ans, b, parser );
 
     case token_lshift: /* ans = a << b */
-        if (numeric_lshift( ans, &b, parser )){
-            parser->code_pos = op->str_ini;
-            return GPARSE_ERROR;
-        }
-        return GPARSE_OK;
+        return numeric_lshift( ans, b, parser );
 
     case token_rshift: /* ans = a >> b */
-        if (numeric_rshift( ans, &b, parser )){
+        return numeric_rshift( ans, b, parser );
+
+    default:
+        parser_error( parser, "Unknown operation" );
+        return GPARSE_ERROR;
+    }
+}
+
+static int dual_operation
+    ( Numeric* ans
+    , Parser* parser, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end
+    , const int operator_mask 
+    )
+{
+    Numeric a;
+    Numeric b;
+    int status;
+
+    const Token* op = get_dual_operand
+        ( parser, tok_ini, tok_end, operator_mask, RIGHT2LEFT, &status );
+
+    if (op == nullptr){
+        /* The dual operator is not present or there is an error */
+        return status;
+    }
+
+    /* Gets the left operand */
+    status = parse_command( &a, parser, strwct, tok_ini, op - 1 );
+    if (status) return status;
+
+    /* Short-circuit: the right operand is not evaluated if the left one
+     * already determines the result */
+    if (op->token_type == token_and || op->token_type == token_or){
+        if (a.type != t_bool){
+            parser_error( parser, "Expecting boolean types" );
             parser->code_pos = op->str_ini;
             return GPARSE_ERROR;
         }
-        return GPARSE_OK;
+        if (a.pool.vbool == (op->token_type == token_or)){
+            numeric_copy( ans, a );
+            return GPARSE_OK;
+        }
+    }
 
-    default:
-        parser_error( parser, "Unknown operation" );
+    /* Gets the right operand */
+    status = parse_command( &b, parser, strwct, op + 1, tok_end );
+    if (status) return status;
+
+    numeric_copy( ans, a );
 
+    if (numeric_operation( op->token_type, ans, &b, parser )){
+        parser->code_pos = op->str_ini;
         return GPARSE_ERROR;
     }
+    return GPARSE_OK;
 }
 
 static int assign_operation
@@ -612,6 +713,14 @@ static int assign_operation
             return GPARSE_ERROR;
         }
 
+        /* A variable of the base is copied before writing it */
+        var = layer_own( strwct, var );
+        if (var == nullptr){
+            parser_error( parser, "Not enough memory for the variable" );
+            parser->code_pos = tok_ini->str_ini;
+            return GPARSE_ERROR;
+        }
+
         /* Calculate the right term. */
         status = parse_command( ans, parser, strwct, op + 1, tok_end );
         if (status != GPARSE_OK) return status;
@@ -637,16 +746,44 @@ static int assign_operation
         return GPARSE_OK;
     }
     else{ /* Implicit declarations allowed */
-        Variable* var = strwct->add_variable
-            ( tok_ini->str_ini, tok_ini->str_end, &status );
+        Variable* var = layer_own
+            ( strwct, strwct->find_variable( tok_ini->str_ini, tok_ini->str_end ) );
+        const bool is_new = var == nullptr;
+        if (is_new){
+            var = strwct->add_variable( tok_ini->str_ini, tok_ini->str_end, &status );
+            if (var == nullptr){
+                parser_error( parser, "Not enough memory for the variable" );
+                return GPARSE_ERROR;
+            }
+        }
 
         /* Calculate the right term */
         status = parse_command( ans, parser, strwct, op + 1, tok_end );
         if (status != GPARSE_OK) return status;
 
-        /* Assign and cast the variable to the right term */
+        if (!is_new && var->free_data == false && var->value_in_block == false){
+            /* The value belongs to the host, it keeps its type */
+            status = numeric_implicit_cast( ans, var->type );
+            if (status != GPARSE_OK){
+                parser_error( parser, "Cannot perform implicit casting" );
+                parser->code_pos = op->str_ini;
+                return status;
+            }
+            variable_assign( var, ans );
+            return GPARSE_OK;
+        }
+
+        /* Assign and cast the variable to the right term. A value loaded
+         * in a block of the parser is left there if the type changes. */
+        if (var->value_in_block == false){
+            var->free_data = true;
+        }
+        else if (var->type != ans->type){
+            var->pvalue = nullptr;
+            var->value_in_block = false;
+            var->free_data = true;
+        }
         variable_dynamic_assign( var, ans );
-        var->free_data = true;
     }
 
     return GPARSE_OK;
@@ -673,7 +810,11 @@ int parse_command( Numeric* ans, Parser* parser, Struct* strwct
             }
             return GPARSE_OK;
         case token_varname:
-            variable_assign_numeric( ans, tok_ini->pvar );
+            if (variable_assign_numeric( ans, tok_ini->pvar ) != GPARSE_OK){
+                parser_error( parser, "Structures cannot be used in expressions" );
+                parser->code_pos = tok_ini->str_ini;
+                return GPARSE_ERROR;
+            }
             return GPARSE_OK;
         case token_name:{
             /* Find the variable */
@@ -737,6 +878,9 @@ int parse_command( Numeric* ans, Parser* parser, Struct* strwct
     status = unary_operation( ans, parser, strwct, tok_ini, tok_end, VARTYPE_MASK );
     if (status != GPARSE_NO_COMMAND) return status;
 
+    status = function_call( ans, parser, strwct, tok_ini, tok_end );
+    if (status != GPARSE_NO_COMMAND) return status;
+
     /* Round Brackets */
     status = bracket( ans, parser, strwct, tok_ini, tok_end );
     if (status != GPARSE_NO_COMMAND) return status;
@@ -753,9 +897,40 @@ int parse_var_declaration( Parser* parser, Struct* strwct
 {
     /* Create the variable */
     int status;
+    const int type = token_vartype->var_type;
+
+    /* Arrays of structures 'name[count]' */
+    const char* name_end = token_name->str_end;
+    int count = 1;
+    if (type >= STRUCT_TYPE_MIN){
+        const char* p = token_name->str_ini;
+        while (p < name_end && *p != '['){
+            p++;
+        }
+        if (p < name_end){
+            if (struct_parse_index( p, name_end, &count ) != name_end || count == 0){
+                parser_error( parser, "Expecting the number of instances" );
+                parser->code_pos = p;
+                return GPARSE_ERROR;
+            }
+            name_end = p;
+        }
+    }
+
+    /* The names of the base are declared too */
+    if (strwct->base != nullptr
+        && strwct->base->find_variable( token_name->str_ini, name_end ) != nullptr){
+        parser_error( parser, "Variable name is already declared" );
+        parser->code_pos = token_name->str_ini;
+        return GPARSE_ERROR;
+    }
 
     Variable* var = strwct->add_variable
-        ( token_name->str_ini, token_name->str_end, &status );
+        ( token_name->str_ini, name_end, &status );
+    if (var == nullptr){
+        parser_error( parser, "Not enough memory for the variable" );
+        return GPARSE_ERROR;
+    }
 
     /* The variable data is handled by the parser */
     var->free_data = true;
@@ -765,9 +940,23 @@ int parse_var_declaration( Parser* parser, Struct* strwct
         parser->code_pos = token_name->str_ini;
         return GPARSE_ERROR;
     }
-    status = variable_alloc( var, token_vartype->var_type );
-    if (status != GPARSE_OK){
-        parser_error( parser, "C types cannot be used in declarations" );
+    if (type >= STRUCT_TYPE_MIN){
+        if (struct_alloc( parser, var, type, count ) != GPARSE_OK){
+            parser_error( parser, "Not enough memory for the structure" );
+            parser->code_pos = token_name->str_ini;
+            return GPARSE_ERROR;
+        }
+        if (token_name < token_end){
+            parser_error( parser, "Structures cannot be initialized" );
+            parser->code_pos = (token_name + 1)->str_ini;
+            return GPARSE_ERROR;
+        }
+        return GPARSE_OK;
+    }
+
+    status = variable_alloc( var, type );
+    if (status != GPARSE_OK){
+        parser_error( parser, "C types cannot be used in declarations" );
         parser->code_pos = token_name->str_ini;
         return status;
     }
@@ -802,6 +991,138 @@ int parse_var_declaration( Parser* parser, Struct* strwct
     }
 }
 
+/* Fields of a structure 'type name, name, ...' */
+static int parse_struct_fields( Parser* parser, Struct* str, int* capacity
+    , const Token* const tok_ini, const Token* const tok_end )
+{
+    if (tok_ini->token_type != token_vartype){
+        parser_error( parser, "Expecting the type of the field" );
+        parser->code_pos = tok_ini->str_ini;
+        return GPARSE_ERROR;
+    }
+    const int type = tok_ini->var_type;
+
+    const Token* tok = tok_ini + 1;
+    while (1){
+        if (tok > tok_end || tok->token_type != token_name
+            || name_is_valid( tok->str_ini, tok->str_end ) == 0){
+            parser_error( parser, "Expecting a field name" );
+            parser->code_pos = tok <= tok_end ? tok->str_ini : tok_end->str_end;
+            return GPARSE_ERROR;
+        }
+
+        int status = struct_add_field( str, capacity, tok->str_ini, tok->str_end, type );
+        if (status == GPARSE_NAME_COLLISION){
+            parser_error( parser, "Field name is repeated" );
+            parser->code_pos = tok->str_ini;
+            return GPARSE_ERROR;
+        }
+        else if (status != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+
+        tok++;
+        if (tok > tok_end){
+            return GPARSE_OK;
+        }
+        if (tok->token_type != token_comma){
+            parser_error( parser, "Expecting ',' or ';'" );
+            parser->code_pos = tok->str_ini;
+            return GPARSE_ERROR;
+        }
+        tok++;
+    }
+}
+
+/* Declaration 'struct name{ type field; type field, field }'. The layout is
+ * computed here, and the name becomes a type of the parser. */
+int parse_struct_declaration( Parser* parser, Struct* strwct
+    , const Token* const tok_ini, const Token* const tok_end )
+{
+    const Token* tok_name = tok_ini + 1;
+    if (tok_name > tok_end || tok_name->token_type != token_name
+        || name_is_valid( tok_name->str_ini, tok_name->str_end ) == 0){
+        if (tok_name <= tok_end && tok_name->token_type == token_vartype){
+            parser_error( parser, "Structure name is already defined" );
+            parser->code_pos = tok_name->str_ini;
+        }
+        else if (tok_name <= tok_end && tok_name->token_type == token_varname){
+            parser_error( parser, "Name is already declared as variable" );
+            parser->code_pos = tok_name->str_ini;
+        }
+        else{
+            parser_error( parser, "Expecting a structure name" );
+            parser->code_pos = tok_ini->str_end;
+        }
+        return GPARSE_ERROR;
+    }
+    const Token* tok_block = tok_name + 1;
+    if (tok_block != tok_end || tok_block->token_type != token_brackets){
+        parser_error( parser, "Expecting the fields of the structure" );
+        parser->code_pos = tok_name->str_end;
+        return GPARSE_ERROR;
+    }
+    const char* name_ini = tok_name->str_ini;
+    const char* name_end = tok_name->str_end;
+
+    /* The tokens are reused to parse the fields, so they are copied */
+    const char* body_ini = tok_block->str_ini + 1;
+    const size_t len = tok_block->str_end - body_ini;
+    char* code = (char*)malloc( len + 1 );
+    if (code == nullptr){
+        return GPARSE_ERROR;
+    }
+    memcpy( code, body_ini, len );
+    code[len] = '\0';
+
+    Struct layout;
+    int capacity = 0;
+    int status = GPARSE_OK;
+    const char* code_block = code;
+    parser->num_tokens = 0;
+    while (*code_block != '\0' && status == GPARSE_OK){
+        code_block = parse_tokens( parser, code_block, nullptr );
+        if (code_block == nullptr){
+            status = GPARSE_ERROR;
+            break;
+        }
+        status = detect_structures( parser, &parser->global );
+        if (status == GPARSE_OK && parser->num_tokens > 0){
+            status = parse_struct_fields( parser, &layout, &capacity
+                , parser->tokens, parser->tokens + parser->num_tokens - 1 );
+        }
+        parser->num_tokens = 0;
+    }
+    if (status != GPARSE_OK && parser->code_pos != nullptr
+        && parser->code_pos >= code && parser->code_pos <= code + len){
+        parser->code_pos = body_ini + (parser->code_pos - code);
+    }
+    free( code );
+
+    if (status == GPARSE_OK && layout.nfields == 0){
+        parser_error( parser, "Expecting the fields of the structure" );
+        parser->code_pos = body_ini;
+        status = GPARSE_ERROR;
+    }
+    if (status != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+
+    Struct* str = strwct->add_struct( name_ini, name_end, &status );
+    if (status == GPARSE_NAME_COLLISION){
+        parser_error( parser, "Structure name is already defined" );
+        parser->code_pos = name_ini;
+        return GPARSE_ERROR;
+    }
+    str->fields = layout.fields;
+    str->nfields = layout.nfields;
+    layout.fields = nullptr;
+    layout.nfields = 0;
+    struct_layout( parser, str );
+
+    return struct_register( parser, str );
+}
+
 extern "C"
 gParser* gParser_create()
 {
@@ -813,6 +1134,11 @@ extern "C"
 void gParser_dispose( gParser* parser )
 {
     Parser* p = (Parser*)parser;
+    if (p != nullptr){
+        graph_dispose( p );
+        snapshots_dispose( p );
+        functions_dispose( p );
+    }
     delete( p );
 }
 
@@ -878,7 +1204,16 @@ static int parser_instruction_block( Parser* parser, Struct* strwct )
                 const Token* tok_blockend = tok_name;
                 while (tok_comma <= tok_end){
                     tok_name = tok_comma;
-                    while (tok_comma < tok_end && tok_comma->token_type != token_comma){
+                    /* Commas inside brackets are arguments of functions */
+                    int ibr = 0;
+                    while (tok_comma < tok_end
+                        && (ibr != 0 || tok_comma->token_type != token_comma)){
+                        if (tok_comma->token_type == token_bracket_round_open){
+                            ibr++;
+                        }
+                        else if (tok_comma->token_type == token_bracket_round_close){
+                            ibr--;
+                        }
                         tok_comma++;
                     }
                     if (tok_comma->token_type == token_comma){
@@ -900,7 +1235,7 @@ static int parser_instruction_block( Parser* parser, Struct* strwct )
                 parser->code_pos = tok_name->str_ini;
                 return GPARSE_ERROR;
             }
-            else if (tok_name->token_type == token_struct){
+            else if (tok_name->token_type == token_vartype && tok_name->var_type >= STRUCT_TYPE_MIN){
                 parser_error( parser, "Name is already declared as structure" );
                 parser->code_pos = tok_name->str_ini;
                 return GPARSE_ERROR;
@@ -914,30 +1249,11 @@ static int parser_instruction_block( Parser* parser, Struct* strwct )
     }
     else if (tok_ini->token_type == token_struct){
         /* It is a structure declaration */
-        const Token* tok_name = tok_ini < tok_end ? tok_ini + 1 : nullptr;
-        if (tok_name != nullptr || tok_name->token_type != token_name){
-            /* Add the structure name */
-            Struct* str = strwct->add_struct
-                ( tok_name->str_ini, tok_name->str_end, &status );
-            if (status == GPARSE_NAME_COLLISION){
-                parser_error( parser, "Structure name is already defined" );
-                parser->code_pos = tok_ini->str_ini;
-                return GPARSE_ERROR;
-            }
-            const Token* tok_block = tok_name < tok_end ? tok_name + 1 : nullptr;
-            Parser* local_parser = new Parser();
-            parser_code( local_parser, str, tok_block->str_ini + 1, tok_block->str_end - 1 );
-            return GPARSE_OK;
-        }
-        else{
-            parser_error( parser, "Expecting a structure name" );
-            parser->code_pos = tok_ini->str_end;
-            return GPARSE_ERROR;
-        }
+        return parse_struct_declaration( parser, strwct, tok_ini, tok_end );
     }
     else if (tok_ini->token_type == token_function){
         /* It is a function declaration */
-
+        return parse_function_declaration( parser, tok_ini, tok_end );
     }
 
     status = parse_command( &ans, parser, strwct, parser->tokens, tok_end );
@@ -978,9 +1294,12 @@ static int parser_code( Parser* parser, Struct* str
 
         /* Checks the names to identify already declared variables or functions */
         detect_declared_variables( parser, str );
+        status = detect_structures( parser, str );
 
         /* Solves the command */
-        status = parser_instruction_block( parser, str );
+        if (status != GPARSE_ERROR){
+            status = parser_instruction_block( parser, str );
+        }
 
         /* Restart the parser as there are no tokens */
         parser->num_tokens = 0;
@@ -1006,6 +1325,7 @@ int gParser_command( gParser* gparser, const char* code )
     if (code == nullptr){
         return GPARSE_NO_COMMAND;
     }
+    parser_snapshot( parser );
     status = parser_code( parser, &parser->global, code, nullptr );
 
     return status;
@@ -1029,11 +1349,78 @@ gVariable* gParser_addVariable
     if (pvar != nullptr){
         pvar->type = vartype;
         pvar->pvalue = pdata;
+
+        /* Structures of the host are used in place */
+        const Struct* str = struct_type( parser, vartype );
+        if (str != nullptr){
+            pvar->size = str->size;
+            struct_update_members( parser->global.vars, pvar );
+        }
+        else{
+            pvar->size = numeric_type_size( vartype );
+        }
     }
 
     return pvar;
 }
 
+extern "C"
+int gParser_addStruct( gParser* gparser, const char* name, const size_t size
+    , const int nfields, const gField* fields )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || name == nullptr){
+        return t_undefined;
+    }
+
+    return struct_add_host( parser, name, size, nfields, fields );
+}
+
+extern "C"
+gVariable* gParser_addStructArray( gParser* gparser, const char* varname
+    , const int type, void* data, const size_t count )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || varname == nullptr || count == 0){
+        return nullptr;
+    }
+    const Struct* str = struct_type( parser, type );
+    if (str == nullptr || count > (size_t)(INT_MAX / str->size)){
+        return nullptr;
+    }
+
+    Variable* var = (Variable*)gParser_addVariable( gparser, varname, type, data );
+    if (var != nullptr){
+        var->size = (int)count*str->size;
+    }
+    return var;
+}
+
+
+extern "C"
+int gParser_addFunction( gParser* gparser, const char* name, const int type
+    , const int nargs, const int* args_type, gFunction function, void* data )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr){
+        return GPARSE_ERROR;
+    }
+    return function_add
+        ( parser, name, type, nargs, args_type, function, nullptr, data );
+}
+
+extern "C"
+int gParser_addFunctionBatch( gParser* gparser, const char* name, const int type
+    , const int nargs, const int* args_type
+    , gFunction function, gFunctionBatch batch, void* data )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr){
+        return GPARSE_ERROR;
+    }
+    return function_add
+        ( parser, name, type, nargs, args_type, function, batch, data );
+}
 
 extern "C"
 gVariable* gParser_findVariable( gParser* gparser, const char* varname )
@@ -1043,5 +1430,3340 @@ gVariable* gParser_findVariable( gParser* gparser, const char* varname )
         return nullptr;
     }
 
-    return parser->global.find_variable( &varname[0], &varname[strlen( varname )] );
+    Variable* var = parser->global.find_variable( &varname[0], &varname[strlen( varname )] );
+    if (var == nullptr){
+        var = struct_find_member( parser, &parser->global, varname );
+    }
+
+    /* The host may write it */
+    return layer_own( &parser->global, var );
+}
+
+/************************/
+/* Compiled expressions */
+/************************/
+
+/* Value produced while compiling an expression */
+struct Operand
+{
+    int reg;            /* Register with the values, -1 if not loaded */
+    int type;
+    int constant;       /* The value is known at compile time */
+    Numeric::Pool value;
+};
+
+int compile_command( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end );
+
+/* Order of the implicit upcasting between numeric types */
+static int type_rank( const int type )
+{
+    switch (type){
+    case t_byte: return 1;
+    case t_int: return 2;
+    case t_l64: return 3;
+    case t_float: return 4;
+    case t_double: return 5;
+    default: return 0;
+    }
+}
+
+static inline int type_is_integer( const int type )
+{
+    return type == t_byte || type == t_int || type == t_l64;
+}
+
+/* Common type of two numeric operands, or t_undefined if there is none */
+static int type_promote( const int a, const int b )
+{
+    if (type_rank( a ) == 0 || type_rank( b ) == 0){
+        return t_undefined;
+    }
+    return type_rank( a ) >= type_rank( b ) ? a : b;
+}
+
+static inline void operand_set_constant( Operand* x, const Numeric* num )
+{
+    x->reg = -1;
+    x->type = num->type;
+    x->constant = 1;
+    x->value = num->pool;
+}
+
+static inline void operand_get_numeric( Numeric* num, const Operand* x )
+{
+    num->pool = x->value;
+    num->type = x->type;
+}
+
+static inline void operand_release( Program* prog, const Operand* x )
+{
+    /* Constants registers are shared and never released */
+    if (x->constant == 0 && x->reg >= 0){
+        program_free_register( prog, x->reg );
+    }
+}
+
+/* Loads the constant in a register */
+static int operand_materialize( Program* prog, Operand* x )
+{
+    if (x->reg < 0){
+        Numeric num;
+        operand_get_numeric( &num, x );
+        x->reg = program_constant( prog, &num );
+        if (x->reg < 0){
+            return GPARSE_ERROR;
+        }
+    }
+    return GPARSE_OK;
+}
+
+static int operand_cast( Program* prog, Operand* x, const int type )
+{
+    if (x->type == type){
+        return GPARSE_OK;
+    }
+
+    if (x->constant){
+        Numeric num;
+        operand_get_numeric( &num, x );
+        if (numeric_explicit_cast( &num, type )){
+            return GPARSE_ERROR;
+        }
+        operand_set_constant( x, &num );
+        return GPARSE_OK;
+    }
+
+    int reg = program_emit_value( prog, op_cast, type, x->type, x->reg, 0 );
+    if (reg < 0){
+        return GPARSE_ERROR;
+    }
+    program_free_register( prog, x->reg );
+    x->reg = reg;
+    x->type = type;
+    return GPARSE_OK;
+}
+
+static int compile_variable( Operand* ans, Program* prog, Variable* var )
+{
+    /* Local variables are already in a register */
+    int local = program_local( prog, var );
+    if (local >= 0){
+        ans->reg = local;
+        ans->type = var->type;
+        ans->constant = 0;
+        return GPARSE_OK;
+    }
+
+    /* Programs are bound to the variables of the layer, see Layer.hpp */
+    var = layer_own( &prog->parser->global, var );
+    int sym = var == nullptr ? -1 : program_symbol( prog, var );
+    if (sym >= 0 && prog->symbols[sym].reg > 0){
+        /* Assigned before by the program */
+        ans->reg = prog->symbols[sym].reg - 1;
+        ans->type = var->type;
+        ans->constant = 0;
+        return GPARSE_OK;
+    }
+    int reg = sym < 0 ? -1 : program_emit_value( prog, op_load, var->type, var->type, sym, 0 );
+    if (reg < 0){
+        return GPARSE_ERROR;
+    }
+    ans->reg = reg;
+    ans->type = var->type;
+    ans->constant = 0;
+    return GPARSE_OK;
+}
+
+/* Types of a dual operation. Operands are casted to 'type_a' and the result
+ * has type 'type'. It follows the same rules than the interpreter. */
+static int compile_dual_types
+    ( int* opcode, int* type, int* type_a
+    , Parser* parser, const Token* op, const int lt, const int rt )
+{
+    const int promoted = type_promote( lt, rt );
+
+    switch (op->token_type){
+    case token_plus:
+    case token_minus:
+    case token_mul:
+        if (promoted == t_undefined){
+            parser_error( parser, "Expecting numeric operands" );
+            return GPARSE_ERROR;
+        }
+        *opcode = op->token_type == token_plus ? op_add
+            : op->token_type == token_minus ? op_sub : op_mul;
+        *type = *type_a = promoted;
+        return GPARSE_OK;
+
+    case token_div:
+    case token_pow:
+        /* Floating point single or double, with preference to double */
+        if (promoted == t_undefined){
+            parser_error( parser, "Expecting numeric operands" );
+            return GPARSE_ERROR;
+        }
+        *opcode = op->token_type == token_div ? op_div : op_pow;
+        *type = *type_a = promoted == t_float ? t_float : t_double;
+        return GPARSE_OK;
+
+    case token_intdiv:
+    case token_remainder:
+        /* Downcasting to integer */
+        if (promoted == t_undefined){
+            parser_error( parser, "Expecting numeric operands" );
+            return GPARSE_ERROR;
+        }
+        *opcode = op->token_type == token_intdiv ? op_intdiv : op_remainder;
+        *type = *type_a = type_is_integer( lt ) ? lt : t_int;
+        return GPARSE_OK;
+
+    case token_equal:
+    case token_notequal:
+    case token_less:
+    case token_greater:
+    case token_lessequal:
+    case token_greaterequal:
+        if (lt == t_bool && rt == t_bool
+            && (op->token_type == token_equal || op->token_type == token_notequal)){
+            *type_a = t_bool;
+        }
+        else if (promoted != t_undefined){
+            *type_a = promoted;
+        }
+        else{
+            parser_error( parser, "Operation not defined between types (%s) (%s)"
+                , numeric_type_name( lt ), numeric_type_name( rt ) );
+            return GPARSE_ERROR;
+        }
+        if (op->token_type == token_notequal
+            && (*type_a == t_float || *type_a == t_double)){
+            parser_error( parser,
+                "a==b between floating point numbers is not a valid operation."
+                " Consider using \"abs(a-b) > eps\"." );
+            return GPARSE_ERROR;
+        }
+        switch (op->token_type){
+        case token_equal: *opcode = op_equal; break;
+        case token_notequal: *opcode = op_notequal; break;
+        case token_less: *opcode = op_less; break;
+        case token_greater: *opcode = op_greater; break;
+        case token_lessequal: *opcode = op_lessequal; break;
+        default: *opcode = op_greaterequal; break;
+        }
+        *type = t_bool;
+        return GPARSE_OK;
+
+    case token_bitand:
+    case token_bitor:
+    case token_bitxor:
+    case token_lshift:
+    case token_rshift:
+        if (!type_is_integer( lt ) || !type_is_integer( rt )){
+            parser_error( parser, "Expecting integer types" );
+            return GPARSE_ERROR;
+        }
+        switch (op->token_type){
+        case token_bitand: *opcode = op_bitand; break;
+        case token_bitor: *opcode = op_bitor; break;
+        case token_bitxor: *opcode = op_bitxor; break;
+        case token_lshift: *opcode = op_lshift; break;
+        default: *opcode = op_rshift; break;
+        }
+        /* Shifts keep the type of the left operand */
+        *type = *type_a = (op->token_type == token_lshift
+            || op->token_type == token_rshift) ? lt : promoted;
+        return GPARSE_OK;
+
+    default:
+        parser_error( parser, "Unknown operation" );
+        return GPARSE_ERROR;
+    }
+}
+
+/* Maximum instructions of the right operand of '&&' and '||' to be evaluated
+ * for all the rows instead of skipping it */
+#define LOGIC_MASK_MAX 4
+
+/* Loads the variables assigned in the tokens in the registers of their
+ * values, before they are evaluated only for some rows, so the rows skipped
+ * keep the values of the variables */
+static int compile_preload( Program* prog, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end )
+{
+    for (const Token* tok = tok_ini; tok < tok_end; tok++){
+        if (tok->token_type != token_varname || tok[1].token_type != token_assign){
+            continue;
+        }
+        Variable* var = tok->pvar;
+        if (var == nullptr){
+            var = strwct->find_variable( tok->str_ini, tok->str_end );
+        }
+        if (var == nullptr || program_local( prog, var ) >= 0){
+            continue;
+        }
+        var = layer_own( &prog->parser->global, var );
+        const int sym = var == nullptr ? -1 : program_symbol( prog, var );
+        if (sym < 0){
+            return GPARSE_ERROR;
+        }
+        if (prog->symbols[sym].reg == 0){
+            const int reg = program_alloc_register( prog );
+            if (reg < 0 || program_emit( prog, op_load, var->type, var->type, reg, sym, 0 ) < 0){
+                return GPARSE_ERROR;
+            }
+            prog->symbols[sym].reg = reg + 1;
+        }
+    }
+    return GPARSE_OK;
+}
+
+/* Compiles 'a && b' and 'a || b'. The right operand is skipped for the rows
+ * where the left operand determines the result. */
+static int compile_logic
+    ( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , Operand* a
+    , const Token* _restrict_ const op
+    , const Token* _restrict_ const tok_end )
+{
+    const int is_and = op->token_type == token_and;
+    Operand b;
+    int status;
+
+    if (a->type != t_bool){
+        parser_error( parser, "Expecting boolean types" );
+        parser->code_pos = op->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    if (a->constant){
+        if (a->value.vbool != is_and){
+            /* The result is known, the right operand is not compiled */
+            *ans = *a;
+            return GPARSE_OK;
+        }
+        status = compile_command( ans, prog, parser, strwct, op + 1, tok_end );
+        if (status) return status;
+        if (ans->type != t_bool){
+            parser_error( parser, "Expecting boolean types" );
+            parser->code_pos = op->str_ini;
+            return GPARSE_ERROR;
+        }
+        return GPARSE_OK;
+    }
+
+    /* The result is merged in place, so a shared value, or the register of
+     * a variable, is copied */
+    if ((prog->share && prog->refs[a->reg] > 1) || program_owns_register( prog, a->reg )){
+        int reg = program_alloc_register( prog );
+        if (reg < 0 || program_emit( prog, op_cast, t_bool, t_bool, reg, a->reg, 0 ) < 0){
+            return GPARSE_ERROR;
+        }
+        operand_release( prog, a );
+        a->reg = reg;
+    }
+
+    if (compile_preload( prog, strwct, op + 1, tok_end )){
+        return GPARSE_ERROR;
+    }
+
+    /* Narrow the selection and jump to the end if there are no rows left */
+    prog->depth++;
+    if (prog->depth > prog->max_depth){
+        prog->max_depth = prog->depth;
+    }
+    int jump = program_emit
+        ( prog, is_and ? op_and : op_or, t_bool, t_bool, a->reg, a->reg, 0 );
+    if (jump < 0) return GPARSE_ERROR;
+
+    status = compile_command( &b, prog, parser, strwct, op + 1, tok_end );
+    if (status) return status;
+    if (b.type != t_bool){
+        parser_error( parser, "Expecting boolean types" );
+        parser->code_pos = op->str_ini;
+        return GPARSE_ERROR;
+    }
+    if (operand_materialize( prog, &b )) return GPARSE_ERROR;
+    prog->depth--;
+
+    if (prog->ncode - (jump + 1) <= LOGIC_MASK_MAX
+        && program_is_safe( prog, jump + 1, prog->ncode )
+        && !program_writes_variables( prog, jump + 1, prog->ncode )){
+        /* A short and safe right operand is cheaper to evaluate for all the
+         * rows and combine both as masks, without branches */
+        program_remove( prog, jump );
+        int reg = program_alloc_register( prog );
+        if (reg < 0 || program_emit( prog, is_and ? op_bitand : op_bitor
+            , t_bool, t_bool, reg, a->reg, b.reg ) < 0){
+            return GPARSE_ERROR;
+        }
+        operand_release( prog, a );
+        operand_release( prog, &b );
+        ans->reg = reg;
+        ans->type = t_bool;
+        ans->constant = 0;
+        return GPARSE_OK;
+    }
+
+    /* Merge the right operand in the kept rows */
+    int end = program_emit( prog, op_logic_end, t_bool, t_bool, a->reg, b.reg, is_and );
+    if (end < 0) return GPARSE_ERROR;
+    prog->code[jump].b = end;
+    operand_release( prog, &b );
+
+    *ans = *a;
+    return GPARSE_OK;
+}
+
+static int compile_dual
+    ( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end
+    , const int operator_mask
+    )
+{
+    Operand a;
+    Operand b;
+    int status;
+
+    const Token* op = get_dual_operand
+        ( parser, tok_ini, tok_end, operator_mask, RIGHT2LEFT, &status );
+
+    if (op == nullptr){
+        /* The dual operator is not present or there is an error */
+        return status;
+    }
+
+    /* Gets the left operand */
+    status = compile_command( &a, prog, parser, strwct, tok_ini, op - 1 );
+    if (status) return status;
+
+    if (op->token_type == token_and || op->token_type == token_or){
+        return compile_logic( ans, prog, parser, strwct, &a, op, tok_end );
+    }
+
+    /* Gets the right operand */
+    status = compile_command( &b, prog, parser, strwct, op + 1, tok_end );
+    if (status) return status;
+
+    if (a.constant && b.constant){
+        /* Both are known, so it is solved as in the interpreter */
+        Numeric na;
+        Numeric nb;
+        operand_get_numeric( &na, &a );
+        operand_get_numeric( &nb, &b );
+        if (numeric_operation( op->token_type, &na, &nb, parser )){
+            parser->code_pos = op->str_ini;
+            return GPARSE_ERROR;
+        }
+        operand_set_constant( ans, &na );
+        return GPARSE_OK;
+    }
+
+    int opcode;
+    int type;
+    int type_a;
+    status = compile_dual_types( &opcode, &type, &type_a, parser, op, a.type, b.type );
+    if (status){
+        parser->code_pos = op->str_ini;
+        return status;
+    }
+
+    const int type_b = (opcode == op_lshift || opcode == op_rshift) ? a.type : type_a;
+    if (operand_cast( prog, &a, type_a ) || operand_cast( prog, &b, type_b )
+        || operand_materialize( prog, &a ) || operand_materialize( prog, &b )){
+        parser_error( parser, "Invalid operation" );
+        parser->code_pos = op->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    /* The destination never overlaps the operands */
+    int reg = program_emit_value( prog, opcode, type, type_a, a.reg, b.reg );
+    if (reg < 0){
+        return GPARSE_ERROR;
+    }
+    operand_release( prog, &a );
+    operand_release( prog, &b );
+
+    ans->reg = reg;
+    ans->type = type;
+    ans->constant = 0;
+    return GPARSE_OK;
+}
+
+static int compile_unary
+    ( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end
+    , const int operator_mask
+    )
+{
+    const Token* tok_loperand = tok_ini;
+    const Token* tok_rterm = tok_ini + 1;
+
+    /* Ignore the brackets for the (type) structures */
+    if (tok_ini->token_type == token_bracket_round_open){
+        if (tok_ini + 2 < tok_end
+            && (tok_ini + 2)->token_type == token_bracket_round_close)
+        {
+            tok_loperand = tok_ini + 1;
+            tok_rterm = tok_ini + 3;
+        }
+    }
+
+    if ((tok_loperand->token_type & operator_mask) == 0){
+        return GPARSE_NO_COMMAND;
+    }
+    if (tok_rterm > tok_end){
+        parser_error( parser, "Expecting expression" );
+        parser->code_pos = tok_ini->str_end;
+        return GPARSE_ERROR;
+    }
+
+    int status = compile_command( ans, prog, parser, strwct, tok_rterm, tok_end );
+    if (status) return status;
+
+    int opcode;
+    switch (tok_loperand->token_type){
+    case token_plus: /* ans = +ans */
+        if (type_rank( ans->type ) == 0){
+            parser_error( parser, "Invalid operation" );
+            parser->code_pos = tok_loperand->str_ini;
+            return GPARSE_ERROR;
+        }
+        return GPARSE_OK;
+
+    case token_minus: /* ans = -ans; */
+        if (type_rank( ans->type ) == 0){
+            parser_error( parser, "Invalid operation" );
+            parser->code_pos = tok_loperand->str_ini;
+            return GPARSE_ERROR;
+        }
+        opcode = op_neg;
+        break;
+
+    case token_not: /* ans = !ans */
+        if (ans->type != t_bool){
+            parser_error( parser, "Invalid operation" );
+            parser->code_pos = tok_loperand->str_ini;
+            return GPARSE_ERROR;
+        }
+        opcode = op_not;
+        break;
+
+    case token_bitinv: /* ans = ~ans */
+        if (!type_is_integer( ans->type )){
+            parser_error( parser, "Invalid operation" );
+            parser->code_pos = tok_loperand->str_ini;
+            return GPARSE_ERROR;
+        }
+        opcode = op_bitinv;
+        break;
+
+    case token_vartype: /* casting (convert one type to another) */
+        if (operand_cast( prog, ans, tok_loperand->var_type )){
+            parser_error( parser, "Invalid type for cast" );
+            parser->code_pos = tok_loperand->str_ini;
+            return GPARSE_ERROR;
+        }
+        return GPARSE_OK;
+
+    default:
+        parser_error( parser, "Unknown operation" );
+        parser->code_pos = tok_loperand->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    if (ans->constant){
+        Numeric num;
+        operand_get_numeric( &num, ans );
+        if (opcode == op_neg) numeric_neg( &num, parser );
+        else if (opcode == op_not) numeric_not( &num, parser );
+        else numeric_bitinv( &num, parser );
+        operand_set_constant( ans, &num );
+        return GPARSE_OK;
+    }
+
+    int reg = program_emit_value( prog, opcode, ans->type, ans->type, ans->reg, 0 );
+    if (reg < 0){
+        return GPARSE_ERROR;
+    }
+    program_free_register( prog, ans->reg );
+    ans->reg = reg;
+    return GPARSE_OK;
+}
+
+static int compile_bracket
+    ( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* const tok_ini
+    , const Token* const tok_end
+    )
+{
+    if (tok_ini->token_type != token_bracket_round_open){
+        return GPARSE_NO_COMMAND;
+    }
+
+    /* Find an close bracket */
+    int ibr = 1;
+    const Token* p = tok_ini + 1;
+    while (p <= tok_end){
+        switch (p->token_type){
+        case token_bracket_round_open:
+            ibr++;
+            break;
+        case token_bracket_round_close:
+            ibr--;
+            break;
+        }
+        if (ibr == 0){
+            if (p != tok_end){
+                parser_error( parser, "Expression error" );
+                parser->code_pos = (p + 1)->str_ini;
+                return GPARSE_ERROR;
+            }
+            return compile_command( ans, prog, parser, strwct, tok_ini + 1, p - 1 );
+        }
+        else if (ibr < 0){
+            parser_error( parser, "Unmatching bracket" );
+            parser->code_pos = p->str_ini;
+            return GPARSE_ERROR;
+        }
+        p++;
+    }
+    parser_error( parser, "Unmatching bracket" );
+    parser->code_pos = tok_end->str_ini;
+    return GPARSE_ERROR;
+}
+
+/* Copies the body of the function at the call site. The registers of the
+ * body are renamed to registers of the program. */
+static int compile_inline
+    ( Operand* ans, Program* prog, const Function* f, Operand* args )
+{
+    const Program* body = script_body( f );
+    int* map = (int*)malloc( sizeof( int )*(body->nregisters + 1) );
+    char* temp = (char*)calloc( body->nregisters + 1, 1 );
+    int status = GPARSE_ERROR;
+    int reg;
+
+    if (map == nullptr || temp == nullptr){
+        goto finish;
+    }
+    for (int r = 0; r < body->nregisters; r++){
+        map[r] = -1;
+    }
+
+    /* Constants */
+    for (int i = 0; i < body->nconstants; i++){
+        const Constant* c = body->constants + i;
+        Numeric num;
+        num.pool = c->value;
+        num.type = c->type;
+        map[c->reg] = program_constant( prog, &num );
+        if (map[c->reg] < 0){
+            goto finish;
+        }
+    }
+
+    /* Arguments. They are copied only if the body modifies them. */
+    for (int k = 0; k < f->nargs; k++){
+        int written = 0;
+        for (int pc = 0; pc < body->ncode; pc++){
+            written |= body->code[pc].dst == k;
+        }
+        if (operand_materialize( prog, args + k )){
+            goto finish;
+        }
+        if (written){
+            reg = program_alloc_register( prog );
+            if (reg < 0 || program_emit( prog, op_cast, f->args_type[k]
+                , f->args_type[k], reg, args[k].reg, 0 ) < 0){
+                goto finish;
+            }
+            map[k] = reg;
+            temp[k] = 1;
+        }
+        else{
+            map[k] = args[k].reg;
+        }
+    }
+
+    /* Temporary values and local variables */
+    for (int r = 0; r < body->nregisters; r++){
+        if (map[r] < 0){
+            map[r] = program_alloc_register( prog );
+            temp[r] = 1;
+            if (map[r] < 0){
+                goto finish;
+            }
+        }
+    }
+
+    {
+        const int base = prog->ncode;
+        for (int pc = 0; pc < body->ncode; pc++){
+            const Instruction* src = body->code + pc;
+            Instruction ins = *src;
+            ins.dst = map[src->dst];
+            switch (src->op){
+            case op_and:
+            case op_or:
+                ins.a = map[src->a];
+                ins.b = src->b + base;
+                break;
+            case op_logic_end:
+                ins.a = map[src->a];
+                break;
+            case op_call:
+                ins.a = prog->nargs;
+                for (int k = 0; k < src->b; k++){
+                    int* arg = array_push( &prog->args, &prog->nargs, &prog->args_capacity );
+                    if (arg == nullptr){
+                        goto finish;
+                    }
+                    *arg = map[body->args[src->a + k]];
+                }
+                break;
+            default:
+                ins.a = map[src->a];
+                ins.b = map[src->b];
+            }
+            Instruction* dst = array_push( &prog->code, &prog->ncode, &prog->code_capacity );
+            if (dst == nullptr){
+                goto finish;
+            }
+            *dst = ins;
+        }
+    }
+
+    if (prog->depth + body->max_depth > prog->max_depth){
+        prog->max_depth = prog->depth + body->max_depth;
+    }
+
+    /* The result must be in a register owned by the caller */
+    reg = map[body->result];
+    if (temp[body->result]){
+        temp[body->result] = 0;
+    }
+    else{
+        int copy = program_alloc_register( prog );
+        if (copy < 0 || program_emit( prog, op_cast, f->type, f->type, copy, reg, 0 ) < 0){
+            goto finish;
+        }
+        reg = copy;
+    }
+    ans->reg = reg;
+    ans->type = f->type;
+    ans->constant = 0;
+    status = GPARSE_OK;
+
+    for (int r = 0; r < body->nregisters; r++){
+        if (temp[r]){
+            program_free_register( prog, map[r] );
+        }
+    }
+    for (int k = 0; k < f->nargs; k++){
+        operand_release( prog, args + k );
+    }
+
+finish:
+    free( map );
+    free( temp );
+    return status;
+}
+
+/* Each call to a window function has its own copy of the function, with
+ * the state of the window in 'data'. Only the values are passed to it. */
+static int compile_window( Operand* ans, Program* prog, Parser* parser
+    , const Function* f, Operand* args, const Token* tok_param )
+{
+    if (args[1].constant == 0){
+        parser_error( parser, "The parameter of the window must be a constant" );
+        parser->code_pos = tok_param->str_ini;
+        return GPARSE_ERROR;
+    }
+    Window* state = f->window( args[1].value.vdouble );
+    if (state == nullptr){
+        parser_error( parser, "Invalid parameter of the window" );
+        parser->code_pos = tok_param->str_ini;
+        return GPARSE_ERROR;
+    }
+    Function* call = (Function*)malloc( sizeof( Function ) );
+    Function** pcall = call == nullptr ? nullptr
+        : array_push( &prog->windows, &prog->nwindows, &prog->windows_capacity );
+    if (pcall == nullptr){
+        free( state );
+        free( call );
+        return GPARSE_ERROR;
+    }
+    *call = *f;
+    call->nargs = 1;
+    call->data = state;
+    *pcall = call;
+
+    int* arg = array_push( &prog->args, &prog->nargs, &prog->args_capacity );
+    if (arg == nullptr || operand_materialize( prog, args )){
+        return GPARSE_ERROR;
+    }
+    *arg = args[0].reg;
+
+    int reg = program_alloc_register( prog );
+    int pc = reg < 0 ? -1 : program_emit( prog, op_call, f->type, f->type, reg, prog->nargs - 1, 1 );
+    if (pc < 0){
+        return GPARSE_ERROR;
+    }
+    prog->code[pc].func = call;
+    operand_release( prog, args );
+
+    ans->reg = reg;
+    ans->type = f->type;
+    ans->constant = 0;
+    return GPARSE_OK;
+}
+
+static int compile_call
+    ( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* const tok_ini
+    , const Token* const tok_end
+    )
+{
+    const Token* args_ini[GPARSE_MAX_ARGS];
+    const Token* args_end[GPARSE_MAX_ARGS];
+    int nargs;
+    int status;
+
+    if (is_function_call( tok_ini, tok_end ) == 0){
+        return GPARSE_NO_COMMAND;
+    }
+    status = split_arguments
+        ( parser, tok_ini + 1, tok_end, args_ini, args_end, &nargs );
+    if (status != GPARSE_OK){
+        return status;
+    }
+
+    Operand args[GPARSE_MAX_ARGS];
+    int types[GPARSE_MAX_ARGS] = { 0 };
+    int constant = 1;
+    for (int k = 0; k < nargs; k++){
+        status = compile_command( args + k, prog, parser, strwct, args_ini[k], args_end[k] );
+        if (status != GPARSE_OK){
+            return status;
+        }
+        types[k] = args[k].type;
+        constant = constant && args[k].constant;
+    }
+
+    /* The call is resolved once, here */
+    int found;
+    const Function* f = function_find
+        ( parser, tok_ini->str_ini, tok_ini->str_end, types, nargs, &found );
+    if (f == nullptr){
+        return function_not_found( parser, tok_ini, found );
+    }
+    for (int k = 0; k < nargs; k++){
+        if (operand_cast( prog, args + k, f->args_type[k] )){
+            return GPARSE_ERROR;
+        }
+    }
+
+    if (function_is_script( f ) && script_body( f )->ncode <= FUNCTION_INLINE_MAX
+        && script_body( f )->nsymbols == 0){
+        return compile_inline( ans, prog, f, args );
+    }
+
+    if (f->window != nullptr){
+        return compile_window( ans, prog, parser, f, args, args_ini[1] );
+    }
+
+    if (constant && f->pure){
+        /* Constant folding */
+        Numeric num;
+        const void* pargs[GPARSE_MAX_ARGS];
+        for (int k = 0; k < nargs; k++){
+            pargs[k] = &args[k].value;
+        }
+        if (function_call_scalar( parser, f, num.pvalue, pargs ) != GPARSE_OK){
+            parser_error( parser, "Not enough memory for the call" );
+            return GPARSE_ERROR;
+        }
+        num.type = f->type;
+        operand_set_constant( ans, &num );
+        return GPARSE_OK;
+    }
+
+    int first = prog->nargs;
+    for (int k = 0; k < nargs; k++){
+        int* arg = array_push( &prog->args, &prog->nargs, &prog->args_capacity );
+        if (arg == nullptr || operand_materialize( prog, args + k )){
+            return GPARSE_ERROR;
+        }
+        *arg = args[k].reg;
+    }
+
+    if (prog->share){
+        Instruction ins;
+        memset( &ins, 0, sizeof( Instruction ) );
+        ins.op = op_call;
+        ins.type = f->type;
+        ins.type_a = f->type;
+        ins.func = f;
+        int reg = program_find_shared( prog, &ins, prog->args + first, nargs );
+        if (reg >= 0){
+            prog->nargs = first;
+            for (int k = 0; k < nargs; k++){
+                operand_release( prog, args + k );
+            }
+            ans->reg = reg;
+            ans->type = f->type;
+            ans->constant = 0;
+            return GPARSE_OK;
+        }
+    }
+
+    int reg = program_alloc_register( prog );
+    int pc = reg < 0 ? -1 : program_emit( prog, op_call, f->type, f->type, reg, first, nargs );
+    if (pc < 0){
+        return GPARSE_ERROR;
+    }
+    prog->code[pc].func = f;
+    if (f->pure == 0){
+        /* The function may change any variable */
+        for (int i = 0; i < prog->nsymbols; i++){
+            prog->symbols[i].reg = 0;
+        }
+        if (prog->share){
+            program_forget_symbol( prog, -1 );
+        }
+    }
+    program_remember( prog, pc, nargs );
+    for (int k = 0; k < nargs; k++){
+        operand_release( prog, args + k );
+    }
+
+    ans->reg = reg;
+    ans->type = f->type;
+    ans->constant = 0;
+    return GPARSE_OK;
+}
+
+static int compile_assign
+    ( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end
+    )
+{
+    int status;
+
+    const Token* op = get_dual_operand
+        ( parser, tok_ini, tok_end, ASSIGN_MASK, LEFT2RIGHT, &status );
+
+    if (op == nullptr){
+        if (status == GPARSE_ERROR){
+            parser->code_pos = tok_ini->str_ini;
+        }
+        return status;
+    }
+
+    if (op->token_type != token_assign){
+        parser_error( parser, "Unsupported assignment in compiled expressions" );
+        parser->code_pos = op->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    Variable* var = tok_ini->pvar;
+    if (var == nullptr){
+        var = strwct->find_variable( tok_ini->str_ini, tok_ini->str_end );
+    }
+    if (var == nullptr || op != tok_ini + 1){
+        parser_error( parser, "Undeclared variable" );
+        parser->code_pos = tok_ini->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    /* Calculate the right term. */
+    status = compile_command( ans, prog, parser, strwct, op + 1, tok_end );
+    if (status != GPARSE_OK) return status;
+
+    /* Cast the right term if possible */
+    if ((var->type == t_bool) != (ans->type == t_bool)
+        || operand_cast( prog, ans, var->type )
+        || operand_materialize( prog, ans )){
+        parser_error( parser, "Cannot perform implicit casting" );
+        parser->code_pos = op->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    int local = program_local( prog, var );
+    if (local >= 0){
+        /* Copy into the register of the local variable */
+        if (program_emit( prog, op_cast, var->type, var->type, local, ans->reg, 0 ) < 0){
+            return GPARSE_ERROR;
+        }
+        return GPARSE_OK;
+    }
+
+    var = layer_own( &parser->global, var );
+    int sym = var == nullptr ? -1 : program_symbol( prog, var );
+    if (sym < 0 || program_emit( prog, op_store, var->type, var->type, ans->reg, ans->reg, sym ) < 0){
+        return GPARSE_ERROR;
+    }
+    if (prog->share){
+        program_forget_symbol( prog, sym );
+    }
+
+    /* The next loads read the values of all the rows from a register. Those
+     * assigned in a branch of '&&' or '||' are loaded before it. */
+    Symbol* assigned = prog->symbols + sym;
+    if (assigned->reg == 0 && prog->depth == 0){
+        const int reg = program_alloc_register( prog );
+        if (reg < 0){
+            return GPARSE_ERROR;
+        }
+        assigned->reg = reg + 1;
+    }
+    if (assigned->reg > 0 && assigned->reg - 1 != ans->reg && program_emit
+        ( prog, op_cast, var->type, var->type, assigned->reg - 1, ans->reg, 0 ) < 0){
+        return GPARSE_ERROR;
+    }
+
+    return GPARSE_OK;
+}
+
+int compile_command( Operand* ans, Program* prog, Parser* parser, Struct* strwct
+    , const Token* _restrict_ const tok_ini
+    , const Token* _restrict_ const tok_end )
+{
+    int status;
+
+    if (tok_ini > tok_end){
+        parser_error( parser, "Expecting an expresion" );
+        return GPARSE_ERROR;
+    }
+    if (tok_ini == tok_end){
+        switch (tok_ini->token_type){
+        case token_literal_number:{
+            Numeric num;
+            status = str2num( &num, tok_end );
+            if (status){
+                parser_error( parser, "Expecting an expresion" );
+                parser->code_pos = tok_ini->str_ini;
+                return GPARSE_ERROR;
+            }
+            operand_set_constant( ans, &num );
+            return GPARSE_OK;
+        }
+        case token_varname:
+            if (tok_ini->pvar->type >= STRUCT_TYPE_MIN){
+                parser_error( parser, "Structures cannot be used in expressions" );
+                parser->code_pos = tok_ini->str_ini;
+                return GPARSE_ERROR;
+            }
+            return compile_variable( ans, prog, tok_ini->pvar );
+        case token_name:{
+            /* Find the variable */
+            Variable* var = strwct->find_variable
+                ( tok_ini->str_ini, tok_ini->str_end );
+            if (var == nullptr){
+                parser_error( parser, "Undeclared variable" );
+                parser->code_pos = tok_ini->str_ini;
+                return GPARSE_ERROR;
+            }
+            return compile_variable( ans, prog, var );
+        }
+        case token_literal_true:
+        case token_literal_false:{
+            Numeric num;
+            numeric_set( &num, _bool_( tok_ini->token_type == token_literal_true ) );
+            operand_set_constant( ans, &num );
+            return GPARSE_OK;
+        }
+        }
+    }
+
+    status = compile_assign( ans, prog, parser, strwct, tok_ini, tok_end );
+    if (status != GPARSE_NO_COMMAND) return status;
+
+    static const int dual_masks[] = { BOOLEAN_OR_MASK, BOOLEAN_AND_MASK
+        , EQUAL_MASK, BITOR_MASK, BITXOR_MASK, BITAND_MASK, BITSHIFT_MASK
+        , ARITMETIC_MASK, MULDIV_MASK, POW_MASK };
+    for (size_t i = 0; i < sizeof( dual_masks ) / sizeof( int ); i++){
+        status = compile_dual( ans, prog, parser, strwct, tok_ini, tok_end, dual_masks[i] );
+        if (status != GPARSE_NO_COMMAND) return status;
+    }
+
+    status = compile_unary( ans, prog, parser, strwct, tok_ini, tok_end, ARITMETIC_MASK );
+    if (status != GPARSE_NO_COMMAND) return status;
+
+    status = compile_unary( ans, prog, parser, strwct, tok_ini, tok_end, VARTYPE_MASK );
+    if (status != GPARSE_NO_COMMAND) return status;
+
+    status = compile_call( ans, prog, parser, strwct, tok_ini, tok_end );
+    if (status != GPARSE_NO_COMMAND) return status;
+
+    /* Round Brackets */
+    status = compile_bracket( ans, prog, parser, strwct, tok_ini, tok_end );
+    if (status != GPARSE_NO_COMMAND) return status;
+
+    parser_error( parser, "Expression error" );
+    parser->code_pos = tok_ini->str_ini;
+    return GPARSE_ERROR;
+}
+
+/* Compiles the statements of the code. The value of the last one is left
+ * in a register of 'ans'. */
+static int compile_source( Operand* ans, Program* prog, Parser* parser
+    , Struct* strwct, const char* code_ini )
+{
+    int status = GPARSE_NO_COMMAND;
+
+    parser->num_tokens = 0;
+    free( parser->err_msg );
+    parser->err_msg = nullptr;
+    parser->code_pos = nullptr;
+
+    const char* code_block = code_ini;
+    while (*code_block != '\0'){
+        code_block = parse_tokens( parser, code_block, nullptr );
+        if (code_block == nullptr){
+            status = GPARSE_ERROR;
+            break;
+        }
+        detect_declared_variables( parser, strwct );
+        if (detect_structures( parser, strwct ) != GPARSE_OK){
+            status = GPARSE_ERROR;
+            break;
+        }
+
+        if (parser->num_tokens > 0){
+            const Token* tok_ini = parser->tokens;
+            const Token* tok_end = parser->tokens + parser->num_tokens - 1;
+            if ((tok_ini->token_type & (VARTYPE_MASK | KEYWORD_MASK)) != 0){
+                parser_error( parser, "Declarations are not allowed in compiled expressions" );
+                parser->code_pos = tok_ini->str_ini;
+                status = GPARSE_ERROR;
+                break;
+            }
+            if (status == GPARSE_OK){
+                operand_release( prog, ans );
+            }
+            status = compile_command( ans, prog, parser, strwct, tok_ini, tok_end );
+        }
+        parser->num_tokens = 0;
+
+        if (status == GPARSE_ERROR){
+            break;
+        }
+    }
+
+    if (status == GPARSE_ERROR){
+        if (parser->code_pos != nullptr){
+            parser->err_column = parser->code_pos - code_ini;
+        }
+        return GPARSE_ERROR;
+    }
+    if (status == GPARSE_NO_COMMAND){
+        parser_error( parser, "Expecting an expresion" );
+        return GPARSE_ERROR;
+    }
+
+    return operand_materialize( prog, ans );
+}
+
+static int compile_code( Program* prog, Parser* parser, Struct* strwct
+    , const char* code_ini )
+{
+    Operand ans;
+    if (compile_source( &ans, prog, parser, strwct, code_ini ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    prog->result = ans.reg;
+    prog->type = ans.type;
+    prog->ans.type = ans.type;
+    prog->ans.size = numeric_type_size( ans.type );
+
+    /* The whole program is a single filter term */
+    if (program_add_term( prog, 0, prog->ncode, prog->result )){
+        return GPARSE_ERROR;
+    }
+
+    return workspace_prepare( &prog->ws, prog, 1 );
+}
+
+/* Compiles the formulas in a single program. The result of each one is
+ * stored in a variable of the program, except the last one, which is also
+ * kept in a register for gProgram_eval. */
+static int compile_set( Program* prog, Parser* parser, Struct* strwct
+    , const char* const* formulas, const int nformulas )
+{
+    prog->share = 1;
+    prog->outputs = (Variable**)calloc( nformulas, sizeof( Variable* ) );
+    prog->output_symbols = (int*)malloc( sizeof( int )*nformulas );
+    if (prog->outputs == nullptr || prog->output_symbols == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    Operand ans;
+    for (int i = 0; i < nformulas; i++){
+        if (formulas[i] == nullptr){
+            parser_error( parser, "Expecting an expresion" );
+            parser->err_line = i;
+            return GPARSE_ERROR;
+        }
+        if (compile_source( &ans, prog, parser, strwct, formulas[i] ) != GPARSE_OK){
+            parser->err_line = i;
+            return GPARSE_ERROR;
+        }
+
+        /* The name is not a valid variable name, so it is never found */
+        char* name = (char*)malloc( 16 );
+        Variable* var = name != nullptr ? new Variable( name ) : nullptr;
+        if (var == nullptr){
+            free( name );
+            return GPARSE_ERROR;
+        }
+        sprintf( name, "#%d", i );
+        prog->outputs[prog->noutputs++] = var;
+        var->type = ans.type;
+        var->size = numeric_type_size( ans.type );
+        var->pvalue = malloc( sizeof( Numeric::Pool ) );
+        var->free_data = true;
+
+        const int sym = var->pvalue != nullptr ? program_symbol( prog, var ) : -1;
+        if (sym < 0 || program_emit( prog, op_store, ans.type, ans.type
+            , ans.reg, ans.reg, sym ) < 0){
+            return GPARSE_ERROR;
+        }
+        prog->output_symbols[i] = sym;
+        if (i < nformulas - 1){
+            operand_release( prog, &ans );
+        }
+    }
+
+    /* The last formula is the result of gProgram_eval */
+    prog->result = ans.reg;
+    prog->type = ans.type;
+    prog->ans.type = ans.type;
+    prog->ans.size = numeric_type_size( ans.type );
+
+    if (program_add_term( prog, 0, prog->ncode, prog->result )){
+        return GPARSE_ERROR;
+    }
+
+    return workspace_prepare( &prog->ws, prog, 1 );
+}
+
+/* Points the next tokens with the name to the local variable */
+static void bind_local
+    ( const Token* tok, const Token* const tok_end, Variable* var )
+{
+    for (; tok <= tok_end; tok++){
+        if ((tok->token_type == token_name || tok->token_type == token_varname)
+            && strtok_compare( var->name, tok->str_ini, tok->str_end ) == 0){
+            Token* t = (Token*)tok;
+            t->token_type = token_varname;
+            t->pvar = var;
+        }
+    }
+}
+
+/* Adds a local variable to the frame of the function */
+static int compile_local( Program* body, Parser* parser, Struct* frame
+    , const Token* const tok_name, const int type, Variable** pvar )
+{
+    int status;
+
+    if (frame->find_variable( tok_name->str_ini, tok_name->str_end ) != nullptr){
+        parser_error( parser, "Variable name is already declared" );
+        parser->code_pos = tok_name->str_ini;
+        return GPARSE_ERROR;
+    }
+    Variable* var = frame->add_variable( tok_name->str_ini, tok_name->str_end, &status );
+    int reg = program_alloc_register( body, 1 );
+    Local* local = array_push( &body->locals, &body->nlocals, &body->locals_capacity );
+    if (var == nullptr || reg < 0 || local == nullptr){
+        return GPARSE_ERROR;
+    }
+    var->type = type;
+    local->var = var;
+    local->reg = reg;
+    *pvar = var;
+    return GPARSE_OK;
+}
+
+/* Declaration of local variables: 'type name [= value], ...' */
+static int compile_local_declaration( Program* body, Parser* parser, Struct* frame
+    , const Token* const tok_ini, const Token* const tok_end )
+{
+    const int type = tok_ini->var_type;
+    const Token* tok_name = tok_ini + 1;
+
+    if (function_valid_type( type ) == 0){
+        parser_error( parser, "C types cannot be used in declarations" );
+        parser->code_pos = tok_ini->str_ini;
+        return GPARSE_ERROR;
+    }
+
+    while (tok_name <= tok_end){
+        /* Commas inside brackets are arguments of functions */
+        const Token* tok_last = tok_name;
+        int ibr = 0;
+        while (tok_last < tok_end
+            && (ibr != 0 || (tok_last + 1)->token_type != token_comma)){
+            tok_last++;
+            if (tok_last->token_type == token_bracket_round_open){
+                ibr++;
+            }
+            else if (tok_last->token_type == token_bracket_round_close){
+                ibr--;
+            }
+        }
+
+        if (tok_name->token_type != token_name && tok_name->token_type != token_varname){
+            parser_error( parser, "Expecting a variable name" );
+            parser->code_pos = tok_name->str_ini;
+            return GPARSE_ERROR;
+        }
+
+        Variable* var;
+        if (compile_local( body, parser, frame, tok_name, type, &var )){
+            return GPARSE_ERROR;
+        }
+        const int reg = program_local( body, var );
+
+        Operand ans;
+        if (tok_name < tok_last){
+            const Token* tok_assign = tok_name + 1;
+            if (tok_assign->token_type != token_assign){
+                parser_error( parser, "Expecting an initialization" );
+                parser->code_pos = tok_assign->str_ini;
+                return GPARSE_ERROR;
+            }
+            int status = compile_command( &ans, body, parser, frame, tok_assign + 1, tok_last );
+            if (status != GPARSE_OK){
+                return status;
+            }
+        }
+        else{
+            /* Initialize the variable to default '0' */
+            Numeric zero;
+            numeric_set( &zero, _int_( 0 ) );
+            operand_set_constant( &ans, &zero );
+            if (type == t_bool){
+                ans.type = t_bool;
+                ans.value.vbool = 0;
+            }
+        }
+        if ((type == t_bool) != (ans.type == t_bool)
+            || operand_cast( body, &ans, type )
+            || operand_materialize( body, &ans )
+            || program_emit( body, op_cast, type, type, reg, ans.reg, 0 ) < 0){
+            parser_error( parser, "Cannot perform implicit casting" );
+            parser->code_pos = tok_name->str_ini;
+            return GPARSE_ERROR;
+        }
+        operand_release( body, &ans );
+
+        /* The next declarations can use it */
+        bind_local( tok_last + 1, tok_end, var );
+        tok_name = tok_last + 2;
+    }
+
+    return GPARSE_OK;
+}
+
+/* Compiles the statements of a function body. The last one must be
+ * 'return value'. */
+static int compile_function_body( Program* body, Parser* parser, Struct* frame
+    , const int type, const char* code_ini )
+{
+    int returned = 0;
+    int status = GPARSE_OK;
+
+    const char* code_block = code_ini;
+    parser->num_tokens = 0;
+    while (*code_block != '\0' && status == GPARSE_OK){
+        code_block = parse_tokens( parser, code_block, nullptr );
+        if (code_block == nullptr){
+            return GPARSE_ERROR;
+        }
+        /* Local variables hide the global ones */
+        detect_declared_variables( parser, frame );
+        detect_declared_variables( parser, &parser->global );
+        if (detect_structures( parser, &parser->global ) != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+
+        if (parser->num_tokens > 0){
+            const Token* tok_ini = parser->tokens;
+            const Token* tok_end = parser->tokens + parser->num_tokens - 1;
+            Operand ans;
+
+            if (returned){
+                parser_error( parser, "Statement after return" );
+                parser->code_pos = tok_ini->str_ini;
+                status = GPARSE_ERROR;
+            }
+            else if (tok_ini->token_type == token_vartype){
+                status = compile_local_declaration( body, parser, frame, tok_ini, tok_end );
+            }
+            else if (tok_ini->token_type == token_return){
+                if (tok_ini == tok_end){
+                    parser_error( parser, "Expecting an expresion" );
+                    parser->code_pos = tok_ini->str_end;
+                    return GPARSE_ERROR;
+                }
+                status = compile_command( &ans, body, parser, frame, tok_ini + 1, tok_end );
+                if (status == GPARSE_OK){
+                    if ((type == t_bool) != (ans.type == t_bool)
+                        || operand_cast( body, &ans, type )
+                        || operand_materialize( body, &ans )){
+                        parser_error( parser, "Cannot perform implicit casting" );
+                        parser->code_pos = tok_ini->str_ini;
+                        return GPARSE_ERROR;
+                    }
+                    body->result = ans.reg;
+                    returned = 1;
+                }
+            }
+            else if ((tok_ini->token_type & KEYWORD_MASK) != 0){
+                parser_error( parser, "Unexpected keyword in function" );
+                parser->code_pos = tok_ini->str_ini;
+                status = GPARSE_ERROR;
+            }
+            else{
+                status = compile_command( &ans, body, parser, frame, tok_ini, tok_end );
+                if (status == GPARSE_OK){
+                    operand_release( body, &ans );
+                }
+            }
+        }
+        parser->num_tokens = 0;
+    }
+
+    if (status == GPARSE_OK && returned == 0){
+        parser_error( parser, "Expecting return at the end of the function" );
+        parser->code_pos = code_block;
+        status = GPARSE_ERROR;
+    }
+    return status;
+}
+
+/* Declaration 'function type name( type arg, ... ){ body }' */
+int parse_function_declaration( Parser* parser
+    , const Token* const tok_ini, const Token* const tok_end )
+{
+    const Token* tok = tok_ini + 1;
+    int status;
+
+    if (tok > tok_end || tok->token_type != token_vartype
+        || function_valid_type( tok->var_type ) == 0){
+        parser_error( parser, "Expecting the type of the function" );
+        parser->code_pos = tok_ini->str_end;
+        return GPARSE_ERROR;
+    }
+    const int type = tok->var_type;
+
+    tok++;
+    if (tok > tok_end || (tok->token_type != token_name && tok->token_type != token_varname)){
+        parser_error( parser, "Expecting a function name" );
+        parser->code_pos = (tok - 1)->str_end;
+        return GPARSE_ERROR;
+    }
+    const char* name_ini = tok->str_ini;
+    const char* name_end = tok->str_end;
+
+    /* Arguments */
+    int nargs = 0;
+    int types[GPARSE_MAX_ARGS];
+    const Token* args[GPARSE_MAX_ARGS];
+    tok++;
+    if (tok > tok_end || tok->token_type != token_bracket_round_open){
+        parser_error( parser, "Expecting the arguments of the function" );
+        parser->code_pos = (tok - 1)->str_end;
+        return GPARSE_ERROR;
+    }
+    tok++;
+    while (tok <= tok_end && tok->token_type != token_bracket_round_close){
+        if (nargs >= GPARSE_MAX_ARGS){
+            parser_error( parser, "Too many arguments" );
+            parser->code_pos = tok->str_ini;
+            return GPARSE_ERROR;
+        }
+        if (tok + 1 > tok_end || tok->token_type != token_vartype
+            || function_valid_type( tok->var_type ) == 0
+            || ((tok + 1)->token_type != token_name && (tok + 1)->token_type != token_varname)){
+            parser_error( parser, "Expecting the type and the name of the argument" );
+            parser->code_pos = tok->str_ini;
+            return GPARSE_ERROR;
+        }
+        types[nargs] = tok->var_type;
+        args[nargs] = tok + 1;
+        nargs++;
+        tok += 2;
+        if (tok <= tok_end && tok->token_type == token_comma){
+            tok++;
+        }
+        else if (tok <= tok_end && tok->token_type != token_bracket_round_close){
+            parser_error( parser, "Expecting ',' or ')'" );
+            parser->code_pos = tok->str_ini;
+            return GPARSE_ERROR;
+        }
+    }
+
+    tok++;
+    if (tok != tok_end || tok->token_type != token_brackets){
+        parser_error( parser, "Expecting the body of the function" );
+        parser->code_pos = tok_end->str_end;
+        return GPARSE_ERROR;
+    }
+
+    /* The tokens are reused to parse the body, so it is copied */
+    const char* decl_ini = tok_ini->str_ini;
+    const char* decl_end = tok_end->str_end + 1;  /* With the closing bracket */
+    const char* body_ini = tok->str_ini + 1;
+    const size_t len = tok->str_end - body_ini;
+    char* code = (char*)malloc( len + 1 );
+    Program* body = new Program;
+    Struct frame;
+    if (code == nullptr){
+        delete body;
+        return GPARSE_ERROR;
+    }
+    memcpy( code, body_ini, len );
+    code[len] = '\0';
+    body->parser = parser;
+
+    /* The arguments are the first registers */
+    status = GPARSE_OK;
+    for (int k = 0; k < nargs && status == GPARSE_OK; k++){
+        Variable* var;
+        status = compile_local( body, parser, &frame, args[k], types[k], &var );
+    }
+    if (status == GPARSE_OK){
+        status = compile_function_body( body, parser, &frame, type, code );
+        if (status != GPARSE_OK && parser->code_pos != nullptr
+            && parser->code_pos >= code && parser->code_pos <= code + len){
+            parser->code_pos = body_ini + (parser->code_pos - code);
+        }
+    }
+    free( code );
+
+    Function* f = nullptr;
+    if (status == GPARSE_OK){
+        body->type = type;
+        f = function_new( parser, name_ini, name_end, type, nargs, types, &status );
+        if (status == GPARSE_NAME_COLLISION){
+            parser_error( parser, "Function is already declared" );
+            parser->code_pos = name_ini;
+        }
+    }
+    if (f == nullptr){
+        delete body;
+        return GPARSE_ERROR;
+    }
+
+    f->scalar = script_scalar;
+    f->batch = script_batch;
+    f->data = body;
+    f->source = (char*)malloc( decl_end - decl_ini + 1 );
+    if (f->source != nullptr){
+        memcpy( f->source, decl_ini, decl_end - decl_ini );
+        f->source[decl_end - decl_ini] = '\0';
+    }
+    f->pure = program_is_safe( body, 0, body->ncode );
+    return GPARSE_OK;
+}
+
+/* Compiles a boolean expression as a filter. Each term of the top level '&&'
+ * is compiled separately, so they can be evaluated in the best order. */
+static int compile_filter( Program* prog, Parser* parser, Struct* strwct
+    , const char* code_ini )
+{
+    const Token* term_ini[64];
+    const Token* term_end[64];
+    int nterms = 0;
+    int status = GPARSE_OK;
+
+    parser->num_tokens = 0;
+    free( parser->err_msg );
+    parser->err_msg = nullptr;
+    parser->code_pos = nullptr;
+
+    const char* code_next = parse_tokens( parser, code_ini, nullptr );
+    if (code_next == nullptr){
+        status = GPARSE_ERROR;
+    }
+    else if (parser->num_tokens == 0){
+        parser_error( parser, "Expecting an expresion" );
+        status = GPARSE_ERROR;
+    }
+    else{
+        while (*code_next == ';' || *code_next == '\n' || *code_next == ' '
+            || *code_next == '\t' || *code_next == '\r'){
+            code_next++;
+        }
+        if (*code_next != '\0'){
+            parser_error( parser, "Filters must be a single expression" );
+            parser->code_pos = code_next;
+            status = GPARSE_ERROR;
+        }
+    }
+
+    if (status == GPARSE_OK){
+        detect_declared_variables( parser, strwct );
+        status = detect_structures( parser, strwct );
+    }
+
+    if (status == GPARSE_OK){
+        const Token* tok_ini = parser->tokens;
+        const Token* tok_end = parser->tokens + parser->num_tokens - 1;
+        const Token* op;
+
+        /* A top level '||' or assignment makes a single term */
+        op = get_dual_operand
+            ( parser, tok_ini, tok_end, BOOLEAN_OR_MASK, RIGHT2LEFT, &status );
+        if (status == GPARSE_NO_COMMAND){
+            op = get_dual_operand
+                ( parser, tok_ini, tok_end, ASSIGN_MASK, LEFT2RIGHT, &status );
+        }
+        if (status == GPARSE_NO_COMMAND){
+            /* Split the terms from right to left */
+            while (nterms < 63){
+                op = get_dual_operand
+                    ( parser, tok_ini, tok_end, BOOLEAN_AND_MASK, RIGHT2LEFT, &status );
+                if (op == nullptr){
+                    break;
+                }
+                term_ini[nterms] = op + 1;
+                term_end[nterms] = tok_end;
+                nterms++;
+                tok_end = op - 1;
+            }
+        }
+        if (status != GPARSE_ERROR){
+            term_ini[nterms] = tok_ini;
+            term_end[nterms] = tok_end;
+            nterms++;
+            status = GPARSE_OK;
+        }
+    }
+
+    /* Compile the terms in the order of the code */
+    for (int k = nterms - 1; k >= 0 && status == GPARSE_OK; k--){
+        Operand term;
+        const int pc0 = prog->ncode;
+        status = compile_command( &term, prog, parser, strwct, term_ini[k], term_end[k] );
+        if (status != GPARSE_OK){
+            break;
+        }
+        if (term.type != t_bool){
+            parser_error( parser, "Expecting boolean types" );
+            parser->code_pos = term_ini[k]->str_ini;
+            status = GPARSE_ERROR;
+            break;
+        }
+        if (operand_materialize( prog, &term )
+            || program_add_term( prog, pc0, prog->ncode, term.reg )){
+            status = GPARSE_ERROR;
+            break;
+        }
+        /* The result is used as soon as the term is evaluated */
+        operand_release( prog, &term );
+    }
+    parser->num_tokens = 0;
+
+    if (status != GPARSE_OK){
+        if (parser->code_pos != nullptr){
+            parser->err_column = parser->code_pos - code_ini;
+        }
+        return GPARSE_ERROR;
+    }
+
+    /* Terms are reordered only if none of them depends on the previous ones */
+    prog->reorder = prog->nterms > 1;
+    for (int k = 0; k < prog->nterms; k++){
+        prog->reorder = prog->reorder && prog->terms[k].safe;
+    }
+
+    /* There is no single result, only the selected rows */
+    prog->result = -1;
+    prog->type = t_bool;
+    prog->ans.type = t_undefined;
+
+    return workspace_prepare( &prog->ws, prog, 1 );
+}
+
+extern "C"
+gProgram* gParser_compile( gParser* gparser, const char* code )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || code == nullptr){
+        return nullptr;
+    }
+
+    Program* prog = new Program;
+    prog->parser = parser;
+
+    if (compile_code( prog, parser, &parser->global, code ) != GPARSE_OK){
+        delete prog;
+        return nullptr;
+    }
+
+    return prog;
+}
+
+extern "C"
+gProgram* gParser_compileSet
+    ( gParser* gparser, const char* const* formulas, int nformulas )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || formulas == nullptr || nformulas <= 0){
+        return nullptr;
+    }
+
+    Program* prog = new Program;
+    prog->parser = parser;
+
+    if (compile_set( prog, parser, &parser->global, formulas, nformulas ) != GPARSE_OK){
+        delete prog;
+        return nullptr;
+    }
+
+    return prog;
+}
+
+extern "C"
+gProgram* gParser_compileFilter( gParser* gparser, const char* code )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || code == nullptr){
+        return nullptr;
+    }
+
+    Program* prog = new Program;
+    prog->parser = parser;
+
+    if (compile_filter( prog, parser, &parser->global, code ) != GPARSE_OK){
+        delete prog;
+        return nullptr;
+    }
+
+    return prog;
+}
+
+extern "C"
+void gProgram_dispose( gProgram* program )
+{
+    Program* prog = (Program*)program;
+    delete( prog );
+}
+
+extern "C"
+int gProgram_bindColumn
+    ( gProgram* program, const char* varname, void* data, size_t stride )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || varname == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    for (int i = 0; i < prog->nsymbols; i++){
+        Symbol* sym = prog->symbols + i;
+        if (strcmp( sym->var->name, varname ) == 0){
+            sym->column = (char*)data;
+            sym->stride = stride != 0 ? stride : numeric_type_size( sym->var->type );
+            sym->packed = 0;
+            sym->validity = nullptr;
+            program_update_nulls( prog );
+            return GPARSE_OK;
+        }
+    }
+
+    return GPARSE_ERROR;
+}
+
+extern "C"
+int gProgram_bindValidity
+    ( gProgram* program, const char* varname, uint64_t* validity )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || varname == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    for (int i = 0; i < prog->nsymbols; i++){
+        Symbol* sym = prog->symbols + i;
+        if (strcmp( sym->var->name, varname ) == 0 && sym->column != nullptr
+            && sym->packed == 0){
+            sym->validity = (unsigned char*)validity;
+            sym->validity_offset = 0;
+            program_update_nulls( prog );
+            return GPARSE_OK;
+        }
+    }
+
+    return GPARSE_ERROR;
+}
+
+extern "C"
+int gProgram_bindStruct
+    ( gProgram* program, const char* varname, void* data, size_t stride )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || varname == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    int status = GPARSE_ERROR;
+    for (int i = 0; i < prog->nsymbols; i++){
+        Symbol* sym = prog->symbols + i;
+        const Variable* base = sym->var->base;
+        if (base != nullptr && strcmp( base->name, varname ) == 0){
+            const Struct* str = struct_type( prog->parser, base->type );
+            sym->column = (char*)data + sym->var->offset;
+            sym->stride = stride != 0 ? stride : str->size;
+            sym->packed = 0;
+            sym->validity = nullptr;
+            status = GPARSE_OK;
+        }
+    }
+    program_update_nulls( prog );
+
+    return status;
+}
+
+extern "C"
+int gProgram_eval( gProgram* program )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || prog->result < 0){
+        return GPARSE_ERROR;
+    }
+
+    parser_snapshot( prog->parser );
+    if (workspace_prepare( &prog->ws, prog, 1 ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    if (program_run( prog, &prog->ws, 0, 1, 0 ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    memcpy( prog->ans.pvalue, prog->ws.reg( prog->result ), prog->ans.size );
+
+    return GPARSE_OK;
+}
+
+/* Evaluates the program for all the rows. Booleans are written as a bitmap
+ * if 'bits' is set. The validity of the results is optional. */
+static int program_eval_batch( Program* prog, const size_t nrows, void* out
+    , const int bits, uint64_t* validity, size_t* null_count )
+{
+    if (prog == nullptr || prog->result < 0){
+        return GPARSE_ERROR;
+    }
+
+    parser_snapshot( prog->parser );
+    if (workspace_prepare( &prog->ws, prog, GPARSE_BATCH ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+
+    const size_t size = prog->ans.size;
+    size_t valid = 0;
+    for (size_t row0 = 0; row0 < nrows; row0 += GPARSE_BATCH){
+        const int n = int( nrows - row0 < GPARSE_BATCH ? nrows - row0 : GPARSE_BATCH );
+        const int nwords = (n + 63) / 64;
+        if (program_run( prog, &prog->ws, row0, n, 1 ) != GPARSE_OK){
+            return GPARSE_ERROR;
+        }
+        const char* result = prog->ws.reg( prog->result );
+        if (out != nullptr && bits){
+            /* GPARSE_BATCH is multiple of 64, so blocks start a word */
+            uint64_t* words = (uint64_t*)out + row0 / 64;
+            memset( words, 0, sizeof( uint64_t )*nwords );
+            for (int i = 0; i < n; i++){
+                words[i / 64] |= uint64_t( result[i] != 0 ) << (i % 64);
+            }
+        }
+        else if (out != nullptr){
+            memcpy( (char*)out + row0*size, result, n*size );
+        }
+
+        if (validity != nullptr || null_count != nullptr){
+            uint64_t* words = validity != nullptr ? validity + row0 / 64 : nullptr;
+            const uint64_t* v = prog->ws.valid_reg( prog->result );
+            for (int w = 0; w < nwords; w++){
+                uint64_t bits_valid = prog->nulls ? v[w] : ~uint64_t( 0 );
+                if (w == nwords - 1 && n % 64 != 0){
+                    bits_valid &= (uint64_t( 1 ) << (n % 64)) - 1;
+                }
+                if (words != nullptr){
+                    words[w] = bits_valid;
+                }
+                valid += bitmap_count( bits_valid );
+            }
+        }
+    }
+
+    if (null_count != nullptr){
+        *null_count = nrows - valid;
+    }
+    return GPARSE_OK;
+}
+
+extern "C"
+int gProgram_evalBatch( gProgram* program, size_t nrows, void* out )
+{
+    return program_eval_batch( (Program*)program, nrows, out, 0, nullptr, nullptr );
+}
+
+extern "C"
+int gProgram_evalNulls( gProgram* program, size_t nrows, void* out
+    , uint64_t* validity, size_t* null_count )
+{
+    return program_eval_batch( (Program*)program, nrows, out, 0, validity, null_count );
+}
+
+extern "C"
+void gProgram_resetWindows( gProgram* program )
+{
+    const Program* prog = (const Program*)program;
+    for (int i = 0; prog != nullptr && i < prog->nwindows; i++){
+        Window* w = (Window*)prog->windows[i]->data;
+        w->reset( w );
+    }
+}
+
+/* Bytes of the registers of a formula set for each tile of rows. All the
+ * formulas are evaluated for a tile before the next one, so the loaded
+ * columns and the shared values stay in the cache. */
+#define SET_TILE_BYTES (1024*1024)
+
+extern "C"
+int gProgram_outputs( gProgram* program )
+{
+    const Program* prog = (const Program*)program;
+    if (prog == nullptr){
+        return 0;
+    }
+    return prog->noutputs > 0 ? prog->noutputs : 1;
+}
+
+extern "C"
+int gProgram_outputType( gProgram* program, int output )
+{
+    const Program* prog = (const Program*)program;
+    if (prog == nullptr || output < 0 || output >= gProgram_outputs( program )){
+        return t_undefined;
+    }
+    return prog->noutputs > 0 ? prog->outputs[output]->type : prog->type;
+}
+
+/* Binds the variables of the results to the output columns, or unbinds
+ * them if 'outs' is nullptr */
+static void program_bind_outputs( Program* prog, void** outs, uint64_t** validity )
+{
+    for (int i = 0; i < prog->noutputs; i++){
+        Symbol* sym = prog->symbols + prog->output_symbols[i];
+        sym->column = outs != nullptr ? (char*)outs[i] : nullptr;
+        sym->stride = prog->outputs[i]->size;
+        sym->validity = validity != nullptr && sym->column != nullptr
+            ? (unsigned char*)validity[i] : nullptr;
+        sym->validity_offset = 0;
+    }
+}
+
+extern "C"
+int gProgram_evalSet( gProgram* program, size_t nrows, void** outs
+    , uint64_t** validity )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || prog->result < 0 || outs == nullptr){
+        return GPARSE_ERROR;
+    }
+    if (prog->noutputs == 0){
+        /* A single expression */
+        return program_eval_batch( prog, nrows, outs[0], 0
+            , validity != nullptr ? validity[0] : nullptr, nullptr );
+    }
+
+    /* Rows of a tile, a multiple of 64 so the bitmaps start a word */
+    size_t tile = SET_TILE_BYTES / ((size_t)(prog->nregisters + 1)*REGISTER_ITEM);
+    tile = tile < 64 ? 64 : (tile > GPARSE_BATCH ? GPARSE_BATCH : tile & ~size_t( 63 ));
+    parser_snapshot( prog->parser );
+    if (workspace_prepare( &prog->ws, prog, int( tile ) ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+
+    /* The stores write the validity only if the inputs have nulls */
+    program_bind_outputs( prog, outs, prog->nulls ? validity : nullptr );
+    int status = GPARSE_OK;
+    for (size_t row0 = 0; row0 < nrows && status == GPARSE_OK; row0 += tile){
+        const int n = int( nrows - row0 < tile ? nrows - row0 : tile );
+        status = program_run( prog, &prog->ws, row0, n, 1 );
+    }
+    program_bind_outputs( prog, nullptr, nullptr );
+
+    if (prog->nulls == 0 && validity != nullptr){
+        const size_t nwords = (nrows + 63) / 64;
+        for (int i = 0; i < prog->noutputs; i++){
+            if (validity[i] != nullptr && nwords > 0){
+                memset( validity[i], 0xFF, sizeof( uint64_t )*nwords );
+                if (nrows % 64 != 0){
+                    validity[i][nwords - 1] = (uint64_t( 1 ) << (nrows % 64)) - 1;
+                }
+            }
+        }
+    }
+
+    return status;
+}
+
+/* Evaluates the filter for all the rows, writing the selected ones as a
+ * bitmap and/or as a list of row indices */
+static int program_filter( Program* prog, const size_t nrows
+    , uint64_t* bitmap, size_t* rows, size_t* count )
+{
+    if (prog == nullptr || prog->type != t_bool){
+        return GPARSE_ERROR;
+    }
+    parser_snapshot( prog->parser );
+    if (workspace_prepare( &prog->ws, prog, GPARSE_BATCH ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+
+    size_t total = 0;
+    for (size_t row0 = 0; row0 < nrows; row0 += GPARSE_BATCH){
+        const int n = int( nrows - row0 < GPARSE_BATCH ? nrows - row0 : GPARSE_BATCH );
+        Selection sel;
+        const int in_mask = program_filter_block( prog, &prog->ws, row0, n, &sel );
+        if (in_mask < 0){
+            return GPARSE_ERROR;
+        }
+
+        if (in_mask){
+            const _bool_* mask = prog->ws.mask;
+            if (bitmap != nullptr){
+                /* GPARSE_BATCH is multiple of 64, so blocks start a word */
+                uint64_t* words = bitmap + row0 / 64;
+                for (int w = 0; w * 64 < n; w++){
+                    const int m = n - w * 64 < 64 ? n - w * 64 : 64;
+                    uint64_t bits = 0;
+                    for (int i = 0; i < m; i++){
+                        bits |= uint64_t( mask[w * 64 + i] ) << i;
+                    }
+                    words[w] = bits;
+                }
+            }
+            if (rows != nullptr){
+                size_t* out = rows + total;
+                size_t k = 0;
+                for (int i = 0; i < n; i++){
+                    out[k] = row0 + i;
+                    k += mask[i];
+                }
+            }
+            total += count_true( mask, n );
+        }
+        else{
+            if (bitmap != nullptr){
+                uint64_t* words = bitmap + row0 / 64;
+                memset( words, 0, sizeof( uint64_t )*((n + 63) / 64) );
+                for (int k = 0; k < sel.n; k++){
+                    const int i = sel.idx == nullptr ? k : sel.idx[k];
+                    words[i / 64] |= uint64_t( 1 ) << (i % 64);
+                }
+            }
+            if (rows != nullptr){
+                for (int k = 0; k < sel.n; k++){
+                    rows[total + k] = row0 + (sel.idx == nullptr ? k : sel.idx[k]);
+                }
+            }
+            total += sel.n;
+        }
+    }
+
+    if (count != nullptr){
+        *count = total;
+    }
+    return GPARSE_OK;
+}
+
+extern "C"
+int gProgram_filter
+    ( gProgram* program, size_t nrows, uint64_t* bitmap, size_t* count )
+{
+    return program_filter( (Program*)program, nrows, bitmap, nullptr, count );
+}
+
+extern "C"
+int gProgram_filterRows
+    ( gProgram* program, size_t nrows, size_t* rows, size_t* count )
+{
+    return program_filter( (Program*)program, nrows, nullptr, rows, count );
+}
+
+extern "C"
+int gProgram_bindArrow( gProgram* program, const char* varname
+    , const struct ArrowSchema* schema, const struct ArrowArray* array )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    return arrow_bind( prog, varname, schema, array );
+}
+
+extern "C"
+int gProgram_evalArrow( gProgram* program, size_t nrows
+    , struct ArrowArray* out, struct ArrowSchema* out_schema )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || out == nullptr || out_schema == nullptr
+        || arrow_format( prog->type ) == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    /* The program writes the results in the buffer of the array. Booleans
+     * are written as a bitmap. Filters have no single result, and select
+     * the rows where the condition is true, so their results are never
+     * null. */
+    const size_t nwords = (nrows + 63) / 64;
+    void* data = prog->type == t_bool
+        ? malloc( sizeof( uint64_t )*(nwords + 1) ) : malloc( prog->ans.size*nrows + 1 );
+    uint64_t* validity = nullptr;
+    size_t nulls = 0;
+    int status = data != nullptr ? GPARSE_OK : GPARSE_ERROR;
+    if (status == GPARSE_OK && prog->result < 0){
+        status = program_filter( prog, nrows, (uint64_t*)data, nullptr, nullptr );
+    }
+    else if (status == GPARSE_OK){
+        validity = prog->nulls ? (uint64_t*)malloc( sizeof( uint64_t )*(nwords + 1) ) : nullptr;
+        status = prog->nulls && validity == nullptr ? GPARSE_ERROR
+            : program_eval_batch( prog, nrows, data, prog->type == t_bool, validity, &nulls );
+        if (nulls == 0){
+            free( validity );
+            validity = nullptr;
+        }
+    }
+    const int64_t null_count = int64_t( nulls );
+
+    if (status == GPARSE_OK){
+        status = arrow_export( out, out_schema, prog->type, nrows, data, validity, null_count );
+    }
+    if (status != GPARSE_OK){
+        free( data );
+        free( validity );
+    }
+    return status;
+}
+
+/********************/
+/* Parallel scripts */
+/********************/
+
+/* Statement of a script compiled for parallel execution */
+struct Statement
+{
+    Program* prog;
+    size_t column;      /* Position in the script */
+};
+
+/* Returns 1 if the program calls functions with side effects */
+static int program_has_effects( const Program* prog )
+{
+    for (int pc = 0; pc < prog->ncode; pc++){
+        if (prog->code[pc].op == op_call && prog->code[pc].func->pure == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Memory used by the statements. Members of structures are variables over
+ * the memory of the structure, so the overlapping ranges of memory are
+ * merged into regions, and the statements are ordered by region. */
+struct Region
+{
+    const char* ini;
+    const char* end;
+    int writer;         /* Last statement writing the region */
+    int* readers;       /* Statements reading it after the writer */
+    int nreaders;
+    int readers_capacity;
+};
+
+static int region_compare( const void* a, const void* b )
+{
+    const char* pa = ((const Region*)a)->ini;
+    const char* pb = ((const Region*)b)->ini;
+    return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+/* Region with the address */
+static Region* region_find( Region* regions, const int nregions, const char* p )
+{
+    int lo = 0;
+    int hi = nregions - 1;
+    while (lo < hi){
+        const int mid = (lo + hi + 1)/2;
+        if (regions[mid].ini <= p){
+            lo = mid;
+        }
+        else{
+            hi = mid - 1;
+        }
+    }
+    return regions + lo;
+}
+
+/* Adds the edge from the statement 'from' to 'to' */
+static int edge_add( int** edges, int* nedges, int* capacity, const int from, const int to )
+{
+    if (from < 0 || from == to){
+        return GPARSE_OK;
+    }
+    int* e0 = array_push( edges, nedges, capacity );
+    int* e1 = e0 != nullptr ? array_push( edges, nedges, capacity ) : nullptr;
+    if (e1 == nullptr){
+        return GPARSE_ERROR;
+    }
+    (*edges)[*nedges - 2] = from;
+    (*edges)[*nedges - 1] = to;
+    return GPARSE_OK;
+}
+
+/* Builds the graph of the statements: a statement reading or writing a
+ * region follows the last statement writing it, and a statement writing it
+ * follows the statements reading it before. Calls to functions with side
+ * effects follow, and precede, every other statement. The successors of
+ * each statement are written in 'first' and 'succ', as in taskgraph_run. */
+static int statements_graph( const Statement* sts, const int n
+    , int* first, int* pending, int** succ )
+{
+    Region* regions = nullptr;
+    int nregions = 0;
+    int regions_capacity = 0;
+    int* edges = nullptr;
+    int nedges = 0;
+    int edges_capacity = 0;
+    int status = GPARSE_OK;
+
+    for (int i = 0; i < n && status == GPARSE_OK; i++){
+        const Program* prog = sts[i].prog;
+        for (int k = 0; k < prog->nsymbols; k++){
+            const Variable* var = prog->symbols[k].var;
+            Region* r = array_push( &regions, &nregions, &regions_capacity );
+            if (r == nullptr){
+                status = GPARSE_ERROR;
+                break;
+            }
+            memset( r, 0, sizeof( Region ) );
+            r->ini = (const char*)var->pvalue;
+            r->end = r->ini + var->size;
+        }
+    }
+    if (nregions > 0){
+        qsort( regions, nregions, sizeof( Region ), region_compare );
+        int m = 0;
+        for (int k = 1; k < nregions; k++){
+            if (regions[k].ini < regions[m].end){
+                if (regions[k].end > regions[m].end){
+                    regions[m].end = regions[k].end;
+                }
+            }
+            else{
+                regions[++m] = regions[k];
+            }
+        }
+        nregions = m + 1;
+    }
+    for (int k = 0; k < nregions; k++){
+        regions[k].writer = -1;
+    }
+
+    int barrier = -1;
+    for (int i = 0; i < n && status == GPARSE_OK; i++){
+        const Program* prog = sts[i].prog;
+        if (program_has_effects( prog )){
+            for (int j = barrier > 0 ? barrier : 0; j < i && status == GPARSE_OK; j++){
+                status = edge_add( &edges, &nedges, &edges_capacity, j, i );
+            }
+            barrier = i;
+        }
+        else{
+            status = edge_add( &edges, &nedges, &edges_capacity, barrier, i );
+        }
+
+        /* Reads first, so 'a = a + 1' does not follow itself */
+        for (int k = 0; k < prog->nsymbols && status == GPARSE_OK; k++){
+            Region* r = region_find( regions, nregions, (const char*)prog->symbols[k].var->pvalue );
+            status = edge_add( &edges, &nedges, &edges_capacity, r->writer, i );
+            if (status == GPARSE_OK && (r->nreaders == 0 || r->readers[r->nreaders - 1] != i)){
+                int* reader = array_push( &r->readers, &r->nreaders, &r->readers_capacity );
+                status = reader != nullptr ? GPARSE_OK : GPARSE_ERROR;
+                if (reader != nullptr){
+                    *reader = i;
+                }
+            }
+        }
+        for (int k = 0; k < prog->nsymbols && status == GPARSE_OK; k++){
+            if (program_writes( prog, k ) == 0){
+                continue;
+            }
+            Region* r = region_find( regions, nregions, (const char*)prog->symbols[k].var->pvalue );
+            for (int j = 0; j < r->nreaders && status == GPARSE_OK; j++){
+                status = edge_add( &edges, &nedges, &edges_capacity, r->readers[j], i );
+            }
+            r->writer = i;
+            r->nreaders = 0;
+        }
+    }
+
+    /* Successors sorted by statement */
+    int nsucc = nedges/2;
+    *succ = status == GPARSE_OK ? (int*)malloc( sizeof( int )*(nsucc + 1) ) : nullptr;
+    if (*succ == nullptr){
+        status = GPARSE_ERROR;
+    }
+    else{
+        memset( first, 0, sizeof( int )*(n + 1) );
+        for (int e = 0; e < nsucc; e++){
+            first[edges[2*e] + 1]++;
+            pending[edges[2*e + 1]]++;
+        }
+        for (int i = 0; i < n; i++){
+            first[i + 1] += first[i];
+        }
+        for (int e = 0; e < nsucc; e++){
+            (*succ)[first[edges[2*e]]++] = edges[2*e + 1];
+        }
+        for (int i = n; i > 0; i--){
+            first[i] = first[i - 1];
+        }
+        first[0] = 0;
+    }
+
+    for (int k = 0; k < nregions; k++){
+        free( regions[k].readers );
+    }
+    free( regions );
+    free( edges );
+    return status;
+}
+
+static int statement_run( void* data, const int task )
+{
+    const Statement* st = (const Statement*)data + task;
+    return program_run( st->prog, &st->prog->ws, 0, 1, 0 );
+}
+
+/* Runs the statements, each one after the previous statements that use
+ * the same variables. Returns the index of the first statement that fails,
+ * or -1. */
+static int statements_run( Parser* parser, Statement* sts, const int n
+    , const int nthreads )
+{
+    int failed = -1;
+
+    /* Workspaces are prepared here, so running cannot fail for memory */
+    for (int i = 0; i < n; i++){
+        if (workspace_prepare( &sts[i].prog->ws, sts[i].prog, 1 ) != GPARSE_OK){
+            return i;
+        }
+    }
+
+    int* first = (int*)malloc( sizeof( int )*(n + 1) );
+    int* pending = (int*)calloc( n + 1, sizeof( int ) );
+    int* status = (int*)malloc( sizeof( int )*(n + 1) );
+    int* succ = nullptr;
+    int ok = first != nullptr && pending != nullptr && status != nullptr
+        && nthreads > 1 && n > 1
+        && statements_graph( sts, n, first, pending, &succ ) == GPARSE_OK;
+
+    if (ok){
+        taskgraph_run( n, first, succ, pending, status, statement_run, sts, nthreads );
+        for (int i = 0; i < n && failed < 0; i++){
+            failed = status[i] != GPARSE_OK ? i : -1;
+        }
+    }
+    else{
+        for (int i = 0; i < n && failed < 0; i++){
+            failed = statement_run( sts, i ) != GPARSE_OK ? i : -1;
+        }
+    }
+
+    /* The result of the last statement is the answer */
+    if (failed < 0 && n > 0){
+        const Program* last = sts[n - 1].prog;
+        Numeric num;
+        num.type = last->type;
+        memcpy( &num.pool, last->ws.reg( last->result ), numeric_type_size( last->type ) );
+        variable_dynamic_assign( &parser->ans, &num );
+    }
+
+    free( first );
+    free( pending );
+    free( status );
+    free( succ );
+    return failed;
+}
+
+/* Runs the script as parser_code, but the consecutive statements that can
+ * be compiled are collected, and run in parallel where they do not use the
+ * same variables. Other statements, like declarations, wait for the
+ * previous ones and run in the interpreter. */
+static int parser_code_parallel( Parser* parser, const char* code, const int nthreads )
+{
+    Statement* sts = nullptr;
+    int nsts = 0;
+    int sts_capacity = 0;
+    int status = GPARSE_NO_COMMAND;
+    char* buffer = nullptr;
+
+    const char* p = code;
+    const char* end = code;
+    while (*p != '\0' && status != GPARSE_ERROR){
+        /* Find the end of the statement */
+        parser->num_tokens = 0;
+        const char* ini = p;
+        end = parse_tokens( parser, p, nullptr );
+        const size_t ntokens = parser->num_tokens;
+        parser->num_tokens = 0;
+        if (end == nullptr){
+            end = ini + strlen( ini );
+        }
+        p = *end != '\0' ? end + 1 : end;
+        if (ntokens == 0){
+            status = GPARSE_NO_COMMAND;
+            continue;
+        }
+
+        /* Compile it alone */
+        Program* prog = nullptr;
+        char* text = (char*)realloc( buffer, end - ini + 1 );
+        if (text != nullptr){
+            buffer = text;
+            memcpy( buffer, ini, end - ini );
+            buffer[end - ini] = '\0';
+            prog = new Program;
+            prog->parser = parser;
+            if (compile_code( prog, parser, &parser->global, buffer ) != GPARSE_OK){
+                delete prog;
+                prog = nullptr;
+            }
+        }
+        Statement* st = prog != nullptr
+            ? array_push( &sts, &nsts, &sts_capacity ) : nullptr;
+        if (st != nullptr){
+            st->prog = prog;
+            st->column = ini - code;
+            status = GPARSE_OK;
+            continue;
+        }
+        delete prog;
+
+        /* Run the previous statements, and this one in the interpreter */
+        const int failed = statements_run( parser, sts, nsts, nthreads );
+        if (failed >= 0){
+            parser_error( parser, "Cannot evaluate the statement" );
+            parser->err_column = (int)sts[failed].column;
+            status = GPARSE_ERROR;
+            break;
+        }
+        for (int i = 0; i < nsts; i++){
+            delete sts[i].prog;
+        }
+        nsts = 0;
+
+        const int s = text != nullptr
+            ? parser_code( parser, &parser->global, buffer, nullptr ) : GPARSE_ERROR;
+        if (s == GPARSE_ERROR){
+            parser->err_column += (int)(ini - code);
+            status = GPARSE_ERROR;
+        }
+        else if (s == GPARSE_OK){
+            status = GPARSE_OK;
+        }
+    }
+
+    /* As in parser_code, the status is the one of the last statement, which
+     * is empty if the script ends with a separator */
+    if (status != GPARSE_ERROR && *end != '\0'){
+        status = GPARSE_NO_COMMAND;
+    }
+    if (status != GPARSE_ERROR){
+        const int failed = statements_run( parser, sts, nsts, nthreads );
+        if (failed >= 0){
+            parser_error( parser, "Cannot evaluate the statement" );
+            parser->err_column = (int)sts[failed].column;
+            status = GPARSE_ERROR;
+        }
+    }
+    for (int i = 0; i < nsts; i++){
+        delete sts[i].prog;
+    }
+    free( sts );
+    free( buffer );
+    return status;
+}
+
+extern "C"
+int gParser_commandParallel( gParser* gparser, const char* code, int nthreads )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || code == nullptr){
+        return GPARSE_NO_COMMAND;
+    }
+    if (nthreads <= 0){
+        nthreads = thread_count();
+    }
+    parser_snapshot( parser );
+    return parser_code_parallel( parser, code, nthreads );
+}
+
+/**************/
+/* Aggregates */
+/**************/
+
+/* Returns 1 if the program can run in several threads at once: it only
+ * assigns bound columns, and it does not call functions with side effects */
+static int program_is_reentrant( const Program* prog )
+{
+    for (int pc = 0; pc < prog->ncode; pc++){
+        const Instruction* ins = prog->code + pc;
+        if (ins->op == op_store && prog->symbols[ins->b].column == nullptr){
+            return 0;
+        }
+    }
+    return program_has_effects( prog ) == 0;
+}
+
+static void aggregate_result( gAggregate* result, const Partial* p )
+{
+    result->count = size_t( p->count );
+    result->sum = p->sum;
+    result->mean = p->count > 0 ? p->sum / p->count : NAN;
+    result->variance = p->count > 1 ? p->m2 / (p->count - 1) : NAN;
+    result->min = p->count > 0 ? p->min : NAN;
+    result->max = p->count > 0 ? p->max : NAN;
+}
+
+extern "C"
+int gProgram_aggregate( gProgram* program, size_t nrows, gAggregate* result
+    , int options, int nthreads )
+{
+    const Program* prog = (const Program*)program;
+    if (prog == nullptr || prog->result < 0 || result == nullptr){
+        return GPARSE_ERROR;
+    }
+    if (nthreads <= 0){
+        nthreads = thread_count();
+    }
+    if (program_is_reentrant( prog ) == 0){
+        nthreads = 1;
+    }
+    parser_snapshot( prog->parser );
+
+    Partial p;
+    if (program_aggregate( prog, nrows, &p, (options & GPARSE_PAIRWISE) != 0
+        , nthreads ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    aggregate_result( result, &p );
+    return GPARSE_OK;
+}
+
+/************/
+/* Group by */
+/************/
+
+extern "C"
+void gGroups_release( gGroups* groups )
+{
+    if (groups == nullptr){
+        return;
+    }
+    free( groups->keys );
+    free( groups->aggregates );
+    groups->keys = nullptr;
+    groups->aggregates = nullptr;
+    groups->ngroups = 0;
+}
+
+extern "C"
+int gProgram_groupBy( gProgram* key, gProgram* value, size_t nrows, gGroups* groups
+    , size_t memory, int nthreads )
+{
+    const Program* kprog = (const Program*)key;
+    const Program* vprog = (const Program*)value;
+    if (kprog == nullptr || kprog->result < 0 || groups == nullptr
+        || (vprog != nullptr && vprog->result < 0)){
+        return GPARSE_ERROR;
+    }
+    memset( groups, 0, sizeof( gGroups ) );
+    groups->key_type = kprog->type;
+    if (nthreads <= 0){
+        nthreads = thread_count();
+    }
+    if (program_is_reentrant( kprog ) == 0
+        || (vprog != nullptr && program_is_reentrant( vprog ) == 0)){
+        nthreads = 1;
+    }
+    parser_snapshot( kprog->parser );
+    if (vprog != nullptr && vprog->parser != kprog->parser){
+        parser_snapshot( vprog->parser );
+    }
+
+    GroupBy gb;
+    if (program_group_by( &gb, kprog, vprog, nrows, int64_t( memory ), nthreads ) != GPARSE_OK){
+        group_by_dispose( &gb );
+        return GPARSE_ERROR;
+    }
+
+    size_t ngroups = 0;
+    for (int p = 0; p < gb.npartitions; p++){
+        ngroups += gb.tables[p].used;
+    }
+    const int size = numeric_type_size( kprog->type );
+    groups->keys = malloc( size*(ngroups > 0 ? ngroups : 1) );
+    groups->aggregates = (gAggregate*)malloc( sizeof( gAggregate )*(ngroups > 0 ? ngroups : 1) );
+    if (groups->keys == nullptr || groups->aggregates == nullptr){
+        group_by_dispose( &gb );
+        gGroups_release( groups );
+        return GPARSE_ERROR;
+    }
+
+    size_t k = 0;
+    for (int p = 0; p < gb.npartitions; p++){
+        const GroupTable* t = gb.tables + p;
+        for (size_t i = 0; i <= t->mask; i++){
+            const GroupSlot* s = t->slots + i;
+            if (s->rows == 0){
+                continue;
+            }
+            Partial partial;
+            group_partial( &partial, s );
+            group_key_value( (char*)groups->keys + k*size, kprog->type, s->key );
+            aggregate_result( groups->aggregates + k, &partial );
+            if (vprog == nullptr){
+                groups->aggregates[k].count = size_t( s->rows );
+            }
+            k++;
+        }
+    }
+    groups->ngroups = ngroups;
+    group_by_dispose( &gb );
+    return GPARSE_OK;
+}
+
+/************/
+/* Registry */
+/************/
+
+extern "C"
+gRegistry* gRegistry_create( gParser* gparser, int capacity )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || capacity <= 0){
+        return nullptr;
+    }
+    return registry_create( parser, capacity );
+}
+
+extern "C"
+void gRegistry_dispose( gRegistry* registry )
+{
+    if (registry == nullptr){
+        return;
+    }
+    registry_dispose( (Registry*)registry );
+}
+
+extern "C"
+int gRegistry_set( gRegistry* registry, const char* name, const char* formula )
+{
+    Registry* reg = (Registry*)registry;
+    if (reg == nullptr || name == nullptr || formula == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    registry_lock( reg );
+    Parser* parser = reg->parser;
+    Program* prog = (Program*)gParser_compile( parser, formula );
+    int status = prog != nullptr ? GPARSE_OK : GPARSE_ERROR;
+    if (status == GPARSE_OK && (prog->result < 0 || program_is_reentrant( prog ) == 0)){
+        parser_error( parser, "Formulas cannot assign variables or have side effects" );
+        status = GPARSE_ERROR;
+    }
+    if (status == GPARSE_OK){
+        status = registry_set( reg, name, prog );
+    }
+    if (status != GPARSE_OK){
+        delete prog;
+    }
+    registry_unlock( reg );
+    return status;
+}
+
+extern "C"
+int gRegistry_remove( gRegistry* registry, const char* name )
+{
+    Registry* reg = (Registry*)registry;
+    if (reg == nullptr || name == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    registry_lock( reg );
+    const int status = registry_find( reg, name ) >= 0
+        ? registry_set( reg, name, nullptr ) : GPARSE_ERROR;
+    registry_unlock( reg );
+    return status;
+}
+
+extern "C"
+int gRegistry_find( gRegistry* registry, const char* name )
+{
+    if (registry == nullptr || name == nullptr){
+        return -1;
+    }
+    return registry_find( (Registry*)registry, name );
+}
+
+extern "C"
+void gRegistry_reclaim( gRegistry* registry )
+{
+    Registry* reg = (Registry*)registry;
+    if (reg == nullptr){
+        return;
+    }
+    registry_lock( reg );
+    registry_reclaim( reg );
+    registry_unlock( reg );
+}
+
+extern "C"
+gReader* gRegistry_reader( gRegistry* registry )
+{
+    if (registry == nullptr){
+        return nullptr;
+    }
+    return registry_reader( (Registry*)registry );
+}
+
+extern "C"
+void gReader_dispose( gReader* reader )
+{
+    if (reader == nullptr){
+        return;
+    }
+    reader_dispose( (Reader*)reader );
+}
+
+extern "C"
+int gReader_eval( gReader* reader, int formula, void* result, int* type )
+{
+    if (reader == nullptr || result == nullptr){
+        return GPARSE_ERROR;
+    }
+    return reader_eval( (Reader*)reader, formula, result, type );
+}
+
+/****************/
+/* Column files */
+/****************/
+
+extern "C"
+int gColumn_write( const char* dir, const char* name, int type
+    , const void* data, const uint64_t* validity, size_t count )
+{
+    if (dir == nullptr || name == nullptr){
+        return GPARSE_ERROR;
+    }
+    return column_write( dir, name, type, data, validity, count );
+}
+
+extern "C"
+int gColumns_open( const char* dir, gColumns* columns )
+{
+    if (dir == nullptr || columns == nullptr){
+        return GPARSE_ERROR;
+    }
+    return columns_open( columns, dir );
+}
+
+extern "C"
+void gColumns_close( gColumns* columns )
+{
+    if (columns == nullptr){
+        return;
+    }
+    columns_close( columns );
+}
+
+extern "C"
+int gProgram_bindColumns( gProgram* program, const gColumns* columns )
+{
+    Program* prog = (Program*)program;
+    if (prog == nullptr || columns == nullptr){
+        return GPARSE_ERROR;
+    }
+    return columns_bind( prog, columns );
+}
+
+/********************/
+/* Shared variables */
+/********************/
+
+extern "C"
+gShared* gShared_create( const char* name, int nvars, const char* const* names
+    , const int* types )
+{
+    if (name == nullptr || names == nullptr || types == nullptr){
+        return nullptr;
+    }
+    return shared_create( name, nvars, names, types );
+}
+
+extern "C"
+gShared* gShared_open( const char* name )
+{
+    if (name == nullptr){
+        return nullptr;
+    }
+    return shared_open( name );
+}
+
+extern "C"
+void gShared_close( gShared* shared )
+{
+    if (shared == nullptr){
+        return;
+    }
+    shared_close( (SharedSegment*)shared );
+}
+
+extern "C"
+int gShared_remove( const char* name )
+{
+    if (name == nullptr){
+        return GPARSE_ERROR;
+    }
+    return shared_remove( name );
+}
+
+extern "C"
+int gShared_find( gShared* shared, const char* varname )
+{
+    if (shared == nullptr || varname == nullptr){
+        return -1;
+    }
+    return shared_find( (SharedSegment*)shared, varname );
+}
+
+extern "C"
+int gShared_write( gShared* shared, int n, const int* index, const void* const* values )
+{
+    if (shared == nullptr || n < 0 || (n > 0 && (index == nullptr || values == nullptr))){
+        return GPARSE_ERROR;
+    }
+    return shared_write( (SharedSegment*)shared, n, index, values );
+}
+
+extern "C"
+void gShared_read( gShared* shared )
+{
+    if (shared == nullptr){
+        return;
+    }
+    shared_read( (SharedSegment*)shared );
+}
+
+extern "C"
+int gParser_addShared( gParser* gparser, gShared* gshared )
+{
+    SharedSegment* shared = (SharedSegment*)gshared;
+    if (gparser == nullptr || shared == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    shared_read( shared );
+    for (int i = 0; i < shared->nvars; i++){
+        if (gParser_addVariable( gparser, shared->vars[i].name, shared->vars[i].type
+            , shared->copy + i ) == nullptr){
+            return GPARSE_ERROR;
+        }
+    }
+    return GPARSE_OK;
+}
+
+/*************/
+/* Snapshots */
+/*************/
+
+extern "C"
+gSnapshot* gParser_addSnapshot( gParser* gparser, int nvars, const char* const* varnames )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || nvars <= 0 || varnames == nullptr){
+        return nullptr;
+    }
+
+    Variable** vars = (Variable**)malloc( sizeof( Variable* )*nvars );
+    if (vars == nullptr){
+        return nullptr;
+    }
+    for (int i = 0; i < nvars; i++){
+        vars[i] = varnames[i] != nullptr
+            ? (Variable*)gParser_findVariable( gparser, varnames[i] ) : nullptr;
+    }
+    Snapshot* snap = snapshot_create( parser, nvars, vars );
+    free( vars );
+    return snap;
+}
+
+extern "C"
+void gSnapshot_begin( gSnapshot* snapshot )
+{
+    snapshot_begin( (Snapshot*)snapshot );
+}
+
+extern "C"
+void gSnapshot_end( gSnapshot* snapshot )
+{
+    snapshot_end( (Snapshot*)snapshot );
+}
+
+/*****************/
+/* Program cache */
+/*****************/
+
+/* Takes the program from the cache, or compiles it and adds it */
+static Program* cache_compile( ProgramCache* cache, const int kind, const char* code )
+{
+    const CacheEntry* entry = cache_find( cache, kind, code );
+    Program* prog = entry != nullptr ? cache_load( cache, entry ) : nullptr;
+    if (prog != nullptr){
+        cache->hits++;
+        return prog;
+    }
+
+    Parser* parser = cache->parser;
+    prog = new Program;
+    prog->parser = parser;
+    const int status = kind == CACHE_FILTER
+        ? compile_filter( prog, parser, &parser->global, code )
+        : compile_code( prog, parser, &parser->global, code );
+    if (status != GPARSE_OK){
+        delete prog;
+        return nullptr;
+    }
+    cache->misses++;
+    cache_store( cache, kind, code, prog );
+    return prog;
+}
+
+extern "C"
+gCache* gCache_open( gParser* gparser, const char* path )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || path == nullptr){
+        return nullptr;
+    }
+    return cache_open( parser, path );
+}
+
+extern "C"
+gProgram* gCache_compile( gCache* gcache, const char* code )
+{
+    if (gcache == nullptr || code == nullptr){
+        return nullptr;
+    }
+    return cache_compile( (ProgramCache*)gcache, CACHE_EXPRESSION, code );
+}
+
+extern "C"
+gProgram* gCache_compileFilter( gCache* gcache, const char* code )
+{
+    if (gcache == nullptr || code == nullptr){
+        return nullptr;
+    }
+    return cache_compile( (ProgramCache*)gcache, CACHE_FILTER, code );
+}
+
+extern "C"
+int gCache_save( gCache* gcache )
+{
+    if (gcache == nullptr){
+        return GPARSE_ERROR;
+    }
+    return cache_save( (ProgramCache*)gcache );
+}
+
+extern "C"
+void gCache_close( gCache* gcache )
+{
+    if (gcache != nullptr){
+        cache_close( (ProgramCache*)gcache );
+    }
+}
+
+/**********/
+/* States */
+/**********/
+
+extern "C"
+int gParser_saveState( gParser* gparser, const char* path )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || path == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    size_t size;
+    char* image = state_image( parser, &size );
+    if (image == nullptr){
+        return GPARSE_ERROR;
+    }
+    FILE* f = fopen( path, "wb" );
+    int status = f != nullptr && fwrite( image, size, 1, f ) == 1 ? GPARSE_OK : GPARSE_ERROR;
+    if (f != nullptr && fclose( f ) != 0){
+        status = GPARSE_ERROR;
+    }
+    free( image );
+    return status;
+}
+
+extern "C"
+int gParser_loadState( gParser* gparser, const char* path )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || path == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    FILE* f = fopen( path, "rb" );
+    if (f == nullptr){
+        parser_error( parser, "The state cannot be read" );
+        return GPARSE_ERROR;
+    }
+    long size = fseek( f, 0, SEEK_END ) == 0 ? ftell( f ) : -1;
+    char* image = size > 0 ? (char*)malloc( size_t( size ) ) : nullptr;
+    if (image == nullptr || fseek( f, 0, SEEK_SET ) != 0
+        || fread( image, size_t( size ), 1, f ) != 1){
+        fclose( f );
+        free( image );
+        parser_error( parser, "The state cannot be read" );
+        return GPARSE_ERROR;
+    }
+    fclose( f );
+
+    const int status = state_load( parser, image, size_t( size ) );
+    free( image );
+    return status;
+}
+
+/* Adds the functions of the other parser from the index first. Functions
+ * of scripts are compiled again, so they use the variables of the parser
+ * and call its functions, and they may call the previous ones. */
+static int parser_copy_functions( Parser* parser, const Parser* from, const int first )
+{
+    int status = GPARSE_OK;
+    for (int i = first; i < from->nfunctions && status == GPARSE_OK; i++){
+        const Function* f = from->functions[i];
+        if (function_is_script( f )){
+            status = f->source != nullptr
+                ? parser_code( parser, &parser->global, f->source, nullptr ) : GPARSE_ERROR;
+        }
+        else{
+            status = function_copy( parser, f );
+        }
+    }
+    return status;
+}
+
+/* Copies the types, the variables and the functions of the template. The
+ * clone of a layer is another layer of the same base. */
+static int parser_clone( Parser* parser, const Parser* from )
+{
+    if (from->base != nullptr && layer_attach( parser, from->base ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+
+    size_t size;
+    char* image = state_image( from, &size );
+    if (image == nullptr){
+        return GPARSE_ERROR;
+    }
+    int status = state_load( parser, image, size );
+    free( image );
+    if (status == GPARSE_OK){
+        status = state_clone_host( parser, from );
+    }
+
+    /* Functions of the base compiled in the template are compiled again,
+     * after its variables are loaded */
+    if (status == GPARSE_OK){
+        status = parser_copy_functions( parser, from, from->nbase_functions );
+    }
+    return status;
+}
+
+extern "C"
+gParser* gParser_clone( const gParser* gtemplate )
+{
+    const Parser* from = (const Parser*)gtemplate;
+    if (from == nullptr){
+        return nullptr;
+    }
+
+    Parser* parser = new Parser;
+    parser->option_explicit_decl = from->option_explicit_decl;
+    if (parser_clone( parser, from ) != GPARSE_OK){
+        gParser_dispose( parser );
+        return nullptr;
+    }
+    return parser;
+}
+
+/**********/
+/* Layers */
+/**********/
+
+extern "C"
+gParser* gParser_createLayer( const gParser* gbase )
+{
+    const Parser* base = (const Parser*)gbase;
+    if (base == nullptr){
+        return nullptr;
+    }
+
+    Parser* parser = new Parser;
+    if (layer_attach( parser, base ) != GPARSE_OK
+        || parser_copy_functions( parser, base, parser->nfunctions ) != GPARSE_OK){
+        gParser_dispose( parser );
+        return nullptr;
+    }
+    return parser;
+}
+
+/*********/
+/* Pools */
+/*********/
+
+extern "C"
+gPool* gPool_create( const gParser* base )
+{
+    Pool* pool = (Pool*)malloc( sizeof( Pool ) );
+    if (pool == nullptr){
+        return nullptr;
+    }
+    memset( pool, 0, sizeof( Pool ) );
+    pool->base = (const Parser*)base;
+    return pool;
+}
+
+extern "C"
+gParser* gPool_acquire( gPool* gpool )
+{
+    Pool* pool = (Pool*)gpool;
+    if (pool == nullptr){
+        return nullptr;
+    }
+    Parser* parser = pool_take( pool );
+    if (parser == nullptr){
+        parser = new Parser;
+        parser->global.arena = &parser->arena;
+        if (pool->base != nullptr && layer_attach( parser, pool->base ) != GPARSE_OK){
+            gParser_dispose( parser );
+            return nullptr;
+        }
+        atomic_add( &pool->nparsers, 1 );
+    }
+
+    /* The functions of the base not shared are released by the reset, with
+     * the variables that they use */
+    if (pool->base != nullptr
+        && parser_copy_functions( parser, pool->base, parser->nfunctions ) != GPARSE_OK){
+        gParser_dispose( parser );
+        atomic_add( &pool->nparsers, -1 );
+        return nullptr;
+    }
+    return parser;
+}
+
+extern "C"
+void gPool_release( gPool* gpool, gParser* parser )
+{
+    Pool* pool = (Pool*)gpool;
+    if (pool == nullptr || parser == nullptr){
+        return;
+    }
+    if (pool_put( pool, (Parser*)parser ) != GPARSE_OK){
+        gParser_dispose( parser );
+        atomic_add( &pool->nparsers, -1 );
+    }
+}
+
+extern "C"
+void gPool_dispose( gPool* gpool )
+{
+    Pool* pool = (Pool*)gpool;
+    if (pool == nullptr){
+        return;
+    }
+    for (int i = 0; i < POOL_SHARDS; i++){
+        PoolShard* shard = pool->shards + i;
+        for (int j = 0; j < shard->nparsers; j++){
+            gParser_dispose( shard->parsers[j] );
+        }
+        free( shard->parsers );
+    }
+    free( pool );
+}
+
+/************/
+/* Formulas */
+/************/
+
+extern "C"
+int gParser_define( gParser* gparser, const char* varname, const char* formula )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || varname == nullptr || formula == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    Program* prog = new Program;
+    prog->parser = parser;
+    if (compile_code( prog, parser, &parser->global, formula ) != GPARSE_OK){
+        delete prog;
+        return GPARSE_ERROR;
+    }
+    for (int pc = 0; pc < prog->ncode; pc++){
+        if (prog->code[pc].op == op_store){
+            parser_error( parser, "Formulas cannot assign variables" );
+            delete prog;
+            return GPARSE_ERROR;
+        }
+    }
+
+    Variable* var = (Variable*)gParser_findVariable( parser, varname );
+    if (var == nullptr){
+        /* Declared with the type of the formula */
+        const char* name_end = varname + strlen( varname );
+        int status;
+        var = name_is_valid( varname, name_end )
+            ? parser->global.add_variable( varname, name_end, &status ) : nullptr;
+        if (var == nullptr){
+            parser_error( parser, "Invalid variable name" );
+            delete prog;
+            return GPARSE_ERROR;
+        }
+        var->free_data = true;
+        if (variable_alloc( var, prog->type ) != GPARSE_OK){
+            parser_error( parser, "The formula has no value" );
+            delete prog;
+            return GPARSE_ERROR;
+        }
+        memset( var->pvalue, 0, var->size );
+    }
+    else{
+        for (int i = 0; i < prog->nsymbols; i++){
+            if (prog->symbols[i].var == var){
+                parser_error( parser, "Circular dependency with the variable '%s'"
+                    , var->name );
+                delete prog;
+                return GPARSE_ERROR;
+            }
+        }
+        if (struct_type( parser, var->type ) != nullptr
+            || (var->type == t_bool) != (prog->type == t_bool)){
+            parser_error( parser, "Cannot perform implicit casting" );
+            delete prog;
+            return GPARSE_ERROR;
+        }
+    }
+
+    /* Assign the result to the variable */
+    int reg = prog->result;
+    if (var->type != prog->type){
+        reg = program_alloc_register( prog );
+        if (reg < 0 || program_emit( prog, op_cast, var->type, prog->type
+            , reg, prog->result, 0 ) < 0){
+            delete prog;
+            return GPARSE_ERROR;
+        }
+    }
+    const int sym = program_symbol( prog, var );
+    if (sym < 0 || program_emit( prog, op_store, var->type, var->type, reg, reg, sym ) < 0){
+        delete prog;
+        return GPARSE_ERROR;
+    }
+
+    if (graph_define( parser, var, prog ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+
+    /* The value is computed now, and its users in the next update */
+    const int inode = var->node - 1;
+    if (graph_eval( parser->nodes + inode ) < 0){
+        parser_error( parser, "Cannot evaluate the formula of '%s'", var->name );
+        return GPARSE_ERROR;
+    }
+    return graph_touch( parser, inode );
+}
+
+extern "C"
+int gParser_touch( gParser* gparser, const char* varname )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || varname == nullptr){
+        return GPARSE_ERROR;
+    }
+    const Variable* var = (const Variable*)gParser_findVariable( parser, varname );
+    if (var == nullptr){
+        return GPARSE_ERROR;
+    }
+
+    if (var->node > 0 && graph_touch( parser, var->node - 1 ) != GPARSE_OK){
+        return GPARSE_ERROR;
+    }
+    /* Formulas may read the members of a structure */
+    if (struct_type( parser, var->type ) != nullptr){
+        for (int i = 0; i < parser->nnodes; i++){
+            if (parser->nodes[i].var->base == var
+                && graph_touch( parser, i ) != GPARSE_OK){
+                return GPARSE_ERROR;
+            }
+        }
+    }
+    return GPARSE_OK;
+}
+
+extern "C"
+int gParser_write( gParser* gparser, const char* varname, const void* value )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr || varname == nullptr || value == nullptr){
+        return GPARSE_ERROR;
+    }
+    gVariable* var = gParser_findVariable( parser, varname );
+    if (var == nullptr){
+        return GPARSE_ERROR;
+    }
+    memcpy( var->pvalue, value, var->size );
+    return gParser_touch( parser, varname );
+}
+
+extern "C"
+int gParser_update( gParser* gparser )
+{
+    Parser* parser = (Parser*)gparser;
+    if (parser == nullptr){
+        return GPARSE_ERROR;
+    }
+    parser_snapshot( parser );
+    return graph_update( parser );
 }
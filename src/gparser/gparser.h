@@ -9,6 +9,8 @@ http://www.apache.org/licenses/LICENSE-2.0
 #ifndef H_GPARSER_H
 #define H_GPARSER_H
 
+#include <stddef.h>
+
 #include "gdata.h"
 
 #if defined(__cplusplus)
@@ -33,21 +35,656 @@ extern "C" {
      */
     int gParser_command( gParser* parser, const char* code );
 
+    /** 
+    Executes the statements in the string as gParser_command, but runs the
+    statements that do not share variables at the same time. The final
+    values, parser->ans and the first error are the same as in sequential
+    execution. Declarations, and other statements that cannot be compiled,
+    wait for the previous statements. Calls to functions without side
+    effects may run in several threads at once. Each statement is compiled
+    first, so it pays off when the statements are costly.
+    @param parser Pointer to the parser object.
+    @param code String with the operations to be parsed
+    @param nthreads Number of threads, or 0 for the number of processors.
+    @return Same as gParser_command.
+     */
+    int gParser_commandParallel( gParser* parser, const char* code, int nthreads );
+
     /** Adds a variable in global scope 
     @param parser Pointer to the parser object.
     @varname Variable name. Must follow the names convention for variables.
+    @vartype Basic type, or a type returned by gParser_addStruct.
+    @pdata Pointer to the value, used in place.
     @return The variable created or nullptr if there is a problem.
     */
     gVariable* gParser_addVariable
         ( gParser* gparser, const char* varname, const int vartype, void* pdata );
+
+    /** 
+    Adds a structure type with the layout of a C structure of the host, so
+    its instances are used in place, e.g.
+        gField fields[] = { { "x", t_double, offsetof( rec, x ) }
+            , { "id", t_int, offsetof( rec, id ) } };
+        int type = gParser_addStruct( parser, "rec", sizeof( rec ), 2, fields );
+        gParser_addVariable( parser, "r", type, &my_rec );
+    Expressions read and write 'r.x' directly in my_rec.
+    @param parser Pointer to the parser object.
+    @param name Name of the type. Must follow the names convention.
+    @param size Size of the structure, sizeof( rec ).
+    @param nfields Number of fields.
+    @param fields Name, type and offset of each field. The type can be another
+    structure type. Fields must be aligned to their type.
+    @return The type of the structure, or t_undefined if the name is already
+    used or a field is not valid.
+    */
+    int gParser_addStruct( gParser* parser, const char* name, const size_t size
+        , const int nfields, const gField* fields );
+
+    /** 
+    Adds an array of structures of the host, used in place as 'name[i].field'.
+    @param parser Pointer to the parser object.
+    @param varname Variable name.
+    @param type Type returned by gParser_addStruct.
+    @param data Pointer to the first structure.
+    @param count Number of structures.
+    @return The variable, or nullptr if there is a problem.
+    */
+    gVariable* gParser_addStructArray( gParser* parser, const char* varname
+        , const int type, void* data, const size_t count );
         
-    /** Find a variable by name in the parser global scope 
+    /** 
+    Adds a function implemented in C, callable as 'name( a, b, ... )'.
+    Calls are resolved when the expression is parsed or compiled, and the
+    arguments are casted to the declared types.
+    @param parser Pointer to the parser object.
+    @param name Function name. Must follow the names convention for variables.
+    It can be added several times with different argument types.
+    @param type Type of the result.
+    @param nargs Number of arguments, up to 8.
+    @param args_type Types of the arguments.
+    @param function Called as function( &result, args, data ), where args[k]
+    points to the k-th argument.
+    @param data Pointer passed to the function, e.g. a lookup table.
+    @return
+        - GPARSE_OK if the function is added
+        - GPARSE_NAME_COLLISION if there is a function with the same name and
+        argument types
+        - GPARSE_ERROR if the name or the types are not valid
+    */
+    int gParser_addFunction( gParser* parser, const char* name, const int type
+        , const int nargs, const int* args_type, gFunction function, void* data );
+
+    /** 
+    Adds a function with a batch implementation. Compiled programs call
+    batch( result, args, n, data ) for blocks of contiguous rows, where
+    args[k] is the column of the k-th argument. The scalar function is used
+    by the interpreter and for blocks where '&&' or '||' skip some rows.
+    @see gParser_addFunction
+    */
+    int gParser_addFunctionBatch( gParser* parser, const char* name, const int type
+        , const int nargs, const int* args_type
+        , gFunction function, gFunctionBatch batch, void* data );
+
+    /** Find a variable by name in the parser global scope.
+    A structure, or an array of structures, is a single block with the
+    layout of the same C structure; 'size' is the size of the whole block.
     @param parser Pointer to the parser object.
     @varname Variable name. 
     @return The variable created or nullptr if the variable is not declared.
     */
    gVariable* gParser_findVariable( gParser* gparser, const char* varname );
 
+    /**
+    Writes the state of the parser to a file: the structure types, and the
+    global variables declared by scripts with their values. The variables
+    of the host, the functions and the formulas are not saved.
+    @return GPARSE_OK, or GPARSE_ERROR if the file cannot be written.
+    */
+    int gParser_saveState( gParser* parser, const char* path );
+
+    /**
+    Loads a state written by gParser_saveState. The variables are added in
+    a single block, without declaring them one by one. The structure types
+    which are not in the parser are added, and those which are must have the
+    same layout.
+    @return GPARSE_OK, or GPARSE_ERROR with the message in parser->err_msg.
+    Nothing is added if the file is not valid, or some variable is already
+    declared.
+    */
+    int gParser_loadState( gParser* parser, const char* path );
+
+    /**
+    Creates a parser with the structure types, the variables and the
+    functions of the template. The values of the variables declared by
+    scripts are copied at once, in a single block, and the variables of the
+    host point to the same memory. Formulas, snapshots and caches are not
+    copied. The template is not modified, and it can be cloned again.
+    @return The new parser, which is released with gParser_dispose, or
+    nullptr if there is not enough memory.
+    */
+    gParser* gParser_clone( const gParser* gtemplate );
+
+    /**
+    Creates a parser that shares the global scope of the base: the variables
+    of the base are read in place, and the first time that the new parser
+    writes one of them, it writes its own copy. The variables that it reads
+    in compiled programs, or that the host finds with gParser_findVariable,
+    are copied too. The structure types of the base are also shared, and
+    its functions, except those of scripts that use global variables, which
+    are compiled again for the new parser.
+    The base must not be released or changed while it has layers. Layers of
+    the same base can be used in different threads.
+    @return The new parser, which is released with gParser_dispose, or
+    nullptr if there is not enough memory.
+    */
+    gParser* gParser_createLayer( const gParser* gbase );
+
+    /**
+    Creates a pool of parsers for short sessions, e.g. one for each request.
+    The parsers released are reset and handed out again, without allocating
+    them again, and each thread takes first the parsers that it released.
+    @param base Parser whose global scope is shared by the parsers of the
+    pool, as in gParser_createLayer, or nullptr for empty parsers.
+    @return The pool, or nullptr if there is not enough memory.
+    */
+    gPool* gPool_create( const gParser* base );
+
+    /**
+    Takes a parser of the pool, or creates it if all of them are in use.
+    It can be used by a single thread until it is released.
+    @return The parser, empty or with the scope of the base, or nullptr if
+    there is not enough memory.
+    */
+    gParser* gPool_acquire( gPool* pool );
+
+    /**
+    Returns the parser to the pool. The variables, functions, structure
+    types, formulas and snapshots added to it are released, and the
+    variables of the host are not modified. The programs, caches and
+    registries of the parser must be released before.
+    */
+    void gPool_release( gPool* pool, gParser* parser );
+
+    /** Releases the pool and its parsers, which must have been returned */
+    void gPool_dispose( gPool* pool );
+
+    /** 
+    Compiles the expressions in the string for repeated evaluation.
+    The variables are resolved in the parser global scope, so they must be
+    declared before compiling.
+    @param parser Pointer to the parser object. Syntactic errors are reported
+    in parser->err_msg and parser->err_column.
+    @param code String with the operations to be compiled
+    @return The compiled program or nullptr if there is an error.
+    */
+    gProgram* gParser_compile( gParser* parser, const char* code );
+
+    /** 
+    Compiles a boolean expression to select rows with gProgram_filter or
+    gProgram_filterRows. The terms of the top level '&&' are evaluated in 
+    the order that discards more rows first, unless any of them has side 
+    effects or may fail for rows discarded by the previous ones (like 
+    'z != 0 && 1 %% z > 0').
+    The filter keeps the selectivity of its terms, and reorders them while
+    it is evaluated, so it must not be used by several threads at once.
+    @return The compiled filter or nullptr if there is an error.
+    */
+    gProgram* gParser_compileFilter( gParser* parser, const char* code );
+
+    /** 
+    Compiles several formulas into a single program with a result for each
+    one, evaluated together by gProgram_evalSet. Columns loaded, and values
+    computed, by a formula are reused by the next ones, so the formulas of
+    the same inputs share their work.
+    @param formulas Array of expressions, as in gParser_compile. The
+    formulas are evaluated in order, so a formula sees the assignments of
+    the previous ones.
+    @param nformulas Number of formulas.
+    @return The compiled program or nullptr if there is an error. The index
+    of the wrong formula is in parser->err_line.
+    */
+    gProgram* gParser_compileSet
+        ( gParser* parser, const char* const* formulas, int nformulas );
+
+    /** Releases the compiled program */
+    void gProgram_dispose( gProgram* program );
+
+    /**
+    Opens a cache of compiled programs in a file. The file is mapped, and
+    the programs in it are taken by gCache_compile instead of compiling
+    them again. A program is taken only if the parser has the same
+    functions that when it was compiled, and variables with the same names
+    and types. Programs with window functions are always compiled.
+    @param parser Parser that compiles the programs, and whose variables and
+    functions they use.
+    @param path File of the cache. If it does not exist, or it was written by
+    another version, the cache is empty.
+    @return The cache, or nullptr if there is no memory.
+    */
+    gCache* gCache_open( gParser* parser, const char* path );
+
+    /** As gParser_compile, but takes the program from the cache if it is
+    there, or adds it otherwise. The program is independent of the cache. */
+    gProgram* gCache_compile( gCache* cache, const char* code );
+
+    /** As gParser_compileFilter, with the cache */
+    gProgram* gCache_compileFilter( gCache* cache, const char* code );
+
+    /**
+    Writes the programs of the cache to its file, if some was added. The
+    file is written aside and then replaces the old one, so other processes
+    read either of them.
+    @return GPARSE_OK, or GPARSE_ERROR if the file cannot be written.
+    */
+    int gCache_save( gCache* cache );
+
+    /** Releases the cache, without saving it. The programs taken from it
+    are kept. */
+    void gCache_close( gCache* cache );
+
+    /** 
+    Binds a variable to a column of values for batch evaluation.
+    @param program Compiled program.
+    @param varname Variable name, as declared in the parser.
+    @param data Pointer to the first row. Values must have the type of the 
+    variable. Assignments in the program write into the column.
+    @param stride Bytes between consecutive rows, or 0 if they are contiguous.
+    @return GPARSE_OK, or GPARSE_ERROR if the program does not use the variable.
+    */
+    int gProgram_bindColumn
+        ( gProgram* program, const char* varname, void* data, size_t stride );
+
+    /** 
+    Marks the null rows of a bound column. Nulls propagate through the
+    operators, so the result of a row is null if any operand is null,
+    except for '&&' and '||', which follow the three-valued logic of SQL:
+    'null && false' is false and 'null || true' is true. Comparisons with
+    null are null, and filters do not select the rows where they are null.
+    @param program Compiled program.
+    @param varname Name of a variable bound with gProgram_bindColumn.
+    @param validity Bitmap of (nrows + 63)/64 words. Bit i%64 of word i/64 is
+    set if the row i has a value. Assignments in the program update it.
+    Pass nullptr to remove it.
+    @return GPARSE_OK, or GPARSE_ERROR if the variable is not bound.
+    */
+    int gProgram_bindValidity
+        ( gProgram* program, const char* varname, uint64_t* validity );
+
+    /** 
+    Binds a structure variable to an array of structures for batch
+    evaluation. Row i reads and writes the members at data + i*stride, in
+    place, so there is no need to copy the fields into columns.
+    @param program Compiled program.
+    @param varname Name of the structure variable.
+    @param data Pointer to the first structure.
+    @param stride Bytes between consecutive structures, or 0 for the size of
+    the structure type.
+    @return GPARSE_OK, or GPARSE_ERROR if the program does not use any member
+    of the variable.
+    */
+    int gProgram_bindStruct
+        ( gProgram* program, const char* varname, void* data, size_t stride );
+
+    /** 
+    Evaluates the program with the current values of the variables.
+    The result is stored in program->ans */
+    int gProgram_eval( gProgram* program );
+
+    /** 
+    Evaluates the program for each row of the bound columns. Variables which
+    are not bound to a column have the same value for all the rows.
+    @param out Array of nrows values of type program->type for the results.
+    */
+    int gProgram_evalBatch( gProgram* program, size_t nrows, void* out );
+
+    /** 
+    Evaluates the program for each row as gProgram_evalBatch, and returns
+    which results are null. The nulls are combined as bitmaps, 64 rows at a
+    time, so the cost is small compared with the evaluation.
+    @param validity Array of (nrows + 63)/64 words, or nullptr. Bit i%64 of 
+    word i/64 is set if the result of the row i is not null.
+    @param null_count Number of null results. It can be nullptr.
+    */
+    int gProgram_evalNulls( gProgram* program, size_t nrows, void* out
+        , uint64_t* validity, size_t* null_count );
+
+    /** 
+    Clears the state of the window functions of the program: mavg( x, n ),
+    mstd( x, n ), ema( x, alpha ), rmin( x, n ) and rmax( x, n ). Each call
+    to one of them keeps the last values it evaluated, from the rows of
+    gProgram_evalBatch in order and from each gProgram_eval, so a stream
+    can be evaluated in pieces. Each value is added in constant time.
+    */
+    void gProgram_resetWindows( gProgram* program );
+
+    /** 
+    Evaluates the program for each row of the bound columns, and aggregates
+    the results without storing them: each block of rows is reduced while
+    it is in the cache. The rows are split among threads, which merge their
+    partial aggregates at the end. Null results are skipped.
+    @param result Count, sum, mean, variance, minimum and maximum.
+    @param options GPARSE_PAIRWISE for pairwise summation, which is more
+    accurate and gives the same result for any number of threads.
+    Otherwise the result may change in the last bits between runs.
+    @param nthreads Number of threads, or 0 for the number of processors.
+    Programs that assign variables which are not bound to columns, or that
+    call functions with side effects, run in a single thread.
+    */
+    int gProgram_aggregate( gProgram* program, size_t nrows, gAggregate* result
+        , int options, int nthreads );
+
+    /** 
+    Groups the rows of the bound columns by the result of a program, and
+    aggregates the results of another program for each group. The groups
+    are kept in a hash table with the aggregates inline, split in partitions
+    which the threads merge into in parallel. Rows with a null key are
+    skipped, and null values are not aggregated, but their rows still form
+    a group. Each group takes about 100 bytes.
+    @param key Program giving the key of each row. Keys of floating point
+    types are compared as doubles.
+    @param value Program giving the values to aggregate, or nullptr to
+    only count the rows.
+    @param groups Groups, in no particular order. They must be released
+    with gGroups_release.
+    @param memory Maximum bytes for the groups, or 0 for no limit. If the
+    groups do not fit, it returns GPARSE_ERROR.
+    @param nthreads Number of threads, or 0 for the number of processors.
+    */
+    int gProgram_groupBy( gProgram* key, gProgram* value, size_t nrows
+        , gGroups* groups, size_t memory, int nthreads );
+
+    /** Frees the keys and aggregates of the groups */
+    void gGroups_release( gGroups* groups );
+
+    /**
+    Writes a column of values to the file 'dir/name.gcol': a header of 128
+    bytes with the name, the type and the count, followed by the values as
+    a raw little-endian array, aligned to 64 bytes, and the validity bitmap.
+    @param dir Directory of the file. It must exist.
+    @param name Name of the variable the column is bound to, up to 87
+    characters.
+    @param type Basic type of the values. Booleans take a byte each.
+    @param data Array of count values.
+    @param validity Bitmap of (count + 63)/64 words, as in
+    gProgram_bindValidity, or nullptr if there are no nulls.
+    @return GPARSE_OK, or GPARSE_ERROR if the name or the type are not valid,
+    or the file cannot be written.
+    */
+    int gColumn_write( const char* dir, const char* name, int type
+        , const void* data, const uint64_t* validity, size_t count );
+
+    /**
+    Maps the column files '*.gcol' of the directory in memory, read only.
+    The pages are read from the file as the programs touch them, advised
+    for sequential access, so opening a large dataset takes no time and
+    the values are never copied.
+    @param columns Columns, sorted by name, and the rows of the shortest
+    one. They must be released with gColumns_close.
+    @return GPARSE_OK, or GPARSE_ERROR if the directory cannot be read or a
+    file is not valid.
+    */
+    int gColumns_open( const char* dir, gColumns* columns );
+
+    /** Unmaps the column files */
+    void gColumns_close( gColumns* columns );
+
+    /**
+    Binds each mapped column to the variable of the program with the same
+    name, with its validity bitmap, for batch evaluation. Columns of
+    variables the program does not use are skipped. The columns must stay
+    open while they are bound.
+    @param program Compiled program. It cannot assign the bound variables.
+    @return GPARSE_OK, or GPARSE_ERROR if no variable is bound or a type does
+    not match.
+    */
+    int gProgram_bindColumns( gProgram* program, const gColumns* columns );
+
+    /**
+    Creates a named segment of shared memory with the variables, all of
+    them zero, so other processes open it with gShared_open. The layout is
+    fixed: the names and types, followed by a value of 8 bytes for each
+    variable. A segment with the same name is replaced, but the processes
+    that opened it keep the old one.
+    @param name Name of the segment, without '/'.
+    @param nvars Number of variables.
+    @param names Names of the variables, up to 55 characters.
+    @param types Basic types of the variables.
+    @return The segment, or nullptr if it cannot be created.
+    */
+    gShared* gShared_create( const char* name, int nvars, const char* const* names
+        , const int* types );
+
+    /** Opens the segment created by another process, or nullptr */
+    gShared* gShared_open( const char* name );
+
+    /** Unmaps the segment */
+    void gShared_close( gShared* shared );
+
+    /** Removes the name of the segment. The processes that opened it keep
+    it until they close it. */
+    int gShared_remove( const char* name );
+
+    /** Index of the variable in the segment, or -1 */
+    int gShared_find( gShared* shared, const char* varname );
+
+    /**
+    Publishes the values of several variables at once: the sequence of the
+    segment is odd while they are written, so readers never see part of
+    them. Writers of all the processes take a spin lock in the segment.
+    @param n Number of values.
+    @param index Indices of the variables, from gShared_find.
+    @param values Pointers to the values, of the types of the variables.
+    */
+    int gShared_write( gShared* shared, int n, const int* index
+        , const void* const* values );
+
+    /**
+    Copies the values last published into the variables added with
+    gParser_addShared. It reads the sequence before and after copying,
+    and copies again if a writer was publishing, so it takes no locks and
+    makes no system calls unless a writer is preempted while publishing.
+    */
+    void gShared_read( gShared* shared );
+
+    /**
+    Adds the variables of the segment to the global scope. They hold the
+    values of the last gShared_read, so they do not change while the
+    expressions are evaluated. The handle must be used by one thread.
+    @return GPARSE_OK, or GPARSE_ERROR if a variable cannot be added.
+    */
+    int gParser_addShared( gParser* parser, gShared* shared );
+
+    /**
+    Groups variables of the host that other threads update while the
+    expressions are evaluated, so each evaluation sees the values of a
+    single update. The variables point to a copy of the values, taken at
+    the start of each gParser_command, gProgram_eval, batch evaluation,
+    aggregate or update. The copy is taken under a sequence lock, without
+    waiting: if the writers are busy for several tries, the evaluation
+    keeps the previous copy and counts it in snapshot->stale, which the
+    host can check after the evaluation. Assignments in the expressions
+    change only the copy.
+    @param parser Pointer to the parser object.
+    @param nvars Number of variables.
+    @param varnames Variables added with gParser_addVariable, which are not
+    in other snapshot.
+    @return The snapshot, owned by the parser, or nullptr if a variable is
+    not valid.
+    */
+    gSnapshot* gParser_addSnapshot( gParser* parser, int nvars, const char* const* varnames );
+
+    /**
+    Starts an update of the variables of the snapshot by the host. The
+    writers of the same snapshot wait for each other, so the updates must be
+    short.
+    */
+    void gSnapshot_begin( gSnapshot* snapshot );
+
+    /** Publishes the values written since gSnapshot_begin */
+    void gSnapshot_end( gSnapshot* snapshot );
+
+    /**
+    Creates a registry of named formulas, which are replaced while other
+    threads evaluate them. Each formula points to its compiled program,
+    swapped atomically by gRegistry_set, so the evaluations that took the
+    old program finish with it. The old programs are released when no
+    evaluation can use them, by epoch-based reclamation.
+    @param parser Parser that compiles the formulas. The formulas read its
+    global variables.
+    @param capacity Maximum number of formulas.
+    @return The registry, or nullptr if there is no memory.
+    */
+    gRegistry* gRegistry_create( gParser* parser, int capacity );
+
+    /** Releases the registry, its formulas and its readers. No thread can
+    be evaluating the formulas. */
+    void gRegistry_dispose( gRegistry* registry );
+
+    /**
+    Compiles the formula and sets it as the new version of the formula with
+    the name. The writers take a lock among them, as they use the parser,
+    but the readers never wait for them.
+    @param name Name of the formula. It is added if it is new.
+    @param formula Expression. It cannot assign variables nor call functions
+    with side effects, as several threads may evaluate it at once.
+    @return GPARSE_OK, or GPARSE_ERROR with the message in parser->err_msg.
+    The previous version is kept if there is an error.
+    */
+    int gRegistry_set( gRegistry* registry, const char* name, const char* formula );
+
+    /** Removes the program of the formula. Its name keeps its index, and
+    evaluating it is an error until it is set again. */
+    int gRegistry_remove( gRegistry* registry, const char* name );
+
+    /** Index of the formula, for gReader_eval, or -1 */
+    int gRegistry_find( gRegistry* registry, const char* name );
+
+    /** Releases the old programs that no reader is evaluating. It is done
+    by gRegistry_set as well. */
+    void gRegistry_reclaim( gRegistry* registry );
+
+    /** Adds a reader, for a single thread that evaluates the formulas. */
+    gReader* gRegistry_reader( gRegistry* registry );
+
+    /** Removes the reader */
+    void gReader_dispose( gReader* reader );
+
+    /**
+    Evaluates the current version of the formula with the values of the
+    global variables. It takes no locks: the reader announces the epoch of
+    the registry while it evaluates, so the version it takes is not
+    released.
+    @param formula Index from gRegistry_find.
+    @param result Room for a value of any basic type, 8 bytes.
+    @param type Type of the result, or nullptr.
+    @return GPARSE_OK, or GPARSE_ERROR if the formula has no program.
+    */
+    int gReader_eval( gReader* reader, int formula, void* result, int* type );
+
+    /** Number of results of the program, or 1 if it is not a formula set */
+    int gProgram_outputs( gProgram* program );
+
+    /** Type of the result of a formula, or t_undefined */
+    int gProgram_outputType( gProgram* program, int output );
+
+    /** 
+    Evaluates all the formulas for each row of the bound columns, in a
+    single pass: the rows are split in tiles small enough to keep the
+    values in the cache, and every formula is evaluated for a tile before
+    the next one.
+    @param outs Array with an array of nrows values for the results of each
+    formula, of type gProgram_outputType. Null arrays are skipped.
+    @param validity Array with a bitmap of (nrows + 63)/64 words for each
+    formula, as in gProgram_evalNulls, or nullptr. Null bitmaps are skipped.
+    */
+    int gProgram_evalSet( gProgram* program, size_t nrows, void** outs
+        , uint64_t** validity );
+
+    /** 
+    Evaluates a boolean program for each row of the bound columns.
+    @param bitmap Array of (nrows + 63)/64 words. Bit i%64 of word i/64 is
+    set if the row i is selected.
+    @param count Number of selected rows. It can be nullptr.
+    */
+    int gProgram_filter
+        ( gProgram* program, size_t nrows, uint64_t* bitmap, size_t* count );
+
+    /** 
+    Evaluates a boolean program for each row of the bound columns.
+    @param rows Array with room for nrows indices. The selected rows are 
+    written in increasing order.
+    @param count Number of selected rows. It can be nullptr.
+    */
+    int gProgram_filterRows
+        ( gProgram* program, size_t nrows, size_t* rows, size_t* count );
+
+    /** 
+    Binds variables to columns of Apache Arrow arrays (C Data Interface) for
+    batch evaluation, in place. The formats are "b" (bool), "C" (byte), "i"
+    (int), "l" (int64), "f" (float) and "g" (double), and must match the
+    type of the variable. The arrays must stay alive while they are bound.
+    @param program Compiled program. It cannot assign the bound variables.
+    @param varname Variable name for a primitive array, or nullptr for a
+    struct array (a record batch): each child is bound to the variable with
+    the same name.
+    @return GPARSE_OK, or GPARSE_ERROR if no variable is bound or a type does
+    not match.
+    */
+    int gProgram_bindArrow( gProgram* program, const char* varname
+        , const struct ArrowSchema* schema, const struct ArrowArray* array );
+
+    /** 
+    Evaluates the program for each row and exports the results as an Arrow
+    array, which owns the buffer written by the program. The nulls of the
+    bound columns propagate as in gProgram_evalNulls. The results of a
+    filter are never null, as it selects only the rows where it is true.
+    @param nrows Number of rows, not larger than the bound arrays.
+    @param out Array with the results. Release it with out->release( out ).
+    @param out_schema Schema of the results.
+    */
+    int gProgram_evalArrow( gProgram* program, size_t nrows
+        , struct ArrowArray* out, struct ArrowSchema* out_schema );
+
+    /** 
+    Defines the variable as a formula of other variables, e.g.
+        gParser_define( parser, "margin", "price - cost" );
+    The formula is compiled once, and the variables it reads are tracked, so
+    gParser_update evaluates it again only when some of them change.
+    @param parser Pointer to the parser object.
+    @param varname Variable assigned by the formula. It is declared with the
+    type of the formula if it does not exist. A new formula for the same
+    variable replaces the previous one.
+    @param formula Expression with the value of the variable. It cannot
+    assign variables, nor depend on the variable itself through other
+    formulas.
+    @return GPARSE_OK, or GPARSE_ERROR with the message in parser->err_msg.
+    The variable is evaluated at once, and its users in the next update.
+    */
+    int gParser_define( gParser* parser, const char* varname, const char* formula );
+
+    /** 
+    Marks a variable as changed, after the host writes its value, so the
+    next gParser_update evaluates the formulas that depend on it. Changes
+    made by gParser_command are not tracked.
+    @return GPARSE_OK, or GPARSE_ERROR if the variable does not exist.
+    */
+    int gParser_touch( gParser* parser, const char* varname );
+
+    /** 
+    Writes the value of a variable and marks it as changed.
+    @param value Pointer to a value of the type of the variable.
+    @see gParser_touch
+    */
+    int gParser_write( gParser* parser, const char* varname, const void* value );
+
+    /** 
+    Evaluates the formulas that depend on the variables changed since the
+    last update, each one once and after its inputs. Formulas whose inputs
+    keep their values are skipped.
+    @return GPARSE_OK, or GPARSE_ERROR if a formula cannot be evaluated.
+    */
+    int gParser_update( gParser* parser );
+
     /** Cast a variable into double. */
     double gVariable_getasDouble( const gVariable var );
 
@@ -56,4 +693,93 @@ extern "C" {
 }
 #endif
 
+#if defined(__cplusplus)
+
+/* Basic type of each C++ type */
+template< typename T > struct gTypeOf;
+template<> struct gTypeOf< _bool_ >{ enum { type = t_bool }; };
+template<> struct gTypeOf< _byte_ >{ enum { type = t_byte }; };
+template<> struct gTypeOf< _int_ >{ enum { type = t_int }; };
+template<> struct gTypeOf< _l64_ >{ enum { type = t_l64 }; };
+template<> struct gTypeOf< _float_ >{ enum { type = t_float }; };
+template<> struct gTypeOf< _double_ >{ enum { type = t_double }; };
+
+template< int... I > struct gIndices{};
+template< int N, int... I > struct gMakeIndices : gMakeIndices< N - 1, N - 1, I... >{};
+template< int... I > struct gMakeIndices< 0, I... >{ typedef gIndices< I... > type; };
+
+/* Adapter of a C++ function to gFunction and gFunctionBatch. The arguments
+ * are read with their own types, so the calls do not need conversions. */
+template< typename R, typename... A >
+struct gNativeFunction
+{
+    typedef R( *Pointer )(A...);
+    typedef typename gMakeIndices< sizeof...(A) >::type Indices;
+
+    template< int... I >
+    static inline R call( Pointer f, const void* const* args, gIndices< I... > )
+    {
+        return f( *(const A*)args[I]... );
+    }
+
+    template< int... I >
+    static inline void call_batch( Pointer f, R* result, const void* const* args
+        , const size_t n, gIndices< I... > )
+    {
+        for (size_t i = 0; i < n; i++){
+            result[i] = f( ((const A*)args[I])[i]... );
+        }
+    }
+
+    static void scalar( void* result, const void* const* args, void* data )
+    {
+        *(R*)result = call( (Pointer)data, args, Indices() );
+    }
+
+    static void batch( void* result, const void* const* args, size_t n, void* data )
+    {
+        call_batch( (Pointer)data, (R*)result, args, n, Indices() );
+    }
+
+    static int add( gParser* parser, const char* name, Pointer f )
+    {
+        /* The last item avoids an empty array */
+        const int types[] = { gTypeOf< A >::type..., t_undefined };
+        return gParser_addFunctionBatch( parser, name, gTypeOf< R >::type
+            , (int)sizeof...(A), types, scalar, batch, (void*)f );
+    }
+};
+
+/** 
+Adds a C++ function. The types of the result and of the arguments are
+deduced from the function pointer.
+@see gParser_addFunction
+*/
+template< typename R, typename... A >
+inline int gParser_addFunction( gParser* parser, const char* name, R( *f )(A...) )
+{
+    return gNativeFunction< R, A... >::add( parser, name, f );
+}
+
+template< typename L, typename R, typename... A >
+inline int gParser_addLambda
+    ( gParser* parser, const char* name, const L& lambda, R( L::* )(A...) const )
+{
+    return gNativeFunction< R, A... >::add( parser, name, (R( *)(A...))lambda );
+}
+
+/** 
+Adds a lambda without captures, e.g.
+    gParser_addFunction( parser, "lerp"
+        , []( double a, double b, double t ){ return a + t*(b - a); } );
+@see gParser_addFunction
+*/
+template< typename L >
+inline int gParser_addFunction( gParser* parser, const char* name, const L& lambda )
+{
+    return gParser_addLambda( parser, name, lambda, &L::operator() );
+}
+
+#endif
+
 #endif /* H_GPARSER_H */